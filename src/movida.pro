@@ -1,5 +1,5 @@
 ### Base project - builds all but plugins ###
 
 TEMPLATE = subdirs
-SUBDIRS = mvdcore mvdsvgz mvdshared movida mvdcrash
+SUBDIRS = mvdcore mvdsvgz mvdshared movida mvdcrash mvdbench
 CONFIG += ordered
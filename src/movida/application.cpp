@@ -27,6 +27,7 @@
 #include "mvdcore/logger.h"
 #include "mvdcore/pathresolver.h"
 #include "mvdcore/settings.h"
+#include "mvdcore/trace.h"
 
 #include <QtCore/QDir>
 #include <QtCore/QFile>
@@ -55,6 +56,7 @@
 #define MVD_ARG_NOGUI "--no-gui"
 #define MVD_ARG_DISPLAY "--display"
 #define MVD_ARG_RESET "--reset"
+#define MVD_ARG_TRACE "--trace"
 
 #define MVD_ARG_VERSION_SHORT "-v"
 #define MVD_ARG_HELP_SHORT "-h"
@@ -64,6 +66,7 @@
 #define MVD_ARG_NOGUI_SHORT "-g"
 #define MVD_ARG_DISPLAY_SHORT "-d"
 #define MVD_ARG_RESET_SHORT "-r"
+#define MVD_ARG_TRACE_SHORT "-t"
 
 // Qt wants -display not --display or -d
 #define MVD_ARG_DISPLAY_QT "-display"
@@ -162,6 +165,10 @@ void MvdApplication::parseCommandLine()
             // Andreas Vox: Qt/Mac has -psn_blah flags that must be accepted.
         } else if (arg == MVD_ARG_RESET || arg == MVD_ARG_RESET_SHORT) {
             reset = true;
+        } else if ((arg == MVD_ARG_TRACE || arg == MVD_ARG_TRACE_SHORT) && ++i < argc) {
+            mTraceFile = QFile::decodeName(argv[i].toLatin1().constData());
+            MvdTrace::setEnabled(true);
+            connect(this, SIGNAL(aboutToQuit()), this, SLOT(writeTrace()));
         } else {
             mFile = QFile::decodeName(argv[i].toLatin1().constData());
             if (!QFileInfo(mFile).exists()) {
@@ -363,6 +370,8 @@ void MvdApplication::showUsage()
         tr("Do not show the splashscreen on startup"));
     printArgLine(ts, MVD_ARG_VERSION_SHORT, MVD_ARG_VERSION,
         tr("Output version information and exit"));
+    printArgLine(ts, MVD_ARG_TRACE_SHORT, MVD_ARG_TRACE,
+        tr("Write a Chrome trace of the session to the given file"));
 #if defined (Q_WS_WIN) && !defined (_CONSOLE)
     printArgLine(ts, MVD_ARG_CONSOLE_SHORT, MVD_ARG_CONSOLE,
         tr("Display a console window"));
@@ -371,6 +380,13 @@ void MvdApplication::showUsage()
     endl(ts);
 }
 
+//! Writes the spans recorded since startup to the file given with --trace.
+void MvdApplication::writeTrace()
+{
+    MvdTrace::writeChromeTrace(mTraceFile);
+    MvdTrace::setEnabled(false);
+}
+
 void MvdApplication::showAvailableLanguages()
 {
     QFile f;
@@ -48,6 +48,9 @@ public:
 
     virtual void commitData(QSessionManager &manager);
 
+private slots:
+    void writeTrace();
+
 private:
     void showHeader();
     void showVersion();
@@ -59,6 +62,7 @@ private:
     QString mGuiLanguage;
     bool mShowSplash;
     QString mFile;
+    QString mTraceFile;
 };
 
 namespace Movida {
@@ -27,9 +27,12 @@
 #include "mvdcore/moviecollection.h"
 #include "mvdcore/settings.h"
 #include "mvdcore/shareddata.h"
+#include "mvdcore/trace.h"
 
 #include <QtCore/QCoreApplication>
 #include <QtCore/QMimeData>
+#include <QtCore/QPair>
+#include <QtCore/QSet>
 #include <QtCore/QUrl>
 #include <QtGui/QAction>
 #include <QtGui/QDrag>
@@ -140,6 +143,9 @@ QString MvdCollectionModel::Private::dataList(const QList<mvdid> &list, Movida::
 //! \internal
 void MvdCollectionModel::Private::sort(Movida::MovieAttribute attribute, Qt::SortOrder order)
 {
+    MVD_TRACE_SPAN(span, "MvdCollectionModel::sort", "model");
+    MVD_TRACE_COUNTER(span, "movies", movies.size());
+
     sortOrder = order;
     sortAttribute = attribute;
 
@@ -458,12 +464,8 @@ QModelIndex MvdCollectionModel::findMovie(mvdid id) const
 */
 void MvdCollectionModel::setMovieCollection(MvdMovieCollection *c)
 {
-    if (d->collection) {
-        disconnect(this, SLOT(movieAdded(mvdid)));
-        disconnect(this, SLOT(movieChanged(mvdid)));
-        disconnect(this, SLOT(movieRemoved(mvdid)));
-        disconnect(this, SLOT(collectionCleared()));
-    }
+    if (d->collection)
+        disconnect(d->collection, 0, this, 0);
 
     d->collection = c;
     d->movies.clear();
@@ -473,6 +475,9 @@ void MvdCollectionModel::setMovieCollection(MvdMovieCollection *c)
         connect(c, SIGNAL(movieAdded(mvdid)), this, SLOT(movieAdded(mvdid)));
         connect(c, SIGNAL(movieChanged(mvdid)), this, SLOT(movieChanged(mvdid)));
         connect(c, SIGNAL(movieRemoved(mvdid)), this, SLOT(movieRemoved(mvdid)));
+        connect(c, SIGNAL(moviesAdded(QList<mvdid>)), this, SLOT(moviesAdded(QList<mvdid>)));
+        connect(c, SIGNAL(moviesChanged(QList<mvdid>)), this, SLOT(moviesChanged(QList<mvdid>)));
+        connect(c, SIGNAL(moviesRemoved(QList<mvdid>)), this, SLOT(moviesRemoved(QList<mvdid>)));
         connect(c, SIGNAL(cleared()), this, SLOT(collectionCleared()));
         connect(c, SIGNAL(destroyed()), this, SLOT(collectionCleared()));
 
@@ -567,6 +572,14 @@ QVariant MvdCollectionModel::Private::data(const QModelIndex &index, int role) c
         return movie.posterPath(collection);
     }
 
+    // Collection image name, resolving it to a path might extract the image
+    if (role == Movida::MoviePosterNameRole && col == 0) {
+        mvdid id = movies.at(row);
+        if (id == MvdNull)
+            return QVariant();
+        return collection->movie(id).poster();
+    }
+
     if (role == Movida::FilterRole) // For future use
         role = Qt::DisplayRole;
 
@@ -720,8 +733,19 @@ void MvdCollectionModel::movieAdded(mvdid id)
     beginInsertRows(QModelIndex(), row, row);
     d->movies.insert(row, id);
     endInsertRows();
+}
 
-    emit dataChanged(createIndex(row, 0), createIndex(row, columnCount() - 1));
+//! \internal Appends all the new movies with a single row insertion.
+void MvdCollectionModel::moviesAdded(const QList<mvdid> &ids)
+{
+    if (ids.isEmpty())
+        return;
+
+    int row = d->movies.size();
+
+    beginInsertRows(QModelIndex(), row, row + ids.size() - 1);
+    d->movies += ids;
+    endInsertRows();
 }
 
 //! \internal
@@ -746,13 +770,61 @@ void MvdCollectionModel::movieRemoved(mvdid id)
 bool MvdCollectionModel::removeRows(int row, int count, const QModelIndex &p)
 {
     beginRemoveRows(p, row, row + count - 1);
-    for (int i = 0; i < count; ++i)
-        if (row < d->movies.size())
-            d->movies.removeAt(row);
+    int end = qMin(row + count, d->movies.size());
+    if (row < end)
+        d->movies.erase(d->movies.begin() + row, d->movies.begin() + end);
     endRemoveRows();
     return true;
 }
 
+/*!
+    \internal Removes the rows of the removed movies, one contiguous range
+    at a time. The model is reset if the rows are scattered across too many
+    ranges.
+*/
+void MvdCollectionModel::moviesRemoved(const QList<mvdid> &ids)
+{
+    if (ids.isEmpty())
+        return;
+
+    const int MaxRanges = 32;
+    QSet<mvdid> removed = ids.toSet();
+
+    // Find the ranges, bottom first so that removing a range does not
+    // invalidate the rows of the next ones
+    QList<QPair<int, int> > ranges;
+    int row = d->movies.size() - 1;
+    while (row >= 0) {
+        if (!removed.contains(d->movies.at(row))) {
+            --row;
+            continue;
+        }
+
+        int last = row;
+        while (row > 0 && removed.contains(d->movies.at(row - 1)))
+            --row;
+        ranges.append(qMakePair(row, last));
+        --row;
+    }
+
+    if (ranges.size() > MaxRanges) {
+        QList<mvdid> movies;
+        for (int i = 0; i < d->movies.size(); ++i) {
+            mvdid id = d->movies.at(i);
+            if (!removed.contains(id))
+                movies.append(id);
+        }
+        d->movies = movies;
+        QAbstractTableModel::reset();
+        return;
+    }
+
+    for (int i = 0; i < ranges.size(); ++i) {
+        const QPair<int, int> &r = ranges.at(i);
+        removeRows(r.first, r.second - r.first + 1, QModelIndex());
+    }
+}
+
 //! \internal
 void MvdCollectionModel::movieChanged(mvdid id)
 {
@@ -760,6 +832,33 @@ void MvdCollectionModel::movieChanged(mvdid id)
     emit dataChanged(createIndex(row, 0), createIndex(row, columnCount() - 1));
 }
 
+/*!
+    \internal Emits a dataChanged() signal for each contiguous range of
+    changed rows, so that the rows in between are not updated in vain.
+*/
+void MvdCollectionModel::moviesChanged(const QList<mvdid> &ids)
+{
+    if (ids.isEmpty())
+        return;
+
+    QSet<mvdid> changed = ids.toSet();
+    const int lastColumn = columnCount() - 1;
+
+    int row = 0;
+    while (row < d->movies.size()) {
+        if (!changed.contains(d->movies.at(row))) {
+            ++row;
+            continue;
+        }
+
+        int first = row;
+        while (row < d->movies.size() - 1 && changed.contains(d->movies.at(row + 1)))
+            ++row;
+        emit dataChanged(createIndex(first, 0), createIndex(row, lastColumn));
+        ++row;
+    }
+}
+
 //! \internal
 void MvdCollectionModel::collectionCleared()
 {
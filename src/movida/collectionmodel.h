@@ -87,6 +87,9 @@ private slots:
     void movieAdded(mvdid);
     void movieRemoved(mvdid);
     void movieChanged(mvdid);
+    void moviesAdded(const QList<mvdid> &ids);
+    void moviesRemoved(const QList<mvdid> &ids);
+    void moviesChanged(const QList<mvdid> &ids);
     void collectionCleared();
     void removeCollection() { setMovieCollection(0); }
     void reloadSettings();
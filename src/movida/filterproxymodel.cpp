@@ -23,20 +23,33 @@
 #include "collectionmodel.h"
 #include "guiglobal.h"
 
+#include "mvdcore/bitmap.h"
 #include "mvdcore/movie.h"
 #include "mvdcore/moviecollection.h"
 #include "mvdcore/naturalcompare.h"
 #include "mvdcore/settings.h"
 #include "mvdcore/shareddata.h"
+#include "mvdcore/trace.h"
 #include "mvdcore/utils.h"
 
 #include <QtCore/QCache>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+#include <algorithm>
 
 class MvdFilterProxyModel::Private
 {
 public:
     Private(MvdFilterProxyModel *p) :
         mInvalidQuery(false),
+        mIndexValid(false),
+        mIndexedMovies(0),
+        mStaleMovies(0),
+        mCandidatesValid(false),
+        mPlanValid(false),
+        mHasBitmapFilter(false),
         mPlainTextAppended(false),
         mOperator(Movida::AndOperator),
         q(p)
@@ -44,18 +57,78 @@ public:
 
     }
 
+    //! Three case folded characters packed in the lower 48 bits.
+    typedef quint64 Trigram;
+    //! Sorted list of movie IDs.
+    typedef QVector<mvdid> PostingList;
+
+    //! Movies that might match a plain text pattern.
+    struct Candidates {
+        Candidates() :
+            all(true) { }
+
+        bool all;
+        PostingList ids;
+    };
+
+    enum Comparison { LessThan, LessOrEqual, GreaterThan, GreaterOrEqual, Equal };
+
+    /*!
+        A filter function. The parameters are parsed once by compileFunction()
+        when the query changes. Functions that select a set of movies (IDs,
+        shared items and special tags) are combined by preparePlan() into a
+        single bitmap; the others are tested on each row.
+    */
     struct Function {
         Function(Movida::FilterFunction ff, const QStringList &p, bool negated) :
             type(ff),
             parameters(p),
-            neg(negated)
+            neg(negated),
+            valid(false),
+            comparison(Equal),
+            value(0),
+            indexed(false),
+            selectivity(1.0)
         { }
 
         Movida::FilterFunction type;
         QStringList parameters;
         bool neg;
+
+        // Compiled function
+        bool valid;
+        Comparison comparison;
+        int value;
+        QList<mvdid> items;
+
+        //! Answered by the bitmap filter.
+        bool indexed;
+        //! Estimated fraction of the movies that match.
+        double selectivity;
     };
 
+    static bool lessSelective(const Function &a, const Function &b)
+    {
+        return a.selectivity < b.selectivity;
+    }
+
+    static bool moreSelective(const Function &a, const Function &b)
+    {
+        return a.selectivity > b.selectivity;
+    }
+
+    static inline bool compare(int a, Comparison c, int b)
+    {
+        switch (c) {
+            case LessThan: return a < b;
+            case LessOrEqual: return a <= b;
+            case GreaterThan: return a > b;
+            case GreaterOrEqual: return a >= b;
+            default: ;
+        }
+        return a == b;
+    }
+
     void addPlainTextQuery(const QString &s) {
         Q_ASSERT(!s.isEmpty());
 
@@ -115,11 +188,23 @@ public:
     void optimizeNewPatterns();
 
     bool plainTextFilter(mvdid id, int sourceRow);
-    bool functionFilter(mvdid id, int sourceRow, const QModelIndex &sourceParent);
-    bool testFunction(int sourceRow, const QModelIndex &sourceParent,
-        const Function &function) const;
+    bool functionFilter(mvdid id);
+    bool testFunction(mvdid id, const Function &function,
+        MvdMovie &movie, bool &movieLoaded) const;
+    void compileFunction(Function &function) const;
+    void preparePlan();
+    const MvdMovieCollection *collection() const;
     inline QList<mvdid> idList(const QStringList &sl) const;
     QString textForMovie(mvdid id, int sourceRow);
+    QString buildTextForMovie(int sourceRow) const;
+
+    // Trigram index
+    static QSet<Trigram> trigrams(const QString &s);
+    void buildIndex();
+    void indexMovie(mvdid id, int sourceRow);
+    void invalidateIndex();
+    void markStale(int count);
+    void computeCandidates();
 
     QList<Movida::MovieAttribute> mMovieAttributes;
     int mSortColumn;
@@ -132,9 +217,28 @@ public:
 
     QCache<mvdid, QString> mTextCache;
 
+    // Trigram -> movies containing it. Changed and removed movies are not
+    // removed from the lists (the candidates are verified anyway): the index
+    // is rebuilt when too many entries are stale.
+    QHash<Trigram, PostingList> mIndex;
+    bool mIndexValid;
+    int mIndexedMovies;
+    int mStaleMovies;
+
+    // One entry for each plain text pattern
+    QList<Candidates> mCandidates;
+    bool mCandidatesValid;
+
+    // mFunctions is sorted and the bitmap filter is up to date
+    bool mPlanValid;
+
+    // Combined result of the indexed functions
+    MvdBitmap mBitmapFilter;
+    bool mHasBitmapFilter;
+
     // Optimization tricks
     bool mPlainTextAppended;
-    QList<mvdid> mPlainTextFailedMatches;
+    QSet<mvdid> mPlainTextFailedMatches;
 
     Movida::BooleanOperator mOperator;
 
@@ -176,17 +280,26 @@ void MvdFilterProxyModel::setSourceModel(QAbstractItemModel *sourceModel)
             this, SLOT(onSourceDataChanged(QModelIndex,QModelIndex)));
         disconnect(sourceModel, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
             this, SLOT(onSourceRowsAboutToBeRemoved(QModelIndex,int,int)));
+        disconnect(old_model, SIGNAL(rowsInserted(QModelIndex,int,int)),
+            this, SLOT(onSourceRowsInserted(QModelIndex,int,int)));
+        disconnect(old_model, SIGNAL(modelReset()),
+            this, SLOT(onSourceModelReset()));
         disconnect(old_model, SIGNAL(destroyed(QObject*)),
             this, SLOT(onSourceModelDestroyed(QObject*)));
     }
 
+    d->invalidateIndex();
+    d->mPlanValid = false;
+
     if (sourceModel) {
-        connect(sourceModel, SIGNAL(dataChanged(QModelIndex,QModelIndex)),
-            this, SLOT(onSourceDataChanged(QModelIndex,QModelIndex)));
         connect(sourceModel, SIGNAL(dataChanged(QModelIndex,QModelIndex)),
             this, SLOT(onSourceDataChanged(QModelIndex,QModelIndex)));
         connect(sourceModel, SIGNAL(rowsAboutToBeRemoved(QModelIndex,int,int)),
             this, SLOT(onSourceRowsAboutToBeRemoved(QModelIndex,int,int)));
+        connect(sourceModel, SIGNAL(rowsInserted(QModelIndex,int,int)),
+            this, SLOT(onSourceRowsInserted(QModelIndex,int,int)));
+        connect(sourceModel, SIGNAL(modelReset()),
+            this, SLOT(onSourceModelReset()));
         connect(sourceModel, SIGNAL(destroyed(QObject*)),
             this, SLOT(onSourceModelDestroyed(QObject*)));
     }
@@ -198,36 +311,77 @@ void MvdFilterProxyModel::onSourceDataChanged(const QModelIndex &topLeft, const
 {
     int row = topLeft.row();
     int end = bottomRight.row();
+
+    // The new text is added to the index, the old one becomes stale
+    if (d->mIndexValid)
+        d->markStale(end - row + 1);
+
     while (row >= 0 && row <= end) {
         QModelIndex index = sourceModel()->index(row, 0);
         bool ok;
         mvdid id = (mvdid) index.data(Movida::IdRole).toInt(&ok);
         if (ok && id != MvdNull) {
             d->mTextCache.remove(id);
-            d->mPlainTextFailedMatches.removeOne(id);
+            d->mPlainTextFailedMatches.remove(id);
+            if (d->mIndexValid)
+                d->indexMovie(id, row);
         }
         ++row;
     }
+
+    d->mCandidatesValid = false;
+    d->mPlanValid = false;
 }
 
 void MvdFilterProxyModel::onSourceRowsAboutToBeRemoved(const QModelIndex &, int row, int end)
 {
+    if (d->mIndexValid)
+        d->markStale(end - row + 1);
+
     while (row >= 0 && row <= end) {
         QModelIndex index = sourceModel()->index(row, 0);
         bool ok;
         mvdid id = (mvdid) index.data(Movida::IdRole).toInt(&ok);
         if (ok && id != MvdNull) {
             d->mTextCache.remove(id);
-            d->mPlainTextFailedMatches.removeOne(id);
+            d->mPlainTextFailedMatches.remove(id);
         }
         ++row;
     }
 }
 
+void MvdFilterProxyModel::onSourceRowsInserted(const QModelIndex &, int row, int end)
+{
+    d->mPlanValid = false;
+
+    if (!d->mIndexValid)
+        return;
+
+    while (row >= 0 && row <= end) {
+        QModelIndex index = sourceModel()->index(row, 0);
+        bool ok;
+        mvdid id = (mvdid) index.data(Movida::IdRole).toInt(&ok);
+        if (ok && id != MvdNull)
+            d->indexMovie(id, row);
+        ++row;
+    }
+
+    d->mCandidatesValid = false;
+}
+
+void MvdFilterProxyModel::onSourceModelReset()
+{
+    d->mTextCache.clear();
+    d->mPlainTextFailedMatches.clear();
+    d->invalidateIndex();
+    d->mPlanValid = false;
+}
+
 void MvdFilterProxyModel::onSourceModelDestroyed(QObject*)
 {
     d->mTextCache.clear();
     d->mPlainTextFailedMatches.clear();
+    d->invalidateIndex();
 }
 
 void MvdFilterProxyModel::setQuickFilterAttributes(const QByteArray &alist)
@@ -236,6 +390,7 @@ void MvdFilterProxyModel::setQuickFilterAttributes(const QByteArray &alist)
     for (int i = 0; i < alist.size(); ++i)
         d->mMovieAttributes << (Movida::MovieAttribute)alist.at(i);
     d->mTextCache.clear();
+    d->invalidateIndex();
 }
 
 QByteArray MvdFilterProxyModel::quickFilterAttributes() const
@@ -247,7 +402,7 @@ QByteArray MvdFilterProxyModel::quickFilterAttributes() const
     return ba;
 }
 
-bool MvdFilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &sourceParent) const
+bool MvdFilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &) const
 {
     if (d->mInvalidQuery)
         return false;
@@ -282,7 +437,7 @@ bool MvdFilterProxyModel::filterAcceptsRow(int sourceRow, const QModelIndex &sou
 
     // Test function parts
     if (!d->mFunctions.isEmpty()) {
-        bool match = d->functionFilter(id, sourceRow, sourceParent);
+        bool match = d->functionFilter(id);
         if (d->mOperator == Movida::AndOperator) {
             if (!match)
                 return false; // Return at first failure
@@ -346,9 +501,14 @@ void MvdFilterProxyModel::setFilterOperator(Movida::BooleanOperator op)
     if (d->mOperator == op)
         return;
     d->mOperator = op;
+    d->mPlanValid = false;
     d->mPlainTextAppended = false;
     d->mPlainTextFailedMatches.clear();
+
+    MVD_TRACE_SPAN(span, "MvdFilterProxyModel::filter", "filter");
     invalidateFilter();
+    MVD_TRACE_COUNTER(span, "rows", sourceModel() ? sourceModel()->rowCount() : 0);
+    MVD_TRACE_COUNTER(span, "accepted", rowCount());
 }
 
 Movida::BooleanOperator MvdFilterProxyModel::filterOperator() const
@@ -373,7 +533,11 @@ bool MvdFilterProxyModel::setFilterAdvancedString(const QString &q)
 
     d->mQuery = q.trimmed();
     bool res = d->rebuildPatterns();
+
+    MVD_TRACE_SPAN(span, "MvdFilterProxyModel::filter", "filter");
     invalidateFilter();
+    MVD_TRACE_COUNTER(span, "rows", sourceModel() ? sourceModel()->rowCount() : 0);
+    MVD_TRACE_COUNTER(span, "accepted", rowCount());
 
     return res;
 }
@@ -421,141 +585,73 @@ bool MvdFilterProxyModel::lessThan(const QModelIndex &left, const QModelIndex &r
 //////////////////////////////////////////////////////////////////////////
 
 
-bool MvdFilterProxyModel::Private::testFunction(int sourceRow, const QModelIndex &sourceParent,
-    const Function &function) const
+//! Returns the collection shown by the source model, if any.
+const MvdMovieCollection *MvdFilterProxyModel::Private::collection() const
 {
-    switch (function.type) {
-        case Movida::MovieIdFilter:
-            {
-                QList<mvdid> ids = idList(function.parameters);
-                if (ids.isEmpty()) return false;
-
-                QModelIndex index = q->sourceModel()->index(sourceRow, (int)Movida::TitleAttribute, sourceParent);
-                mvdid currentId = index.data(Movida::IdRole).toUInt();
-
-                return ids.contains(currentId) != function.neg;
+    MvdCollectionModel *m = dynamic_cast<MvdCollectionModel *>(q->sourceModel());
+    return m ? m->movieCollection() : 0;
+}
 
-            } break;
+/*!
+    Parses the parameters of \p function. Functions with invalid parameters
+    never match.
+*/
+void MvdFilterProxyModel::Private::compileFunction(Function &function) const
+{
+    function.valid = false;
 
+    switch (function.type) {
+        case Movida::MovieIdFilter:
         case Movida::SharedDataIdFilter:
             {
-                QList<mvdid> ids = idList(function.parameters);
-                if (ids.isEmpty()) return false;
-
-                QModelIndex index = q->sourceModel()->index(sourceRow, (int)Movida::TitleAttribute, sourceParent);
-                mvdid currentMovieId = index.data(Movida::IdRole).toUInt();
-
-                MvdCollectionModel *m = dynamic_cast<MvdCollectionModel *>(q->sourceModel());
-                Q_ASSERT(m);
-
-                const MvdMovieCollection *c = m->movieCollection();
-                if (!c) return false;
-
-                MvdMovie mov = c->movie(currentMovieId);
-                QString x = mov.validTitle();
-
-                MvdSharedData &sd = c->sharedData();
-
-                bool match = true;
-                foreach(mvdid id, ids)
-                {
-                    MvdSdItem item = sd.item(id);
-
-                    match = item.movies.contains(currentMovieId);
-                    if (!match) break;
-                }
-
-                return match != function.neg;
+                function.items = idList(function.parameters);
+                function.valid = !function.items.isEmpty();
 
             } break;
 
         case Movida::MarkAsSeenFilter:
-            {
-                QModelIndex index = q->sourceModel()->index(sourceRow, (int)Movida::SeenAttribute, sourceParent);
-                bool seen = index.data().toBool();
-                return seen != function.neg;
-
-            } break;
-
         case Movida::MarkAsLoanedFilter:
-            {
-                QModelIndex index = q->sourceModel()->index(sourceRow, (int)Movida::LoanedAttribute, sourceParent);
-                bool loaned = index.data().toBool();
-                return loaned != function.neg;
-
-            } break;
-
         case Movida::MarkAsSpecialFilter:
-            {
-                QModelIndex index = q->sourceModel()->index(sourceRow, (int)Movida::SpecialAttribute, sourceParent);
-                bool spec = index.data().toBool();
-                return spec != function.neg;
-
-            } break;
+            function.valid = true;
+            break;
 
         case Movida::RatingFilter:
             {
                 if (function.parameters.isEmpty())
-                    return false;
+                    return;
 
-                QModelIndex index = q->sourceModel()->index(sourceRow, (int)Movida::RatingAttribute, sourceParent);
-                int rating = index.data(Movida::SortRole).toInt();
-
-                QString x = function.parameters.first();
                 QRegExp rx("\\s*([<>=]?[=]?)\\s*(\\d)\\s*");
-                if (rx.indexIn(x) < 0)
-                    return false;
-
-                enum { Lt, LtEq, Gt, GtEq, Eq } op = Eq;
-                int n;
-
-                if (rx.numCaptures() == 2) {
-                    const QString op_s = rx.cap(1);
-                    op = op_s == QLatin1String("<")
-                         ? Lt
-                         : op_s == QLatin1String("<=")
-                         ? LtEq
-                         : op_s == QLatin1String(">")
-                         ? Gt
-                         : op_s == QLatin1String(">=")
-                         ? GtEq
-                         : Eq;
-                    n = rx.cap(2).toInt();
-                } else n = rx.cap(1).toInt();
-
-                bool match;
-                if (op == Lt)
-                    match = rating < n;
-                if (op == LtEq)
-                    match = rating <= n;
-                else if (op == Gt)
-                    match = rating > n;
-                else if (op == GtEq)
-                    match = rating >= n;
-                else
-                    match = rating == n;
-
-                return match != function.neg;
+                if (rx.indexIn(function.parameters.first()) < 0)
+                    return;
+
+                const QString op_s = rx.cap(1);
+                function.comparison = op_s == QLatin1String("<")
+                     ? LessThan
+                     : op_s == QLatin1String("<=")
+                     ? LessOrEqual
+                     : op_s == QLatin1String(">")
+                     ? GreaterThan
+                     : op_s == QLatin1String(">=")
+                     ? GreaterOrEqual
+                     : Equal;
+                function.value = rx.cap(2).toInt();
+                function.valid = true;
 
             } break;
 
         case Movida::RunningTimeFilter:
             {
                 if (function.parameters.isEmpty())
-                    return false;
+                    return;
 
-                QModelIndex index = q->sourceModel()->index(sourceRow, (int)Movida::RunningTimeAttribute, sourceParent);
-                int rt = index.data(Movida::SortRole).toUInt();
                 int min = -1;
                 QString op;
 
                 QString s = function.parameters.first();
                 QRegExp rx("\\s*([<>=])?(\\d{1,3})\\s*m?\\s*");
                 if (rx.exactMatch(s)) {
-                    if (rx.numCaptures() == 2) {
-                        op = rx.cap(1);
-                        min = rx.cap(2).toInt();
-                    }
+                    op = rx.cap(1);
+                    min = rx.cap(2).toInt();
                 } else {
                     QString hm("(\\d{1,3})\\s*h(?:\\s*(\\d+)\\s*m?)?"); // 1h 20m OR 1h 20 OR 1h
                     QString qm("(\\d{1,3})\\s*'(?:\\s*(\\d+)\\s*(?:'')?)?"); // 1' 10'' OR 1' 10
@@ -564,7 +660,7 @@ bool MvdFilterProxyModel::Private::testFunction(int sourceRow, const QModelIndex
                         .arg(hm).arg(qm).arg(dm)
                         );
                     if (!rx.exactMatch(s))
-                        return false;
+                        return;
                     QStringList captures;
                     QStringList rxCaptures = rx.capturedTexts();
                     rxCaptures.removeAt(0); // First item is the whole match
@@ -575,14 +671,14 @@ bool MvdFilterProxyModel::Private::testFunction(int sourceRow, const QModelIndex
                     if (captures.size() == 1) {
                         QString s = captures.at(0);
                         if (s.isEmpty())
-                            return false;
+                            return;
                         if (s.at(0).isNumber())
                             min = s.toInt() * 60; // hours
-                        else return false; // only <>= operator
+                        else return; // only <>= operator
                     } else if (captures.size() == 2) {
                         QString s = captures.at(0);
                         if (s.isEmpty())
-                            return false;
+                            return;
                         if (s.at(0).isNumber()) {
                             min = captures.at(0).toInt() * 60; // hours
                             min += captures.at(1).toInt(); // minutes
@@ -598,23 +694,140 @@ bool MvdFilterProxyModel::Private::testFunction(int sourceRow, const QModelIndex
                 }
 
                 if (min < 0)
-                    return false;
+                    return;
 
+                function.comparison = op == QLatin1String("<")
+                    ? LessThan
+                    : op == QLatin1String(">")
+                    ? GreaterThan
+                    : Equal;
+                function.value = min;
+                function.valid = true;
 
-                enum { Lt, Gt, Eq } _op = Eq;
-                _op = op == QLatin1String("<") ? Lt : rx.cap(1) == QLatin1String(">") ? Gt : Eq;
+            } break;
 
-                bool match;
-                if (_op == Lt)
-                    match = rt < min;
-                else if (_op == Gt)
-                    match = rt > min;
-                else
-                    match = rt == min;
+        default:
+            ;
+    }
+}
 
-                return match != function.neg;
+/*!
+    Evaluates the functions that select a set of movies with bitmap algebra
+    (AND, OR and NOT of the shared data, special tag and movie ID bitmaps)
+    and sorts the remaining functions by their estimated selectivity, so that
+    the evaluation of each row can stop as early as possible: functions that
+    are likely to fail come first with the AND operator, functions that are
+    likely to succeed come first with the OR operator.
+*/
+void MvdFilterProxyModel::Private::preparePlan()
+{
+    mPlanValid = true;
+    mBitmapFilter.clear();
+    mHasBitmapFilter = false;
 
-            } break;
+    if (mFunctions.isEmpty())
+        return;
+
+    const MvdMovieCollection *c = collection();
+    const MvdBitmap universe = c ? c->movieBitmap() : MvdBitmap();
+
+    for (int i = 0; i < mFunctions.size(); ++i) {
+        Function &f = mFunctions[i];
+        MvdBitmap movies;
+        f.indexed = true;
+
+        switch (f.type) {
+            case Movida::MovieIdFilter:
+                for (int j = 0; j < f.items.size(); ++j)
+                    if (universe.contains(f.items.at(j)))
+                        movies.insert(f.items.at(j));
+                break;
+
+            case Movida::SharedDataIdFilter:
+                if (c) {
+                    MvdSharedData &sd = c->sharedData();
+                    for (int j = 0; j < f.items.size(); ++j) {
+                        if (j == 0)
+                            movies = sd.movieBitmap(f.items.at(j));
+                        else movies &= sd.movieBitmap(f.items.at(j));
+                        if (movies.isEmpty())
+                            break;
+                    }
+                }
+                break;
+
+            case Movida::MarkAsSeenFilter:
+                if (c) movies = c->tagBitmap(Movida::SeenTag);
+                break;
+
+            case Movida::MarkAsLoanedFilter:
+                if (c) movies = c->tagBitmap(Movida::LoanedTag);
+                break;
+
+            case Movida::MarkAsSpecialFilter:
+                if (c) movies = c->tagBitmap(Movida::SpecialTag);
+                break;
+
+            default:
+                f.indexed = !f.valid;
+        }
+
+        if (f.indexed) {
+            // Invalid functions never match, regardless of negation
+            if (!f.valid)
+                movies.clear();
+            else if (f.neg)
+                movies = universe - movies;
+
+            if (!mHasBitmapFilter)
+                mBitmapFilter = movies;
+            else if (mOperator == Movida::AndOperator)
+                mBitmapFilter &= movies;
+            else mBitmapFilter |= movies;
+
+            mHasBitmapFilter = true;
+            continue;
+        }
+
+        double selectivity;
+        if (f.type == Movida::RatingFilter)
+            selectivity = f.comparison == Equal ? 0.2 : 0.5;
+        else if (f.type == Movida::RunningTimeFilter)
+            selectivity = f.comparison == Equal ? 0.05 : 0.5;
+        else selectivity = 0.5;
+
+        f.selectivity = f.neg ? 1.0 - selectivity : selectivity;
+    }
+
+    if (mOperator == Movida::AndOperator)
+        qStableSort(mFunctions.begin(), mFunctions.end(), lessSelective);
+    else qStableSort(mFunctions.begin(), mFunctions.end(), moreSelective);
+}
+
+/*!
+    Tests a compiled filter function that is not answered by the bitmap
+    filter. The movie is only loaded from the collection once for each row.
+*/
+bool MvdFilterProxyModel::Private::testFunction(mvdid id, const Function &function,
+    MvdMovie &movie, bool &movieLoaded) const
+{
+    if (!function.valid)
+        return false;
+
+    if (!movieLoaded) {
+        const MvdMovieCollection *c = collection();
+        if (!c)
+            return false;
+        movie = c->movie(id);
+        movieLoaded = true;
+    }
+
+    switch (function.type) {
+        case Movida::RatingFilter:
+            return compare(movie.rating(), function.comparison, function.value) != function.neg;
+
+        case Movida::RunningTimeFilter:
+            return compare(movie.runningTime(), function.comparison, function.value) != function.neg;
 
         default:
             ;
@@ -631,6 +844,8 @@ bool MvdFilterProxyModel::Private::rebuildPatterns()
     mPlainStrings.clear();
     mInvalidQuery = false;
     mPlainTextAppended = false;
+    mCandidatesValid = false;
+    mPlanValid = false;
 
     if (mQuery.isEmpty())
         return true;
@@ -659,7 +874,9 @@ bool MvdFilterProxyModel::Private::rebuildPatterns()
         }
 
         QStringList p = ps.split(QLatin1Char(','), QString::SkipEmptyParts);
-        mFunctions.append(Function(ff, p, op == QLatin1String("!")));
+        Function function(ff, p, op == QLatin1String("!"));
+        compileFunction(function);
+        mFunctions.append(function);
 
         QString s = mQuery.mid(offset, frx.pos() - offset);
 
@@ -738,6 +955,15 @@ QString MvdFilterProxyModel::Private::textForMovie(mvdid id, int sourceRow)
     if (cachedText)
         return *cachedText;
 
+    QString text = buildTextForMovie(sourceRow);
+    mTextCache.insert(id, new QString(text));
+
+    return text;
+}
+
+//! Builds the normalized search text for the movie at \p sourceRow.
+QString MvdFilterProxyModel::Private::buildTextForMovie(int sourceRow) const
+{
     QString title;
     bool titleAdded = false;
 
@@ -764,11 +990,142 @@ QString MvdFilterProxyModel::Private::textForMovie(mvdid id, int sourceRow)
     }
 
     Movida::normalize(text);
-    mTextCache.insert(id, new QString(text));
-
     return text;
 }
 
+/*!
+    Returns the trigrams in \p s. Characters are case folded the same way
+    QString::contains() does with Qt::CaseInsensitive, so that the index
+    can be used for both case sensitive and insensitive searches.
+*/
+QSet<MvdFilterProxyModel::Private::Trigram> MvdFilterProxyModel::Private::trigrams(const QString &s)
+{
+    QSet<Trigram> set;
+    if (s.length() < 3)
+        return set;
+
+    const QChar *c = s.unicode();
+    Trigram t = (Trigram(c[0].toCaseFolded().unicode()) << 16) | c[1].toCaseFolded().unicode();
+    for (int i = 2; i < s.length(); ++i) {
+        t = ((t << 16) | c[i].toCaseFolded().unicode()) & Q_UINT64_C(0xFFFFFFFFFFFF);
+        set.insert(t);
+    }
+
+    return set;
+}
+
+//! Indexes all the movies in the source model.
+void MvdFilterProxyModel::Private::buildIndex()
+{
+    mIndex.clear();
+    mIndexedMovies = 0;
+    mStaleMovies = 0;
+    mIndexValid = true;
+
+    QAbstractItemModel *model = q->sourceModel();
+    if (!model)
+        return;
+
+    int rows = model->rowCount();
+    for (int row = 0; row < rows; ++row) {
+        bool ok;
+        mvdid id = (mvdid) model->index(row, 0).data(Movida::IdRole).toInt(&ok);
+        if (ok && id != MvdNull)
+            indexMovie(id, row);
+    }
+}
+
+//! Adds the current text of a movie to the index.
+void MvdFilterProxyModel::Private::indexMovie(mvdid id, int sourceRow)
+{
+    QSet<Trigram> set = trigrams(buildTextForMovie(sourceRow));
+
+    for (QSet<Trigram>::ConstIterator it = set.constBegin(); it != set.constEnd(); ++it) {
+        PostingList &list = mIndex[*it];
+        // New movies usually have the greatest ID
+        if (list.isEmpty() || list.last() < id)
+            list.append(id);
+        else {
+            PostingList::Iterator pos = qLowerBound(list.begin(), list.end(), id);
+            if (pos == list.end() || *pos != id)
+                list.insert(pos, id);
+        }
+    }
+
+    ++mIndexedMovies;
+}
+
+//! Drops the index; it will be rebuilt when needed.
+void MvdFilterProxyModel::Private::invalidateIndex()
+{
+    mIndex.clear();
+    mIndexValid = false;
+    mIndexedMovies = 0;
+    mStaleMovies = 0;
+    mCandidatesValid = false;
+}
+
+//! Drops the index if more than a quarter of its entries are out of date.
+void MvdFilterProxyModel::Private::markStale(int count)
+{
+    mStaleMovies += count;
+    if (mStaleMovies > mIndexedMovies / 4 + 16)
+        invalidateIndex();
+}
+
+/*!
+    Looks up the trigrams of each plain text pattern and intersects their
+    movie lists, starting from the shortest one. Patterns shorter than three
+    characters match all the movies.
+*/
+void MvdFilterProxyModel::Private::computeCandidates()
+{
+    mCandidates.clear();
+    mCandidatesValid = true;
+
+    for (int i = 0; i < mPlainStrings.size(); ++i) {
+        Candidates c;
+
+        QString pattern = mPlainStrings.at(i);
+        Movida::normalize(pattern);
+        QSet<Trigram> set = trigrams(pattern);
+
+        if (!set.isEmpty()) {
+            if (!mIndexValid)
+                buildIndex();
+
+            QList<const PostingList *> lists;
+            for (QSet<Trigram>::ConstIterator it = set.constBegin(); it != set.constEnd(); ++it) {
+                QHash<Trigram, PostingList>::ConstIterator l = mIndex.constFind(*it);
+                if (l == mIndex.constEnd()) {
+                    lists.clear();
+                    break;
+                }
+                lists.append(&l.value());
+            }
+
+            c.all = false;
+            if (!lists.isEmpty()) {
+                // Shortest list first
+                for (int j = 1; j < lists.size(); ++j) {
+                    if (lists.at(j)->size() < lists.at(0)->size())
+                        lists.swap(0, j);
+                }
+
+                c.ids = *lists.at(0);
+                for (int j = 1; j < lists.size() && !c.ids.isEmpty(); ++j) {
+                    const PostingList &other = *lists.at(j);
+                    PostingList::Iterator end = std::set_intersection(c.ids.begin(), c.ids.end(),
+                        other.constBegin(), other.constEnd(), c.ids.begin());
+                    c.ids.resize(end - c.ids.begin());
+                }
+            }
+        }
+
+        mCandidates.append(c);
+    }
+}
+
 bool MvdFilterProxyModel::Private::plainTextFilter(mvdid id, int sourceRow)
 {
     if (mPlainTextAppended) {
@@ -777,21 +1134,28 @@ bool MvdFilterProxyModel::Private::plainTextFilter(mvdid id, int sourceRow)
             return false;
     }
 
-    //    Qt::CaseSensitivity cs = filterCaseSensitivity();
-
+    if (!mCandidatesValid)
+        computeCandidates();
 
     bool hasMatches = false;
     QStringList::ConstIterator begin = mPlainStrings.constBegin();
     QStringList::ConstIterator end = mPlainStrings.constEnd();
+    QList<Candidates>::ConstIterator candidates = mCandidates.constBegin();
     while (begin != end) {
-        QString queryPattern = *begin;
-        Movida::normalize(queryPattern);
+        bool match = candidates->all
+            || qBinaryFind(candidates->ids.constBegin(), candidates->ids.constEnd(), id) != candidates->ids.constEnd();
+
+        // Verify the candidates
+        if (match) {
+            QString queryPattern = *begin;
+            Movida::normalize(queryPattern);
 
-        QString targetString = textForMovie(id, sourceRow);
-        bool match = targetString.contains(queryPattern, q->filterCaseSensitivity());
+            QString targetString = textForMovie(id, sourceRow);
+            match = targetString.contains(queryPattern, q->filterCaseSensitivity());
+        }
 
         if (!match) {
-            mPlainTextFailedMatches.append(id);
+            mPlainTextFailedMatches.insert(id);
         } else hasMatches = true;
 
         if (mOperator == Movida::AndOperator) {
@@ -803,20 +1167,43 @@ bool MvdFilterProxyModel::Private::plainTextFilter(mvdid id, int sourceRow)
         }
 
         ++begin;
+        ++candidates;
     }
 
     return hasMatches;
 }
 
-bool MvdFilterProxyModel::Private::functionFilter(mvdid id, int sourceRow,
-    const QModelIndex &sourceParent)
+bool MvdFilterProxyModel::Private::functionFilter(mvdid id)
 {
+    if (!mPlanValid)
+        preparePlan();
+
     bool hasMatches = false;
+    if (mHasBitmapFilter) {
+        bool match = mBitmapFilter.contains(id);
+        if (mOperator == Movida::AndOperator) {
+            if (!match)
+                return false;
+        } else {
+            if (match)
+                return true;
+        }
+        hasMatches = match;
+    }
+
+    MvdMovie movie;
+    bool movieLoaded = false;
+
     QList<Private::Function>::ConstIterator fun_begin = mFunctions.constBegin();
     QList<Private::Function>::ConstIterator fun_end = mFunctions.constEnd();
     while (fun_begin != fun_end) {
         const Private::Function& fun = *fun_begin;
-        bool match = testFunction(sourceRow, sourceParent, fun);
+        if (fun.indexed) {
+            ++fun_begin;
+            continue;
+        }
+
+        bool match = testFunction(id, fun, movie, movieLoaded);
         if (mOperator == Movida::AndOperator) {
             if (!match)
                 return false; // Return at first failure
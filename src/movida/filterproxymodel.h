@@ -65,6 +65,8 @@ protected:
 protected slots:
     virtual void onSourceDataChanged(const QModelIndex &, const QModelIndex &);
     virtual void onSourceRowsAboutToBeRemoved(const QModelIndex &, int, int);
+    virtual void onSourceRowsInserted(const QModelIndex &, int, int);
+    virtual void onSourceModelReset();
     virtual void onSourceModelDestroyed(QObject*);
     virtual void reloadSettings();
 
@@ -47,7 +47,8 @@ enum ViewRole {
     MoviePosterRole,
     UniqueDisplayRole,
     SortRole,
-    FilterRole
+    FilterRole,
+    MoviePosterNameRole
 };
 
 enum ItemValidator {
@@ -195,7 +195,7 @@ void MvdMainInfoPage::setMovieImpl(const MvdMovie &movie)
 
     if (mDefaultPoster.isEmpty())
         setMoviePoster();
-    else setMoviePoster(mCollection->metaData(MvdMovieCollection::DataPathInfo).append("/images/").append(mDefaultPoster));
+    else setMoviePoster(mCollection->imagePath(mDefaultPoster));
 
     validate();
     setModified(false);
@@ -58,6 +58,7 @@
 #include <QtCore/QSharedPointer>
 #include <QtCore/QSignalMapper>
 #include <QtCore/QTemporaryFile>
+#include <QtCore/QThread>
 #include <QtCore/QTimer>
 #include <QtCore/QtDebug>
 #include <QtGui/QActionGroup>
@@ -139,6 +140,7 @@ MvdMainWindow::MvdMainWindow(QWidget *parent) :
     p.setDefaultValue("movida/movie-list/initials", false);    //! \todo: rename to movie-view
     p.setDefaultValue("movida/use-history", true);
     p.setDefaultValue("movida/max-history-items", 20);
+    p.setDefaultValue("movida/journaled-saves", false);
     p.setDefaultValue("movida/quick-filter/case-sensitive", false);
     p.setDefaultValue("movida/quick-filter/attributes", defaultFilterAttributes);
     p.setDefaultValue("movida/quick-filter/sort-attribute", (int) Movida::TitleAttribute);
@@ -457,49 +459,34 @@ bool MvdMainWindow::newCollection(bool silent, bool *error)
 /*!
     Loads a new collection from a file.
     The user will be asked to save the current collection if necessary.
+
+    The collection is loaded in background and movies are shown as soon as
+    they are available. Returns false if loading could not be started.
 */
 bool MvdMainWindow::loadCollection(const QString &file)
 {
     if (!d->closeCollection())
         return true;
 
-    /*! \todo add thread to load coll. and (_IMPORTANT_) lock gui!*/
-
     // Avoid the colelctionModified() signal emission.
     core().currentCollection()->setModifiedStatus(true);
 
-    setEnabled(false);
-
-    MvdCollectionLoader loader;
-    loader.setProgressHandler(d, "collectionLoaderCallback");
-    MvdCollectionLoader::StatusCode res = loader.load(core().currentCollection(), file);
-    core().currentCollection()->setModifiedStatus(false);
-
-    if (res != MvdCollectionLoader::NoError) {
-        core().createNewCollection();
-        QMessageBox::warning(this, MVD_CAPTION, tr("Failed to load the collection."));
+    if (!d->mCollectionLoader) {
+        d->mCollectionLoader = new MvdCollectionLoader(d);
+        d->mCollectionLoader->setLoadMode(QThread::idealThreadCount() > 1
+            ? MvdCollectionLoader::ParallelLoadMode : MvdCollectionLoader::StreamingLoadMode);
+        d->mCollectionLoader->setProgressHandler(d, "collectionLoaderCallback");
+        connect(d->mCollectionLoader, SIGNAL(finished(int)), d, SLOT(collectionLoaded(int)));
     }
 
-    setEnabled(true);
-
-    if (res != MvdCollectionLoader::NoError)
+    if (!d->mCollectionLoader->loadInBackground(core().currentCollection(), file)) {
+        core().currentCollection()->setModifiedStatus(false);
+        QMessageBox::warning(this, MVD_CAPTION, tr("Failed to load the collection."));
         return false;
+    }
 
-    // Update GUI controls
-    d->collectionModified();
-
-    Movida::MovieAttribute a = Movida::TitleAttribute;
-    QAction *ca = d->mAG_ViewSort->checkedAction();
-    if (ca)
-        a = (Movida::MovieAttribute)ca->data().toInt();
-
-    d->mTreeView->sortByColumn((int)a, d->mFilterModel->sortOrder());
-    d->mSharedDataModel->sort(0, d->mSharedDataModel->sortOrder());
-
-    d->mSelectionModel->setCurrentIndex(d->mMovieModel->index(0, 0), QItemSelectionModel::Select);
-    currentMovieView()->setFocus();
-
-    showTemporaryMessage(tr("%1 movies loaded.").arg(core().currentCollection()->count()));
+    // Lock the GUI parts that could modify the collection
+    d->setLoadingCollection(true);
 
     return true;
 }
@@ -526,7 +513,10 @@ bool MvdMainWindow::saveCollection(bool silent)
 {
     Q_ASSERT(!core().currentCollection()->isEmpty());
 
+    d->waitForBackgroundSave();
+
     MvdCollectionSaver saver(this);
+    saver.setSaveMode(d->saveMode());
     MvdCollectionSaver::StatusCode res = saver.save(core().currentCollection());
     if (res != MvdCollectionSaver::NoError) {
         if (!silent)
@@ -644,6 +634,8 @@ void MvdMainWindow::showPreferences()
 */
 void MvdMainWindow::showLog()
 {
+    MvdLogger::instance().flush();
+
     QFileInfo fi(paths().logFile());
     QFile file(fi.absoluteFilePath());
     if (!file.open(QIODevice::ReadOnly)) {
@@ -839,9 +831,7 @@ void MvdMainWindow::removeMovies(const QModelIndexList &list)
         if (id != MvdNull) ids.append(id);
     }
 
-    for (int i = 0; i < ids.size(); ++i) {
-        core().currentCollection()->removeMovie(ids.at(i));
-    }
+    core().currentCollection()->removeMovies(ids);
 
     d->movieViewSelectionChanged();
     d->collectionModified();
@@ -60,6 +60,7 @@
 #include <QtCore/QDir>
 #include <QtCore/QTemporaryFile>
 #include <QtCore/QTimer>
+#include <QtGui/QAbstractItemView>
 #include <QtGui/QDesktopServices>
 #include <QtGui/QFileDialog>
 #include <QtGui/QFrame>
@@ -664,7 +665,7 @@ void MvdMainWindow::Private::setupConnections()
     connect(mA_FileOpen, SIGNAL(triggered()), this, SLOT(loadCollectionDlg()));
     connect(mA_FileOpenLast, SIGNAL(triggered()), q, SLOT(loadLastCollection()));
     connect(mA_FileSaveAs, SIGNAL(triggered()), this, SLOT(saveCollectionDlg()));
-    connect(mA_FileSave, SIGNAL(triggered()), q, SLOT(saveCollection()));
+    connect(mA_FileSave, SIGNAL(triggered()), this, SLOT(saveCollectionInBackground()));
 
     connect(mA_ToolPref, SIGNAL(triggered()), q, SLOT(showPreferences()));
     connect(mA_ToolLog, SIGNAL(triggered()), q, SLOT(showLog()));
@@ -826,6 +827,48 @@ void MvdMainWindow::Private::updateBrowserView()
 {
     QList<mvdid> ids = q->selectedMovies();
     mDetailsView->showMovies(ids);
+
+    if (ids.size() == 1)
+        prerenderAdjacentMovies();
+}
+
+/*!
+    Renders in background the browser view pages of the movies next to the
+    current one in the active view (previous and next row, and the items
+    above and below in the smart view), so that moving with the arrow keys
+    shows them with no delay.
+*/
+void MvdMainWindow::Private::prerenderAdjacentMovies()
+{
+    QAbstractItemView *view = qobject_cast<QAbstractItemView *>(mMainViewStack->currentWidget());
+    MvdMovieCollection *collection = core().currentCollection();
+    if (!view || !collection)
+        return;
+
+    QModelIndex current = view->currentIndex();
+    if (!current.isValid())
+        return;
+
+    QModelIndexList adjacent;
+    adjacent << current.sibling(current.row() - 1, 0) << current.sibling(current.row() + 1, 0);
+
+    if (view == mSmartView) {
+        QRect r = view->visualRect(current);
+        adjacent << view->indexAt(r.center() - QPoint(0, r.height()))
+                 << view->indexAt(r.center() + QPoint(0, r.height()));
+    }
+
+    QList<mvdid> ids;
+    for (int i = 0; i < adjacent.size(); ++i) {
+        const QModelIndex &index = adjacent.at(i);
+        if (!index.isValid() || index.row() == current.row())
+            continue;
+        mvdid id = movieIndexToId(index);
+        if (id != MvdNull && !ids.contains(id))
+            ids.append(id);
+    }
+
+    tcache().prerender(collection, ids);
 }
 
 void MvdMainWindow::Private::timerEvent(QTimerEvent *e)
@@ -1038,6 +1081,9 @@ void MvdMainWindow::Private::pluginActionTriggered()
 
 void MvdMainWindow::Private::cleanUp()
 {
+    waitForBackgroundSave();
+    cancelBackgroundLoad();
+
     MvdSettings &p = Movida::settings();
 
     p.setValue("movida/appearance/main-window-state", q->saveState());
@@ -1310,13 +1356,84 @@ bool MvdMainWindow::Private::collectionLoaderCallback(int state, const QVariant
 
     } else if (state == MvdCollectionLoader::ProgressInfo) {
 
-        //int percent = data.toInt();
+        int percent = data.toInt();
+        q->statusBar()->showMessage(MvdMainWindow::tr("Loading collection (%1%)... Press Esc to cancel.").arg(percent));
 
     }
 
     return true;
 }
 
+//! Called when the collection has been loaded in background.
+void MvdMainWindow::Private::collectionLoaded(int status)
+{
+    MvdCollectionLoader::StatusCode res = (MvdCollectionLoader::StatusCode)status;
+
+    core().currentCollection()->setModifiedStatus(false);
+    setLoadingCollection(false);
+
+    // Cancelled by cancelBackgroundLoad(): the caller is going to discard
+    // the collection anyway
+    if (mDiscardingLoad)
+        return;
+
+    if (res != MvdCollectionLoader::NoError) {
+        core().currentCollection()->clearPersistentData();
+        core().createNewCollection();
+
+        if (res == MvdCollectionLoader::CancelledError)
+            q->showTemporaryMessage(MvdMainWindow::tr("Loading cancelled."));
+        else
+            QMessageBox::warning(q, MVD_CAPTION, MvdMainWindow::tr("Failed to load the collection."));
+        return;
+    }
+
+    // Update GUI controls
+    collectionModified();
+
+    Movida::MovieAttribute a = Movida::TitleAttribute;
+    QAction *ca = mAG_ViewSort->checkedAction();
+    if (ca)
+        a = (Movida::MovieAttribute)ca->data().toInt();
+
+    mTreeView->sortByColumn((int)a, mFilterModel->sortOrder());
+    mSharedDataModel->sort(0, mSharedDataModel->sortOrder());
+
+    mSelectionModel->setCurrentIndex(mMovieModel->index(0, 0), QItemSelectionModel::Select);
+    q->currentMovieView()->setFocus();
+
+    q->showTemporaryMessage(MvdMainWindow::tr("%1 movies loaded.").arg(core().currentCollection()->count()));
+}
+
+/*!
+    Cancels a running background load and waits for the loader to stop.
+    The partially loaded collection is left to the caller, which is
+    expected to close it.
+*/
+void MvdMainWindow::Private::cancelBackgroundLoad()
+{
+    if (mCollectionLoader && mCollectionLoader->isLoading()) {
+        mDiscardingLoad = true;
+        mCollectionLoader->cancel();
+        mCollectionLoader->waitForFinished();
+        mDiscardingLoad = false;
+    }
+}
+
+/*!
+    Locks the menus and toolbars while the collection is being loaded,
+    leaving the movie views usable.
+*/
+void MvdMainWindow::Private::setLoadingCollection(bool loading)
+{
+    q->menuBar()->setEnabled(!loading);
+    mTB_MainToolBar->setEnabled(!loading);
+
+    if (loading)
+        q->statusBar()->showMessage(MvdMainWindow::tr("Loading collection... Press Esc to cancel."));
+    else q->statusBar()->clearMessage();
+}
+
 /*!
     Opens a file selection dialog.
     Returns false if the collection has not been loaded
@@ -1359,6 +1476,8 @@ bool MvdMainWindow::Private::saveCollectionDlg(bool silent)
 {
     Q_ASSERT(!core().currentCollection()->isEmpty());
 
+    waitForBackgroundSave();
+
     QString lastDir = Movida::settings().value("movida/directories/collection").toString();
 
     QString filename = QFileDialog::getSaveFileName(q, MVD_CAPTION, lastDir, "*.mmc");
@@ -1377,6 +1496,7 @@ bool MvdMainWindow::Private::saveCollectionDlg(bool silent)
     }
 
     MvdCollectionSaver saver(q);
+    saver.setSaveMode(saveMode());
     MvdCollectionSaver::StatusCode res = saver.save(core().currentCollection(), filename);
 
     if (res != MvdCollectionSaver::NoError) {
@@ -1391,6 +1511,68 @@ bool MvdMainWindow::Private::saveCollectionDlg(bool silent)
     return true;
 }
 
+/*!
+    Saves the current collection in a separate thread. The collection can
+    be modified while it is being saved.
+*/
+void MvdMainWindow::Private::saveCollectionInBackground()
+{
+    Q_ASSERT(!core().currentCollection()->isEmpty());
+
+    if (!mBackgroundSaver) {
+        mBackgroundSaver = new MvdCollectionSaver(this);
+        connect(mBackgroundSaver, SIGNAL(finished(int)), this, SLOT(backgroundSaveFinished(int)));
+    }
+
+    if (mBackgroundSaver->isSaving())
+        return;
+
+    mBackgroundSaver->setSaveMode(saveMode());
+
+    if (!mBackgroundSaver->saveInBackground(core().currentCollection())) {
+        QMessageBox::warning(q, MVD_CAPTION, MvdMainWindow::tr("Failed to save the collection."));
+        return;
+    }
+
+    mA_FileSave->setEnabled(false);
+    q->statusBar()->showMessage(MvdMainWindow::tr("Saving collection..."));
+}
+
+void MvdMainWindow::Private::backgroundSaveFinished(int status)
+{
+    q->statusBar()->clearMessage();
+
+    if (status != MvdCollectionSaver::NoError)
+        QMessageBox::warning(q, MVD_CAPTION, MvdMainWindow::tr("Failed to save the collection."));
+
+    // The collection might have been modified while saving
+    collectionModified();
+    updateCaption();
+}
+
+/*!
+    Returns the mode used to save the collection. Journaled saves are
+    optional, as older versions of Movida ignore the journal records and
+    would lose the changes stored in them.
+*/
+MvdCollectionSaver::SaveMode MvdMainWindow::Private::saveMode() const
+{
+    return Movida::settings().value("movida/journaled-saves").toBool()
+        ? MvdCollectionSaver::JournaledSaveMode : MvdCollectionSaver::FullSaveMode;
+}
+
+/*!
+    Blocks until a running background save has completed.
+*/
+void MvdMainWindow::Private::waitForBackgroundSave()
+{
+    if (mBackgroundSaver && mBackgroundSaver->isSaving()) {
+        QApplication::setOverrideCursor(Qt::WaitCursor);
+        mBackgroundSaver->waitForFinished();
+        QApplication::restoreOverrideCursor();
+    }
+}
+
 /*!
     Closes the current collection and initializes a new empty collection.
     Returns false if the collection has not been closed.
@@ -1400,6 +1582,9 @@ bool MvdMainWindow::Private::closeCollection(bool silent, bool *error)
     if (error)
         *error = false;
 
+    waitForBackgroundSave();
+    cancelBackgroundLoad();
+
     if (!mFilterWidget->isEmpty())
         q->resetFilter();
 
@@ -1470,6 +1655,10 @@ void MvdMainWindow::Private::showMovieContextMenu(const QModelIndex &/*index*/)
 {
     //! \todo Refactor menu in order to use application wide actions
 
+    // The collection must not be modified while it is being loaded
+    if (mCollectionLoader && mCollectionLoader->isLoading())
+        return;
+
     QWidget *senderWidget = mMainViewStack->currentWidget();
 
     Q_ASSERT(senderWidget);
@@ -1805,6 +1994,11 @@ void MvdLogSyntaxHighlighter::highlightBlock(const QString &text)
 
 void MvdMainWindow::Private::escape()
 {
+    if (mCollectionLoader && mCollectionLoader->isLoading()) {
+        mCollectionLoader->cancel();
+        return;
+    }
+
     if (mInfoPanel->isVisible()) {
         q->hideMessages();
         return;
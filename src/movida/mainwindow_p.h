@@ -34,6 +34,7 @@
 
 #include "mainwindow.h"
 
+#include "mvdcore/collectionsaver.h"
 #include "mvdcore/core.h"
 
 #include <QtCore/QList>
@@ -46,6 +47,7 @@
 #include <QtGui/QSyntaxHighlighter>
 
 class MvdBrowserView;
+class MvdCollectionLoader;
 class MvdCollectionModel;
 class MvdDockWidget;
 class MvdFilterProxyModel;
@@ -91,6 +93,9 @@ public:
         mFilterModel(0),
         mDraggingSharedData(false),
         mSavedFilterMessage(0),
+        mBackgroundSaver(0),
+        mCollectionLoader(0),
+        mDiscardingLoad(false),
         mMainLayout(0),
         mA_FileExit(0),
         mA_FileNew(0),
@@ -161,6 +166,7 @@ public:
 
     void updateActionTexts(int);
     void updateBrowserView();
+    void prerenderAdjacentMovies();
     void updateViewSortMenu();
 
     void updateCaption();
@@ -182,6 +188,10 @@ public:
     void dispatchMessage(Movida::MessageType t, const QString &m);
 
     bool closeCollection(bool silent = false, bool *error = 0);
+    void waitForBackgroundSave();
+    MvdCollectionSaver::SaveMode saveMode() const;
+    void cancelBackgroundLoad();
+    void setLoadingCollection(bool loading);
 
     void setMoviePoster(quint32 movieId, const QUrl &url);
 
@@ -210,8 +220,11 @@ public slots:
 
     void openRecentFile(QAction *a);
     bool collectionLoaderCallback(int state, const QVariant &data);
+    void collectionLoaded(int status);
     bool loadCollectionDlg();
     bool saveCollectionDlg(bool silent = false);
+    void saveCollectionInBackground();
+    void backgroundSaveFinished(int status);
 
     void addRecentFile(const QString &file);
 
@@ -273,6 +286,13 @@ public:
     bool mDraggingSharedData;
     int mSavedFilterMessage;
 
+    // Background save
+    MvdCollectionSaver *mBackgroundSaver;
+
+    // Background load
+    MvdCollectionLoader *mCollectionLoader;
+    bool mDiscardingLoad;
+
 
     //////////////////////////////////////////////////////////////////////////
     // GUI
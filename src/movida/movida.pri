@@ -28,6 +28,7 @@ HEADERS += \
 	multipagedialog.h \
 	notespage.h \
 	posterlabel.h \
+	posterloader.h \
 	ratingwidget.h \
 	rowselectionmodel.h \
 	sdtreewidget.h \
@@ -69,6 +70,7 @@ SOURCES += \
 	multipagedialog.cpp \
 	notespage.cpp \
 	posterlabel.cpp \
+	posterloader.cpp \
 	ratingwidget.cpp \
 	sdtreewidget.cpp \
 	settingsdialog.cpp \
@@ -217,6 +217,8 @@ void MvdMovieMassEditor::storeTriggered()
 //! \internal Simply stores the changes made to the movies.
 bool MvdMovieMassEditor::storeMovies()
 {
+    MvdMovieCollection::MovieList changed;
+
     foreach(mvdid id, mMovieIds)
     {
         MvdMovie movie = mCollection->movie(id);
@@ -248,9 +250,11 @@ bool MvdMovieMassEditor::storeMovies()
         }
 
         if (m)
-            mCollection->updateMovie(id, movie);
+            changed.insert(id, movie);
     }
 
+    mCollection->updateMovies(changed);
+
     return true;
 }
 
@@ -0,0 +1,240 @@
+/**************************************************************************
+** Filename: posterloader.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#include "posterloader.h"
+
+#include "mvdcore/thumbnailcache.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtGui/QPixmap>
+#include <QtGui/QPixmapCache>
+
+/*!
+    \class MvdPosterLoader posterloader.h
+    \ingroup Movida
+
+    \brief Decodes and scales movie posters on a pool of worker threads.
+
+    Posters are requested with a cache key, the collection image name, the
+    image path and the target size. Thumbnails stored by MvdThumbnailCache
+    are used when available, so the image path can be empty if the
+    thumbnail is known to exist. Visible posters are decoded before
+    prefetched ones, regardless of the request order. Decoded posters are
+    converted to pixmaps in the GUI thread and inserted in the QPixmapCache
+    with the requested key, then posterLoaded() is emitted (also if the
+    poster could not be loaded, see hasFailed()).
+*/
+
+
+/************************************************************************
+    MvdPosterLoader::Private
+ *************************************************************************/
+
+//! \internal
+class MvdPosterLoader::Private
+{
+public:
+    struct Job {
+        QString key;
+        QString image;
+        QString path;
+        QSize size;
+    };
+
+    class Worker;
+
+    Private(MvdPosterLoader *p) :
+        q(p)
+    { }
+
+    bool takeJob(Job *job);
+    void finishJob(const QString &key, const QImage &image);
+
+    QThreadPool pool;
+
+    // Guards the queues and jobs
+    QMutex mutex;
+    QHash<QString, Job> jobs;
+    QStringList visibleQueue;
+    QStringList prefetchQueue;
+    QSet<QString> running;
+
+    // GUI thread only
+    QSet<QString> failed;
+
+private:
+    MvdPosterLoader *q;
+};
+
+//! \internal Decodes a single poster. The job is picked when the worker starts.
+class MvdPosterLoader::Private::Worker : public QRunnable
+{
+public:
+    Worker(MvdPosterLoader::Private *p) :
+        d(p)
+    { }
+
+    void run()
+    {
+        Job job;
+        if (!d->takeJob(&job))
+            return;
+
+        d->finishJob(job.key, MvdThumbnailCache::createThumbnail(job.image, job.path, job.size));
+    }
+
+private:
+    MvdPosterLoader::Private *d;
+};
+
+/*!
+    \internal Removes the most urgent job from the queues. Returns false if
+    there is nothing left to do (e.g. the job has been cancelled).
+*/
+bool MvdPosterLoader::Private::takeJob(Job *job)
+{
+    QMutexLocker locker(&mutex);
+
+    QString key;
+    if (!visibleQueue.isEmpty())
+        key = visibleQueue.takeFirst();
+    else if (!prefetchQueue.isEmpty())
+        key = prefetchQueue.takeFirst();
+    else return false;
+
+    *job = jobs.take(key);
+    running.insert(key);
+    return true;
+}
+
+//! \internal Called in the worker thread, hands the image over to the GUI thread.
+void MvdPosterLoader::Private::finishJob(const QString &key, const QImage &image)
+{
+    QMetaObject::invokeMethod(q, "deliver", Qt::QueuedConnection,
+        Q_ARG(QString, key), Q_ARG(QImage, image));
+}
+
+
+/************************************************************************
+    MvdPosterLoader
+ *************************************************************************/
+
+//! Creates a new poster loader using one worker thread less than the available cores.
+MvdPosterLoader::MvdPosterLoader(QObject *parent) :
+    QObject(parent),
+    d(new Private(this))
+{
+    d->pool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+//! Cancels pending requests and waits for the running ones.
+MvdPosterLoader::~MvdPosterLoader()
+{
+    clear();
+    d->pool.waitForDone();
+    delete d;
+}
+
+/*!
+    Requests a poster to be decoded and scaled to fit \p size, keeping its
+    aspect ratio. The request is ignored if the same key is already being
+    decoded; a pending prefetch request is promoted if \p priority is
+    VisiblePriority.
+*/
+void MvdPosterLoader::request(const QString &key, const QString &image, const QString &path,
+    const QSize &size, Priority priority)
+{
+    if (d->failed.contains(key))
+        return;
+
+    QMutexLocker locker(&d->mutex);
+
+    if (d->running.contains(key))
+        return;
+
+    if (d->jobs.contains(key)) {
+        if (priority == VisiblePriority && d->prefetchQueue.removeOne(key))
+            d->visibleQueue.append(key);
+        return;
+    }
+
+    Private::Job job;
+    job.key = key;
+    job.image = image;
+    job.path = path;
+    job.size = size;
+    d->jobs.insert(key, job);
+
+    if (priority == VisiblePriority)
+        d->visibleQueue.append(key);
+    else d->prefetchQueue.append(key);
+
+    locker.unlock();
+    d->pool.start(new Private::Worker(d));
+}
+
+//! Returns true if the poster with the given key could not be loaded.
+bool MvdPosterLoader::hasFailed(const QString &key) const
+{
+    return d->failed.contains(key);
+}
+
+//! Cancels the prefetch requests that have not been started yet.
+void MvdPosterLoader::clearPrefetchRequests()
+{
+    QMutexLocker locker(&d->mutex);
+
+    for (int i = 0; i < d->prefetchQueue.size(); ++i)
+        d->jobs.remove(d->prefetchQueue.at(i));
+    d->prefetchQueue.clear();
+}
+
+//! Cancels all the requests that have not been started yet and forgets failed posters.
+void MvdPosterLoader::clear()
+{
+    QMutexLocker locker(&d->mutex);
+
+    d->jobs.clear();
+    d->visibleQueue.clear();
+    d->prefetchQueue.clear();
+    d->failed.clear();
+}
+
+//! \internal Caches the decoded poster and notifies the views.
+void MvdPosterLoader::deliver(const QString &key, const QImage &image)
+{
+    {
+        QMutexLocker locker(&d->mutex);
+        d->running.remove(key);
+    }
+
+    if (image.isNull())
+        d->failed.insert(key);
+    else QPixmapCache::insert(key, QPixmap::fromImage(image));
+
+    emit posterLoaded(key);
+}
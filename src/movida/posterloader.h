@@ -0,0 +1,59 @@
+/**************************************************************************
+** Filename: posterloader.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_POSTERLOADER_H
+#define MVD_POSTERLOADER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QSize>
+#include <QtGui/QImage>
+
+class MvdPosterLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Priority {
+        PrefetchPriority,
+        VisiblePriority
+    };
+
+    MvdPosterLoader(QObject *parent = 0);
+    virtual ~MvdPosterLoader();
+
+    void request(const QString &key, const QString &image, const QString &path,
+        const QSize &size, Priority priority = VisiblePriority);
+    bool hasFailed(const QString &key) const;
+
+    void clearPrefetchRequests();
+    void clear();
+
+signals:
+    void posterLoaded(const QString &key);
+
+private slots:
+    void deliver(const QString &key, const QImage &image);
+
+private:
+    class Private;
+    Private *d;
+};
+
+#endif // MVD_POSTERLOADER_H
@@ -28,6 +28,9 @@
 
 #include "mvdshared/grafx.h"
 
+#include <QtCore/QTimer>
+#include <QtGui/QScrollBar>
+
 /*!
     \class MvdSmartView smartview.h
     \ingroup movida
@@ -44,6 +47,9 @@ public:
     {}
 
     bool dragging;
+
+    //! Coalesces scroll and layout changes before prefetching posters
+    QTimer prefetchTimer;
 };
 
 
@@ -84,6 +90,11 @@ void MvdSmartView::init()
     setAttribute(Qt::WA_Hover);
     viewport()->setAttribute(Qt::WA_Hover);
     setContentsMargins(0,0,0,20);
+
+    d->prefetchTimer.setSingleShot(true);
+    d->prefetchTimer.setInterval(100);
+    connect(&d->prefetchTimer, SIGNAL(timeout()), this, SLOT(prefetchPosters()));
+    connect(verticalScrollBar(), SIGNAL(valueChanged(int)), this, SLOT(schedulePrefetch()));
 }
 
 void MvdSmartView::setSelectionModel(QItemSelectionModel *selectionModel)
@@ -105,6 +116,53 @@ void MvdSmartView::keyPressEvent(QKeyEvent *e)
 void MvdSmartView::resizeEvent(QResizeEvent *e)
 {
     MvdListView::resizeEvent(e);
+    schedulePrefetch();
+}
+
+//! \internal Called when the items are laid out again (e.g. sorting or filtering).
+void MvdSmartView::updateGeometries()
+{
+    MvdListView::updateGeometries();
+    schedulePrefetch();
+}
+
+//! \internal
+void MvdSmartView::schedulePrefetch()
+{
+    d->prefetchTimer.start();
+}
+
+/*!
+    \internal Finds the visible rows and lets the delegate prefetch the
+    posters around them. Items have a uniform size, so sampling the viewport
+    twice per item in each direction finds all of them.
+*/
+void MvdSmartView::prefetchPosters()
+{
+    MvdSmartViewDelegate *delegate = dynamic_cast<MvdSmartViewDelegate *>(itemDelegate());
+    if (!delegate || !model())
+        return;
+
+    QSize step = iconSize() / 2;
+    if (step.width() <= 0 || step.height() <= 0)
+        return;
+
+    int first = -1;
+    int last = -1;
+    QRect r = viewport()->rect();
+    for (int y = r.top(); y <= r.bottom(); y += step.height()) {
+        for (int x = r.left(); x <= r.right(); x += step.width()) {
+            QModelIndex index = indexAt(QPoint(x, y));
+            if (!index.isValid())
+                continue;
+            if (first < 0 || index.row() < first)
+                first = index.row();
+            if (index.row() > last)
+                last = index.row();
+        }
+    }
+
+    delegate->prefetchPosters(first, last);
 }
 
 bool MvdSmartView::event(QEvent *e)
@@ -58,9 +58,12 @@ protected:
     void dragLeaveEvent(QDragLeaveEvent *e);
     void dragMoveEvent(QDragMoveEvent*e);
     void dropEvent(QDropEvent *e);
+    void updateGeometries();
 
 private slots:
     void dragFinished();
+    void schedulePrefetch();
+    void prefetchPosters();
 
 private:
     friend class MvdSmartViewDelegate;
@@ -26,6 +26,7 @@
 #include "mvdcore/core.h"
 #include "mvdcore/movie.h"
 #include "mvdcore/moviecollection.h"
+#include "mvdcore/thumbnailcache.h"
 
 #include <QPixmapCache>
 #include <QtCore/QFile>
@@ -87,6 +88,9 @@ MvdSmartViewDelegate::MvdSmartViewDelegate(MvdSmartView *parent) :
     mView = parent;
     Q_ASSERT(mView);
 
+    mPosterLoader = new MvdPosterLoader(this);
+    connect(mPosterLoader, SIGNAL(posterLoaded(QString)), SLOT(posterLoaded(QString)));
+
     QPalette p = mView->palette();
     p.setBrush(QPalette::Normal, QPalette::Highlight, QBrush(SelectionColor));
     p.setBrush(QPalette::Inactive, QPalette::Highlight, QBrush(InactiveSelectionColor));
@@ -118,41 +122,64 @@ void MvdSmartViewDelegate::setItemSize(ItemSize size)
         size = MediumItemSize;
     mItemSize = size;
 
-    // Compute new metrics
+    int textWidth, textHeight;
+    computeMetrics(size, &mSize, &mIconSize, &textWidth, &textHeight);
+
+    mControlsSize = QSize(textWidth, ControlSize);
+    mTextSize = QSize(textWidth, textHeight);
+
+    // Posters decoded for the old size are useless now
+    mPosterLoader->clear();
+    mPendingPosters.clear();
+
+    // Let the thumbnail cache create the posters for all the sizes at once,
+    // including the drag pixmap size (see MvdGrafx::moviesDragPixmap())
+    ItemSize sizes[3] = { SmallItemSize, MediumItemSize, LargeItemSize };
+    for (int i = 0; i < 3; ++i) {
+        QSize itemSize, iconSize;
+        computeMetrics(sizes[i], &itemSize, &iconSize, &textWidth, &textHeight);
+        MvdThumbnailCache::registerSize(posterSize(iconSize));
+        MvdThumbnailCache::registerSize(iconSize);
+    }
+
+    // This will update the view automatically.
+    mView->setIconSize(mSize);
+
+    QHash<QString, QVariant> p;
+    p.insert("movida/movie-poster/cached-size", mIconSize);
+    Movida::core().registerParameters(p);
+
+    rebuildDefaultIcon();
+}
+
+//! \internal Computes the item, icon and text sizes for the given item size.
+void MvdSmartViewDelegate::computeMetrics(ItemSize size, QSize *itemSize, QSize *iconSize,
+    int *textWidth, int *textHeight) const
+{
     QFontMetrics fontMetrics = mView->fontMetrics();
     int lineCount = size == SmallItemSize ? 4 : size == MediumItemSize ? 6 : 8;
 
     // Text width depends on item aspect ratio, and thus on the icon size
-    int textHeight = fontMetrics.height() * lineCount + 3 * Padding;     // Add some extra space
+    int th = fontMetrics.height() * lineCount + 3 * Padding;     // Add some extra space
     if (UseTitleSeparator) {
-        textHeight += HalfPadding + Padding + BorderWidth;     // Separator after title
-        textHeight += fontMetrics.leading() * (lineCount - 2);
-    } else textHeight += fontMetrics.leading() * (lineCount - 1);
+        th += HalfPadding + Padding + BorderWidth;     // Separator after title
+        th += fontMetrics.leading() * (lineCount - 2);
+    } else th += fontMetrics.leading() * (lineCount - 1);
 
     // Icon size depends on text height and controls height.
-    int iconHeight = textHeight + HalfPadding + ControlSize;
+    int iconHeight = th + HalfPadding + ControlSize;
     int iconWidth = int(IconAspectRatio * iconHeight);
 
-    textHeight -= (2 * BorderWidth + 2 * HalfPadding);     // Leave more space
+    th -= (2 * BorderWidth + 2 * HalfPadding);     // Leave more space
 
     // We have the icon width and we can compute the text width now
     int itemHeight = BorderWidth + Padding + iconHeight + Padding + BorderWidth;
     int itemWidth = (int)ceil(double(itemHeight * ItemAspectRatio));
-    int textWidth = itemWidth - BorderWidth - Padding - iconWidth - IconMarginRight - Padding - BorderWidth;
-
-    mSize = QSize(itemWidth, itemHeight);
-    mIconSize = QSize(iconWidth, iconHeight);
-    mControlsSize = QSize(textWidth, ControlSize);
-    mTextSize = QSize(textWidth, textHeight);
-
-    // This will update the view automatically.
-    mView->setIconSize(mSize);
 
-    QHash<QString, QVariant> p;
-    p.insert("movida/movie-poster/cached-size", mIconSize);
-    Movida::core().registerParameters(p);
-
-    rebuildDefaultIcon();
+    *itemSize = QSize(itemWidth, itemHeight);
+    *iconSize = QSize(iconWidth, iconHeight);
+    *textWidth = itemWidth - BorderWidth - Padding - iconWidth - IconMarginRight - Padding - BorderWidth;
+    *textHeight = th;
 }
 
 //! Returns the current item size.
@@ -271,20 +298,18 @@ void MvdSmartViewDelegate::paint(QPainter *painter, const QStyleOptionViewItem &
     QRect rIcon(rIconArea.adjusted(iconDecoWidth, iconDecoWidth, -iconDecoWidth, -iconDecoWidth));
 
     QPixmap pixmap;
-    QString customPixmapPath = index.data(Movida::MoviePosterRole).toString();
-
-    if (!customPixmapPath.isEmpty()) {
-        QString pixmapKey = QString("%1x%2/%3")
-                                .arg(rIconArea.width()).arg(rIconArea.height())
-                                .arg(customPixmapPath);
-
-        if (!QPixmapCache::find(pixmapKey, pixmap)) {
-            pixmap = QPixmap(customPixmapPath);
-            if (!pixmap.isNull()) {
-                // Resize and cache poster pixmap
-                pixmap = pixmap.scaled(rIcon.size(), Qt::KeepAspectRatio, Qt::SmoothTransformation);
-                QPixmapCache::insert(pixmapKey, pixmap);
-            }
+    QString posterName = index.data(Movida::MoviePosterNameRole).toString();
+
+    if (!posterName.isEmpty()) {
+        QString pixmapKey = posterKey(posterName);
+
+        // Draw the default poster until the poster has been decoded
+        if (!QPixmapCache::find(pixmapKey, pixmap) && !mPosterLoader->hasFailed(pixmapKey)) {
+            // Items are repainted several times before the poster is ready
+            QPersistentModelIndex pending(index);
+            if (!mPendingPosters.contains(pixmapKey, pending))
+                mPendingPosters.insert(pixmapKey, pending);
+            requestPoster(index, posterName, MvdPosterLoader::VisiblePriority);
         }
 
         // Align pixmap
@@ -661,6 +686,84 @@ void MvdSmartViewDelegate::rebuildDefaultIcon()
                          .scaled(QSize(w, h), Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
 }
 
+//! \internal Returns the QPixmapCache key for a poster at the current item size.
+QString MvdSmartViewDelegate::posterKey(const QString &image) const
+{
+    return QString("%1x%2/%3").arg(mIconSize.width()).arg(mIconSize.height()).arg(image);
+}
+
+//! \internal Returns the maximum size of a poster for the given icon size.
+QSize MvdSmartViewDelegate::posterSize(const QSize &iconSize) const
+{
+    int iconDecoWidth = IconPadding + BorderWidth;
+    return iconSize - QSize(2 * iconDecoWidth, 2 * iconDecoWidth);
+}
+
+/*!
+    \internal Requests a poster to the loader. The image path is only
+    resolved if no thumbnail is stored, as it might require the image to
+    be extracted from the collection archive.
+*/
+void MvdSmartViewDelegate::requestPoster(const QModelIndex &index, const QString &image,
+    MvdPosterLoader::Priority priority) const
+{
+    QSize size = posterSize(mIconSize);
+    QString path;
+    if (!MvdThumbnailCache::contains(image, size))
+        path = index.data(Movida::MoviePosterRole).toString();
+
+    mPosterLoader->request(posterKey(image), image, path, size, priority);
+}
+
+//! \internal Repaints the items waiting for a poster.
+void MvdSmartViewDelegate::posterLoaded(const QString &key)
+{
+    QList<QPersistentModelIndex> indexes = mPendingPosters.values(key);
+    mPendingPosters.remove(key);
+
+    for (int i = 0; i < indexes.size(); ++i) {
+        const QPersistentModelIndex &index = indexes.at(i);
+        if (index.isValid() && index.model() == mView->model())
+            mView->update(index);
+    }
+}
+
+/*!
+    Requests the posters of the rows just outside the visible range, one
+    screen before and one after. Prefetched posters are decoded after the
+    visible ones and pending prefetch requests are cancelled every time
+    the visible range changes.
+*/
+void MvdSmartViewDelegate::prefetchPosters(int firstVisibleRow, int lastVisibleRow)
+{
+    mPosterLoader->clearPrefetchRequests();
+
+    QAbstractItemModel *model = mView->model();
+    if (!model || firstVisibleRow < 0 || lastVisibleRow < firstVisibleRow)
+        return;
+
+    const int count = lastVisibleRow - firstVisibleRow + 1;
+    const int rowCount = model->rowCount(mView->rootIndex());
+
+    // Rows below the viewport first, as scrolling down is more common
+    for (int i = 1; i <= count; ++i) {
+        int rows[2] = { lastVisibleRow + i, firstVisibleRow - i };
+        for (int j = 0; j < 2; ++j) {
+            if (rows[j] < 0 || rows[j] >= rowCount)
+                continue;
+
+            QModelIndex index = model->index(rows[j], 0, mView->rootIndex());
+            QString image = index.data(Movida::MoviePosterNameRole).toString();
+            if (image.isEmpty())
+                continue;
+
+            QPixmap pixmap;
+            if (!QPixmapCache::find(posterKey(image), pixmap))
+                requestPoster(index, image, MvdPosterLoader::PrefetchPriority);
+        }
+    }
+}
+
 //! \internal
 bool MvdSmartViewDelegate::hasMouseOver(const QRect &itemRect) const
 {
@@ -22,7 +22,10 @@
 #define MVD_SMARTVIEWDELEGATE_H
 
 #include "guiglobal.h"
+#include "posterloader.h"
 
+#include <QtCore/QHash>
+#include <QtCore/QPersistentModelIndex>
 #include <QtGui/QItemDelegate>
 #include <QtGui/QTextLayout>
 #include <QtGui/QTextOption>
@@ -49,6 +52,7 @@ public:
     void forcedUpdate();
     void mousePressed(const QRect &rect, const QModelIndex &index);
     void showHoveredControlHint();
+    void prefetchPosters(int firstVisibleRow, int lastVisibleRow);
 
 protected:
     virtual void paint(QPainter *painter,
@@ -60,6 +64,9 @@ protected:
 
     virtual QSize maximumIconSize() const;
 
+private slots:
+    void posterLoaded(const QString &key);
+
 private:
     static const int Margin;
     static const int Padding;
@@ -105,6 +112,8 @@ private:
     mutable QTextLayout mTextLayout;
     mutable QTextOption mTextOption;
     MvdSmartView *mView;
+    MvdPosterLoader *mPosterLoader;
+    mutable QMultiHash<QString, QPersistentModelIndex> mPendingPosters;
 
     // Metrics - anything else can be computed easily starting with these values
     QSize mSize; // Whole item
@@ -118,6 +127,12 @@ private:
     QRect rect, QString text, const TextOptions &options, QRect *boundingRect = 0, int maxLines = 1) const;
     QSizeF doTextLayout(int lineWidth, int maxHeight, int *lineCount = 0) const;
     void rebuildDefaultIcon();
+    void computeMetrics(ItemSize size, QSize *itemSize, QSize *iconSize,
+        int *textWidth, int *textHeight) const;
+    QString posterKey(const QString &image) const;
+    QSize posterSize(const QSize &iconSize) const;
+    void requestPoster(const QModelIndex &index, const QString &image,
+        MvdPosterLoader::Priority priority) const;
     inline bool hasMouseOver(const QRect &itemRect) const;
     inline Control hoveredControl(const QRect &itemRect, int *index, bool* isItemHovered = 0) const;
 };
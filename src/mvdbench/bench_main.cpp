@@ -0,0 +1,224 @@
+/**************************************************************************
+** Filename: bench_main.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+/*
+    mvdbench - Benchmarks for Movida.
+
+    Generates a synthetic collection (see MvdCollectionGenerator) and times
+    the most expensive operations with QTestLib (see MvdBenchmark). Any
+    QTestLib option can be used: "-xml -o FILE" writes machine-readable
+    results, which can be stored and passed back with --baseline to detect
+    regressions.
+*/
+
+#include "benchmark.h"
+#include "collectiongenerator.h"
+
+#include "mvdcore/collectionsaver.h"
+#include "mvdcore/core.h"
+#include "mvdcore/moviecollection.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QXmlStreamReader>
+#include <QtGui/QApplication>
+#include <QtTest/QtTest>
+
+#include <iostream>
+
+using namespace Movida;
+
+namespace {
+void usage()
+{
+    std::cerr << "Usage: mvdbench [options] [QTestLib options] [benchmarks]\n"
+        "  --movies N         number of movies (default 1000)\n"
+        "  --persons N        number of persons (default 2000)\n"
+        "  --posters N        number of movie posters (default 100)\n"
+        "  --attributes N     extended attributes per movie (default 4)\n"
+        "  --seed N           generator seed (default 1)\n"
+        "  --generate FILE    only write the generated collection to FILE\n"
+        "  --baseline FILE    compare the results with a previous results file;\n"
+        "                     requires -xml -o FILE\n"
+        "  --tolerance N      allowed slowdown in percent (default 10)\n"
+        "Run with -help for the QTestLib options.\n";
+}
+
+/*!
+    Reads the results of a QTestLib run written with the -xml option.
+    Returns the time per iteration of each benchmark, keyed by function
+    and data tag.
+*/
+QHash<QString, double> readResults(const QString &path)
+{
+    QHash<QString, double> results;
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return results;
+
+    QString function;
+    QXmlStreamReader xml(&file);
+    while (!xml.atEnd()) {
+        if (xml.readNext() != QXmlStreamReader::StartElement)
+            continue;
+
+        const QXmlStreamAttributes attributes = xml.attributes();
+        if (xml.name() == QLatin1String("TestFunction")) {
+            function = attributes.value(QLatin1String("name")).toString();
+        } else if (xml.name() == QLatin1String("BenchmarkResult")) {
+            const QString tag = attributes.value(QLatin1String("tag")).toString();
+            const double value = attributes.value(QLatin1String("value")).toString().toDouble();
+            const int iterations = attributes.value(QLatin1String("iterations")).toString().toInt();
+            QString name = function;
+            if (!tag.isEmpty())
+                name.append(QLatin1Char(':')).append(tag);
+            results.insert(name, iterations > 0 ? value / iterations : value);
+        }
+    }
+
+    if (xml.hasError())
+        results.clear();
+    return results;
+}
+
+/*!
+    Compares \p results with \p baseline. Returns the number of benchmarks
+    that are more than \p tolerance percent slower.
+*/
+int compareResults(const QHash<QString, double> &results,
+    const QHash<QString, double> &baseline, int tolerance)
+{
+    int regressions = 0;
+
+    QStringList names = results.keys();
+    qSort(names);
+    for (int i = 0; i < names.size(); ++i) {
+        const QString &name = names.at(i);
+        QHash<QString, double>::ConstIterator it = baseline.constFind(name);
+        if (it == baseline.constEnd())
+            continue;
+
+        const double value = results.value(name);
+        const double base = it.value();
+        const bool slower = value * 100 > base * (100 + tolerance);
+        if (slower)
+            ++regressions;
+
+        std::cerr << qPrintable(QString("%1: %2, baseline %3%4").arg(name, -32)
+            .arg(value, 0, 'f', 2).arg(base, 0, 'f', 2)
+            .arg(slower ? QLatin1String(" REGRESSION") : QLatin1String("")))
+            << std::endl;
+    }
+
+    return regressions;
+}
+}
+
+int main(int argc, char **argv)
+{
+    QApplication app(argc, argv, false);
+
+    MvdCollectionGenerator::Options options;
+    int tolerance = 10;
+    QString generateFile, baselineFile, outputFile;
+    bool xmlOutput = false;
+
+    // Our own options are removed, the others are passed to QTestLib
+    QStringList args = app.arguments();
+    QStringList testArgs;
+    testArgs << args.value(0);
+    for (int i = 1; i < args.size(); ++i) {
+        const QString &arg = args.at(i);
+        if (!arg.startsWith(QLatin1String("--"))) {
+            if (arg == QLatin1String("-xml"))
+                xmlOutput = true;
+            else if (arg == QLatin1String("-o") && i + 1 < args.size())
+                outputFile = args.at(i + 1);
+            testArgs << arg;
+            continue;
+        }
+
+        if (i + 1 >= args.size()) {
+            usage();
+            return 1;
+        }
+
+        const QString value = args.at(++i);
+        if (arg == QLatin1String("--movies"))
+            options.movies = value.toInt();
+        else if (arg == QLatin1String("--persons"))
+            options.persons = value.toInt();
+        else if (arg == QLatin1String("--posters"))
+            options.posters = value.toInt();
+        else if (arg == QLatin1String("--attributes"))
+            options.attributes = value.toInt();
+        else if (arg == QLatin1String("--seed"))
+            options.seed = value.toUInt();
+        else if (arg == QLatin1String("--generate"))
+            generateFile = value;
+        else if (arg == QLatin1String("--baseline"))
+            baselineFile = value;
+        else if (arg == QLatin1String("--tolerance"))
+            tolerance = value.toInt();
+        else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (!baselineFile.isEmpty() && (!xmlOutput || outputFile.isEmpty())) {
+        usage();
+        return 1;
+    }
+
+    if (!core().isInitialized()) {
+        std::cerr << "Unable to initialize the Movida core library." << std::endl;
+        return 1;
+    }
+
+    if (!generateFile.isEmpty()) {
+        MvdCollectionGenerator generator(options);
+        MvdMovieCollection *collection = generator.generate();
+        MvdCollectionSaver saver;
+        MvdCollectionSaver::StatusCode res = saver.save(collection, generateFile);
+        delete collection;
+        return res == MvdCollectionSaver::NoError ? 0 : 1;
+    }
+
+    MvdBenchmark benchmark(options);
+    int res = QTest::qExec(&benchmark, testArgs);
+    if (res != 0 || baselineFile.isEmpty())
+        return res;
+
+    const QHash<QString, double> baseline = readResults(baselineFile);
+    if (baseline.isEmpty()) {
+        std::cerr << "Unable to read " << qPrintable(baselineFile) << std::endl;
+        return 1;
+    }
+
+    const QHash<QString, double> results = readResults(outputFile);
+    if (results.isEmpty()) {
+        std::cerr << "Unable to read " << qPrintable(outputFile) << std::endl;
+        return 1;
+    }
+
+    return compareResults(results, baseline, tolerance) == 0 ? 0 : 2;
+}
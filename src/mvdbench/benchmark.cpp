@@ -0,0 +1,282 @@
+/**************************************************************************
+** Filename: benchmark.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#include "benchmark.h"
+
+#include "movida/collectionmodel.h"
+#include "movida/filterproxymodel.h"
+#include "movida/mainwindow.h"
+
+#include "mvdcore/collectionloader.h"
+#include "mvdcore/collectionsaver.h"
+#include "mvdcore/collectionsnapshot.h"
+#include "mvdcore/core.h"
+#include "mvdcore/movie.h"
+#include "mvdcore/moviecollection.h"
+#include "mvdcore/pathresolver.h"
+#include "mvdcore/sditem.h"
+#include "mvdcore/shareddata.h"
+#include "mvdcore/templatemanager.h"
+
+#include <QtCore/QThreadPool>
+#include <QtTest/QtTest>
+
+using namespace Movida;
+
+// The collection and filter models are compiled into mvdbench from the
+// application sources. They only use the main window to show status bar
+// messages and to set posters dropped on the views, which never happens
+// while sorting or filtering, so a null stub is enough.
+MvdMainWindow *Movida::MainWindow = 0;
+
+Q_DECLARE_METATYPE(Movida::MovieAttribute)
+
+namespace {
+void setSnapshots(bool enable)
+{
+    QHash<QString, QVariant> p;
+    p.insert("mvdcore/collection-snapshots", enable);
+    core().registerParameters(p);
+}
+}
+
+/*!
+    \class MvdBenchmark benchmark.h
+
+    \brief QTestLib benchmarks for the most expensive Movida operations.
+
+    All the benchmarks run on the same synthetic collection, created by
+    MvdCollectionGenerator with the options passed to the constructor and
+    saved to a temporary directory by initTestCase().
+*/
+
+MvdBenchmark::MvdBenchmark(const MvdCollectionGenerator::Options &options, QObject *parent) :
+    QObject(parent),
+    mGenerator(options),
+    mCollection(0)
+{
+}
+
+MvdBenchmark::~MvdBenchmark()
+{
+    delete mCollection;
+}
+
+void MvdBenchmark::initTestCase()
+{
+    QVERIFY(core().isInitialized());
+
+    // Snapshots are only enabled by the snapshot load benchmark
+    setSnapshots(false);
+
+    mTempPath = paths().generateTempDir();
+    QVERIFY(!mTempPath.isEmpty());
+    mFile = mTempPath + "bench.mmc";
+    mJournalFile = mTempPath + "journal.mmc";
+
+    mCollection = mGenerator.generate();
+    QVERIFY(mCollection);
+
+    MvdCollectionSaver saver;
+    QCOMPARE(saver.save(mCollection, mFile), MvdCollectionSaver::NoError);
+}
+
+void MvdBenchmark::cleanupTestCase()
+{
+    delete mCollection;
+    mCollection = 0;
+
+    if (!mTempPath.isEmpty())
+        paths().removeDirectoryTree(mTempPath);
+}
+
+void MvdBenchmark::generate()
+{
+    QBENCHMARK {
+        MvdMovieCollection *collection = mGenerator.generate();
+        QVERIFY(collection);
+        delete collection;
+    }
+}
+
+void MvdBenchmark::saveFull()
+{
+    MvdCollectionSaver saver;
+    QBENCHMARK {
+        QCOMPARE(saver.save(mCollection, mFile), MvdCollectionSaver::NoError);
+    }
+}
+
+//! Saves a few changed movies after a full save.
+void MvdBenchmark::saveJournaled()
+{
+    MvdCollectionSaver saver;
+    saver.setSaveMode(MvdCollectionSaver::JournaledSaveMode);
+    QCOMPARE(saver.save(mCollection, mJournalFile), MvdCollectionSaver::NoError);
+
+    const QList<mvdid> ids = mCollection->movieIds();
+    QVERIFY(!ids.isEmpty());
+    const int changes = qMax(1, ids.size() / 100);
+
+    // Changing the movies is included in the measure, but it is negligible
+    // compared to the save.
+    int run = 0;
+    QBENCHMARK {
+        for (int i = 0; i < changes; ++i) {
+            mvdid id = ids.at((run * changes + i) % ids.size());
+            MvdMovie movie = mCollection->movie(id);
+            movie.setNotes(QString("Changed %1").arg(run));
+            mCollection->updateMovie(id, movie);
+        }
+        ++run;
+
+        QCOMPARE(saver.save(mCollection, mJournalFile), MvdCollectionSaver::NoError);
+    }
+
+    MvdCollectionSnapshot::remove(mJournalFile);
+}
+
+void MvdBenchmark::load_data()
+{
+    QTest::addColumn<int>("mode");
+    QTest::addColumn<bool>("snapshot");
+
+    QTest::newRow("dom") << (int) MvdCollectionLoader::DomLoadMode << false;
+    QTest::newRow("streaming") << (int) MvdCollectionLoader::StreamingLoadMode << false;
+    QTest::newRow("parallel") << (int) MvdCollectionLoader::ParallelLoadMode << false;
+    QTest::newRow("snapshot") << (int) MvdCollectionLoader::DomLoadMode << true;
+}
+
+void MvdBenchmark::load()
+{
+    QFETCH(int, mode);
+    QFETCH(bool, snapshot);
+
+    setSnapshots(snapshot);
+    if (snapshot) {
+        // The first load writes the snapshot in background
+        MvdMovieCollection collection;
+        MvdCollectionLoader loader;
+        QCOMPARE(loader.load(&collection, mFile), MvdCollectionLoader::NoError);
+        QThreadPool::globalInstance()->waitForDone();
+    }
+
+    QBENCHMARK {
+        MvdMovieCollection collection;
+        MvdCollectionLoader loader;
+        loader.setLoadMode((MvdCollectionLoader::LoadMode) mode);
+        QCOMPARE(loader.load(&collection, mFile), MvdCollectionLoader::NoError);
+    }
+
+    if (snapshot) {
+        QThreadPool::globalInstance()->waitForDone();
+        MvdCollectionSnapshot::remove(mFile);
+        setSnapshots(false);
+    }
+}
+
+void MvdBenchmark::sharedDataAddItem()
+{
+    const MvdSharedData::ItemList persons = mCollection->sharedData().items(Movida::PersonRole);
+
+    QBENCHMARK {
+        MvdSharedData sd;
+        for (MvdSharedData::ItemList::ConstIterator it = persons.constBegin(); it != persons.constEnd(); ++it)
+            sd.addItem(it.value());
+    }
+}
+
+void MvdBenchmark::collectionModelSort_data()
+{
+    QTest::addColumn<Movida::MovieAttribute>("attribute");
+
+    QTest::newRow("title") << Movida::TitleAttribute;
+    QTest::newRow("year") << Movida::YearAttribute;
+    QTest::newRow("rating") << Movida::RatingAttribute;
+    QTest::newRow("directors") << Movida::DirectorsAttribute;
+}
+
+void MvdBenchmark::collectionModelSort()
+{
+    QFETCH(Movida::MovieAttribute, attribute);
+
+    MvdCollectionModel model(mCollection, this);
+    QCOMPARE(model.rowCount(), mCollection->count());
+
+    // Alternates the order, so every run has to move the rows
+    Qt::SortOrder order = Qt::AscendingOrder;
+    QBENCHMARK {
+        model.sortByAttribute(attribute, order);
+        order = order == Qt::AscendingOrder ? Qt::DescendingOrder : Qt::AscendingOrder;
+    }
+}
+
+void MvdBenchmark::filterProxyModelFilter_data()
+{
+    QTest::addColumn<QString>("query");
+
+    QTest::newRow("word") << QString("dark");
+    QTest::newRow("words") << QString("silver king");
+    QTest::newRow("rating") << QString("@rating(>3)");
+    QTest::newRow("mixed") << QString("@rating(>3) dark");
+}
+
+void MvdBenchmark::filterProxyModelFilter()
+{
+    QFETCH(QString, query);
+
+    // Same attributes as the default quick filter settings
+    QByteArray attributes(6, '\0');
+    attributes[0] = (const char) Movida::TitleAttribute;
+    attributes[1] = (const char) Movida::OriginalTitleAttribute;
+    attributes[2] = (const char) Movida::DirectorsAttribute;
+    attributes[3] = (const char) Movida::CastAttribute;
+    attributes[4] = (const char) Movida::YearAttribute;
+    attributes[5] = (const char) Movida::TagsAttribute;
+
+    MvdCollectionModel model(mCollection, this);
+    MvdFilterProxyModel proxy(this);
+    proxy.setQuickFilterAttributes(attributes);
+    proxy.setSourceModel(&model);
+
+    // A trailing space changes the query but not its result, so that
+    // every run has to filter the rows again.
+    QString q = query;
+    QBENCHMARK {
+        q = q.size() == query.size() ? query + QLatin1Char(' ') : query;
+        QVERIFY(proxy.setFilterAdvancedString(q));
+    }
+}
+
+void MvdBenchmark::templateRender()
+{
+    const MvdMovieCollection::MovieList movies = mCollection->movies();
+    const int pages = qMin(100, movies.size());
+
+    if (movies.isEmpty()
+        || tmanager().movieToHtml(movies.constBegin().value(), *mCollection, QLatin1String("BrowserView")).isEmpty())
+        QSKIP("No BrowserView template found.", SkipAll);
+
+    QBENCHMARK {
+        MvdMovieCollection::MovieList::ConstIterator it = movies.constBegin();
+        for (int i = 0; i < pages; ++i, ++it)
+            tmanager().movieToHtml(it.value(), *mCollection, QLatin1String("BrowserView"));
+    }
+}
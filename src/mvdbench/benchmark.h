@@ -0,0 +1,63 @@
+/**************************************************************************
+** Filename: benchmark.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_BENCHMARK_H
+#define MVD_BENCHMARK_H
+
+#include "collectiongenerator.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+class MvdMovieCollection;
+
+class MvdBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    MvdBenchmark(const MvdCollectionGenerator::Options &options, QObject *parent = 0);
+    virtual ~MvdBenchmark();
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void generate();
+    void saveFull();
+    void saveJournaled();
+    void load_data();
+    void load();
+    void sharedDataAddItem();
+    void collectionModelSort_data();
+    void collectionModelSort();
+    void filterProxyModelFilter_data();
+    void filterProxyModelFilter();
+    void templateRender();
+
+private:
+    MvdCollectionGenerator mGenerator;
+    MvdMovieCollection *mCollection;
+    QString mTempPath;
+    QString mFile;
+    QString mJournalFile;
+};
+
+#endif // MVD_BENCHMARK_H
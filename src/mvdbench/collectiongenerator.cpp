@@ -0,0 +1,216 @@
+/**************************************************************************
+** Filename: collectiongenerator.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#include "collectiongenerator.h"
+
+#include "mvdcore/movie.h"
+#include "mvdcore/moviecollection.h"
+#include "mvdcore/pathresolver.h"
+#include "mvdcore/sditem.h"
+#include "mvdcore/shareddata.h"
+
+#include <QtGui/QImage>
+
+using namespace Movida;
+
+/*!
+    \class MvdCollectionGenerator collectiongenerator.h
+
+    \brief Creates synthetic collections for the benchmarks.
+
+    The same options always produce the same collection: a private
+    xorshift generator is used instead of qrand(), so the results do not
+    depend on the platform or on other code using the global seed.
+*/
+
+namespace {
+const char * const Words[] = {
+    "night", "day", "dawn", "son", "bride", "return", "revenge", "terror",
+    "attack", "evil", "mutant", "alien", "zombie", "dead", "shadow", "river",
+    "city", "king", "queen", "stranger", "winter", "summer", "last", "first",
+    "dark", "silver", "golden", "broken", "silent", "lost", "secret", "story"
+};
+const int WordCount = sizeof(Words) / sizeof(Words[0]);
+
+const char * const Genres[] = {
+    "Action", "Adventure", "Animation", "Comedy", "Crime", "Documentary",
+    "Drama", "Fantasy", "Horror", "Musical", "Romance", "Science Fiction",
+    "Thriller", "War", "Western"
+};
+const int GenreCount = sizeof(Genres) / sizeof(Genres[0]);
+
+const int CountryCount = 25;
+const int LanguageCount = 15;
+const int TagCount = 8;
+}
+
+MvdCollectionGenerator::MvdCollectionGenerator(const Options &options) :
+    mOptions(options),
+    mState(options.seed ? options.seed : 1)
+{ }
+
+//! Returns the next pseudo-random number.
+quint32 MvdCollectionGenerator::next()
+{
+    mState ^= mState << 13;
+    mState ^= mState >> 17;
+    mState ^= mState << 5;
+    return mState;
+}
+
+//! Returns a pseudo-random number in [0, max).
+int MvdCollectionGenerator::next(int max)
+{
+    return max > 0 ? (int)(next() % (quint32)max) : 0;
+}
+
+QString MvdCollectionGenerator::words(int count)
+{
+    QStringList list;
+    for (int i = 0; i < count; ++i)
+        list.append(QLatin1String(Words[next(WordCount)]));
+    if (!list.isEmpty())
+        list[0][0] = list.at(0).at(0).toUpper();
+    return list.join(QLatin1String(" "));
+}
+
+//! Returns between \p min and \p max distinct IDs from \p ids.
+QList<mvdid> MvdCollectionGenerator::pick(const QList<mvdid> &ids, int min, int max)
+{
+    QList<mvdid> picked;
+    int count = qMin(ids.size(), min + next(max - min + 1));
+    while (picked.size() < count) {
+        mvdid id = ids.at(next(ids.size()));
+        if (!picked.contains(id))
+            picked.append(id);
+    }
+    return picked;
+}
+
+/*!
+    Writes a poster to \p dir and returns its path. Posters are filled
+    with random blocks so that they do not compress much better than
+    real images.
+*/
+QString MvdCollectionGenerator::createPoster(const QString &dir, int index)
+{
+    QImage image(120, 180, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); y += 4) {
+        for (int x = 0; x < image.width(); x += 4) {
+            QRgb color = qRgb(next(256), next(256), next(256));
+            for (int yy = y; yy < y + 4; ++yy)
+                for (int xx = x; xx < x + 4; ++xx)
+                    image.setPixel(xx, yy, color);
+        }
+    }
+
+    QString path = QString("%1poster%2.png").arg(dir).arg(index);
+    return image.save(path, "PNG") ? path : QString();
+}
+
+/*!
+    Creates a new collection. The caller takes ownership of the collection.
+*/
+MvdMovieCollection *MvdCollectionGenerator::generate()
+{
+    mState = mOptions.seed ? mOptions.seed : 1;
+
+    MvdMovieCollection *collection = new MvdMovieCollection;
+    collection->setMetaData(MvdMovieCollection::NameInfo, QLatin1String("Benchmark collection"));
+    collection->setMetaData(MvdMovieCollection::OwnerInfo, QLatin1String("mvdbench"));
+
+    MvdSharedData &sd = collection->sharedData();
+
+    QList<mvdid> persons;
+    for (int i = 0; i < mOptions.persons; ++i) {
+        QString name = QString("%1 %2").arg(words(2)).arg(i + 1);
+        mvdid id = sd.addItem(MvdSdItem(Movida::PersonRole, name));
+        if (id != MvdNull)
+            persons.append(id);
+    }
+
+    QList<mvdid> genres;
+    for (int i = 0; i < GenreCount; ++i)
+        genres.append(sd.addItem(MvdSdItem(Movida::GenreRole, QLatin1String(Genres[i]))));
+
+    QList<mvdid> countries;
+    for (int i = 0; i < CountryCount; ++i)
+        countries.append(sd.addItem(MvdSdItem(Movida::CountryRole, QString("Country %1").arg(i + 1))));
+
+    QList<mvdid> languages;
+    for (int i = 0; i < LanguageCount; ++i)
+        languages.append(sd.addItem(MvdSdItem(Movida::LanguageRole, QString("Language %1").arg(i + 1))));
+
+    QList<mvdid> tags;
+    for (int i = 0; i < TagCount; ++i)
+        tags.append(sd.addItem(MvdSdItem(Movida::TagRole, QString("Tag %1").arg(i + 1))));
+
+    QStringList posters;
+    QString posterDir = paths().generateTempDir();
+    for (int i = 0; i < mOptions.posters; ++i) {
+        QString path = createPoster(posterDir, i);
+        if (!path.isEmpty())
+            posters.append(collection->addImage(path, MvdMovieCollection::MoviePosterImage));
+    }
+    paths().removeDirectoryTree(posterDir);
+
+    for (int i = 0; i < mOptions.movies; ++i) {
+        MvdMovie movie;
+        movie.setTitle(words(1 + next(4)));
+        if (next(3) == 0)
+            movie.setOriginalTitle(words(1 + next(4)));
+        movie.setYear(QString::number(1930 + next(80)));
+        movie.setImdbId(QString::number(1000000 + i));
+        movie.setRunningTime(60 + next(120));
+        movie.setRating(next(6));
+        movie.setPlot(words(20 + next(60)));
+        if (next(5) == 0)
+            movie.setNotes(words(5 + next(20)));
+        movie.setStorageId(QString("A%1").arg(next(500)));
+
+        if (!persons.isEmpty()) {
+            movie.setDirectors(pick(persons, 1, 2));
+            movie.setProducers(pick(persons, 0, 2));
+
+            QList<mvdid> actors = pick(persons, 3, 12);
+            for (int j = 0; j < actors.size(); ++j)
+                movie.addActor(actors.at(j), QStringList() << words(2));
+        }
+
+        movie.setGenres(pick(genres, 1, 3));
+        movie.setCountries(pick(countries, 1, 2));
+        movie.setLanguages(pick(languages, 1, 2));
+        movie.setTags(pick(tags, 0, 2));
+
+        QList<MvdUrl> urls;
+        urls.append(MvdUrl(QString("http://movies.example.com/%1").arg(i + 1), words(2), true));
+        movie.setUrls(urls);
+
+        if (i < posters.size())
+            movie.setPoster(posters.at(i));
+
+        for (int j = 0; j < mOptions.attributes; ++j)
+            movie.setExtendedAttribute(QString("attribute-%1").arg(j + 1), words(2));
+
+        collection->addMovie(movie);
+    }
+
+    return collection;
+}
@@ -0,0 +1,66 @@
+/**************************************************************************
+** Filename: collectiongenerator.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_COLLECTIONGENERATOR_H
+#define MVD_COLLECTIONGENERATOR_H
+
+#include "mvdcore/global.h"
+
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+
+class MvdMovieCollection;
+
+class MvdCollectionGenerator
+{
+public:
+    struct Options {
+        Options() :
+            movies(1000),
+            persons(2000),
+            posters(100),
+            attributes(4),
+            seed(1) { }
+
+        int movies;
+        int persons;
+        int posters;
+        int attributes;
+        quint32 seed;
+    };
+
+    MvdCollectionGenerator(const Options &options = Options());
+
+    MvdMovieCollection *generate();
+
+    Options options() const { return mOptions; }
+
+private:
+    quint32 next();
+    int next(int max);
+    QString words(int count);
+    QList<mvdid> pick(const QList<mvdid> &ids, int min, int max);
+    QString createPoster(const QString &dir, int index);
+
+    Options mOptions;
+    quint32 mState;
+};
+
+#endif // MVD_COLLECTIONGENERATOR_H
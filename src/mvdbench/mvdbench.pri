@@ -0,0 +1,14 @@
+HEADERS += \
+	benchmark.h \
+	collectiongenerator.h \
+	../movida/collectionmodel.h \
+	../movida/filterproxymodel.h \
+	../movida/guiglobal.h
+
+SOURCES += \
+	bench_main.cpp \
+	benchmark.cpp \
+	collectiongenerator.cpp \
+	../movida/collectionmodel.cpp \
+	../movida/filterproxymodel.cpp \
+	../movida/guiglobal.cpp
@@ -0,0 +1,21 @@
+### Application - optional - requires: mvdcore, mvdshared ###
+
+ROOT = ../..
+TARGET = mvdbench
+DESTDIR = $${ROOT}/bin
+LIBS += -lmvdcore -lmvdshared
+win32 {
+	LIBS += -llibxml2 -llibxslt
+} else {
+	LIBS += -lxml2 -lxslt
+}
+TEMPLATE = app
+QT += testlib
+CONFIG += console
+QMAKE_TARGET_DESCRIPTION = Benchmarks for Movida.
+
+include(mvdbench.pri)
+
+!contains(CONFIG, 'BASE_CONFIG_INCLUDED') {
+	include(../movida.pri)
+}
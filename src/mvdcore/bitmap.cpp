@@ -0,0 +1,327 @@
+/**************************************************************************
+** Filename: bitmap.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#include "bitmap.h"
+
+#include <QtCore/QtAlgorithms>
+
+#include <algorithm>
+#include <iterator>
+
+/*!
+    \class MvdBitmap bitmap.h
+    \ingroup MvdCore
+
+    \brief Compressed set of movie IDs supporting fast set algebra.
+
+    Movie IDs are assigned sequentially, so they can be used directly as bit
+    positions. Bitmaps with few IDs compared to the highest ID (e.g. the
+    movies an actor appears in) are stored as a sorted ID vector, the others
+    (e.g. all the seen movies) as a vector of 64 bit words. The
+    representation is switched automatically and is transparent to the user.
+*/
+
+namespace {
+inline int bitCount(quint64 w)
+{
+    w = w - ((w >> 1) & Q_UINT64_C(0x5555555555555555));
+    w = (w & Q_UINT64_C(0x3333333333333333)) + ((w >> 2) & Q_UINT64_C(0x3333333333333333));
+    w = (w + (w >> 4)) & Q_UINT64_C(0x0F0F0F0F0F0F0F0F);
+    return int((w * Q_UINT64_C(0x0101010101010101)) >> 56);
+}
+
+inline int wordCount(mvdid highest)
+{
+    return int(highest >> 6) + 1;
+}
+}
+
+//! Creates a new empty bitmap.
+MvdBitmap::MvdBitmap() :
+    mDense(false),
+    mCount(0)
+{
+}
+
+//! Returns true if the bitmap contains no IDs.
+bool MvdBitmap::isEmpty() const
+{
+    return mCount == 0;
+}
+
+//! Returns the number of IDs in the bitmap.
+int MvdBitmap::count() const
+{
+    return mCount;
+}
+
+//! Returns true if \p id is in the bitmap.
+bool MvdBitmap::contains(mvdid id) const
+{
+    if (mDense) {
+        int w = int(id >> 6);
+        return w < mWords.size() && (mWords.at(w) & (Q_UINT64_C(1) << (id & 63)));
+    }
+
+    return qBinaryFind(mIds.constBegin(), mIds.constEnd(), id) != mIds.constEnd();
+}
+
+//! Adds \p id to the bitmap.
+void MvdBitmap::insert(mvdid id)
+{
+    if (mDense) {
+        int w = int(id >> 6);
+        if (w >= mWords.size())
+            mWords.resize(w + 1);
+        quint64 bit = Q_UINT64_C(1) << (id & 63);
+        if (!(mWords.at(w) & bit)) {
+            mWords[w] |= bit;
+            ++mCount;
+        }
+        return;
+    }
+
+    // IDs are usually added in increasing order
+    if (mIds.isEmpty() || mIds.last() < id)
+        mIds.append(id);
+    else {
+        QVector<mvdid>::Iterator it = qLowerBound(mIds.begin(), mIds.end(), id);
+        if (*it == id)
+            return;
+        mIds.insert(it, id);
+    }
+
+    ++mCount;
+    optimize();
+}
+
+//! Removes \p id from the bitmap.
+void MvdBitmap::remove(mvdid id)
+{
+    if (mDense) {
+        int w = int(id >> 6);
+        quint64 bit = Q_UINT64_C(1) << (id & 63);
+        if (w < mWords.size() && (mWords.at(w) & bit)) {
+            mWords[w] &= ~bit;
+            --mCount;
+            optimize();
+        }
+        return;
+    }
+
+    QVector<mvdid>::Iterator it = qBinaryFind(mIds.begin(), mIds.end(), id);
+    if (it != mIds.end()) {
+        mIds.erase(it);
+        --mCount;
+    }
+}
+
+//! Removes all the IDs.
+void MvdBitmap::clear()
+{
+    mIds.clear();
+    mWords.clear();
+    mDense = false;
+    mCount = 0;
+}
+
+//! Returns the IDs in the bitmap in increasing order.
+QList<mvdid> MvdBitmap::toList() const
+{
+    if (!mDense)
+        return mIds.toList();
+
+    QList<mvdid> list;
+    for (int w = 0; w < mWords.size(); ++w) {
+        quint64 word = mWords.at(w);
+        for (int b = 0; word; ++b, word >>= 1)
+            if (word & 1)
+                list.append(mvdid((w << 6) + b));
+    }
+    return list;
+}
+
+//! Keeps only the IDs that are also in \p other.
+MvdBitmap &MvdBitmap::operator&=(const MvdBitmap &other)
+{
+    if (mDense && other.mDense) {
+        if (mWords.size() > other.mWords.size())
+            mWords.resize(other.mWords.size());
+        mCount = 0;
+        for (int w = 0; w < mWords.size(); ++w) {
+            mWords[w] &= other.mWords.at(w);
+            mCount += bitCount(mWords.at(w));
+        }
+    } else if (!mDense && !other.mDense) {
+        QVector<mvdid> ids;
+        std::set_intersection(mIds.constBegin(), mIds.constEnd(),
+            other.mIds.constBegin(), other.mIds.constEnd(), std::back_inserter(ids));
+        mIds = ids;
+        mCount = mIds.size();
+    } else {
+        // The result is never larger than the sparse operand
+        const MvdBitmap &sparse = mDense ? other : *this;
+        const MvdBitmap &dense = mDense ? *this : other;
+        QVector<mvdid> ids;
+        for (int i = 0; i < sparse.mIds.size(); ++i)
+            if (dense.contains(sparse.mIds.at(i)))
+                ids.append(sparse.mIds.at(i));
+        mIds = ids;
+        mWords.clear();
+        mDense = false;
+        mCount = mIds.size();
+    }
+
+    optimize();
+    return *this;
+}
+
+//! Adds the IDs in \p other.
+MvdBitmap &MvdBitmap::operator|=(const MvdBitmap &other)
+{
+    if (other.isEmpty())
+        return *this;
+
+    if (!mDense && !other.mDense) {
+        QVector<mvdid> ids;
+        ids.reserve(mIds.size() + other.mIds.size());
+        std::set_union(mIds.constBegin(), mIds.constEnd(),
+            other.mIds.constBegin(), other.mIds.constEnd(), std::back_inserter(ids));
+        mIds = ids;
+        mCount = mIds.size();
+    } else {
+        toDense();
+        if (other.mDense) {
+            if (mWords.size() < other.mWords.size())
+                mWords.resize(other.mWords.size());
+            mCount = 0;
+            for (int w = 0; w < mWords.size(); ++w) {
+                if (w < other.mWords.size())
+                    mWords[w] |= other.mWords.at(w);
+                mCount += bitCount(mWords.at(w));
+            }
+        } else {
+            for (int i = 0; i < other.mIds.size(); ++i)
+                insert(other.mIds.at(i));
+        }
+    }
+
+    optimize();
+    return *this;
+}
+
+//! Removes the IDs that are in \p other.
+MvdBitmap &MvdBitmap::operator-=(const MvdBitmap &other)
+{
+    if (other.isEmpty() || isEmpty())
+        return *this;
+
+    if (!mDense) {
+        QVector<mvdid> ids;
+        for (int i = 0; i < mIds.size(); ++i)
+            if (!other.contains(mIds.at(i)))
+                ids.append(mIds.at(i));
+        mIds = ids;
+        mCount = mIds.size();
+    } else if (other.mDense) {
+        mCount = 0;
+        for (int w = 0; w < mWords.size(); ++w) {
+            if (w < other.mWords.size())
+                mWords[w] &= ~other.mWords.at(w);
+            mCount += bitCount(mWords.at(w));
+        }
+    } else {
+        for (int i = 0; i < other.mIds.size(); ++i) {
+            mvdid id = other.mIds.at(i);
+            int w = int(id >> 6);
+            if (w >= mWords.size())
+                break;
+            quint64 bit = Q_UINT64_C(1) << (id & 63);
+            if (mWords.at(w) & bit) {
+                mWords[w] &= ~bit;
+                --mCount;
+            }
+        }
+    }
+
+    optimize();
+    return *this;
+}
+
+//! Returns true if both bitmaps contain the same IDs.
+bool MvdBitmap::operator==(const MvdBitmap &other) const
+{
+    if (mCount != other.mCount)
+        return false;
+    if (!mDense && !other.mDense)
+        return mIds == other.mIds;
+    return toList() == other.toList();
+}
+
+//! \internal Switches to the word vector representation.
+void MvdBitmap::toDense()
+{
+    if (mDense)
+        return;
+
+    mWords.clear();
+    if (!mIds.isEmpty())
+        mWords.resize(wordCount(mIds.last()));
+    for (int i = 0; i < mIds.size(); ++i) {
+        mvdid id = mIds.at(i);
+        mWords[int(id >> 6)] |= Q_UINT64_C(1) << (id & 63);
+    }
+
+    mIds.clear();
+    mDense = true;
+}
+
+/*!
+    \internal Uses the smallest representation for the current IDs. The
+    dense representation is only dropped when it is twice as large as the
+    sparse one, to avoid switching back and forth on every change.
+*/
+void MvdBitmap::optimize()
+{
+    if (mDense) {
+        int size = mWords.size();
+        while (size > 0 && !mWords.at(size - 1))
+            --size;
+        if (size != mWords.size())
+            mWords.resize(size);
+
+        // 4 bytes per ID against 8 bytes per word
+        if (mCount * 4 < size * 4) {
+            QVector<mvdid> ids;
+            ids.reserve(mCount);
+            for (int w = 0; w < size; ++w) {
+                quint64 word = mWords.at(w);
+                for (int b = 0; word; ++b, word >>= 1)
+                    if (word & 1)
+                        ids.append(mvdid((w << 6) + b));
+            }
+            mIds = ids;
+            mWords.clear();
+            mDense = false;
+        }
+    } else if (mCount > 16 && mCount * 4 > wordCount(mIds.last()) * 8) {
+        toDense();
+    }
+}
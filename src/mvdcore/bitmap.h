@@ -0,0 +1,70 @@
+/**************************************************************************
+** Filename: bitmap.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_BITMAP_H
+#define MVD_BITMAP_H
+
+#include "global.h"
+
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+class MVD_EXPORT MvdBitmap
+{
+public:
+    MvdBitmap();
+
+    bool isEmpty() const;
+    int count() const;
+    bool contains(mvdid id) const;
+
+    void insert(mvdid id);
+    void remove(mvdid id);
+    void clear();
+
+    QList<mvdid> toList() const;
+
+    MvdBitmap &operator&=(const MvdBitmap &other);
+    MvdBitmap &operator|=(const MvdBitmap &other);
+    MvdBitmap &operator-=(const MvdBitmap &other);
+
+    inline MvdBitmap operator&(const MvdBitmap &other) const
+    { MvdBitmap b(*this); b &= other; return b; }
+    inline MvdBitmap operator|(const MvdBitmap &other) const
+    { MvdBitmap b(*this); b |= other; return b; }
+    inline MvdBitmap operator-(const MvdBitmap &other) const
+    { MvdBitmap b(*this); b -= other; return b; }
+
+    bool operator==(const MvdBitmap &other) const;
+    inline bool operator!=(const MvdBitmap &other) const
+    { return !operator==(other); }
+
+private:
+    void toDense();
+    void optimize();
+
+    // Sorted IDs for sparse bitmaps, 64 bit words for dense bitmaps
+    QVector<mvdid> mIds;
+    QVector<quint64> mWords;
+    bool mDense;
+    int mCount;
+};
+
+#endif // MVD_BITMAP_H
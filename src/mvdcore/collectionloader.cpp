@@ -20,6 +20,7 @@
 
 #include "collectionloader.h"
 
+#include "collectionsnapshot.h"
 #include "core.h"
 #include "global.h"
 #include "logger.h"
@@ -30,25 +31,98 @@
 #include "sditem.h"
 #include "settings.h"
 #include "shareddata.h"
+#include "trace.h"
 #include "unzip.h"
 #include "utils.h"
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QBuffer>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDateTime>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
+#include <QtCore/QIODevice>
+#include <QtCore/QMutex>
+#include <QtCore/QPair>
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
+#include <QtCore/QSet>
 #include <QtCore/QString>
 #include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <QtCore/QTime>
+#include <QtCore/QVector>
 
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
+#include <libxml/SAX2.h>
+
+#include <cstring>
 
 using namespace Movida;
 
 namespace {
 const int version = 1;
+
+/*!
+    \internal Write-only device that forwards the data inflated by MvdUnZip
+    to a libxml2 push parser.
+*/
+class XmlPushDevice : public QIODevice
+{
+public:
+    XmlPushDevice(xmlParserCtxtPtr ctxt) :
+        QIODevice(),
+        mContext(ctxt)
+    {
+        open(QIODevice::WriteOnly);
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 size)
+    {
+        // Returning an error makes MvdUnZip stop inflating
+        if (xmlParseChunk(mContext, data, (int)size, 0) != 0)
+            return -1;
+        return size;
+    }
+
+private:
+    xmlParserCtxtPtr mContext;
+};
+
+//! \internal Maps the IDs in \p ids, removing the IDs that are not in \p idMapper.
+QList<mvdid> remapIds(QList<mvdid> ids, const QHash<mvdid, mvdid> &idMapper)
+{
+    for (int i = ids.size() - 1; i >= 0; --i) {
+        mvdid id = idMapper.value(ids.at(i), MvdNull);
+        if (id == MvdNull)
+            ids.removeAt(i);
+        else ids[i] = id;
+    }
+    return ids;
+}
+
+//! \internal Same as above for lists of persons and roles.
+QList<MvdRoleItem> remapIds(QList<MvdRoleItem> items, const QHash<mvdid, mvdid> &idMapper)
+{
+    for (int i = items.size() - 1; i >= 0; --i) {
+        mvdid id = idMapper.value(items.at(i).first, MvdNull);
+        if (id == MvdNull)
+            items.removeAt(i);
+        else items[i].first = id;
+    }
+    return items;
+}
 }
 
 Q_DECLARE_METATYPE(MvdCollectionLoader::Info);
@@ -65,26 +139,110 @@ Q_DECLARE_METATYPE(MvdCollectionLoader::Info);
 class MvdCollectionLoader::Private
 {
 public:
+    class Thread;
+    class SnapshotWriter;
+    class DocumentReader;
+    class MovieReader;
+
     Private(MvdCollectionLoader * cl) :
         q(cl),
-        progressReceiver(0)
+        progressReceiver(0),
+        collection(0),
+        loadMode(MvdCollectionLoader::DomLoadMode),
+        thread(0),
+        background(false),
+        batchSize(100),
+        status(MvdCollectionLoader::NoError),
+        continueParsing(true),
+        idMapper(0),
+        journalRecords(0),
+        journalOffset(-1),
+        journalUsable(false),
+        deliveryPending(false),
+        expectedMovies(0),
+        loadedMovies(0)
     { }
 
     //! \internal
     typedef QHash<mvdid, mvdid> IdMapper;
 
+    //! \internal Contents of a streamed XML document.
+    enum StreamTarget {
+        SharedDataStream,
+        CollectionStream
+    };
+
+    //! \internal Parser status passed to the SAX callbacks.
+    struct StreamContext {
+        MvdCollectionLoader::Private *loader;
+        StreamTarget target;
+        IdMapper *idMapper;
+        MvdMovieCollection *collection;
+        QString posterDir;
+    };
+
+    MvdCollectionLoader::StatusCode load(MvdMovieCollection *collection, QString file);
+
+    void callLoader(const char *member);
+    void queueMovie(const MvdMovie &movie, mvdid fileId);
+    void reportProgress();
+    void setJournalInfo(MvdMovieCollection *collection, const QString &file);
+    void writeSnapshot(MvdMovieCollection *collection, const QString &file);
+
+    bool readMetaData(MvdUnZip *uz, const QString &tmpPath, bool streaming);
+
+    bool isCancelled() const
+    { return (int)cancelled != 0; }
+
     inline bool checkArchiveVersion(const QString &attribute);
     inline bool loadXmlDocument(const QString &path, xmlDocPtr *doc, xmlNodePtr *cur, int *itemCount);
+    inline bool readXmlDocument(MvdUnZip *uz, const QString &entry, xmlDocPtr *doc, xmlNodePtr *cur, int *itemCount);
+    bool checkXmlDocument(const QString &name, xmlDocPtr *doc, xmlNodePtr *cur, int *itemCount);
+
+
+    // Streaming parser
+    bool streamXmlDocument(MvdUnZip *uz, const QString &entry, StreamTarget target,
+        IdMapper *idMapper, MvdMovieCollection *collection);
+
+    static void streamEndElement(void *ctx, const xmlChar *localname,
+        const xmlChar *prefix, const xmlChar *URI);
+    static bool isStreamedItem(xmlNodePtr node, const char *name, const char *parentName);
+
 
+    static mvdid readId(xmlNodePtr node);
 
     // Shared data parser
     void parseSharedItem(xmlDocPtr doc, xmlNodePtr node,
         IdMapper *idMapper, MvdMovieCollection *collection, int itemCount);
+    bool readSharedItem(xmlDocPtr doc, xmlNodePtr node, mvdid *id, MvdSdItem *item);
+    void addSharedItem(mvdid id, const MvdSdItem &item, IdMapper *idMapper,
+        MvdMovieCollection *collection);
 
 
     // Movie parser
     void parseCollection(xmlDocPtr doc, xmlNodePtr cur,
         const IdMapper &idMapper, MvdMovieCollection *collection, int itemCount);
+    void parseMovie(xmlDocPtr doc, xmlNodePtr node,
+        const IdMapper &idMapper, MvdMovieCollection *collection, const QString &posterDir);
+    MvdMovie readMovie(xmlDocPtr doc, xmlNodePtr node,
+        const IdMapper &idMapper, const QString &posterDir);
+    void addMovie(const MvdMovie &movie, mvdid fileId, MvdMovieCollection *collection);
+
+
+    // Parallel parser
+    MvdCollectionLoader::StatusCode loadParallel(MvdUnZip *uz, const QString &file,
+        IdMapper *idMapper, MvdMovieCollection *collection);
+    static void remapMovie(MvdMovie *movie, const IdMapper &idMapper);
+
+
+    // Snapshot reader
+    bool readSnapshot(MvdCollectionSnapshot *snapshot,
+        QList<QPair<mvdid, MvdSdItem> > *items, QList<QPair<mvdid, MvdMovie> > *movies);
+
+
+    // Journal parser
+    void parseJournalRecord(xmlDocPtr doc, xmlNodePtr cur, MvdMovieCollection *collection);
+    void setMetaData(MvdMovieCollection *collection, const QHash<QString, QString> &metadata);
 
 
     // Shared data ID parsers
@@ -110,6 +268,193 @@ public:
     QObject *progressReceiver;
     QString progressMember;
     MvdMovieCollection *collection;
+
+    MvdCollectionLoader::LoadMode loadMode;
+
+    // Images left in the archive (streaming and parallel modes only)
+    QSet<QString> archivedImages;
+
+    // Background loading
+    Thread *thread;
+    bool background;
+    QAtomicInt cancelled;
+    int batchSize;
+    QString fileName;
+    MvdCollectionLoader::StatusCode status;
+
+    // Data handed from the parser to the loader's thread
+    MvdCollectionLoader::Info info;
+    bool continueParsing;
+    QString dataPath;
+    QString archivePath;
+    QStringList imageEntries;
+    QString posterDir;
+
+    IdMapper *idMapper;
+    QList<QPair<mvdid, MvdSdItem> > sharedItems;
+
+    // Movie IDs in the archive to movie IDs in the collection, used to
+    // apply the journal records
+    IdMapper movieMapper;
+    QList<QPair<QString, QByteArray> > journal;
+
+    // Used by setJournalInfo() once the collection has been loaded
+    IdMapper sharedItemMapper;
+    int journalRecords;
+    qint64 journalOffset;
+    bool journalUsable;
+
+    // Checksum of an archive loaded without a valid binary snapshot
+    QString snapshotChecksum;
+
+    QMutex mutex;
+    QList<MvdMovie> pendingMovies;
+    QList<mvdid> pendingMovieIds;
+    bool deliveryPending;
+
+    int expectedMovies;
+    int loadedMovies;
+};
+
+//! \internal Loads a collection in a separate thread.
+class MvdCollectionLoader::Private::Thread : public QThread
+{
+public:
+    Thread(MvdCollectionLoader::Private *p) :
+        QThread(),
+        d(p) { }
+
+protected:
+    void run()
+    {
+        d->status = d->load(d->collection, d->fileName);
+    }
+
+private:
+    MvdCollectionLoader::Private *d;
+};
+
+//! \internal Writes a binary snapshot of a loaded collection.
+class MvdCollectionLoader::Private::SnapshotWriter : public QRunnable
+{
+public:
+    SnapshotWriter(MvdMovieCollection *collection, const QString &archive,
+        const QString &checksum) :
+        QRunnable(),
+        mCollection(collection),
+        mArchive(archive),
+        mChecksum(checksum) { }
+
+    ~SnapshotWriter()
+    {
+        delete mCollection;
+    }
+
+protected:
+    void run()
+    {
+        MvdCollectionSnapshot::write(mCollection, mArchive, mChecksum);
+    }
+
+private:
+    MvdMovieCollection *mCollection;
+    QString mArchive;
+    QString mChecksum;
+};
+
+/*!
+    \internal Inflates and parses a XML file in a worker thread. Each reader
+    opens its own MvdUnZip instance, so more files can be inflated at once.
+*/
+class MvdCollectionLoader::Private::DocumentReader : public QRunnable
+{
+public:
+    DocumentReader(const QString &archive, const QString &entry) :
+        QRunnable(),
+        mArchive(archive),
+        mEntry(entry),
+        mDocument(0)
+    {
+        setAutoDelete(false);
+    }
+
+    ~DocumentReader()
+    {
+        if (mDocument)
+            xmlFreeDoc(mDocument);
+    }
+
+    //! Waits for the document to be parsed. The caller must free the document.
+    xmlDocPtr takeDocument()
+    {
+        mDone.acquire();
+        xmlDocPtr doc = mDocument;
+        mDocument = 0;
+        return doc;
+    }
+
+protected:
+    void run()
+    {
+        MVD_TRACE_SPAN(span, "MvdCollectionLoader::DocumentReader", "loader");
+
+        MvdUnZip uz;
+        if (uz.openArchive(mArchive) == MvdUnZip::NoError) {
+            QByteArray data = uz.readFile(mEntry);
+            QByteArray name = mEntry.toUtf8();
+            MVD_TRACE_COUNTER(span, "bytes", data.size());
+            if (!data.isEmpty())
+                mDocument = xmlReadMemory(data.constData(), data.size(), name.constData(), 0, 0);
+        }
+
+        mDone.release();
+    }
+
+private:
+    QString mArchive;
+    QString mEntry;
+    xmlDocPtr mDocument;
+    QSemaphore mDone;
+};
+
+/*!
+    \internal Converts a range of <movie> nodes in a worker thread. Movies and
+    their IDs are stored at the same positions as the nodes.
+*/
+class MvdCollectionLoader::Private::MovieReader : public QRunnable
+{
+public:
+    MovieReader(MvdCollectionLoader::Private *p, xmlDocPtr doc, const xmlNodePtr *nodes,
+        int count, const IdMapper &idMapper, MvdMovie *movies, mvdid *ids) :
+        QRunnable(),
+        d(p),
+        mDocument(doc),
+        mNodes(nodes),
+        mCount(count),
+        mIdMapper(idMapper),
+        mMovies(movies),
+        mIds(ids) { }
+
+protected:
+    void run()
+    {
+        MVD_TRACE_SPAN(span, "MvdCollectionLoader::MovieReader", "loader");
+        MVD_TRACE_COUNTER(span, "movies", mCount);
+
+        for (int i = 0; i < mCount && !d->isCancelled(); ++i) {
+            mMovies[i] = d->readMovie(mDocument, mNodes[i], mIdMapper, d->posterDir);
+            mIds[i] = readId(mNodes[i]);
+        }
+    }
+
+private:
+    MvdCollectionLoader::Private *d;
+    xmlDocPtr mDocument;
+    const xmlNodePtr *mNodes;
+    int mCount;
+    const IdMapper &mIdMapper;
+    MvdMovie *mMovies;
+    mvdid *mIds;
 };
 
 /*!
@@ -136,26 +481,55 @@ void MvdCollectionLoader::Private::parseSharedItem(xmlDocPtr doc, xmlNodePtr nod
     Q_ASSERT(doc && node && idMapper && collection);
     Q_UNUSED(itemCount);
 
-    xmlChar *attr = 0;
+    mvdid id;
+    MvdSdItem item;
+    if (!readSharedItem(doc, node, &id, &item))
+        return;
 
-    attr = xmlGetProp(node, (const xmlChar *)"id");
-    if (!attr)
+    addSharedItem(id, item, idMapper, collection);
+}
+
+/*!
+    \internal Adds a shared item to the collection and maps its \p id in the
+    archive to the new ID.
+*/
+void MvdCollectionLoader::Private::addSharedItem(mvdid id, const MvdSdItem &item,
+    IdMapper *idMapper, MvdMovieCollection *collection)
+{
+    // Items are added by the loader's thread
+    if (background) {
+        sharedItems.append(qMakePair(id, item));
         return;
+    }
 
-    mvdid id = MvdCore::atoid((const char *)attr);
-    xmlFree(attr);
+    mvdid newId = collection->sharedData().addItem(item);
+    if (newId != MvdNull)
+        idMapper->insert(id, newId);
+}
+
+/*!
+    \internal Reads a <shared-item> node. Returns false if the item is not
+    valid.
+*/
+bool MvdCollectionLoader::Private::readSharedItem(xmlDocPtr doc, xmlNodePtr node,
+    mvdid *id, MvdSdItem *item)
+{
+    xmlChar *attr = 0;
+
+    *id = readId(node);
+    if (*id == MvdNull)
+        return false;
 
     attr = xmlGetProp(node, (const xmlChar *)"type");
     if (!attr)
-        return;
+        return false;
 
     Movida::DataRole type = MvdSharedData::roleFromString(MVD_QSTR(attr));
     xmlFree(attr);
 
     if (type == Movida::NoRole)
-        return;
+        return false;
 
-    MvdSdItem item;
     xmlNodePtr n = node->children;
 
     while (n) {
@@ -170,26 +544,34 @@ void MvdCollectionLoader::Private::parseSharedItem(xmlDocPtr doc, xmlNodePtr nod
             xmlFree(attr);
 
         if (!xmlStrcmp(n->name, (const xmlChar *)"value"))
-            item.value = data;
+            item->value = data;
         else if (!xmlStrcmp(n->name, (const xmlChar *)"description"))
-            item.description = data;
+            item->description = data;
         else if (!xmlStrcmp(n->name, (const xmlChar *)"identifier"))
-            item.id = data;
+            item->id = data;
         else if (!xmlStrcmp(n->name, (const xmlChar *)"urls")) {
             QList<MvdUrl> urls;
             parseUrlDescriptions(doc, n, &urls);
             if (!urls.isEmpty())
-                item.urls = urls;
+                item->urls = urls;
         }
         n = n->next;
     }
 
-    if (!item.value.isEmpty()) {
-        item.role = type;
-        mvdid newId = collection->sharedData().addItem(item);
-        if (newId != MvdNull)
-            idMapper->insert(id, newId);
-    }
+    item->role = type;
+    return !item->value.isEmpty();
+}
+
+//! \internal Returns the value of the id attribute of \p node or MvdNull.
+mvdid MvdCollectionLoader::Private::readId(xmlNodePtr node)
+{
+    xmlChar *attr = xmlGetProp(node, (const xmlChar *)"id");
+    if (!attr)
+        return MvdNull;
+
+    mvdid id = MvdCore::atoid((const char *)attr);
+    xmlFree(attr);
+    return id;
 }
 
 /*!
@@ -209,15 +591,8 @@ void MvdCollectionLoader::Private::parseCollection(xmlDocPtr doc, xmlNodePtr cur
 {
     Q_UNUSED(itemCount)
 
-    QString posterDir = collection->metaData(MvdMovieCollection::DataPathInfo)
-        .append("images") + QDir::separator();
-
-    xmlChar *attr = 0;
     cur = cur->xmlChildrenNode;
 
-    xmlNodePtr mNode = 0;
-    QString nodeName;
-
     while (cur) {
         if (cur->type == XML_ELEMENT_NODE && !xmlStrcmp(cur->name, (const xmlChar *)"movies")) {
             cur = cur->children;
@@ -225,259 +600,456 @@ void MvdCollectionLoader::Private::parseCollection(xmlDocPtr doc, xmlNodePtr cur
         } else cur = cur->next;
     }
 
-    while (cur) {
-        if (cur->type != XML_ELEMENT_NODE || xmlStrcmp(cur->name, (const xmlChar *)"movie")) {
-            cur = cur->next;
-            continue;
-        }
-
-        MvdMovie movie;
-        mNode = cur->children;
-
-        while (mNode) {
-            if (mNode->type != XML_ELEMENT_NODE) {
-                mNode = mNode->next;
-                continue;
-            }
-
-            nodeName = MVD_QSTR(mNode->name);
-
-            if (nodeName == QLatin1String("cast"))
-                parsePersonIdList(doc, mNode, idMapper, &movie, Movida::ActorRole);
-            else if (nodeName == QLatin1String("tags"))
-                parseSimpleIdList(doc, mNode, idMapper, &movie, Movida::TagRole);
-            else if (nodeName == QLatin1String("color-mode")) {
-                attr = xmlGetProp(mNode, (const xmlChar *)"value");
-                if (attr) {
-                    nodeName = MVD_QSTR(attr);
-                    xmlFree(attr);
-
-                    if (nodeName == QLatin1String("bw"))
-                        movie.setColorMode(Movida::BlackWhite);
-                    else if (nodeName == QLatin1String("color"))
-                        movie.setColorMode(Movida::Color);
-                }
-            } else if (nodeName == QLatin1String("countries"))
-                parseSimpleIdList(doc, mNode, idMapper, &movie, Movida::CountryRole);
-            else if (nodeName == QLatin1String("languages"))
-                parseSimpleIdList(doc, mNode, idMapper, &movie, Movida::LanguageRole);
-            else if (nodeName == QLatin1String("crew"))
-                parsePersonIdList(doc, mNode, idMapper, &movie, Movida::CrewMemberRole);
-            else if (nodeName == QLatin1String("directors"))
-                parsePersonIdList(doc, mNode, idMapper, &movie, Movida::DirectorRole);
-            else if (nodeName == QLatin1String("genres"))
-                parseSimpleIdList(doc, mNode, idMapper, &movie, Movida::GenreRole);
-            else if (nodeName == QLatin1String("imdb-id")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    QRegExp imdbRx(Movida::core().parameter("mvdcore/imdb-id-regexp").toString());
-                    QString imdbId = MVD_QSTR(attr);
-                    if (imdbRx.exactMatch(imdbId))
-                        movie.setImdbId(imdbId);
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("running-time")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    quint32 minutes = MvdCore::atoid((const char *)attr);
-                    movie.setRunningTime(minutes);
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("seen")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    bool b = !xmlStrcmp(attr, (const xmlChar *)"true");
-                    movie.setSpecialTagEnabled(Movida::SeenTag, b);
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("special")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    bool b = !xmlStrcmp(attr, (const xmlChar *)"true");
-                    movie.setSpecialTagEnabled(Movida::SpecialTag, b);
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("loaned")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    bool b = !xmlStrcmp(attr, (const xmlChar *)"true");
-                    movie.setSpecialTagEnabled(Movida::LoanedTag, b);
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("urls")) {
-                QList<MvdUrl> urls;
-                parseUrlDescriptions(doc, mNode, &urls);
-                if (!urls.isEmpty())
-                    movie.setUrls(urls);
-            } else if (nodeName == QLatin1String("notes")) {
-                /*! \todo multiple notes handling with optional automatic
-                   title generation like in opera web browser
-                 */
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    movie.setNotes(MVD_QSTR(attr));
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("original-title")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    movie.setOriginalTitle(MVD_QSTR(attr));
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("plot")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    movie.setPlot(MVD_QSTR(attr));
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("producers"))
-                parsePersonIdList(doc, mNode, idMapper, &movie, Movida::ProducerRole);
-            else if (nodeName == QLatin1String("year")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    movie.setYear(MVD_QSTR(attr));
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("rating")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    movie.setRating(MvdCore::atoid((const char *)attr));
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("storage-id")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    movie.setStorageId(MVD_QSTR(attr));
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("special-contents")) {
-                QStringList list = parseStringDescriptions(doc, mNode, "item");
-                movie.setSpecialContents(list);
-            } else if (nodeName == QLatin1String("poster")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    QString poster = MVD_QSTR(attr);
-                    xmlFree(attr);
-                    if (!QFile::exists(posterDir + poster)) {
-                        Movida::wLog() << QString("MvdCollectionLoader: Missing movie poster: %1")
-                            .arg(posterDir + poster);
-                    } else
-                        movie.setPoster(poster);
-                }
-            } else if (nodeName == QLatin1String("title")) {
-                attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
-                if (attr) {
-                    movie.setTitle(MVD_QSTR(attr));
-                    xmlFree(attr);
-                }
-            } else if (nodeName == QLatin1String("extended-attributes")) {
-                QHash<QString, QVariant> data_list = parseDataList(doc, mNode, "attribute", "name");
-                movie.setExtendedAttributes(data_list);
-            }
-
-            mNode = mNode->next;
-        }
+    while (cur && !isCancelled()) {
+        if (cur->type == XML_ELEMENT_NODE && !xmlStrcmp(cur->name, (const xmlChar *)"movie"))
+            parseMovie(doc, cur, idMapper, collection, posterDir);
 
         cur = cur->next;
-
-        if (movie.isValid()) {
-            mvdid movieId = collection->addMovie(movie);
-            Q_UNUSED(movieId);
-        }
-
     }     // loop over <movie> nodes
 }
 
 /*!
-    \internal Parses a list of urls.
-
-    \verbatim
-    <urls>
-    <url description="SharonRocks website" default="true">http://sharonrocks.net</url>
-    <url description="Wikipedia">http://en.wikipedia.org/wiki/Sharon_Stoned</url>
-    </urls>
-    \endverbatim
+    \internal Parses a single <movie> node and adds the movie to the collection.
+    \p posterDir is the directory containing the extracted movie posters.
 */
-void MvdCollectionLoader::Private::parseUrlDescriptions(xmlDocPtr doc, xmlNodePtr node,
-    QList<MvdUrl> *list)
+void MvdCollectionLoader::Private::parseMovie(xmlDocPtr doc, xmlNodePtr node,
+    const IdMapper &idMapper, MvdMovieCollection *collection, const QString &posterDir)
 {
-    Q_ASSERT(doc && node && list);
-
-    xmlNodePtr linkItem = node->children;
-    xmlChar *attr = 0;
-
-    while (linkItem) {
-        if (linkItem->type == XML_ELEMENT_NODE &&
-            !xmlStrcmp(linkItem->name, (const xmlChar *)"url")) {
-            attr = xmlNodeListGetString(doc, linkItem->xmlChildrenNode, 1);
-            if (attr) {
-                MvdUrl url;
-                url.url = MVD_QSTR(attr).trimmed();
-                xmlFree(attr);
-
-                attr = xmlGetProp(linkItem, (const xmlChar *)"description");
-                if (attr) {
-                    url.description = MVD_QSTR(attr).trimmed();
-                    xmlFree(attr);
-                }
-
-                attr = xmlGetProp(linkItem, (const xmlChar *)"default");
-                if (attr) {
-                    url.isDefault = !xmlStrcmp(attr, (const xmlChar *)"true");
-                    xmlFree(attr);
-                }
-
-                if (!url.url.isEmpty())
-                    list->append(url);
-            }
-        }
+    MvdMovie movie = readMovie(doc, node, idMapper, posterDir);
+    if (!movie.isValid())
+        return;
 
-        linkItem = linkItem->next;
-    }
+    // Older archives have no movie IDs
+    addMovie(movie, readId(node), collection);
 }
 
 /*!
-    \internal Parses an XML node containing a list of strings.
+    \internal Adds a movie to the collection. \p fileId is the ID of the
+    movie in the archive or MvdNull.
 */
-QStringList MvdCollectionLoader::Private::parseStringDescriptions(xmlDocPtr doc, xmlNodePtr node,
-    const QString &tag)
+void MvdCollectionLoader::Private::addMovie(const MvdMovie &movie, mvdid fileId,
+    MvdMovieCollection *collection)
 {
-    xmlNodePtr item = node->children;
-    xmlChar *attr = 0;
-    QStringList list;
-
-    while (item) {
-        if (item->type == XML_ELEMENT_NODE && MVD_QSTR(item->name) == tag) {
-            attr = xmlNodeListGetString(doc, item->xmlChildrenNode, 1);
-            if (attr) {
-                list.append(MVD_QSTR(attr));
-                xmlFree(attr);
-            }
-        }
+    // Journal records can not refer to the movie
+    if (fileId == MvdNull)
+        journalUsable = false;
 
-        item = item->next;
+    if (background) {
+        queueMovie(movie, fileId);
+        return;
     }
 
-    return list;
+    mvdid movieId = collection->addMovie(movie);
+    if (fileId != MvdNull && movieId != MvdNull)
+        movieMapper.insert(fileId, movieId);
+
+    if ((++loadedMovies % batchSize) == 0)
+        reportProgress();
 }
 
 /*!
-    \internal Parses an XML node containing a list of name-value nodes.
+    \internal Reads a <movie> node. Shared item IDs are mapped to the IDs
+    in the collection using \p idMapper.
 */
-QHash<QString, QVariant> MvdCollectionLoader::Private::parseDataList(xmlDocPtr doc, xmlNodePtr node,
-    const QString &tag, const QString &attributeTag)
+MvdMovie MvdCollectionLoader::Private::readMovie(xmlDocPtr doc, xmlNodePtr node,
+    const IdMapper &idMapper, const QString &posterDir)
 {
-    xmlNodePtr item = node->children;
     xmlChar *attr = 0;
-    QHash<QString, QVariant> list;
+    xmlNodePtr mNode = node->children;
+    QString nodeName;
 
-    while (item) {
-        if (item->type == XML_ELEMENT_NODE && MVD_QSTR(item->name) == tag) {
-            QString key, value;
-            attr = xmlGetProp(item, (const xmlChar *)MVD_CSTR(attributeTag));
-            if (attr) {
-                key = MVD_QSTR(attr).trimmed();
-                xmlFree(attr);
+    MvdMovie movie;
+
+    while (mNode) {
+        if (mNode->type != XML_ELEMENT_NODE) {
+            mNode = mNode->next;
+            continue;
+        }
+
+        nodeName = MVD_QSTR(mNode->name);
+
+        if (nodeName == QLatin1String("cast"))
+            parsePersonIdList(doc, mNode, idMapper, &movie, Movida::ActorRole);
+        else if (nodeName == QLatin1String("tags"))
+            parseSimpleIdList(doc, mNode, idMapper, &movie, Movida::TagRole);
+        else if (nodeName == QLatin1String("color-mode")) {
+            attr = xmlGetProp(mNode, (const xmlChar *)"value");
+            if (attr) {
+                nodeName = MVD_QSTR(attr);
+                xmlFree(attr);
+
+                if (nodeName == QLatin1String("bw"))
+                    movie.setColorMode(Movida::BlackWhite);
+                else if (nodeName == QLatin1String("color"))
+                    movie.setColorMode(Movida::Color);
+            }
+        } else if (nodeName == QLatin1String("countries"))
+            parseSimpleIdList(doc, mNode, idMapper, &movie, Movida::CountryRole);
+        else if (nodeName == QLatin1String("languages"))
+            parseSimpleIdList(doc, mNode, idMapper, &movie, Movida::LanguageRole);
+        else if (nodeName == QLatin1String("crew"))
+            parsePersonIdList(doc, mNode, idMapper, &movie, Movida::CrewMemberRole);
+        else if (nodeName == QLatin1String("directors"))
+            parsePersonIdList(doc, mNode, idMapper, &movie, Movida::DirectorRole);
+        else if (nodeName == QLatin1String("genres"))
+            parseSimpleIdList(doc, mNode, idMapper, &movie, Movida::GenreRole);
+        else if (nodeName == QLatin1String("imdb-id")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                QRegExp imdbRx(Movida::core().parameter("mvdcore/imdb-id-regexp").toString());
+                QString imdbId = MVD_QSTR(attr);
+                if (imdbRx.exactMatch(imdbId))
+                    movie.setImdbId(imdbId);
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("running-time")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                quint32 minutes = MvdCore::atoid((const char *)attr);
+                movie.setRunningTime(minutes);
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("seen")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                bool b = !xmlStrcmp(attr, (const xmlChar *)"true");
+                movie.setSpecialTagEnabled(Movida::SeenTag, b);
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("special")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                bool b = !xmlStrcmp(attr, (const xmlChar *)"true");
+                movie.setSpecialTagEnabled(Movida::SpecialTag, b);
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("loaned")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                bool b = !xmlStrcmp(attr, (const xmlChar *)"true");
+                movie.setSpecialTagEnabled(Movida::LoanedTag, b);
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("urls")) {
+            QList<MvdUrl> urls;
+            parseUrlDescriptions(doc, mNode, &urls);
+            if (!urls.isEmpty())
+                movie.setUrls(urls);
+        } else if (nodeName == QLatin1String("notes")) {
+            /*! \todo multiple notes handling with optional automatic
+               title generation like in opera web browser
+             */
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                movie.setNotes(MVD_QSTR(attr));
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("original-title")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                movie.setOriginalTitle(MVD_QSTR(attr));
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("plot")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                movie.setPlot(MVD_QSTR(attr));
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("producers"))
+            parsePersonIdList(doc, mNode, idMapper, &movie, Movida::ProducerRole);
+        else if (nodeName == QLatin1String("year")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                movie.setYear(MVD_QSTR(attr));
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("rating")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                movie.setRating(MvdCore::atoid((const char *)attr));
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("storage-id")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                movie.setStorageId(MVD_QSTR(attr));
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("special-contents")) {
+            QStringList list = parseStringDescriptions(doc, mNode, "item");
+            movie.setSpecialContents(list);
+        } else if (nodeName == QLatin1String("poster")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                QString poster = MVD_QSTR(attr);
+                xmlFree(attr);
+                if (!archivedImages.contains(poster) && !QFile::exists(posterDir + poster)) {
+                    Movida::wLog() << QString("MvdCollectionLoader: Missing movie poster: %1")
+                        .arg(posterDir + poster);
+                } else
+                    movie.setPoster(poster);
+            }
+        } else if (nodeName == QLatin1String("title")) {
+            attr = xmlNodeListGetString(doc, mNode->xmlChildrenNode, 1);
+            if (attr) {
+                movie.setTitle(MVD_QSTR(attr));
+                xmlFree(attr);
+            }
+        } else if (nodeName == QLatin1String("extended-attributes")) {
+            QHash<QString, QVariant> data_list = parseDataList(doc, mNode, "attribute", "name");
+            movie.setExtendedAttributes(data_list);
+        }
+
+        mNode = mNode->next;
+    }
+
+    return movie;
+}
+
+/*!
+    \internal Applies a journal record written by MvdCollectionSaver in
+    JournaledSaveMode. Items and movies are matched by the IDs they had
+    when the record was written.
+
+    \verbatim
+    <info>
+    <!-- ... -->
+    </info>
+    <shared-data>
+    <shared-item id="12" type="person">...</shared-item>
+    <removed-shared-item id="13"/>
+    </shared-data>
+    <movies>
+    <movie id="2">...</movie>
+    <removed-movie id="3"/>
+    </movies>
+    \endverbatim
+*/
+void MvdCollectionLoader::Private::parseJournalRecord(xmlDocPtr doc, xmlNodePtr cur,
+    MvdMovieCollection *collection)
+{
+    Q_ASSERT(idMapper);
+
+    MvdSharedData &sd = collection->sharedData();
+
+    for (xmlNodePtr n = cur->xmlChildrenNode; n; n = n->next) {
+        if (n->type != XML_ELEMENT_NODE)
+            continue;
+
+        if (!xmlStrcmp(n->name, (const xmlChar *)"info")) {
+            QHash<QString, QString> metadata;
+            for (xmlNodePtr nn = n->xmlChildrenNode; nn; nn = nn->next) {
+                if (nn->type != XML_ELEMENT_NODE)
+                    continue;
+
+                xmlChar *attr = xmlNodeListGetString(doc, nn->xmlChildrenNode, 1);
+                metadata.insert(MVD_QSTR(nn->name), MVD_QSTR(attr));
+                if (attr)
+                    xmlFree(attr);
+            }
+            setMetaData(collection, metadata);
+        } else if (!xmlStrcmp(n->name, (const xmlChar *)"shared-data")) {
+            for (xmlNodePtr nn = n->xmlChildrenNode; nn; nn = nn->next) {
+                if (nn->type != XML_ELEMENT_NODE)
+                    continue;
+
+                if (!xmlStrcmp(nn->name, (const xmlChar *)"shared-item")) {
+                    mvdid id;
+                    MvdSdItem item;
+                    if (!readSharedItem(doc, nn, &id, &item))
+                        continue;
+
+                    IdMapper::ConstIterator it = idMapper->constFind(id);
+                    if (it != idMapper->constEnd()) {
+                        // References are not stored in the archive
+                        MvdSdItem current = sd.item(it.value());
+                        item.movies = current.movies;
+                        item.persons = current.persons;
+                        sd.updateItem(it.value(), item);
+                    } else {
+                        mvdid newId = sd.addItem(item);
+                        if (newId != MvdNull)
+                            idMapper->insert(id, newId);
+                    }
+                } else if (!xmlStrcmp(nn->name, (const xmlChar *)"removed-shared-item")) {
+                    mvdid id = idMapper->take(readId(nn));
+                    if (id != MvdNull)
+                        sd.removeItem(id);
+                }
+            }
+        } else if (!xmlStrcmp(n->name, (const xmlChar *)"movies")) {
+            for (xmlNodePtr nn = n->xmlChildrenNode; nn; nn = nn->next) {
+                if (nn->type != XML_ELEMENT_NODE)
+                    continue;
+
+                if (!xmlStrcmp(nn->name, (const xmlChar *)"movie")) {
+                    mvdid fileId = readId(nn);
+                    MvdMovie movie = readMovie(doc, nn, *idMapper, posterDir);
+                    if (fileId == MvdNull || !movie.isValid())
+                        continue;
+
+                    IdMapper::ConstIterator it = movieMapper.constFind(fileId);
+                    if (it != movieMapper.constEnd())
+                        collection->updateMovie(it.value(), movie);
+                    else {
+                        mvdid movieId = collection->addMovie(movie);
+                        if (movieId != MvdNull)
+                            movieMapper.insert(fileId, movieId);
+                    }
+                } else if (!xmlStrcmp(nn->name, (const xmlChar *)"removed-movie")) {
+                    mvdid id = movieMapper.take(readId(nn));
+                    if (id != MvdNull)
+                        collection->removeMovie(id);
+                }
+            }
+        }
+    }
+}
+
+/*!
+    \internal Stores a movie parsed in the background thread. The loader's
+    thread is notified as soon as a batch of movies is available; movies
+    parsed in the meantime are added to the same batch.
+*/
+void MvdCollectionLoader::Private::queueMovie(const MvdMovie &movie, mvdid fileId)
+{
+    QMutexLocker locker(&mutex);
+
+    pendingMovies.append(movie);
+    pendingMovieIds.append(fileId);
+    if (!deliveryPending && pendingMovies.size() >= batchSize) {
+        deliveryPending = true;
+        QMetaObject::invokeMethod(q, "addMovies", Qt::QueuedConnection);
+    }
+}
+
+/*!
+    \internal Invokes a MvdCollectionLoader slot in the loader's thread,
+    waiting for it to return. The slot is called directly if we are not
+    loading in background.
+*/
+void MvdCollectionLoader::Private::callLoader(const char *member)
+{
+    Qt::ConnectionType type = QThread::currentThread() == q->thread()
+        ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
+    QMetaObject::invokeMethod(q, member, type);
+}
+
+/*!
+    \internal Notifies the progress handler about the number of loaded movies.
+    Loading is cancelled if the handler returns false.
+*/
+void MvdCollectionLoader::Private::reportProgress()
+{
+    if (!progressReceiver || expectedMovies <= 0)
+        return;
+
+    int percent = qMin(100, (loadedMovies * 100) / expectedMovies);
+    bool continueLoading = true;
+
+    QMetaObject::invokeMethod(
+        progressReceiver,
+        qPrintable(progressMember),
+        Qt::DirectConnection,
+        Q_RETURN_ARG(bool, continueLoading),
+        Q_ARG(int, ProgressInfo),
+        Q_ARG(QVariant, QVariant(percent)));
+
+    if (!continueLoading)
+        q->cancel();
+}
+
+/*!
+    \internal Parses a list of urls.
+
+    \verbatim
+    <urls>
+    <url description="SharonRocks website" default="true">http://sharonrocks.net</url>
+    <url description="Wikipedia">http://en.wikipedia.org/wiki/Sharon_Stoned</url>
+    </urls>
+    \endverbatim
+*/
+void MvdCollectionLoader::Private::parseUrlDescriptions(xmlDocPtr doc, xmlNodePtr node,
+    QList<MvdUrl> *list)
+{
+    Q_ASSERT(doc && node && list);
+
+    xmlNodePtr linkItem = node->children;
+    xmlChar *attr = 0;
+
+    while (linkItem) {
+        if (linkItem->type == XML_ELEMENT_NODE &&
+            !xmlStrcmp(linkItem->name, (const xmlChar *)"url")) {
+            attr = xmlNodeListGetString(doc, linkItem->xmlChildrenNode, 1);
+            if (attr) {
+                MvdUrl url;
+                url.url = MVD_QSTR(attr).trimmed();
+                xmlFree(attr);
+
+                attr = xmlGetProp(linkItem, (const xmlChar *)"description");
+                if (attr) {
+                    url.description = MVD_QSTR(attr).trimmed();
+                    xmlFree(attr);
+                }
+
+                attr = xmlGetProp(linkItem, (const xmlChar *)"default");
+                if (attr) {
+                    url.isDefault = !xmlStrcmp(attr, (const xmlChar *)"true");
+                    xmlFree(attr);
+                }
+
+                if (!url.url.isEmpty())
+                    list->append(url);
+            }
+        }
+
+        linkItem = linkItem->next;
+    }
+}
+
+/*!
+    \internal Parses an XML node containing a list of strings.
+*/
+QStringList MvdCollectionLoader::Private::parseStringDescriptions(xmlDocPtr doc, xmlNodePtr node,
+    const QString &tag)
+{
+    xmlNodePtr item = node->children;
+    xmlChar *attr = 0;
+    QStringList list;
+
+    while (item) {
+        if (item->type == XML_ELEMENT_NODE && MVD_QSTR(item->name) == tag) {
+            attr = xmlNodeListGetString(doc, item->xmlChildrenNode, 1);
+            if (attr) {
+                list.append(MVD_QSTR(attr));
+                xmlFree(attr);
+            }
+        }
+
+        item = item->next;
+    }
+
+    return list;
+}
+
+/*!
+    \internal Parses an XML node containing a list of name-value nodes.
+*/
+QHash<QString, QVariant> MvdCollectionLoader::Private::parseDataList(xmlDocPtr doc, xmlNodePtr node,
+    const QString &tag, const QString &attributeTag)
+{
+    xmlNodePtr item = node->children;
+    xmlChar *attr = 0;
+    QHash<QString, QVariant> list;
+
+    while (item) {
+        if (item->type == XML_ELEMENT_NODE && MVD_QSTR(item->name) == tag) {
+            QString key, value;
+            attr = xmlGetProp(item, (const xmlChar *)MVD_CSTR(attributeTag));
+            if (attr) {
+                key = MVD_QSTR(attr).trimmed();
+                xmlFree(attr);
             }
 
             if (key.isEmpty()) {
@@ -690,8 +1262,6 @@ bool MvdCollectionLoader::Private::checkArchiveVersion(const QString &attribute)
 bool MvdCollectionLoader::Private::loadXmlDocument(const QString &path, xmlDocPtr *doc,
     xmlNodePtr *cur, int *itemCount)
 {
-    xmlChar *attr = 0;
-
     QByteArray cleanPath = QDir::cleanPath(path).toAscii();
 
     if (cleanPath.isEmpty()) {
@@ -706,9 +1276,50 @@ bool MvdCollectionLoader::Private::loadXmlDocument(const QString &path, xmlDocPt
         .arg(time.elapsed())
         .arg(path);
 
+    return checkXmlDocument(QFileInfo(path).fileName(), doc, cur, itemCount);
+}
+
+/*!
+    \internal Same as loadXmlDocument() but the document is read into memory
+    directly from the \p entry file in the archive.
+*/
+bool MvdCollectionLoader::Private::readXmlDocument(MvdUnZip *uz, const QString &entry,
+    xmlDocPtr *doc, xmlNodePtr *cur, int *itemCount)
+{
+    Q_ASSERT(uz);
+
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+
+    QTime time;
+    time.start();
+    MvdUnZip::ErrorCode ec = uz->extractFile(entry, &buffer);
+    if (ec != MvdUnZip::NoError) {
+        eLog() << QString("MvdCollectionLoader: Unable to extract %1").arg(entry);
+        return false;
+    }
+
+    const QByteArray &data = buffer.data();
+    QByteArray name = entry.toUtf8();
+    *doc = xmlReadMemory(data.constData(), data.size(), name.constData(), 0, 0);
+    iLog() << QString("MvdCollectionLoader: xmlReadMemory() took %1 ms for %2.")
+        .arg(time.elapsed())
+        .arg(entry);
+
+    return checkXmlDocument(QFileInfo(entry).fileName(), doc, cur, itemCount);
+}
+
+/*!
+    \internal Checks if \p doc is a valid Movida XML document. See
+    loadXmlDocument() for a description of the parameters.
+*/
+bool MvdCollectionLoader::Private::checkXmlDocument(const QString &name, xmlDocPtr *doc,
+    xmlNodePtr *cur, int *itemCount)
+{
+    xmlChar *attr = 0;
+
     if (!*doc) {
-        QFileInfo fi(path);
-        eLog() << QString("MvdCollectionLoader: %1 is not a valid XML file").arg(fi.fileName());
+        eLog() << QString("MvdCollectionLoader: %1 is not a valid XML file").arg(name);
         return false;
     }
 
@@ -734,108 +1345,323 @@ bool MvdCollectionLoader::Private::loadXmlDocument(const QString &path, xmlDocPt
     return true;
 }
 
+/*!
+    \internal Parses the \p entry XML file while it is being extracted from the
+    archive. Movies and shared items are added to the collection as soon as
+    their closing tag is found and their nodes are released right after, so
+    neither a temporary file nor the whole document tree are needed.
+*/
+bool MvdCollectionLoader::Private::streamXmlDocument(MvdUnZip *uz, const QString &entry,
+    StreamTarget target, IdMapper *idMapper, MvdMovieCollection *collection)
+{
+    Q_ASSERT(uz && idMapper && collection);
+
+    StreamContext context;
+    context.loader = this;
+    context.target = target;
+    context.idMapper = idMapper;
+    context.collection = collection;
+    context.posterDir = posterDir;
+
+    xmlSAXHandler sax;
+    memset(&sax, 0, sizeof(xmlSAXHandler));
+    xmlSAXVersion(&sax, 2);
+    sax.endElementNs = streamEndElement;
+
+    QByteArray name = entry.toUtf8();
+    xmlParserCtxtPtr ctxt = xmlCreatePushParserCtxt(&sax, 0, 0, 0, name.constData());
+    if (!ctxt) {
+        eLog() << "MvdCollectionLoader: Unable to create XML parser";
+        return false;
+    }
 
-//////////////////////////////////////////////////////////////////////////
+    ctxt->_private = &context;
 
+    XmlPushDevice device(ctxt);
+    MvdUnZip::ErrorCode ec = uz->extractFile(entry, &device);
+    int res = xmlParseChunk(ctxt, 0, 0, 1);
 
-MvdCollectionLoader::MvdCollectionLoader(QObject *parent) :
-    QObject(parent),
-    d(new Private(this))
-{
-    qRegisterMetaType<MvdCollectionLoader::Info>("MvdCollectionLoader::Info");
-}
+    bool ok = true;
+    if (isCancelled())
+        ok = false;
+    else if (ec != MvdUnZip::NoError || res != 0 || !ctxt->wellFormed) {
+        eLog() << QString("MvdCollectionLoader: %1 is not a valid XML file").arg(QFileInfo(entry).fileName());
+        ok = false;
+    }
 
-MvdCollectionLoader::~MvdCollectionLoader()
-{
-    delete d;
+    if (ctxt->myDoc) {
+        xmlNodePtr root = xmlDocGetRootElement(ctxt->myDoc);
+        if (ok && (!root || xmlStrcmp(root->name, (const xmlChar *)"movida-xml-doc"))) {
+            eLog() << "MvdCollectionLoader: Invalid XML document root name";
+            ok = false;
+        }
+        xmlFreeDoc(ctxt->myDoc);
+        ctxt->myDoc = 0;
+    }
+
+    xmlFreeParserCtxt(ctxt);
+    return ok;
 }
 
 /*!
-    Loads a collection from the given file or from the collection's file path if
-    \p file is null.
+    \internal SAX2 end element handler used by streamXmlDocument().
 */
-MvdCollectionLoader::StatusCode MvdCollectionLoader::load(MvdMovieCollection *collection, QString file)
+void MvdCollectionLoader::Private::streamEndElement(void *ctx, const xmlChar *localname,
+    const xmlChar *prefix, const xmlChar *URI)
 {
-    if (!collection)
-        return InvalidCollectionError;
+    xmlParserCtxtPtr ctxt = (xmlParserCtxtPtr)ctx;
+    xmlNodePtr node = ctxt->node;
 
-    d->collection = collection;
+    // Let libxml2 complete the node first
+    xmlSAX2EndElementNs(ctx, localname, prefix, URI);
 
-    QTime time;
+    StreamContext *context = (StreamContext *)ctxt->_private;
+    if (!context || !node)
+        return;
 
-    if (file.isEmpty()) {
-        file = collection->path();
-        if (file.isEmpty()) {
-            eLog() << QString("MvdCollectionLoader: No filename specified.");
-            return FileNotFoundError;
-        }
+    if (context->loader->isCancelled()) {
+        xmlStopParser(ctxt);
+        return;
     }
 
-    QFile mmcFile(file);
-    iLog() << QString("MvdCollectionLoader: Attempting to load collection from %1").arg(file);
+    if (context->target == CollectionStream) {
+        if (!isStreamedItem(node, "movie", "movies"))
+            return;
+        context->loader->parseMovie(ctxt->myDoc, node, *context->idMapper,
+            context->collection, context->posterDir);
+    } else {
+        if (!isStreamedItem(node, "shared-item", "shared-data"))
+            return;
+        context->loader->parseSharedItem(ctxt->myDoc, node, context->idMapper,
+            context->collection, -1);
+    }
 
-    if (!mmcFile.exists()) {
-        eLog() << QString("MvdCollectionLoader: File does not exist: %1").arg(file);
-        return FileNotFoundError;
+    // Release the item and any whitespace preceding it. All the children are
+    // removed so that libxml2 will not append text to a freed node.
+    xmlNodePtr parent = node->parent;
+    while (parent->children) {
+        xmlNodePtr child = parent->children;
+        xmlUnlinkNode(child);
+        xmlFreeNode(child);
     }
+}
 
-    if (!mmcFile.open(QIODevice::ReadOnly)) {
-        eLog() << QString("MvdCollectionLoader: Could not open file for reading (%1): %2")
-            .arg(mmcFile.errorString()).arg(file);
-        return FileOpenError;
+/*!
+    \internal Returns true if \p node is a \p name element child of a
+    \p parentName element which in turn is a child of the document root.
+*/
+bool MvdCollectionLoader::Private::isStreamedItem(xmlNodePtr node, const char *name,
+    const char *parentName)
+{
+    if (node->type != XML_ELEMENT_NODE || xmlStrcmp(node->name, (const xmlChar *)name))
+        return false;
+
+    xmlNodePtr parent = node->parent;
+    if (!parent || parent->type != XML_ELEMENT_NODE
+        || xmlStrcmp(parent->name, (const xmlChar *)parentName))
+        return false;
+
+    xmlNodePtr root = parent->parent;
+    return root && root->type == XML_ELEMENT_NODE
+           && root->parent && root->parent->type == XML_DOCUMENT_NODE
+           && !xmlStrcmp(root->name, (const xmlChar *)"movida-xml-doc");
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+
+
+MvdCollectionLoader::MvdCollectionLoader(QObject *parent) :
+    QObject(parent),
+    d(new Private(this))
+{
+    qRegisterMetaType<MvdCollectionLoader::Info>("MvdCollectionLoader::Info");
+}
+
+MvdCollectionLoader::~MvdCollectionLoader()
+{
+    if (isLoading()) {
+        cancel();
+        waitForFinished();
     }
 
-    MvdUnZip uz;
+    delete d->thread;
+    delete d;
+}
 
+/*!
+    \internal Loads shared.xml and collection.xml using all the available
+    cores: both files are inflated and parsed at the same time, then the
+    <movie> nodes are split into ranges that are converted by worker
+    threads while the shared items are added to the collection. Movies
+    still refer to the shared item IDs in the archive until they are
+    remapped and added to the collection by the loader.
+*/
+MvdCollectionLoader::StatusCode MvdCollectionLoader::Private::loadParallel(MvdUnZip *uz,
+    const QString &file, IdMapper *idMapper, MvdMovieCollection *collection)
+{
+    Q_ASSERT(uz && idMapper && collection);
+
+    MVD_TRACE_SPAN(span, "MvdCollectionLoader::loadParallel", "loader");
+
+    QTime time;
     time.start();
-    MvdUnZip::ErrorCode ec = uz.openArchive(file);
-    iLog() << QString("MvdCollectionLoader: MvdUnZip::openArchive() took %1 ms.").arg(time.elapsed());
-    if (ec != MvdUnZip::NoError) {
-        eLog() << QString("MvdCollectionLoader: Unable to open compressed zip archive: %1").arg(file);
-        return ZipError;
+
+    // libxml2 must be initialized before parsing in more threads
+    xmlInitParser();
+
+    // Declared before the pool so that they are destroyed after its threads
+    DocumentReader sharedReader(file, "movida-collection/shared.xml");
+    DocumentReader collectionReader(file, "movida-collection/collection.xml");
+
+    QThreadPool pool;
+    pool.start(&collectionReader);
+
+    const bool hasSharedData = uz->contains("movida-collection/shared.xml");
+    if (hasSharedData)
+        pool.start(&sharedReader);
+
+    xmlDocPtr doc = 0;
+    xmlNodePtr cur = 0;
+    int itemCount = -1;
+
+    // Shared item IDs in the archive, used to validate the movies
+    QList<QPair<mvdid, MvdSdItem> > items;
+    IdMapper fileIds;
+
+    if (hasSharedData) {
+        doc = sharedReader.takeDocument();
+        if (checkXmlDocument("shared.xml", &doc, &cur, &itemCount)) {
+            xmlNodePtr n = cur->xmlChildrenNode;
+            while (n) {
+                if (n->type == XML_ELEMENT_NODE && !xmlStrcmp(n->name, (const xmlChar *)"shared-data")) {
+                    xmlNodePtr nn = n->xmlChildrenNode;
+                    while (nn) {
+                        mvdid id;
+                        MvdSdItem item;
+                        if (nn->type == XML_ELEMENT_NODE && !xmlStrcmp(nn->name, (const xmlChar *)"shared-item")
+                            && readSharedItem(doc, nn, &id, &item)) {
+                            items.append(qMakePair(id, item));
+                            fileIds.insert(id, id);
+                        }
+
+                        nn = nn->next;
+                    }
+                }
+
+                n = n->next;
+            }
+            xmlFreeDoc(doc);
+        } else
+            eLog() << "MvdCollectionLoader: Unable to parse shared.xml file";
     }
 
-    if (!(uz.contains("movida-collection/metadata.xml") && uz.contains("movida-collection/collection.xml"))) {
-        eLog() << QString("MvdCollectionLoader: Missing Movida archive files: %1").arg(file);
+    doc = collectionReader.takeDocument();
+    if (!checkXmlDocument("collection.xml", &doc, &cur, &itemCount)) {
+        eLog() << "MvdCollectionLoader: Unable to parse collection.xml file";
         return InvalidFileError;
     }
 
-    QString tmpPath = paths().generateTempDir();
-    QDir tmpDir(tmpPath);
+    iLog() << QString("MvdCollectionLoader: inflating and parsing the XML files took %1 ms.")
+        .arg(time.elapsed());
+    time.start();
 
-    if (!tmpDir.exists()) {
-        eLog() << QString("MvdCollectionLoader: Unable to create temp directory %1").arg(tmpPath);
-        return TemporaryDirectoryError;
+    QVector<xmlNodePtr> nodes;
+    nodes.reserve(qMax(0, itemCount));
+
+    cur = cur->xmlChildrenNode;
+    while (cur) {
+        if (cur->type == XML_ELEMENT_NODE && !xmlStrcmp(cur->name, (const xmlChar *)"movies")) {
+            cur = cur->children;
+            break;
+        } else cur = cur->next;
     }
 
-    iLog() << QString("MvdCollectionLoader: Created temporary directory: %1").arg(tmpPath);
+    while (cur) {
+        if (cur->type == XML_ELEMENT_NODE && !xmlStrcmp(cur->name, (const xmlChar *)"movie"))
+            nodes.append(cur);
+        cur = cur->next;
+    }
 
-    QString dataPath = MvdCore::toQtFilePath(tmpPath + "movida-collection" + QDir::separator(), true);
-    iLog() << QString("MvdCollectionLoader: Temporary collection data path: %1").arg(dataPath);
+    const int count = nodes.size();
+    QVector<MvdMovie> movies(count);
+    QVector<mvdid> ids(count);
 
-    time.start();
-    uz.setProgressHandler(this, "extractionProgress");
-    ec = uz.extractAll(tmpDir);
-    iLog() << QString("MvdCollectionLoader: MvdUnZip::extractAll() took %1 ms.").arg(time.elapsed());
+    // A few ranges per thread, so that slower ranges do not stall the pool
+    const int rangeSize = qMax(batchSize, count / (pool.maxThreadCount() * 4) + 1);
+    for (int i = 0; i < count; i += rangeSize)
+        pool.start(new MovieReader(this, doc, nodes.constData() + i, qMin(rangeSize, count - i),
+            fileIds, movies.data() + i, ids.data() + i));
+
+    // Merge: add the shared items while the movies are being converted...
+    for (int i = 0; i < items.size(); ++i)
+        addSharedItem(items.at(i).first, items.at(i).second, idMapper, collection);
+    if (background && !isCancelled())
+        callLoader("addSharedItems");
+
+    pool.waitForDone();
+    xmlFreeDoc(doc);
+
+    // ...then map the shared item IDs and add the movies
+    for (int i = 0; i < count && !isCancelled(); ++i) {
+        MvdMovie &movie = movies[i];
+        if (!movie.isValid())
+            continue;
+
+        remapMovie(&movie, *idMapper);
+        addMovie(movie, ids.at(i), collection);
+        movie = MvdMovie();
+    }
+
+    iLog() << QString("MvdCollectionLoader: converting %1 movies with %2 threads took %3 ms.")
+        .arg(count).arg(pool.maxThreadCount()).arg(time.elapsed());
+
+    return isCancelled() ? CancelledError : NoError;
+}
+
+/*!
+    \internal Replaces the shared item IDs in \p movie with the IDs in
+    \p idMapper. IDs that are not in \p idMapper are removed.
+*/
+void MvdCollectionLoader::Private::remapMovie(MvdMovie *movie, const IdMapper &idMapper)
+{
+    movie->setLanguages(remapIds(movie->languages(), idMapper));
+    movie->setCountries(remapIds(movie->countries(), idMapper));
+    movie->setTags(remapIds(movie->tags(), idMapper));
+    movie->setGenres(remapIds(movie->genres(), idMapper));
+    movie->setDirectors(remapIds(movie->directors(), idMapper));
+    movie->setProducers(remapIds(movie->producers(), idMapper));
+    movie->setCrewMembers(remapIds(movie->crewMembers(), idMapper));
+    movie->setActors(remapIds(movie->actors(), idMapper));
+}
+
+/*!
+    \internal Reads the collection info in metadata.xml. Returns false if the
+    file can not be parsed.
+*/
+bool MvdCollectionLoader::Private::readMetaData(MvdUnZip *uz, const QString &tmpPath, bool streaming)
+{
+    MVD_TRACE_SPAN(span, "MvdCollectionLoader::readMetaData", "loader");
 
     xmlDocPtr doc = 0;
     xmlNodePtr cur = 0;
     xmlChar *attr = 0;
     int itemCount = -1;
 
-    if (!d->loadXmlDocument(QString("%1%2").arg(tmpPath)
-                .arg("movida-collection/metadata.xml"), &doc, &cur, &itemCount)) {
-        paths().removeDirectoryTree(tmpPath);
-        eLog() << "MvdCollectionLoader: Unable to load metadata.xml file";
-        return InvalidFileError;
-    }
+    bool metadataLoaded = streaming
+        ? readXmlDocument(uz, "movida-collection/metadata.xml", &doc, &cur, &itemCount)
+        : loadXmlDocument(QString("%1%2").arg(tmpPath)
+            .arg("movida-collection/metadata.xml"), &doc, &cur, &itemCount);
+
+    if (!metadataLoaded)
+        return false;
 
     attr = xmlGetProp(cur, (const xmlChar *)"version");
     if (attr) {
         xmlFree(attr);
         //! \todo version check: notify user about too old archives or too old application!
         /*
-           if (!d->checkArchiveVersion(attr))
+           if (!checkArchiveVersion(attr))
            {
            mp->removeDirectoryTree(tmpPath);
            xmlFreeDoc(doc);
@@ -848,7 +1674,6 @@ MvdCollectionLoader::StatusCode MvdCollectionLoader::load(MvdMovieCollection *co
     //! \todo use the update attribute to set some collection metadata?
 
     QString currentNode;
-    MvdCollectionLoader::Info info;
 
     cur = cur->xmlChildrenNode;
     while (cur != 0) {
@@ -893,51 +1718,205 @@ MvdCollectionLoader::StatusCode MvdCollectionLoader::load(MvdMovieCollection *co
 
     xmlFreeDoc(doc);
 
-    bool continueParsing = true;
-    if (d->progressReceiver) {
-        QMetaObject::invokeMethod(
-            d->progressReceiver,
-            qPrintable(d->progressMember),
-            Qt::DirectConnection,
-            Q_RETURN_ARG(bool, continueParsing),
-            Q_ARG(int, CollectionInfo),
-            Q_ARG(QVariant, QVariant::fromValue<MvdCollectionLoader::Info>(info)));
+    return true;
+}
+
+/*!
+    \internal Loads the collection. Runs in a separate thread if \p background
+    is true: the collection is then only modified in the loader's thread.
+*/
+MvdCollectionLoader::StatusCode MvdCollectionLoader::Private::load(MvdMovieCollection *collection, QString file)
+{
+    MVD_TRACE_SPAN(loadSpan, "MvdCollectionLoader::load", "loader");
+
+    QTime time;
+
+    info = MvdCollectionLoader::Info();
+    imageEntries.clear();
+    archivePath.clear();
+    loadedMovies = 0;
+    movieMapper.clear();
+    journal.clear();
+    sharedItemMapper.clear();
+    journalRecords = 0;
+    journalOffset = -1;
+    journalUsable = true;
+    snapshotChecksum.clear();
+
+    if (file.isEmpty()) {
+        file = collection->path();
+        if (file.isEmpty()) {
+            eLog() << QString("MvdCollectionLoader: No filename specified.");
+            return FileNotFoundError;
+        }
     }
 
-    if (!continueParsing) {
-        return NoError;
+    QFile mmcFile(file);
+    iLog() << QString("MvdCollectionLoader: Attempting to load collection from %1").arg(file);
+
+    if (!mmcFile.exists()) {
+        eLog() << QString("MvdCollectionLoader: File does not exist: %1").arg(file);
+        return FileNotFoundError;
     }
 
-    // Set metadata
+    if (!mmcFile.open(QIODevice::ReadOnly)) {
+        eLog() << QString("MvdCollectionLoader: Could not open file for reading (%1): %2")
+            .arg(mmcFile.errorString()).arg(file);
+        return FileOpenError;
+    }
 
-    for (QHash<QString, QString>::ConstIterator it = info.metadata.begin(); it != info.metadata.end(); ++it) {
-        MvdMovieCollection::MetaDataType infoType = MvdMovieCollection::InvalidInfo;
-        QString currentNode = it.key();
-        if (currentNode == "name")
-            infoType = MvdMovieCollection::NameInfo;
-        else if (currentNode == "notes")
-            infoType = MvdMovieCollection::NotesInfo;
-        else if (currentNode == "owner")
-            infoType = MvdMovieCollection::OwnerInfo;
-        else if (currentNode == "email")
-            infoType = MvdMovieCollection::EMailInfo;
-        else if (currentNode == "website")
-            infoType = MvdMovieCollection::WebsiteInfo;
+    MvdUnZip uz;
+
+    time.start();
+    MvdUnZip::ErrorCode ec = uz.openArchive(file);
+    iLog() << QString("MvdCollectionLoader: MvdUnZip::openArchive() took %1 ms.").arg(time.elapsed());
+    if (ec != MvdUnZip::NoError) {
+        eLog() << QString("MvdCollectionLoader: Unable to open compressed zip archive: %1").arg(file);
+        return ZipError;
+    }
+
+    if (!(uz.contains("movida-collection/metadata.xml") && uz.contains("movida-collection/collection.xml"))) {
+        eLog() << QString("MvdCollectionLoader: Missing Movida archive files: %1").arg(file);
+        return InvalidFileError;
+    }
+
+    // The XML files need not be parsed if the archive has not been changed
+    // since the last snapshot has been written. The whole snapshot is read
+    // before anything is added to the collection, so that the XML files can
+    // still be used if it is corrupted.
+    MvdCollectionSnapshot snapshot;
+    QList<QPair<mvdid, MvdSdItem> > snapshotItems;
+    QList<QPair<mvdid, MvdMovie> > snapshotMovies;
+    if (Movida::core().parameter("mvdcore/collection-snapshots").toBool()) {
+        const QString checksum = MvdCollectionSnapshot::archiveChecksum(&uz);
+        if (snapshot.open(file, checksum)) {
+            MVD_TRACE_SPAN(phaseSpan, "MvdCollectionLoader::readSnapshot", "loader");
+            time.start();
+            if (readSnapshot(&snapshot, &snapshotItems, &snapshotMovies)) {
+                iLog() << QString("MvdCollectionLoader: reading snapshot %1 took %2 ms.")
+                    .arg(MvdCollectionSnapshot::snapshotPath(file)).arg(time.elapsed());
+            } else {
+                wLog() << QString("MvdCollectionLoader: Unable to read snapshot %1, loading the XML files.")
+                    .arg(MvdCollectionSnapshot::snapshotPath(file));
+                snapshot.close();
+                snapshotItems.clear();
+                snapshotMovies.clear();
+                MvdCollectionSnapshot::remove(file);
+            }
+        }
+
+        if (!snapshot.isOpen())
+            snapshotChecksum = checksum;
+    }
+
+    QString tmpPath = paths().generateTempDir();
+    QDir tmpDir(tmpPath);
 
-        collection->setMetaData(infoType, it.value());
+    if (!tmpDir.exists()) {
+        eLog() << QString("MvdCollectionLoader: Unable to create temp directory %1").arg(tmpPath);
+        return TemporaryDirectoryError;
     }
 
-    collection->setMetaData(MvdMovieCollection::DataPathInfo, dataPath + "persistent");
+    iLog() << QString("MvdCollectionLoader: Created temporary directory: %1").arg(tmpPath);
+
+    QString dataPath = MvdCore::toQtFilePath(tmpPath + "movida-collection" + QDir::separator(), true);
+    iLog() << QString("MvdCollectionLoader: Temporary collection data path: %1").arg(dataPath);
+
+    const bool streaming = loadMode == MvdCollectionLoader::StreamingLoadMode;
+    const bool parallel = loadMode == MvdCollectionLoader::ParallelLoadMode;
+
+    // XML files are read directly from the archive and images are left in
+    // the archive until needed
+    const bool archived = streaming || parallel;
+
+    time.start();
+    uz.setProgressHandler(q, "extractionProgress");
+    if (archived || snapshot.isOpen()) {
+        // Only the persistent files are extracted (images are extracted too
+        // if the XML files are replaced by the snapshot in DomLoadMode)
+        QStringList persistentFiles;
+        QStringList entries = uz.fileList();
+        for (int i = 0; i < entries.size(); ++i) {
+            const QString &entry = entries.at(i);
+            if (archived && entry.startsWith(QLatin1String("movida-collection/persistent/images/"))) {
+                if (!entry.endsWith('/'))
+                    imageEntries.append(entry);
+            } else if (entry.startsWith(QLatin1String("movida-collection/persistent/")))
+                persistentFiles.append(entry);
+        }
+
+        if (!persistentFiles.isEmpty())
+            ec = uz.extractFiles(persistentFiles, tmpDir);
+        iLog() << QString("MvdCollectionLoader: MvdUnZip::extractFiles() took %1 ms for %2 files.")
+            .arg(time.elapsed()).arg(persistentFiles.size());
+    } else {
+        ec = uz.extractAll(tmpDir);
+        iLog() << QString("MvdCollectionLoader: MvdUnZip::extractAll() took %1 ms.").arg(time.elapsed());
+    }
+
+    if (snapshot.isOpen()) {
+        info.metadata = snapshot.metaData();
+        info.expectedMovieCount = snapshot.movieCount();
+    } else if (!readMetaData(&uz, tmpPath, archived)) {
+        paths().removeDirectoryTree(tmpPath);
+        eLog() << "MvdCollectionLoader: Unable to load metadata.xml file";
+        return InvalidFileError;
+    }
+
+    expectedMovies = info.expectedMovieCount;
+    continueParsing = true;
+    callLoader("reportCollectionInfo");
+
+    if (!continueParsing || isCancelled()) {
+        paths().removeDirectoryTree(tmpPath);
+        return CancelledError;
+    }
+
+    // Set metadata
+    this->dataPath = dataPath;
+    if (archived)
+        archivePath = QFileInfo(mmcFile).absoluteFilePath();
+    callLoader("applyMetaData");
 
     /*! \todo show dialog with collection info and ask to proceed
             with loading (use a "Do not show this again" dialog!)
      */
 
-    Private::IdMapper idMapper;
+    IdMapper idMapper;
+    this->idMapper = &idMapper;
+    sharedItems.clear();
+
+    xmlDocPtr doc = 0;
+    xmlNodePtr cur = 0;
+    int itemCount = -1;
 
     // ******* READ SHARED DATA *******
-    if (QFile::exists(QString("%1%2").arg(dataPath).arg("shared.xml"))) {
-        if (d->loadXmlDocument(QString("%1%2").arg(dataPath).arg("shared.xml"),
+    if (snapshot.isOpen()) {
+        MVD_TRACE_SPAN(phaseSpan, "MvdCollectionLoader::addSnapshotItems", "loader");
+        MVD_TRACE_COUNTER(phaseSpan, "items", snapshotItems.size());
+        for (int i = 0; i < snapshotItems.size(); ++i)
+            addSharedItem(snapshotItems.at(i).first, snapshotItems.at(i).second, &idMapper, collection);
+        snapshotItems.clear();
+    } else if (parallel) {
+        // Movies are loaded together with the shared data
+        StatusCode res = loadParallel(&uz, file, &idMapper, collection);
+        if (res != NoError) {
+            paths().removeDirectoryTree(tmpPath);
+            return res;
+        }
+    } else if (streaming) {
+        if (uz.contains("movida-collection/shared.xml")) {
+            MVD_TRACE_SPAN(phaseSpan, "MvdCollectionLoader::streamXmlDocument(shared.xml)", "loader");
+            time.start();
+            if (streamXmlDocument(&uz, "movida-collection/shared.xml",
+                    SharedDataStream, &idMapper, collection))
+                iLog() << QString("MvdCollectionLoader: streaming shared.xml took %1 ms.").arg(time.elapsed());
+            else
+                eLog() << "MvdCollectionLoader: Unable to parse shared.xml file";
+        }
+    } else if (QFile::exists(QString("%1%2").arg(dataPath).arg("shared.xml"))) {
+        MVD_TRACE_SPAN(phaseSpan, "MvdCollectionLoader::parseSharedData", "loader");
+        if (loadXmlDocument(QString("%1%2").arg(dataPath).arg("shared.xml"),
                 &doc, &cur, &itemCount)) {
             time.start();
             xmlNodePtr n = cur->xmlChildrenNode;
@@ -946,7 +1925,7 @@ MvdCollectionLoader::StatusCode MvdCollectionLoader::load(MvdMovieCollection *co
                     xmlNodePtr nn = n->xmlChildrenNode;
                     while (nn) {
                         if (cur->type == XML_ELEMENT_NODE && !xmlStrcmp(nn->name, (const xmlChar *)"shared-item"))
-                            d->parseSharedItem(doc, nn, &idMapper, collection, itemCount);
+                            parseSharedItem(doc, nn, &idMapper, collection, itemCount);
 
                         nn = nn->next;
                     }
@@ -960,29 +1939,336 @@ MvdCollectionLoader::StatusCode MvdCollectionLoader::load(MvdMovieCollection *co
             eLog() << "MvdCollectionLoader: Unable to parse shared.xml file";
     }
 
+    if (background && !isCancelled())
+        callLoader("addSharedItems");
+
     // **** COLLECTION ****
-    if (!d->loadXmlDocument(
-            QString("%1%2").arg(dataPath).arg("collection.xml"),
-            &doc, &cur, &itemCount)) {
-        paths().removeDirectoryTree(tmpPath);
-        eLog() << "MvdCollectionLoader: Unable to parse collection.xml file";
-        return InvalidFileError;
+    if (snapshot.isOpen()) {
+        MVD_TRACE_SPAN(phaseSpan, "MvdCollectionLoader::addSnapshotMovies", "loader");
+        MVD_TRACE_COUNTER(phaseSpan, "movies", snapshotMovies.size());
+        for (int i = 0; i < snapshotMovies.size() && !isCancelled(); ++i) {
+            MvdMovie &movie = snapshotMovies[i].second;
+            remapMovie(&movie, idMapper);
+            const QString poster = movie.poster();
+            if (!poster.isEmpty() && !archivedImages.contains(poster)
+                && !QFile::exists(posterDir + poster)) {
+                wLog() << QString("MvdCollectionLoader: Missing movie poster: %1").arg(posterDir + poster);
+                movie.setPoster(QString());
+            }
+            addMovie(movie, snapshotMovies.at(i).first, collection);
+        }
+        snapshotMovies.clear();
+    } else if (parallel) {
+        // Already loaded by loadParallel()
+    } else if (streaming) {
+        MVD_TRACE_SPAN(phaseSpan, "MvdCollectionLoader::streamXmlDocument(collection.xml)", "loader");
+        time.start();
+        if (!streamXmlDocument(&uz, "movida-collection/collection.xml",
+                CollectionStream, &idMapper, collection)) {
+            paths().removeDirectoryTree(tmpPath);
+            if (isCancelled())
+                return CancelledError;
+            eLog() << "MvdCollectionLoader: Unable to parse collection.xml file";
+            return InvalidFileError;
+        }
+        iLog() << QString("MvdCollectionLoader: streaming collection.xml took %1 ms.").arg(time.elapsed());
+    } else {
+        MVD_TRACE_SPAN(phaseSpan, "MvdCollectionLoader::parseCollection", "loader");
+        if (!loadXmlDocument(
+                QString("%1%2").arg(dataPath).arg("collection.xml"),
+                &doc, &cur, &itemCount)) {
+            paths().removeDirectoryTree(tmpPath);
+            eLog() << "MvdCollectionLoader: Unable to parse collection.xml file";
+            return InvalidFileError;
+        }
+
+        time.start();
+        parseCollection(doc, cur, idMapper, collection, itemCount);
+        iLog() << QString("MvdCollectionLoader: parsing collection.xml took %1 ms.").arg(time.elapsed());
+        xmlFreeDoc(doc);
     }
 
-    time.start();
-    d->parseCollection(doc, cur, idMapper, collection, itemCount);
-    iLog() << QString("MvdCollectionLoader: parsing collection.xml took %1 ms.").arg(time.elapsed());
-    xmlFreeDoc(doc);
+    // **** JOURNAL ****
+    // The snapshot already contains the changes in the journal records
+    QStringList records;
+    QList<MvdUnZip::ZipEntry> entries = uz.entryList();
+    for (int i = 0; i < entries.size(); ++i) {
+        const MvdUnZip::ZipEntry &entry = entries.at(i);
+        if (!entry.filename.startsWith(QLatin1String("movida-collection/journal/"))
+            || !entry.filename.endsWith(QLatin1String(".xml")))
+            continue;
+
+        // Records are numbered from 1, see MvdCollectionSaver. The first
+        // record is appended right after the archive written by the last
+        // full save, so its offset is the size of that archive: everything
+        // after it (records, images and central directories) is journal.
+        journalRecords = qMax(journalRecords, QFileInfo(entry.filename).completeBaseName().toInt());
+        if (journalOffset < 0 || entry.headerOffset < journalOffset)
+            journalOffset = entry.headerOffset;
+
+        if (!snapshot.isOpen())
+            records.append(entry.filename);
+    }
+
+    qSort(records);
+
+    // Later records depend on the previous ones
+    for (int i = 0; i < records.size() && !isCancelled(); ++i) {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        if (uz.extractFile(records.at(i), &buffer) != MvdUnZip::NoError) {
+            eLog() << QString("MvdCollectionLoader: Unable to extract %1, %2 journal records ignored.")
+                .arg(records.at(i)).arg(records.size() - i);
+            journalUsable = false;
+            break;
+        }
+        journal.append(qMakePair(records.at(i), buffer.data()));
+    }
+
+    if (!journal.isEmpty() && !isCancelled()) {
+        MVD_TRACE_SPAN(phaseSpan, "MvdCollectionLoader::applyJournal", "loader");
+        MVD_TRACE_COUNTER(phaseSpan, "records", journal.size());
+        time.start();
+        callLoader("applyJournal");
+        iLog() << QString("MvdCollectionLoader: applying %1 journal records took %2 ms.")
+            .arg(journal.size()).arg(time.elapsed());
+    }
+
+    journal.clear();
+
+    if (isCancelled()) {
+        paths().removeDirectoryTree(tmpPath);
+        return CancelledError;
+    }
 
     paths().removeDirectoryTree(tmpPath, "persistent");
 
-    QFileInfo finfo(mmcFile);
-    collection->setFileName(finfo.completeBaseName());
-    collection->setPath(finfo.absoluteFilePath());
+    sharedItemMapper = idMapper;
+
+    // The file name is set by the loader's thread when loading in background
+    if (!background) {
+        QFileInfo finfo(mmcFile);
+        collection->setFileName(finfo.completeBaseName());
+        collection->setPath(finfo.absoluteFilePath());
+        setJournalInfo(collection, file);
+        writeSnapshot(collection, file);
+    }
 
+    MVD_TRACE_COUNTER(loadSpan, "movies", loadedMovies);
     return NoError;
 }
 
+/*!
+    \internal Reads all the shared items and movies from \p snapshot.
+    Returns false if the snapshot is corrupted. The shared item IDs in the
+    movies are still the IDs in the snapshot and need to be remapped once
+    the shared items have been added to the collection.
+*/
+bool MvdCollectionLoader::Private::readSnapshot(MvdCollectionSnapshot *snapshot,
+    QList<QPair<mvdid, MvdSdItem> > *items, QList<QPair<mvdid, MvdMovie> > *movies)
+{
+    IdMapper ids;
+    mvdid id;
+
+    MvdSdItem item;
+    while (snapshot->readSharedItem(&id, &item)) {
+        items->append(qMakePair(id, item));
+        ids.insert(id, id);
+    }
+
+    MvdMovie movie;
+    while (!isCancelled() && snapshot->readMovie(&id, &movie, ids))
+        movies->append(qMakePair(id, movie));
+
+    return isCancelled() || snapshot->atEnd();
+}
+
+/*!
+    \internal Sets the journal info of a collection just loaded from \p file,
+    so that the next save can append a journal record to the archive. The
+    collection IDs do not match the IDs in the archive, so the journal info
+    maps them back (see MvdMovieCollection::JournalInfo). The journal is not
+    used if some movie has no ID in the archive or some record could not be
+    applied: the next save will then rewrite the archive.
+*/
+void MvdCollectionLoader::Private::setJournalInfo(MvdMovieCollection *collection, const QString &file)
+{
+    if (!journalUsable)
+        return;
+
+    MvdMovieCollection::JournalInfo journalInfo;
+    journalInfo.archive = QFileInfo(file).absoluteFilePath();
+    journalInfo.revision = collection->revision();
+    journalInfo.sharedRevision = collection->sharedData().revision();
+    journalInfo.records = journalRecords;
+    journalInfo.size = QFileInfo(file).size();
+    journalInfo.baseSize = journalOffset < 0 ? journalInfo.size : journalOffset;
+
+    for (IdMapper::ConstIterator it = movieMapper.constBegin(); it != movieMapper.constEnd(); ++it) {
+        journalInfo.movieIds.insert(it.value(), it.key());
+        journalInfo.movieIdBase = qMax(journalInfo.movieIdBase, it.key());
+    }
+
+    for (IdMapper::ConstIterator it = sharedItemMapper.constBegin(); it != sharedItemMapper.constEnd(); ++it) {
+        journalInfo.sharedItemIds.insert(it.value(), it.key());
+        journalInfo.sharedItemIdBase = qMax(journalInfo.sharedItemIdBase, it.key());
+    }
+
+    collection->setJournalInfo(journalInfo);
+}
+
+/*!
+    \internal Writes a binary snapshot of a collection loaded from the XML
+    files in \p file, so that the next load is faster. The snapshot is
+    written in a separate thread from a copy of the collection. No snapshot
+    is written if the journal info could not be set (see setJournalInfo()),
+    as the snapshot needs the IDs in the archive.
+*/
+void MvdCollectionLoader::Private::writeSnapshot(MvdMovieCollection *collection, const QString &file)
+{
+    if (snapshotChecksum.isEmpty() || !collection->journalInfo().isValid())
+        return;
+
+    QThreadPool::globalInstance()->start(
+        new SnapshotWriter(collection->createSnapshot(), file, snapshotChecksum));
+    snapshotChecksum.clear();
+}
+
+/*!
+    Loads a collection from the given file or from the collection's file path if
+    \p file is null.
+*/
+MvdCollectionLoader::StatusCode MvdCollectionLoader::load(MvdMovieCollection *collection, QString file)
+{
+    if (!collection)
+        return InvalidCollectionError;
+
+    if (isLoading()) {
+        eLog() << "MvdCollectionLoader: A background load is still running.";
+        return UnknownError;
+    }
+
+    d->collection = collection;
+    d->background = false;
+    d->cancelled = 0;
+    d->batchSize = qMax(1, Movida::core().parameter("mvdcore/loader-batch-size").toInt());
+
+    StatusCode res = d->load(collection, file);
+    d->movieMapper.clear();
+    d->sharedItemMapper.clear();
+    return res;
+}
+
+/*!
+    Same as load() but the XML files are parsed in a separate thread.
+    Returns false if loading could not be started.
+
+    Shared data is added to the collection before the first movie is parsed;
+    movies are then added in batches (see the "mvdcore/loader-batch-size"
+    core parameter) so that they can be shown while the collection is being
+    loaded. The finished() signal is emitted with a StatusCode value when done.
+
+    The collection must not be deleted before finished() has been emitted
+    and should not be modified by the caller in the meantime.
+*/
+bool MvdCollectionLoader::loadInBackground(MvdMovieCollection *collection, QString file)
+{
+    if (!collection)
+        return false;
+
+    if (isLoading()) {
+        wLog() << "MvdCollectionLoader: A background load is already running.";
+        return false;
+    }
+
+    if (file.isEmpty()) {
+        file = collection->path();
+        if (file.isEmpty()) {
+            eLog() << QString("MvdCollectionLoader: No filename specified.");
+            return false;
+        }
+    }
+
+    d->collection = collection;
+    d->fileName = file;
+    d->background = true;
+    d->cancelled = 0;
+    d->status = UnknownError;
+    d->batchSize = qMax(1, Movida::core().parameter("mvdcore/loader-batch-size").toInt());
+    d->pendingMovies.clear();
+    d->pendingMovieIds.clear();
+    d->deliveryPending = false;
+
+    if (!d->thread) {
+        d->thread = new Private::Thread(d);
+        connect(d->thread, SIGNAL(finished()), this, SLOT(backgroundLoadFinished()));
+    }
+
+    d->thread->start();
+    return true;
+}
+
+/*!
+    Returns true if a background load has been started and the finished()
+    signal has not been emitted yet.
+*/
+bool MvdCollectionLoader::isLoading() const
+{
+    return d->background;
+}
+
+/*!
+    Stops loading as soon as possible. load() returns and finished() is
+    emitted with CancelledError. Movies that have already been added
+    are not removed from the collection.
+*/
+void MvdCollectionLoader::cancel()
+{
+    d->cancelled.fetchAndStoreOrdered(1);
+}
+
+/*!
+    Blocks until the current background load (if any) has finished.
+    The finished() signal is emitted before returning.
+*/
+void MvdCollectionLoader::waitForFinished()
+{
+    if (!isLoading())
+        return;
+
+    // The parser thread might be waiting for a slot to be called in this thread
+    while (!d->thread->wait(20))
+        QCoreApplication::sendPostedEvents(this, QEvent::MetaCall);
+
+    backgroundLoadFinished();
+}
+
+/*!
+    Sets the strategy used to parse the XML files in the archive.
+    The default is DomLoadMode.
+
+    In StreamingLoadMode the XML files are not extracted to the temporary
+    directory and no complete document tree is built: each movie is added to
+    the collection as soon as it has been read from the archive.
+
+    In ParallelLoadMode the XML files are inflated and parsed concurrently
+    and the movies are converted by as many threads as there are cores;
+    movies are only added to the collection once they have all been
+    converted.
+*/
+void MvdCollectionLoader::setLoadMode(LoadMode mode)
+{
+    d->loadMode = mode;
+}
+
+/*!
+    Returns the strategy used to parse the XML files in the archive.
+*/
+MvdCollectionLoader::LoadMode MvdCollectionLoader::loadMode() const
+{
+    return d->loadMode;
+}
+
 void MvdCollectionLoader::setProgressHandler(QObject *receiver, const char *member)
 {
     if (!receiver || !member)
@@ -997,3 +2283,175 @@ void MvdCollectionLoader::extractionProgress(int progress)
 {
     Q_UNUSED(progress)
 }
+
+//! \internal Passes the collection info to the progress handler.
+void MvdCollectionLoader::reportCollectionInfo()
+{
+    if (!d->progressReceiver)
+        return;
+
+    QMetaObject::invokeMethod(
+        d->progressReceiver,
+        qPrintable(d->progressMember),
+        Qt::DirectConnection,
+        Q_RETURN_ARG(bool, d->continueParsing),
+        Q_ARG(int, CollectionInfo),
+        Q_ARG(QVariant, QVariant::fromValue<MvdCollectionLoader::Info>(d->info)));
+}
+
+/*!
+    \internal Sets the collection metadata read from an <info> node.
+    Unknown metadata is ignored.
+*/
+void MvdCollectionLoader::Private::setMetaData(MvdMovieCollection *collection,
+    const QHash<QString, QString> &metadata)
+{
+    for (QHash<QString, QString>::ConstIterator it = metadata.begin(); it != metadata.end(); ++it) {
+        MvdMovieCollection::MetaDataType infoType = MvdMovieCollection::InvalidInfo;
+        QString currentNode = it.key();
+        if (currentNode == "name")
+            infoType = MvdMovieCollection::NameInfo;
+        else if (currentNode == "notes")
+            infoType = MvdMovieCollection::NotesInfo;
+        else if (currentNode == "owner")
+            infoType = MvdMovieCollection::OwnerInfo;
+        else if (currentNode == "email")
+            infoType = MvdMovieCollection::EMailInfo;
+        else if (currentNode == "website")
+            infoType = MvdMovieCollection::WebsiteInfo;
+
+        if (infoType != MvdMovieCollection::InvalidInfo)
+            collection->setMetaData(infoType, it.value());
+    }
+}
+
+//! \internal Sets the collection metadata read from the archive.
+void MvdCollectionLoader::applyMetaData()
+{
+    d->setMetaData(d->collection, d->info.metadata);
+
+    // Set once the collection has been loaded, see Private::setJournalInfo()
+    d->collection->setJournalInfo(MvdMovieCollection::JournalInfo());
+
+    d->collection->setMetaData(MvdMovieCollection::DataPathInfo, d->dataPath + "persistent");
+    d->archivedImages.clear();
+    if (!d->archivePath.isEmpty()) {
+        QDir().mkpath(d->collection->metaData(MvdMovieCollection::DataPathInfo).append("images"));
+        d->collection->setImageArchive(d->archivePath, d->imageEntries);
+
+        for (int i = 0; i < d->imageEntries.size(); ++i) {
+            const QString &entry = d->imageEntries.at(i);
+            d->archivedImages.insert(entry.mid(entry.lastIndexOf('/') + 1));
+        }
+    }
+
+
+    d->posterDir = d->collection->metaData(MvdMovieCollection::DataPathInfo)
+        .append("images") + QDir::separator();
+}
+
+//! \internal Adds the shared items parsed in background to the collection.
+void MvdCollectionLoader::addSharedItems()
+{
+    MvdSharedData &sd = d->collection->sharedData();
+
+    for (int i = 0; i < d->sharedItems.size(); ++i) {
+        const QPair<mvdid, MvdSdItem> &p = d->sharedItems.at(i);
+        mvdid newId = sd.addItem(p.second);
+        if (newId != MvdNull)
+            d->idMapper->insert(p.first, newId);
+    }
+
+    d->sharedItems.clear();
+}
+
+//! \internal Adds the movies parsed in background to the collection.
+void MvdCollectionLoader::addMovies()
+{
+    MVD_TRACE_SPAN(span, "MvdCollectionLoader::addMovies", "loader");
+
+    d->mutex.lock();
+    QList<MvdMovie> movies = d->pendingMovies;
+    QList<mvdid> fileIds = d->pendingMovieIds;
+    d->pendingMovies.clear();
+    d->pendingMovieIds.clear();
+    d->deliveryPending = false;
+    d->mutex.unlock();
+
+    if (movies.isEmpty() || !d->collection || d->isCancelled())
+        return;
+
+    MVD_TRACE_COUNTER(span, "movies", movies.size());
+    QList<mvdid> ids = d->collection->addMovies(movies);
+    for (int i = 0; i < ids.size(); ++i) {
+        if (fileIds.at(i) != MvdNull && ids.at(i) != MvdNull)
+            d->movieMapper.insert(fileIds.at(i), ids.at(i));
+    }
+
+    d->loadedMovies += movies.size();
+    d->reportProgress();
+}
+
+/*!
+    \internal Applies the journal records read from the archive, after
+    the movies that are still waiting to be added to the collection.
+*/
+void MvdCollectionLoader::applyJournal()
+{
+    addMovies();
+
+    for (int i = 0; i < d->journal.size() && !d->isCancelled(); ++i) {
+        const QString &name = d->journal.at(i).first;
+        const QByteArray &data = d->journal.at(i).second;
+
+        xmlDocPtr doc = 0;
+        xmlNodePtr cur = 0;
+        int itemCount = -1;
+
+        QByteArray url = name.toUtf8();
+        doc = xmlReadMemory(data.constData(), data.size(), url.constData(), 0, 0);
+        if (!d->checkXmlDocument(QFileInfo(name).fileName(), &doc, &cur, &itemCount)) {
+            eLog() << QString("MvdCollectionLoader: %1 journal records ignored.")
+                .arg(d->journal.size() - i);
+            d->journalUsable = false;
+            break;
+        }
+
+        d->parseJournalRecord(doc, cur, d->collection);
+        xmlFreeDoc(doc);
+    }
+}
+
+//! \internal Called in the loader's thread when the background load is done.
+void MvdCollectionLoader::backgroundLoadFinished()
+{
+    if (!isLoading())
+        return;
+
+    // Add the last batch
+    if (d->status == NoError)
+        addMovies();
+
+    d->background = false;
+    d->pendingMovies.clear();
+    d->pendingMovieIds.clear();
+    d->sharedItems.clear();
+    d->idMapper = 0;
+
+    StatusCode res = d->isCancelled() ? CancelledError : d->status;
+    if (res == NoError) {
+        QFileInfo finfo(d->fileName);
+        d->collection->setFileName(finfo.completeBaseName());
+        d->collection->setPath(finfo.absoluteFilePath());
+        d->setJournalInfo(d->collection, d->fileName);
+        d->writeSnapshot(d->collection, d->fileName);
+    }
+
+    d->movieMapper.clear();
+    d->sharedItemMapper.clear();
+
+    d->collection = 0;
+
+    iLog() << QString("MvdCollectionLoader: Background load finished with status %1.").arg((int)res);
+    emit finished((int)res);
+}
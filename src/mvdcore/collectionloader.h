@@ -54,18 +54,45 @@ public:
         ZipError,
         InvalidFileError,
         TemporaryDirectoryError,
-        UnknownError
+        UnknownError,
+        CancelledError
+    };
+
+    enum LoadMode {
+        DomLoadMode = 0,
+        StreamingLoadMode,
+        ParallelLoadMode
     };
 
     MvdCollectionLoader(QObject * parent = 0);
     virtual ~MvdCollectionLoader();
 
+    void setLoadMode(LoadMode mode);
+    LoadMode loadMode() const;
+
     void setProgressHandler(QObject *receiver, const char *member);
     StatusCode load(MvdMovieCollection *collection, QString file = QString());
 
+    bool loadInBackground(MvdMovieCollection *collection, QString file = QString());
+    bool isLoading() const;
+    void waitForFinished();
+
+public slots:
+    void cancel();
+
+signals:
+    void finished(int status);
+
 private slots:
     void extractionProgress(int);
 
+    void reportCollectionInfo();
+    void applyMetaData();
+    void addSharedItems();
+    void addMovies();
+    void applyJournal();
+    void backgroundLoadFinished();
+
 private:
     class Private;
     Private *d;
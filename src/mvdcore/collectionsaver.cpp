@@ -20,13 +20,18 @@
 
 #include "collectionsaver.h"
 
+#include "collectionsnapshot.h"
+#include "core.h"
 #include "global.h"
 #include "logger.h"
 #include "md5.h"
 #include "movie.h"
 #include "movie.h"
 #include "pathresolver.h"
+#include "sditem.h"
 #include "settings.h"
+#include "trace.h"
+#include "unzip.h"
 #include "utils.h"
 #include "xmlwriter.h"
 #include "zip.h"
@@ -36,9 +41,13 @@
 #include <QtCore/QDir>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
+#include <QtCore/QPointer>
+#include <QtCore/QSet>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
 #include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QTime>
 
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
@@ -63,13 +72,42 @@ const int version = 1;
 class MvdCollectionSaver::Private
 {
 public:
+    class Thread;
+
     Private(MvdCollectionSaver * s) :
         progressReceiver(0),
+        thread(0),
+        snapshot(0),
+        storeFilename(false),
+        revision(0),
+        status(MvdCollectionSaver::NoError),
+        saveMode(MvdCollectionSaver::FullSaveMode),
+        journaled(false),
+        snapshots(false),
+        archiveIds(0),
         q(s) { }
 
-    inline QFile *createFile(const QString &name);
+    MvdCollectionSaver::StatusCode prepare(MvdMovieCollection *collection,
+        QString *mmcFilename, bool *storeFilename);
+    MvdCollectionSaver::StatusCode write(MvdMovieCollection *collection,
+        const QString &mmcFilename);
+    MvdCollectionSaver::StatusCode writeArchive(MvdMovieCollection *collection,
+        const QString &mmcFilename);
+    MvdCollectionSaver::StatusCode replaceArchive(const QString &tmpFilename,
+        const QString &mmcFilename);
+    MvdCollectionSaver::StatusCode writeJournal(MvdMovieCollection *collection,
+        const QString &mmcFilename);
+    MvdCollectionSaver::StatusCode writeJournalRecord(MvdMovieCollection *collection,
+        MvdZip *zipper);
+    MvdZip::ErrorCode addPersistentData(MvdMovieCollection *collection, MvdZip *zipper);
+    void removeUnusedImages(MvdMovieCollection *collection);
+    void updateJournalInfo(MvdMovieCollection *collection, MvdCollectionSaver::StatusCode status);
+    void writeSnapshot(MvdMovieCollection *collection, const QString &mmcFilename);
 
     inline void writeDocumentRoot(MvdXmlWriter *xml, int itemCount);
+    void writeMetaData(MvdXmlWriter *xml, MvdMovieCollection *collection);
+    void writeSharedItem(MvdXmlWriter *xml, mvdid id, const MvdSdItem &item);
+    void writeMovie(MvdXmlWriter *xml, mvdid id, const MvdMovie &movie);
 
     void writePersonList(MvdXmlWriter *xml, const QList<MvdRoleItem> &data);
     void writePersonList(MvdXmlWriter *xml, const QList<mvdid> &data);
@@ -82,29 +120,165 @@ public:
     QObject *progressReceiver;
     QString progressMember;
 
+    // Background save
+    Thread *thread;
+    MvdMovieCollection *snapshot;
+    QPointer<MvdMovieCollection> collection;
+    QString fileName;
+    bool storeFilename;
+    uint revision;
+    MvdCollectionSaver::StatusCode status;
+
+    MvdCollectionSaver::SaveMode saveMode;
+
+    // Set by prepare(): true if the changes are appended to the journal,
+    // journal is the info to be stored in the collection once written
+    bool journaled;
+    MvdMovieCollection::JournalInfo journal;
+
+    // Set by prepare(): true if a binary snapshot is written after the archive
+    bool snapshots;
+
+    // Set while a journal record is written, as the records refer to the
+    // movies and shared items by their ID in the archive
+    const MvdMovieCollection::JournalInfo *archiveIds;
+
+    inline mvdid movieId(mvdid id) const
+    { return archiveIds ? archiveIds->archiveMovieId(id) : id; }
+    inline mvdid sharedItemId(mvdid id) const
+    { return archiveIds ? archiveIds->archiveSharedItemId(id) : id; }
+
 private:
     MvdCollectionSaver *q;
 };
 
+//! \internal Writes a collection snapshot in a separate thread.
+class MvdCollectionSaver::Private::Thread : public QThread
+{
+public:
+    Thread(MvdCollectionSaver::Private *p) :
+        QThread(),
+        d(p) { }
+
+protected:
+    void run()
+    {
+        d->status = d->write(d->snapshot, d->fileName);
+    }
+
+private:
+    MvdCollectionSaver::Private *d;
+};
+
 
 //////////////////////////////////////////////////////////////////////////
 
 
 /*!
-    \internal Creates and opens a new file for writing.
-    Returns 0 in case of error.
+    \internal Checks the parameters and prepares the persistent data of the
+    collection for writing. Must be called in the thread the collection
+    lives in.
 */
-QFile *MvdCollectionSaver::Private::createFile(const QString &name)
+MvdCollectionSaver::StatusCode MvdCollectionSaver::Private::prepare(MvdMovieCollection *collection,
+    QString *mmcFilename, bool *storeFilename)
 {
-    QFile *file = new QFile(name);
+    if (!collection)
+        return InvalidCollectionError;
+
+    *storeFilename = true;
+
+    if (mmcFilename->isEmpty()) {
+        *storeFilename = false;
+        *mmcFilename = collection->path();
+        if (mmcFilename->isEmpty())
+            return InvalidFileError;
+    }
+
+    //! \todo Implement some kind of backup copy support
+
+    removeUnusedImages(collection);
+
+    snapshots = Movida::core().parameter("mvdcore/collection-snapshots").toBool();
+
+    // Decide whether the changes can be appended to the journal
+    journaled = false;
+    journal = MvdMovieCollection::JournalInfo();
 
-    if (!file->open(QIODevice::WriteOnly)) {
-        eLog() << QString("MvdCollectionSaver_P: Unable to create file: %1").arg(name);
-        delete file;
-        return 0;
+    MvdMovieCollection::JournalInfo info = collection->journalInfo();
+    if (saveMode == MvdCollectionSaver::FullSaveMode) {
+        if (info.isValid())
+            collection->setJournalInfo(journal);
+        return NoError;
     }
 
-    return file;
+    const QString archive = QFileInfo(*mmcFilename).absoluteFilePath();
+    if (info.isValid() && info.archive == archive && info.baseSize > 0
+        && info.size == QFileInfo(archive).size()) {
+        const qint64 percent = Movida::core().parameter("mvdcore/journal-compaction-percent").toInt();
+        if ((info.size - info.baseSize) * 100 <= info.baseSize * percent) {
+            journaled = true;
+            journal = info;
+        } else iLog() << QString("MvdCollectionSaver: Compacting %1 journal records.").arg(info.records);
+    }
+
+    journal.archive = archive;
+    journal.revision = collection->revision();
+    journal.sharedRevision = collection->sharedData().revision();
+
+    // Start tracking the changes made after this revision. The journal can
+    // not be used before the archive has been written as the size is 0.
+    if (!journaled)
+        collection->setJournalInfo(journal);
+
+    return NoError;
+}
+
+/*!
+    \internal Stores the new journal info in \p collection after a save in
+    JournaledSaveMode, or disables the journal if the save failed.
+*/
+void MvdCollectionSaver::Private::updateJournalInfo(MvdMovieCollection *collection,
+    MvdCollectionSaver::StatusCode status)
+{
+    if (!journal.isValid())
+        return;
+
+    // The collection has been cleared or saved again in the meantime
+    if (collection->journalInfo().archive != journal.archive)
+        return;
+
+    collection->setJournalInfo(status == NoError ? journal : MvdMovieCollection::JournalInfo());
+}
+
+/*!
+    \internal Removes images that are no more referenced by any movie from
+    the persistent data directory.
+*/
+void MvdCollectionSaver::Private::removeUnusedImages(MvdMovieCollection *collection)
+{
+    // data path is SOME_TEMP_DIR/persistent
+    QString dataPath = collection->metaData(MvdMovieCollection::DataPathInfo);
+
+    QDir imgDir(dataPath + "/images");
+    QStringList storedImages = imgDir.entryList(QDir::Files | QDir::NoDotAndDotDot);
+    if (storedImages.isEmpty())
+        return;
+
+    QSet<QString> posters;
+    MvdMovieCollection::MovieList movies = collection->movies();
+    for (MvdMovieCollection::MovieList::ConstIterator it = movies.constBegin();
+         it != movies.constEnd(); ++it) {
+        //! \todo regenerate name if there are possible name clashes (iow. poster filename = HASH.PROG_ID but no other filed named HASH exists any more)
+        QString poster = it.value().poster();
+        if (!poster.isEmpty())
+            posters.insert(poster);
+    }
+
+    for (int i = 0; i < storedImages.size(); ++i) {
+        const QString &image = storedImages.at(i);
+        if (!posters.contains(image))
+            QFile::remove(dataPath + "/images/" + image);
+    }
 }
 
 //! \internal
@@ -118,6 +292,166 @@ void MvdCollectionSaver::Private::writeDocumentRoot(MvdXmlWriter *xml, int itemC
     attrs.clear();
 }
 
+//! \internal Writes the collection metadata.
+void MvdCollectionSaver::Private::writeMetaData(MvdXmlWriter *xml,
+    MvdMovieCollection *collection)
+{
+    xml->writeOpenTag("info");
+
+    xml->writeTaggedString("movies", QString::number(collection->count()));
+    xml->writeTaggedString("name", collection->metaData(MvdMovieCollection::NameInfo));
+    xml->writeTaggedString("owner", collection->metaData(MvdMovieCollection::OwnerInfo));
+    xml->writeTaggedString("notes", collection->metaData(MvdMovieCollection::NotesInfo));
+    xml->writeTaggedString("email", collection->metaData(MvdMovieCollection::EMailInfo));
+    xml->writeTaggedString("website", collection->metaData(MvdMovieCollection::WebsiteInfo));
+
+    xml->writeCloseTag("info");
+}
+
+//! \internal Writes a shared item.
+void MvdCollectionSaver::Private::writeSharedItem(MvdXmlWriter *xml,
+    mvdid id, const MvdSdItem &item)
+{
+    QHash<QString, QString> attrs;
+
+    attrs.insert("id", QString::number(sharedItemId(id)));
+    attrs.insert("type", MvdSharedData::roleToString(item.role));
+    xml->writeOpenTag("shared-item", attrs);
+    attrs.clear();
+
+    xml->writeTaggedString("value", item.value);
+    xml->writeTaggedString("description", item.description);
+    xml->writeTaggedString("identifier", item.id);
+    if (!item.urls.isEmpty()) {
+        xml->writeOpenTag("urls");
+        for (int i = 0; i < item.urls.size(); ++i) {
+            const MvdUrl &url = item.urls.at(i);
+            attrs.insert("description", url.description);
+            if (url.isDefault)
+                attrs.insert("default", "true");
+            xml->writeTaggedString("url", url.url);
+            attrs.clear();
+        }
+        xml->writeCloseTag("urls");
+    }
+
+    xml->writeCloseTag("shared-item");
+}
+
+/*!
+    \internal Writes a movie. The ID is only used to apply journal records
+    when the collection is loaded.
+*/
+void MvdCollectionSaver::Private::writeMovie(MvdXmlWriter *xml,
+    mvdid id, const MvdMovie &movie)
+{
+    xml->writeOpenTag("movie", MvdAttribute("id", QString::number(movieId(id))));
+
+    xml->writeTaggedString("title", movie.title());
+    xml->writeTaggedString("original-title", movie.originalTitle());
+    xml->writeTaggedString("running-time", QString::number(movie.runningTime()));
+    xml->writeTaggedString("year", movie.year());
+    xml->writeTaggedString("rating", QString::number(movie.rating()));
+    xml->writeTaggedString("imdb-id", movie.imdbId());
+    xml->writeCDataString("notes", movie.notes());
+    xml->writeCDataString("plot", movie.plot());
+    xml->writeTaggedString("storage-id", movie.storageId());
+    if (movie.hasSpecialTagEnabled(Movida::SeenTag))
+        xml->writeTaggedString("seen", "true");
+    if (movie.hasSpecialTagEnabled(Movida::LoanedTag))
+        xml->writeTaggedString("loaned", "true");
+    if (movie.hasSpecialTagEnabled(Movida::SpecialTag))
+        xml->writeTaggedString("special", "true");
+
+    QList<MvdRoleItem> persons = movie.actors();
+    if (!persons.isEmpty()) {
+        xml->writeOpenTag("cast");
+        writePersonList(xml, persons);
+        xml->writeCloseTag("cast");
+    }
+
+    persons = movie.crewMembers();
+    if (!persons.isEmpty()) {
+        xml->writeOpenTag("crew");
+        writePersonList(xml, persons);
+        xml->writeCloseTag("crew");
+    }
+
+    QList<mvdid> ids = movie.directors();
+    if (!ids.isEmpty()) {
+        xml->writeOpenTag("directors");
+        writePersonList(xml, ids);
+        xml->writeCloseTag("directors");
+    }
+
+    ids = movie.producers();
+    if (!ids.isEmpty()) {
+        xml->writeOpenTag("producers");
+        writePersonList(xml, ids);
+        xml->writeCloseTag("producers");
+    }
+
+    ids = movie.genres();
+    if (!ids.isEmpty()) {
+        xml->writeOpenTag("genres");
+        writeIdList(xml, ids, "genre");
+        xml->writeCloseTag("genres");
+    }
+
+    ids = movie.countries();
+    if (!ids.isEmpty()) {
+        xml->writeOpenTag("countries");
+        writeIdList(xml, ids, "country");
+        xml->writeCloseTag("countries");
+    }
+
+    ids = movie.languages();
+    if (!ids.isEmpty()) {
+        xml->writeOpenTag("languages");
+        writeIdList(xml, ids, "language");
+        xml->writeCloseTag("languages");
+    }
+
+    ids = movie.tags();
+    if (!ids.isEmpty()) {
+        xml->writeOpenTag("tags");
+        writeIdList(xml, ids, "tag");
+        xml->writeCloseTag("tags");
+    }
+
+    Movida::ColorMode cmode = movie.colorMode();
+    if (cmode != Movida::UnknownColorMode)
+        xml->writeTaggedString("color-mode",
+            cmode == Movida::Color ? "color" : "bw");
+
+    QList<MvdUrl> urls = movie.urls();
+    if (!urls.isEmpty()) {
+        xml->writeOpenTag("urls");
+        writeUrlList(xml, urls);
+        xml->writeCloseTag("urls");
+    }
+
+    QStringList list = movie.specialContents();
+    if (!list.isEmpty()) {
+        xml->writeOpenTag("special-contents");
+        writeStringList(xml, list, "item");
+        xml->writeCloseTag("special-contents");
+    }
+
+    QString poster = movie.poster();
+    if (!poster.isEmpty())
+        xml->writeTaggedString("poster", poster);
+
+    QHash<QString, QVariant> extra = movie.extendedAttributes();
+    if (!extra.isEmpty()) {
+        xml->writeOpenTag(QLatin1String("extended-attributes"));
+        writeDataList(xml, extra, QLatin1String("attribute"), QLatin1String("name"));
+        xml->writeCloseTag(QLatin1String("extended-attributes"));
+    }
+
+    xml->writeCloseTag("movie");
+}
+
 /*!
     \internal Writes out a list of persons with a possible list of roles.
 
@@ -139,7 +473,7 @@ void MvdCollectionSaver::Private::writePersonList(MvdXmlWriter *xml,
         const MvdRoleItem &item = idRoleList.at(i);
         mvdid id = item.first;
         QStringList roles = item.second;
-        attrs.insert("id", QString::number(id));
+        attrs.insert("id", QString::number(sharedItemId(id)));
 
         if (roles.isEmpty()) {
             xml->writeAtomTag("person", attrs);
@@ -174,7 +508,7 @@ void MvdCollectionSaver::Private::writePersonList(MvdXmlWriter *xml,
 
     for (int i = 0; i < list.size(); ++i) {
         mvdid id = list.at(i);
-        attrs.insert("id", QString::number(id));
+        attrs.insert("id", QString::number(sharedItemId(id)));
         xml->writeAtomTag("person", attrs);
         attrs.clear();
     }
@@ -194,7 +528,7 @@ void MvdCollectionSaver::Private::writeIdList(MvdXmlWriter *xml,
 
     for (int i = 0; i < list.size(); ++i) {
         mvdid id = list.at(i);
-        attrs.insert("id", QString::number(id));
+        attrs.insert("id", QString::number(sharedItemId(id)));
         xml->writeAtomTag(tag, attrs);
         attrs.clear();
     }
@@ -257,39 +591,375 @@ void MvdCollectionSaver::Private::writeDataList(MvdXmlWriter *xml,
     }
 }
 
-/************************************************************************
-    MvdCollectionSaver
- *************************************************************************/
+/*!
+    \internal Writes the collection to a temporary file that replaces
+    \p mmcFilename on success, as unchanged images are copied from the
+    previous archive that usually is the same file. Journaled saves append
+    to \p mmcFilename instead (see writeJournal()). Only reads from
+    \p collection, so it can run in a separate thread on a collection
+    snapshot.
+
+    Images not extracted yet are read from the previous archive, so the
+    collection keeps it open; extraction is suspended while the archive is
+    modified, as the file can not be replaced while it is open on Windows.
+*/
+MvdCollectionSaver::StatusCode MvdCollectionSaver::Private::write(MvdMovieCollection *collection,
+    const QString &mmcFilename)
+{
+    MVD_TRACE_SPAN(span, "MvdCollectionSaver::write", "saver");
+    MVD_TRACE_COUNTER(span, "movies", collection->count());
+
+    if (journaled) {
+        // The snapshot is left stale, as rewriting it would make each
+        // journaled save as slow as the collection is large. The next load
+        // uses the XML files and the journal records and writes a new one.
+        collection->suspendImageExtraction();
+        StatusCode res = writeJournal(collection, mmcFilename);
+        collection->resumeImageExtraction();
+        return res;
+    }
 
-MvdCollectionSaver::MvdCollectionSaver(QObject *parent) :
-    QObject(parent),
-    d(new Private(this))
-{ }
+    const QString tmpFilename = mmcFilename + ".tmp";
+    QFile::remove(tmpFilename);
 
-MvdCollectionSaver::~MvdCollectionSaver()
+    StatusCode res = writeArchive(collection, tmpFilename);
+    if (res != NoError) {
+        QFile::remove(tmpFilename);
+        return res;
+    }
+
+    collection->suspendImageExtraction();
+    res = replaceArchive(tmpFilename, mmcFilename);
+    collection->resumeImageExtraction();
+    if (res != NoError)
+        return res;
+
+    if (journal.isValid())
+        journal.baseSize = journal.size = QFileInfo(mmcFilename).size();
+
+    writeSnapshot(collection, mmcFilename);
+
+    return NoError;
+}
+
+//! \internal Replaces \p mmcFilename with \p tmpFilename.
+MvdCollectionSaver::StatusCode MvdCollectionSaver::Private::replaceArchive(const QString &tmpFilename,
+    const QString &mmcFilename)
 {
-    delete d;
+    if (QFile::exists(mmcFilename) && !QFile::remove(mmcFilename)) {
+        eLog() << QString("MvdCollectionSaver: Unable to replace %1").arg(mmcFilename);
+        QFile::remove(tmpFilename);
+        return FileOpenError;
+    }
+
+    if (!QFile::rename(tmpFilename, mmcFilename)) {
+        eLog() << QString("MvdCollectionSaver: Unable to rename %1 to %2")
+            .arg(tmpFilename).arg(mmcFilename);
+        return FileOpenError;
+    }
+
+    return NoError;
 }
 
 /*!
-    Attempts to write the collection to file using the given filename or
-    the collection's filename (if \p mmcFilename is empty).
+    \internal Writes a binary snapshot of \p collection for the archive just
+    written to \p mmcFilename, so that the next load does not need to parse
+    the XML files (see MvdCollectionSnapshot). A failure is not an error, the
+    stale snapshot is simply removed.
 */
-MvdCollectionSaver::StatusCode MvdCollectionSaver::save(MvdMovieCollection *collection, QString mmcFilename)
+void MvdCollectionSaver::Private::writeSnapshot(MvdMovieCollection *collection,
+    const QString &mmcFilename)
 {
-    if (!collection)
-        return InvalidCollectionError;
+    MVD_TRACE_SPAN(span, "MvdCollectionSaver::writeSnapshot", "saver");
+
+    if (!snapshots) {
+        MvdCollectionSnapshot::remove(mmcFilename);
+        return;
+    }
 
-    bool storeFilename = true;
+    QString checksum;
 
-    if (mmcFilename.isEmpty()) {
-        storeFilename = false;
-        mmcFilename = collection->path();
-        if (mmcFilename.isEmpty())
-            return InvalidFileError;
+    {
+        MvdUnZip uz;
+        if (uz.openArchive(mmcFilename) == MvdUnZip::NoError)
+            checksum = MvdCollectionSnapshot::archiveChecksum(&uz);
     }
 
-    //! \todo Implement some kind of backup copy support
+    if (checksum.isEmpty() || !MvdCollectionSnapshot::write(collection, mmcFilename, checksum))
+        MvdCollectionSnapshot::remove(mmcFilename);
+}
+
+/*!
+    \internal Appends a journal record with the changes made after the
+    revision in the journal info of \p collection to \p mmcFilename.
+    The archive is truncated to its previous size if the record can not be
+    written.
+*/
+MvdCollectionSaver::StatusCode MvdCollectionSaver::Private::writeJournal(MvdMovieCollection *collection,
+    const QString &mmcFilename)
+{
+    MVD_TRACE_SPAN(span, "MvdCollectionSaver::writeJournal", "saver");
+
+    StatusCode res = NoError;
+
+    {
+        MvdZip zipper;
+        MvdZip::ErrorCode zerr = zipper.appendArchive(mmcFilename);
+        if (zerr != MvdZip::NoError) {
+            eLog() << QString("MvdCollectionSaver: Unable to open zip archive (%1): %2")
+                .arg(zipper.formatError(zerr)).arg(mmcFilename);
+            return ZipError;
+        }
+
+        res = writeJournalRecord(collection, &zipper);
+    }
+
+    if (res != NoError) {
+        QFile file(mmcFilename);
+        if (!file.resize(journal.size))
+            eLog() << QString("MvdCollectionSaver: Unable to restore %1").arg(mmcFilename);
+        return res;
+    }
+
+    ++journal.records;
+    journal.size = QFileInfo(mmcFilename).size();
+
+    iLog() << QString("MvdCollectionSaver: Journal record %1 written (%2 of %3 bytes).")
+        .arg(journal.records).arg(journal.size - journal.baseSize).arg(journal.size);
+
+    return NoError;
+}
+
+/*!
+    \internal Writes the changed and removed movies and shared items, the
+    metadata and any new image to an opened archive. Movies and shared
+    items are written with their ID in the archive (see
+    MvdMovieCollection::JournalInfo).
+
+    \verbatim
+    <shared-data>
+    <shared-item id="12" type="person">...</shared-item>
+    <removed-shared-item id="13"/>
+    </shared-data>
+    <movies>
+    <movie id="2">...</movie>
+    <removed-movie id="3"/>
+    </movies>
+    \endverbatim
+*/
+MvdCollectionSaver::StatusCode MvdCollectionSaver::Private::writeJournalRecord(MvdMovieCollection *collection,
+    MvdZip *zipper)
+{
+    const MvdMovieCollection::JournalInfo previous = collection->journalInfo();
+    const MvdSharedData &sd = collection->sharedData();
+
+    QList<mvdid> sharedItems = sd.changedItems(previous.sharedRevision);
+    QList<mvdid> movies = collection->changedMovies(previous.revision);
+
+    QIODevice *file = zipper->openEntry(QString("movida-collection/journal/%1.xml")
+        .arg(journal.records + 1, 5, 10, QLatin1Char('0')));
+    if (!file)
+        return ZipError;
+
+    MvdXmlWriter *xml = new MvdXmlWriter(file);
+    xml->setSkipEmptyAttributes(true);
+    xml->setSkipEmptyTags(true);
+
+    archiveIds = &previous;
+
+    writeDocumentRoot(xml, sharedItems.size() + movies.size());
+
+    // Empty values replace the metadata in the previous records
+    xml->setSkipEmptyTags(false);
+    writeMetaData(xml, collection);
+    xml->setSkipEmptyTags(true);
+
+    if (!sharedItems.isEmpty()) {
+        xml->writeOpenTag("shared-data");
+        for (int i = 0; i < sharedItems.size(); ++i) {
+            mvdid id = sharedItems.at(i);
+            MvdSdItem item = sd.item(id);
+            if (item.value.isEmpty())
+                xml->writeAtomTag("removed-shared-item", MvdAttribute("id", QString::number(sharedItemId(id))));
+            else writeSharedItem(xml, id, item);
+        }
+        xml->writeCloseTag("shared-data");
+    }
+
+    if (!movies.isEmpty()) {
+        xml->writeOpenTag("movies");
+        for (int i = 0; i < movies.size(); ++i) {
+            mvdid id = movies.at(i);
+            MvdMovie movie = collection->movie(id);
+            if (!movie.isValid())
+                xml->writeAtomTag("removed-movie", MvdAttribute("id", QString::number(movieId(id))));
+            else writeMovie(xml, id, movie);
+        }
+        xml->writeCloseTag("movies");
+    }
+
+    xml->writeCloseTag("movida-xml-doc");
+
+    delete xml;
+    archiveIds = 0;
+
+    MvdZip::ErrorCode zerr = zipper->closeEntry();
+    if (zerr != MvdZip::NoError)
+        return ZipError;
+
+    emit q->progress(80);
+
+    // New images, other persistent data is only stored by full saves
+    const QString dataPath = collection->metaData(MvdMovieCollection::DataPathInfo);
+    const QString imageRoot = QLatin1String("movida-collection/persistent/images/");
+
+    QStringList files;
+    QFileInfoList images = QDir(dataPath + "/images").entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+    for (int i = 0; i < images.size(); ++i) {
+        const QFileInfo &image = images.at(i);
+        if (!zipper->contains(imageRoot + image.fileName()))
+            files.append(image.absoluteFilePath());
+    }
+
+    if (!files.isEmpty()) {
+        zipper->setProgressHandler(q, "zipProgress");
+        zerr = zipper->addFiles(files, imageRoot);
+        if (zerr != MvdZip::NoError) {
+            eLog() << QString("MvdCollectionSaver: Unable to add files to zip archive (%1).")
+                .arg(zipper->formatError(zerr));
+            return ZipError;
+        }
+    }
+
+    zerr = zipper->closeArchive();
+    if (zerr != MvdZip::NoError) {
+        eLog() << QString("MvdCollectionSaver: Unable to close zip archive (%1).")
+            .arg(zipper->formatError(zerr));
+        return ZipError;
+    }
+
+    emit q->progress(100);
+
+    return NoError;
+}
+
+/*!
+    \internal Adds the images and any other persistent data to the archive.
+    Images that are still stored in the previous archive or that have been
+    extracted from it are copied without decompressing them: image names
+    are content hashes (see MvdMovieCollection::addImage()), so an entry
+    with the same name and size holds the same image.
+*/
+MvdZip::ErrorCode MvdCollectionSaver::Private::addPersistentData(MvdMovieCollection *collection,
+    MvdZip *zipper)
+{
+    MVD_TRACE_SPAN(span, "MvdCollectionSaver::addPersistentData", "saver");
+
+    // data path is SOME_TEMP_DIR/persistent
+    const QString dataPath = collection->metaData(MvdMovieCollection::DataPathInfo);
+    const QString imageRoot = QLatin1String("movida-collection/persistent/images/");
+
+    QString previousPath = collection->imageArchive();
+    if (previousPath.isEmpty())
+        previousPath = collection->path();
+
+    MvdUnZip previous;
+    QHash<QString, MvdUnZip::ZipEntry> previousEntries;
+    if (!previousPath.isEmpty() && QFile::exists(previousPath)
+        && previous.openArchive(previousPath) == MvdUnZip::NoError) {
+        QList<MvdUnZip::ZipEntry> entries = previous.entryList();
+        for (int i = 0; i < entries.size(); ++i)
+            previousEntries.insert(entries.at(i).filename, entries.at(i));
+    }
+
+    QTime time;
+    time.start();
+    int copied = 0;
+
+    MvdZip::ErrorCode zerr = MvdZip::NoError;
+
+    QSet<QString> posters;
+    MvdMovieCollection::MovieList movies = collection->movies();
+    for (MvdMovieCollection::MovieList::ConstIterator it = movies.constBegin();
+         it != movies.constEnd(); ++it) {
+        QString poster = it.value().poster();
+        if (!poster.isEmpty())
+            posters.insert(poster);
+    }
+
+    // Images that have never been extracted
+    const QHash<QString, QString> archived = collection->archivedImages();
+    for (QHash<QString, QString>::ConstIterator it = archived.constBegin();
+         it != archived.constEnd() && zerr == MvdZip::NoError; ++it) {
+        if (!posters.contains(it.key()))
+            continue;
+
+        if (!previousEntries.contains(it.value())) {
+            wLog() << QString("MvdCollectionSaver: Image not found in %1: %2")
+                .arg(previousPath).arg(it.value());
+            continue;
+        }
+
+        zerr = zipper->copyEntry(&previous, it.value(), imageRoot + it.key());
+        ++copied;
+    }
+
+    if (zerr != MvdZip::NoError || !QFileInfo(dataPath).isDir())
+        return zerr;
+
+    // Extracted or new images
+    QStringList files;
+    QDir imgDir(dataPath + "/images");
+    QFileInfoList images = imgDir.entryInfoList(QDir::Files | QDir::NoDotAndDotDot);
+    for (int i = 0; i < images.size() && zerr == MvdZip::NoError; ++i) {
+        const QFileInfo &image = images.at(i);
+
+        // Possibly being extracted by the collection's thread
+        if (archived.contains(image.fileName()))
+            continue;
+
+        QHash<QString, MvdUnZip::ZipEntry>::ConstIterator it =
+            previousEntries.constFind(imageRoot + image.fileName());
+        if (it != previousEntries.constEnd() && (qint64)it.value().uncompressedSize == image.size()) {
+            zerr = zipper->copyEntry(&previous, it.key());
+            ++copied;
+        } else files.append(image.absoluteFilePath());
+    }
+
+    previous.closeArchive();
+
+    if (copied != 0)
+        iLog() << QString("MvdCollectionSaver: Copied %1 unchanged images in %2 ms.")
+            .arg(copied).arg(time.elapsed());
+
+    if (zerr == MvdZip::NoError && !files.isEmpty())
+        zerr = zipper->addFiles(files, imageRoot);
+
+    // Any other persistent data
+    QFileInfoList list = QDir(dataPath).entryInfoList(QDir::Files | QDir::Dirs
+        | QDir::NoDotAndDotDot | QDir::NoSymLinks);
+    files.clear();
+    for (int i = 0; i < list.size() && zerr == MvdZip::NoError; ++i) {
+        const QFileInfo &info = list.at(i);
+        if (!info.isDir())
+            files.append(info.absoluteFilePath());
+        else if (info.fileName() != QLatin1String("images"))
+            zerr = zipper->addDirectory(info.absoluteFilePath(), "movida-collection/persistent");
+    }
+
+    if (zerr == MvdZip::NoError && !files.isEmpty())
+        zerr = zipper->addFiles(files, "movida-collection/persistent");
+
+    return zerr;
+}
+
+/*!
+    \internal Writes the XML files and the persistent data to a new archive.
+*/
+MvdCollectionSaver::StatusCode MvdCollectionSaver::Private::writeArchive(MvdMovieCollection *collection,
+    const QString &mmcFilename)
+{
+    MVD_TRACE_SPAN(span, "MvdCollectionSaver::writeArchive", "saver");
 
     MvdZip zipper;
     MvdZip::ErrorCode zerr = zipper.createArchive(mmcFilename);
@@ -304,248 +974,86 @@ MvdCollectionSaver::StatusCode MvdCollectionSaver::save(MvdMovieCollection *coll
     QString dataPath = collection->metaData(MvdMovieCollection::DataPathInfo);
     iLog() << QString("MvdCollectionSaver: Data path: %1").arg(dataPath);
 
-    // cdup to exit the 'persistent' directory
-    QDir dataPathDir(dataPath);
-    dataPathDir.cdUp();
-
-    QString mmcBase = dataPathDir.absolutePath().append("/");
-    iLog() << QString("MvdCollectionSaver: MMC base path: %1").arg(mmcBase);
-
-    QString currFile;
-    QHash<QString, QString> attrs;
-
-    QFile *file = 0;
+    // The XML files are written directly to the archive
+    QIODevice *file = 0;
     MvdXmlWriter *xml = 0;
 
 
     // **************** metadata.xml ****************
 
-    currFile = mmcBase + "metadata.xml";
-
-    file = d->createFile(currFile);
-    if (!file) {
-        paths().removeDirectoryTree(mmcBase, "persistent");
-        return FileOpenError;
-    }
+    file = zipper.openEntry("movida-collection/metadata.xml");
+    if (!file)
+        return ZipError;
 
     xml = new MvdXmlWriter(file);
     xml->setSkipEmptyAttributes(true);
     xml->setSkipEmptyTags(true);
 
-    d->writeDocumentRoot(xml, 1);
-
-    xml->writeOpenTag("info");
-
-    xml->writeTaggedString("movies", QString::number(collection->count()));
-    xml->writeTaggedString("name", collection->metaData(MvdMovieCollection::NameInfo));
-    xml->writeTaggedString("owner", collection->metaData(MvdMovieCollection::OwnerInfo));
-    xml->writeTaggedString("notes", collection->metaData(MvdMovieCollection::NotesInfo));
-    xml->writeTaggedString("email", collection->metaData(MvdMovieCollection::EMailInfo));
-    xml->writeTaggedString("website", collection->metaData(MvdMovieCollection::WebsiteInfo));
-
-    xml->writeCloseTag("info");
+    writeDocumentRoot(xml, 1);
+    writeMetaData(xml, collection);
     xml->writeCloseTag("movida-xml-doc");
 
     delete xml;
-    delete file;
+
+    zerr = zipper.closeEntry();
+    if (zerr != MvdZip::NoError)
+        return ZipError;
 
 
     // **************** SHARED.XML ****************
 
-    currFile = mmcBase + "shared.xml";
-
-    file = d->createFile(currFile);
-    if (file == 0) {
-        paths().removeDirectoryTree(mmcBase, "persistent");
-        return FileOpenError;
-    }
+    file = zipper.openEntry("movida-collection/shared.xml");
+    if (!file)
+        return ZipError;
 
     xml = new MvdXmlWriter(file);
     xml->setSkipEmptyAttributes(true);
     xml->setSkipEmptyTags(true);
 
-    d->writeDocumentRoot(xml, collection->sharedData().countItems());
+    writeDocumentRoot(xml, collection->sharedData().countItems());
 
     MvdSharedData::ItemList sharedData = collection->sharedData().items(Movida::NoRole);
     if (!sharedData.isEmpty()) {
         xml->writeOpenTag("shared-data");
         for (MvdSharedData::ItemList::ConstIterator it = sharedData.constBegin();
-             it != sharedData.constEnd(); ++it) {
-            mvdid id = it.key();
-            const MvdSdItem &item = it.value();
-
-            attrs.insert("id", QString::number(id));
-            attrs.insert("type", MvdSharedData::roleToString(item.role));
-            xml->writeOpenTag("shared-item", attrs);
-            attrs.clear();
-
-            xml->writeTaggedString("value", item.value);
-            xml->writeTaggedString("description", item.description);
-            xml->writeTaggedString("identifier", item.id);
-            if (!item.urls.isEmpty()) {
-                xml->writeOpenTag("urls");
-                for (int i = 0; i < item.urls.size(); ++i) {
-                    const MvdUrl &url = item.urls.at(i);
-                    attrs.insert("description", url.description);
-                    if (url.isDefault)
-                        attrs.insert("default", "true");
-                    xml->writeTaggedString("url", url.url);
-                    attrs.clear();
-                }
-                xml->writeCloseTag("urls");
-            }
-
-            xml->writeCloseTag("shared-item");
-        }
+             it != sharedData.constEnd(); ++it)
+            writeSharedItem(xml, it.key(), it.value());
         xml->writeCloseTag("shared-data");
     }
 
     xml->writeCloseTag("movida-xml-doc");
 
     delete xml;
-    delete file;
+
+    zerr = zipper.closeEntry();
+    if (zerr != MvdZip::NoError)
+        return ZipError;
 
 
     // **************** COLLECTION.XML ****************
 
-    currFile = mmcBase + "collection.xml";
-
-    file = d->createFile(currFile);
-    if (file == 0) {
-        paths().removeDirectoryTree(mmcBase, "persistent");
-        return FileOpenError;
-    }
+    file = zipper.openEntry("movida-collection/collection.xml");
+    if (!file)
+        return ZipError;
 
     xml = new MvdXmlWriter(file);
     xml->setSkipEmptyAttributes(true);
     xml->setSkipEmptyTags(true);
 
-    d->writeDocumentRoot(xml, collection->count());
+    writeDocumentRoot(xml, collection->count());
 
     MvdMovieCollection::MovieList movies = collection->movies();
 
-    QStringList persistentData;
-
-    QDir imgDir(dataPath + "/images");
-    QStringList storedImages = imgDir.entryList(QDir::Files | QDir::NoDotAndDotDot);
-    for (int i = 0; i < storedImages.size(); ++i)
-        persistentData.append(QString("images/").append(storedImages.at(i)));
-
     if (!movies.isEmpty()) {
         xml->writeOpenTag("movies");
 
+        int written = 0;
         for (MvdMovieCollection::MovieList::ConstIterator it = movies.constBegin();
              it != movies.constEnd(); ++it) {
-            const MvdMovie &movie = it.value();
-
-            xml->writeOpenTag("movie");
-
-            xml->writeTaggedString("title", movie.title());
-            xml->writeTaggedString("original-title", movie.originalTitle());
-            xml->writeTaggedString("running-time", QString::number(movie.runningTime()));
-            xml->writeTaggedString("year", movie.year());
-            xml->writeTaggedString("rating", QString::number(movie.rating()));
-            xml->writeTaggedString("imdb-id", movie.imdbId());
-            xml->writeCDataString("notes", movie.notes());
-            xml->writeCDataString("plot", movie.plot());
-            xml->writeTaggedString("storage-id", movie.storageId());
-            if (movie.hasSpecialTagEnabled(Movida::SeenTag))
-                xml->writeTaggedString("seen", "true");
-            if (movie.hasSpecialTagEnabled(Movida::LoanedTag))
-                xml->writeTaggedString("loaned", "true");
-            if (movie.hasSpecialTagEnabled(Movida::SpecialTag))
-                xml->writeTaggedString("special", "true");
-
-            QList<MvdRoleItem> persons = movie.actors();
-            if (!persons.isEmpty()) {
-                xml->writeOpenTag("cast");
-                d->writePersonList(xml, persons);
-                xml->writeCloseTag("cast");
-            }
-
-            persons = movie.crewMembers();
-            if (!persons.isEmpty()) {
-                xml->writeOpenTag("crew");
-                d->writePersonList(xml, persons);
-                xml->writeCloseTag("crew");
-            }
-
-            QList<mvdid> ids = movie.directors();
-            if (!ids.isEmpty()) {
-                xml->writeOpenTag("directors");
-                d->writePersonList(xml, ids);
-                xml->writeCloseTag("directors");
-            }
-
-            ids = movie.producers();
-            if (!ids.isEmpty()) {
-                xml->writeOpenTag("producers");
-                d->writePersonList(xml, ids);
-                xml->writeCloseTag("producers");
-            }
-
-            ids = movie.genres();
-            if (!ids.isEmpty()) {
-                xml->writeOpenTag("genres");
-                d->writeIdList(xml, ids, "genre");
-                xml->writeCloseTag("genres");
-            }
+            if ((++written % 100) == 0)
+                emit q->progress(15 + (65 * written) / movies.size());
 
-            ids = movie.countries();
-            if (!ids.isEmpty()) {
-                xml->writeOpenTag("countries");
-                d->writeIdList(xml, ids, "country");
-                xml->writeCloseTag("countries");
-            }
-
-            ids = movie.languages();
-            if (!ids.isEmpty()) {
-                xml->writeOpenTag("languages");
-                d->writeIdList(xml, ids, "language");
-                xml->writeCloseTag("languages");
-            }
-
-            ids = movie.tags();
-            if (!ids.isEmpty()) {
-                xml->writeOpenTag("tags");
-                d->writeIdList(xml, ids, "tag");
-                xml->writeCloseTag("tags");
-            }
-
-            Movida::ColorMode cmode = movie.colorMode();
-            if (cmode != Movida::UnknownColorMode)
-                xml->writeTaggedString("color-mode",
-                    cmode == Movida::Color ? "color" : "bw");
-
-            QList<MvdUrl> urls = movie.urls();
-            if (!urls.isEmpty()) {
-                xml->writeOpenTag("urls");
-                d->writeUrlList(xml, urls);
-                xml->writeCloseTag("urls");
-            }
-
-            QStringList list = movie.specialContents();
-            if (!list.isEmpty()) {
-                xml->writeOpenTag("special-contents");
-                d->writeStringList(xml, list, "item");
-                xml->writeCloseTag("special-contents");
-            }
-
-            //! \todo regenerate name if there are possible name clashes (iow. poster filename = HASH.PROG_ID but no other filed named HASH exists any more)
-            QString poster = movie.poster();
-            if (!poster.isEmpty()) {
-                xml->writeTaggedString("poster", poster);
-                persistentData.removeAll(poster.prepend("images/"));
-            }
-
-            QHash<QString, QVariant> extra = movie.extendedAttributes();
-            if (!extra.isEmpty()) {
-                xml->writeOpenTag(QLatin1String("extended-attributes"));
-                d->writeDataList(xml, extra, QLatin1String("attribute"), QLatin1String("name"));
-                xml->writeCloseTag(QLatin1String("extended-attributes"));
-            }
-
-            xml->writeCloseTag("movie");
+            writeMovie(xml, it.key(), it.value());
         }
 
         xml->writeCloseTag("movies");
@@ -555,17 +1063,18 @@ MvdCollectionSaver::StatusCode MvdCollectionSaver::save(MvdMovieCollection *coll
     xml->writeCloseTag("movida-xml-doc");
 
     delete xml;
-    delete file;
 
-    // **************** remove unused persistent data ****************
-    for (int i = 0; i < persistentData.size(); ++i)
-        QFile::remove(dataPath + "/" + persistentData.at(i));
+    zerr = zipper.closeEntry();
+    if (zerr != MvdZip::NoError)
+        return ZipError;
+
+    emit q->progress(80);
 
     // **************** ZIP IT! ****************
 
-    zerr = zipper.addDirectory(mmcBase, "movida-collection", MvdZip::IgnoreRootOption);
-
-    paths().removeDirectoryTree(mmcBase, "persistent");
+    // Add the images and any other persistent data
+    zipper.setProgressHandler(q, "zipProgress");
+    zerr = addPersistentData(collection, &zipper);
 
     if (!zerr == MvdZip::NoError) {
         eLog() << QString("MvdCollectionSaver: Unable to add files to zip archive (%1): %2")
@@ -580,15 +1089,188 @@ MvdCollectionSaver::StatusCode MvdCollectionSaver::save(MvdMovieCollection *coll
         return ZipError;
     }
 
+    emit q->progress(100);
+
+    return NoError;
+}
+
+
+/************************************************************************
+    MvdCollectionSaver
+ *************************************************************************/
+
+MvdCollectionSaver::MvdCollectionSaver(QObject *parent) :
+    QObject(parent),
+    d(new Private(this))
+{ }
+
+MvdCollectionSaver::~MvdCollectionSaver()
+{
+    if (d->thread) {
+        d->thread->wait();
+        delete d->thread;
+    }
+
+    delete d->snapshot;
+    delete d;
+}
+
+/*!
+    Sets how the collection is written to file. The default is FullSaveMode.
+
+    In JournaledSaveMode the movies and shared items changed since the
+    collection has been saved or loaded are appended to the archive as a
+    journal record, which MvdCollectionLoader applies when the collection
+    is loaded. The whole collection is written again when the journal grows
+    beyond the "mvdcore/journal-compaction-percent" parameter, when the
+    collection is saved to a different file or if the file has been changed
+    by someone else. Use saveInBackground() to compact the journal in a
+    separate thread.
+*/
+void MvdCollectionSaver::setSaveMode(SaveMode mode)
+{
+    d->saveMode = mode;
+}
+
+/*!
+    Returns how the collection is written to file.
+*/
+MvdCollectionSaver::SaveMode MvdCollectionSaver::saveMode() const
+{
+    return d->saveMode;
+}
+
+/*!
+    Attempts to write the collection to file using the given filename or
+    the collection's filename (if \p mmcFilename is empty).
+*/
+MvdCollectionSaver::StatusCode MvdCollectionSaver::save(MvdMovieCollection *collection, QString mmcFilename)
+{
+    if (isSaving()) {
+        eLog() << "MvdCollectionSaver: A background save is still running.";
+        return UnknownError;
+    }
+
+    bool storeFilename;
+    StatusCode res = d->prepare(collection, &mmcFilename, &storeFilename);
+    if (res != NoError)
+        return res;
+
+    res = d->write(collection, mmcFilename);
+    d->updateJournalInfo(collection, res);
+    if (res != NoError)
+        return res;
+
     if (storeFilename) {
         QFileInfo fi(mmcFilename);
         collection->setFileName(fi.completeBaseName());
         collection->setPath(fi.absoluteFilePath());
     }
 
+    collection->notifySaved(collection->revision());
+
     return NoError;
 }
 
+/*!
+    Same as save() but the collection is written in a separate thread.
+    A snapshot of the collection is taken, so the collection can be modified
+    while it is being saved. Returns false if the save could not be started.
+
+    The progress() signal is emitted while the collection is being written
+    and the finished() signal with a StatusCode value when done.
+    MvdMovieCollection::notifySaved() is called on success, so the modified
+    status is only reset if the collection has not been changed in the
+    meantime.
+*/
+bool MvdCollectionSaver::saveInBackground(MvdMovieCollection *collection, QString mmcFilename)
+{
+    if (isSaving()) {
+        wLog() << "MvdCollectionSaver: A background save is already running.";
+        return false;
+    }
+
+    bool storeFilename;
+    StatusCode res = d->prepare(collection, &mmcFilename, &storeFilename);
+    if (res != NoError)
+        return false;
+
+    d->collection = collection;
+    d->snapshot = collection->createSnapshot();
+    d->revision = collection->revision();
+    d->fileName = mmcFilename;
+    d->storeFilename = storeFilename;
+    d->status = UnknownError;
+
+    if (!d->thread) {
+        d->thread = new Private::Thread(d);
+        connect(d->thread, SIGNAL(finished()), this, SLOT(backgroundSaveFinished()));
+    }
+
+    iLog() << QString("MvdCollectionSaver: Saving collection in background: %1").arg(mmcFilename);
+    d->thread->start(QThread::LowPriority);
+    return true;
+}
+
+/*!
+    Returns true if a background save has been started and the finished()
+    signal has not been emitted yet.
+*/
+bool MvdCollectionSaver::isSaving() const
+{
+    return d->snapshot != 0;
+}
+
+/*!
+    Blocks until the current background save (if any) has finished.
+    The finished() signal is emitted before returning.
+*/
+void MvdCollectionSaver::waitForFinished()
+{
+    if (!isSaving())
+        return;
+
+    d->thread->wait();
+    backgroundSaveFinished();
+}
+
+//! \internal Called in the saver's thread when the background save is done.
+void MvdCollectionSaver::backgroundSaveFinished()
+{
+    if (!isSaving())
+        return;
+
+    delete d->snapshot;
+    d->snapshot = 0;
+
+    StatusCode res = d->status;
+    MvdMovieCollection *collection = d->collection;
+    d->collection = 0;
+
+    if (collection)
+        d->updateJournalInfo(collection, res);
+
+    if (res == NoError && collection) {
+        if (d->storeFilename) {
+            QFileInfo fi(d->fileName);
+            collection->setFileName(fi.completeBaseName());
+            collection->setPath(fi.absoluteFilePath());
+        }
+
+        collection->notifySaved(d->revision);
+    }
+
+    iLog() << QString("MvdCollectionSaver: Background save finished with status %1.").arg((int)res);
+    emit finished((int)res);
+}
+
+
+//! \internal Maps the compression progress to the last part of the save operation.
+void MvdCollectionSaver::zipProgress(int percent)
+{
+    emit progress(80 + (19 * percent) / 100);
+}
+
 void MvdCollectionSaver::setProgressHandler(QObject *receiver, const char *member)
 {
     if (!receiver || !member)
@@ -41,12 +41,32 @@ public:
         UnknownError
     };
 
+    enum SaveMode {
+        FullSaveMode = 0,
+        JournaledSaveMode
+    };
+
     MvdCollectionSaver(QObject * parent = 0);
     virtual ~MvdCollectionSaver();
 
+    void setSaveMode(SaveMode mode);
+    SaveMode saveMode() const;
+
     void setProgressHandler(QObject *receiver, const char *member);
     StatusCode save(MvdMovieCollection *collection, QString file = QString());
 
+    bool saveInBackground(MvdMovieCollection *collection, QString file = QString());
+    bool isSaving() const;
+    void waitForFinished();
+
+signals:
+    void progress(int percent);
+    void finished(int status);
+
+private slots:
+    void backgroundSaveFinished();
+    void zipProgress(int percent);
+
 private:
     class Private;
     Private *d;
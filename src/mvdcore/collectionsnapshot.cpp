@@ -0,0 +1,530 @@
+/**************************************************************************
+** Filename: collectionsnapshot.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#include "collectionsnapshot.h"
+
+#include "logger.h"
+#include "md5.h"
+#include "movie.h"
+#include "moviecollection.h"
+#include "pathresolver.h"
+#include "sditem.h"
+#include "shareddata.h"
+#include "trace.h"
+#include "unzip.h"
+
+#include <QtCore/QBuffer>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QThread>
+#include <QtCore/QTime>
+
+using namespace Movida;
+
+/*!
+    \class MvdCollectionSnapshot collectionsnapshot.h
+    \ingroup MvdCore
+
+    \brief Binary copy of the movies and shared data of a collection archive.
+
+    Parsing the XML files of a large collection takes much longer than
+    reading the same data in binary form, so MvdCollectionSaver writes a
+    snapshot of the collection after each full save (journaled saves leave
+    it stale) and MvdCollectionLoader after loading an archive without a
+    valid snapshot.
+
+    Snapshots are stored in the user resources directory and are only
+    used if the archive checksum (see archiveChecksum()) still matches,
+    i.e. if the archive has not been changed since the snapshot was written.
+
+    The file starts with a fixed size header containing the item counts and
+    the offset of the shared data and movie sections, followed by the
+    archive checksum and the collection metadata. The file is mapped into
+    memory when possible, so only the pages that are actually read are
+    loaded.
+*/
+
+namespace {
+const quint32 snapshotMagic = 0x4d564453; // "MVDS"
+const quint32 snapshotVersion = 2;
+
+// Magic, version, item counts and section offsets
+const qint64 offsetsPosition = 16;
+
+//! Writes a list of shared item IDs, mapped to their ID in the archive.
+void writeIds(QDataStream &out, const QList<mvdid> &ids,
+    const MvdMovieCollection::JournalInfo &archiveIds)
+{
+    out << (qint32)ids.size();
+    for (int i = 0; i < ids.size(); ++i)
+        out << archiveIds.archiveSharedItemId(ids.at(i));
+}
+
+//! Reads a list of shared item IDs, skipping IDs that are not in \p idMapper.
+QList<mvdid> readIds(QDataStream &in, const QHash<mvdid, mvdid> &idMapper)
+{
+    QList<mvdid> ids;
+    qint32 count = 0;
+    in >> count;
+
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        mvdid id;
+        in >> id;
+        QHash<mvdid, mvdid>::ConstIterator it = idMapper.constFind(id);
+        if (it != idMapper.constEnd())
+            ids.append(it.value());
+    }
+
+    return ids;
+}
+
+//! Writes a list of persons and roles, see writeIds().
+void writeRoleItems(QDataStream &out, const QList<MvdRoleItem> &items,
+    const MvdMovieCollection::JournalInfo &archiveIds)
+{
+    out << (qint32)items.size();
+    for (int i = 0; i < items.size(); ++i)
+        out << archiveIds.archiveSharedItemId(items.at(i).first) << items.at(i).second;
+}
+
+//! Reads a list of persons and roles, see readIds().
+QList<MvdRoleItem> readRoleItems(QDataStream &in, const QHash<mvdid, mvdid> &idMapper)
+{
+    QList<MvdRoleItem> items;
+    qint32 count = 0;
+    in >> count;
+
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        mvdid id;
+        QStringList roles;
+        in >> id >> roles;
+        QHash<mvdid, mvdid>::ConstIterator it = idMapper.constFind(id);
+        if (it != idMapper.constEnd())
+            items.append(MvdRoleItem(it.value(), roles));
+    }
+
+    return items;
+}
+
+void writeUrls(QDataStream &out, const QList<MvdUrl> &urls)
+{
+    out << (qint32)urls.size();
+    for (int i = 0; i < urls.size(); ++i) {
+        const MvdUrl &url = urls.at(i);
+        out << url.url << url.description << url.isDefault;
+    }
+}
+
+QList<MvdUrl> readUrls(QDataStream &in)
+{
+    QList<MvdUrl> urls;
+    qint32 count = 0;
+    in >> count;
+
+    for (qint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        MvdUrl url;
+        in >> url.url >> url.description >> url.isDefault;
+        urls.append(url);
+    }
+
+    return urls;
+}
+}
+
+
+/************************************************************************
+    MvdCollectionSnapshot::Private
+ *************************************************************************/
+
+//! \internal
+class MvdCollectionSnapshot::Private
+{
+public:
+    Private() :
+        data(0),
+        sharedItems(0),
+        movies(0),
+        sharedRead(0),
+        moviesRead(0),
+        moviesOffset(0),
+        readingMovies(false)
+    { }
+
+    QFile file;
+    uchar *data;
+    QByteArray bytes;
+    QBuffer buffer;
+    QDataStream stream;
+
+    QHash<QString, QString> metadata;
+    qint32 sharedItems;
+    qint32 movies;
+    qint32 sharedRead;
+    qint32 moviesRead;
+    qint64 moviesOffset;
+    bool readingMovies;
+};
+
+
+/************************************************************************
+    MvdCollectionSnapshot
+ *************************************************************************/
+
+MvdCollectionSnapshot::MvdCollectionSnapshot() :
+    d(new Private)
+{ }
+
+MvdCollectionSnapshot::~MvdCollectionSnapshot()
+{
+    close();
+    delete d;
+}
+
+/*!
+    Returns a checksum of the archive contents, computed from the names,
+    CRC32 values and sizes in the central directory, so that no entry needs
+    to be read.
+*/
+QString MvdCollectionSnapshot::archiveChecksum(MvdUnZip *archive)
+{
+    Q_ASSERT(archive);
+
+    QByteArray data;
+    QList<MvdUnZip::ZipEntry> entries = archive->entryList();
+    for (int i = 0; i < entries.size(); ++i) {
+        const MvdUnZip::ZipEntry &entry = entries.at(i);
+        data.append(entry.filename.toUtf8());
+        data.append(QString(":%1:%2:%3\n").arg(entry.crc32)
+            .arg(entry.compressedSize).arg(entry.uncompressedSize).toAscii());
+    }
+
+    return MvdMd5::hashData(data);
+}
+
+//! Returns the path of the snapshot for \p archive.
+QString MvdCollectionSnapshot::snapshotPath(const QString &archive)
+{
+    QString name = MvdMd5::hashData(QFileInfo(archive).absoluteFilePath().toUtf8());
+    return paths().resourcesDir(Movida::UserScope).append("Snapshots/").append(name).append(".mvds");
+}
+
+/*!
+    Writes a snapshot of \p collection for \p archive. \p checksum is the
+    checksum of the archive the collection has been written to or loaded
+    from. Only reads from \p collection, so it can run in a separate thread
+    on a collection snapshot.
+
+    Movies and shared items are stored with their ID in the archive (see
+    MvdMovieCollection::JournalInfo), so that the IDs of a collection loaded
+    from the snapshot match the IDs used by the journal records.
+*/
+bool MvdCollectionSnapshot::write(MvdMovieCollection *collection, const QString &archive,
+    const QString &checksum)
+{
+    Q_ASSERT(collection);
+
+    MVD_TRACE_SPAN(span, "MvdCollectionSnapshot::write", "snapshot");
+    MVD_TRACE_COUNTER(span, "movies", collection->count());
+
+    const QString path = snapshotPath(archive);
+    if (!QDir().mkpath(QFileInfo(path).absolutePath()))
+        return false;
+
+    QTime time;
+    time.start();
+
+    // The snapshot is written to a temporary file first so that no partial
+    // snapshot is ever read
+    const QString tmp = path + QString(".%1.tmp").arg((quintptr)QThread::currentThreadId());
+    QFile file(tmp);
+    if (!file.open(QIODevice::WriteOnly)) {
+        wLog() << QString("MvdCollectionSnapshot: Unable to write %1").arg(tmp);
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_4_0);
+
+    QHash<QString, QString> metadata;
+    metadata.insert("name", collection->metaData(MvdMovieCollection::NameInfo));
+    metadata.insert("owner", collection->metaData(MvdMovieCollection::OwnerInfo));
+    metadata.insert("notes", collection->metaData(MvdMovieCollection::NotesInfo));
+    metadata.insert("email", collection->metaData(MvdMovieCollection::EMailInfo));
+    metadata.insert("website", collection->metaData(MvdMovieCollection::WebsiteInfo));
+
+    const MvdSharedData::ItemList items = collection->sharedData().items(Movida::NoRole);
+    const MvdMovieCollection::MovieList movies = collection->movies();
+    const MvdMovieCollection::JournalInfo archiveIds = collection->journalInfo();
+
+    // The offsets are written when the sections are complete
+    out << snapshotMagic << snapshotVersion << (qint32)items.size() << (qint32)movies.size()
+        << (qint64)0 << (qint64)0 << checksum << metadata;
+
+    const qint64 sharedOffset = file.pos();
+    for (MvdSharedData::ItemList::ConstIterator it = items.constBegin(); it != items.constEnd(); ++it) {
+        const MvdSdItem &item = it.value();
+        out << archiveIds.archiveSharedItemId(it.key()) << (qint32)item.role
+            << item.value << item.description << item.id;
+        writeUrls(out, item.urls);
+    }
+
+    const qint64 moviesOffset = file.pos();
+    for (MvdMovieCollection::MovieList::ConstIterator it = movies.constBegin(); it != movies.constEnd(); ++it) {
+        const MvdMovie &movie = it.value();
+        out << archiveIds.archiveMovieId(it.key()) << movie.title() << movie.originalTitle() << movie.year()
+            << movie.imdbId() << movie.plot() << movie.notes() << movie.storageId()
+            << movie.poster() << movie.runningTime() << movie.rating()
+            << (qint32)movie.colorMode() << (qint32)movie.specialTags()
+            << movie.specialContents() << movie.extendedAttributes();
+        writeIds(out, movie.languages(), archiveIds);
+        writeIds(out, movie.countries(), archiveIds);
+        writeIds(out, movie.tags(), archiveIds);
+        writeIds(out, movie.genres(), archiveIds);
+        writeIds(out, movie.directors(), archiveIds);
+        writeIds(out, movie.producers(), archiveIds);
+        writeRoleItems(out, movie.crewMembers(), archiveIds);
+        writeRoleItems(out, movie.actors(), archiveIds);
+        writeUrls(out, movie.urls());
+    }
+
+    bool ok = out.status() == QDataStream::Ok && file.seek(offsetsPosition);
+    if (ok) {
+        out << sharedOffset << moviesOffset;
+        ok = out.status() == QDataStream::Ok && file.flush();
+    }
+
+    file.close();
+
+    if (!ok) {
+        wLog() << QString("MvdCollectionSnapshot: Unable to write %1").arg(tmp);
+        QFile::remove(tmp);
+        return false;
+    }
+
+    QFile::remove(path);
+    if (!QFile::rename(tmp, path)) {
+        QFile::remove(tmp);
+        return false;
+    }
+
+    iLog() << QString("MvdCollectionSnapshot: Snapshot of %1 written in %2 ms.")
+        .arg(archive).arg(time.elapsed());
+    return true;
+}
+
+//! Removes the snapshot for \p archive.
+void MvdCollectionSnapshot::remove(const QString &archive)
+{
+    QFile::remove(snapshotPath(archive));
+}
+
+/*!
+    Opens the snapshot for \p archive. Returns false if there is no
+    snapshot, if it has been written by a different version or if
+    \p checksum does not match the checksum of the archive the snapshot
+    has been written for.
+*/
+bool MvdCollectionSnapshot::open(const QString &archive, const QString &checksum)
+{
+    close();
+
+    d->file.setFileName(snapshotPath(archive));
+    if (!d->file.exists() || !d->file.open(QIODevice::ReadOnly))
+        return false;
+
+    const qint64 size = d->file.size();
+    d->data = d->file.map(0, size);
+    if (d->data)
+        d->bytes = QByteArray::fromRawData((const char *)d->data, (int)size);
+    else d->bytes = d->file.readAll();
+
+    d->buffer.setData(d->bytes);
+    d->buffer.open(QIODevice::ReadOnly);
+    d->stream.setDevice(&d->buffer);
+    d->stream.setVersion(QDataStream::Qt_4_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint64 sharedOffset = 0;
+    QString snapshotChecksum;
+
+    d->stream >> magic >> version;
+    if (magic != snapshotMagic || version != snapshotVersion) {
+        iLog() << QString("MvdCollectionSnapshot: Ignoring incompatible snapshot for %1").arg(archive);
+        close();
+        return false;
+    }
+
+    d->stream >> d->sharedItems >> d->movies >> sharedOffset >> d->moviesOffset
+        >> snapshotChecksum >> d->metadata;
+
+    if (d->stream.status() != QDataStream::Ok || snapshotChecksum != checksum
+        || sharedOffset <= 0 || sharedOffset > size
+        || d->moviesOffset < sharedOffset || d->moviesOffset > size) {
+        iLog() << QString("MvdCollectionSnapshot: Ignoring stale snapshot for %1").arg(archive);
+        close();
+        return false;
+    }
+
+    d->buffer.seek(sharedOffset);
+    return true;
+}
+
+//! Closes the snapshot and releases the mapped file.
+void MvdCollectionSnapshot::close()
+{
+    d->stream.setDevice(0);
+    d->buffer.close();
+    d->buffer.setData(QByteArray());
+    d->bytes.clear();
+
+    if (d->data) {
+        d->file.unmap(d->data);
+        d->data = 0;
+    }
+
+    d->file.close();
+
+    d->metadata.clear();
+    d->sharedItems = d->movies = 0;
+    d->sharedRead = d->moviesRead = 0;
+    d->moviesOffset = 0;
+    d->readingMovies = false;
+}
+
+//! Returns true if a valid snapshot has been opened.
+bool MvdCollectionSnapshot::isOpen() const
+{
+    return d->stream.device() != 0;
+}
+
+//! Returns the collection metadata stored in the snapshot.
+QHash<QString, QString> MvdCollectionSnapshot::metaData() const
+{
+    return d->metadata;
+}
+
+//! Returns the number of shared items in the snapshot.
+int MvdCollectionSnapshot::sharedItemCount() const
+{
+    return d->sharedItems;
+}
+
+//! Returns the number of movies in the snapshot.
+int MvdCollectionSnapshot::movieCount() const
+{
+    return d->movies;
+}
+
+/*!
+    Reads the next shared item and its ID in the snapshot. Returns false
+    if all the items have been read or if the snapshot is corrupted.
+    Shared items must be read before any movie.
+*/
+bool MvdCollectionSnapshot::readSharedItem(mvdid *id, MvdSdItem *item)
+{
+    Q_ASSERT(id && item);
+
+    if (!isOpen() || d->readingMovies || d->sharedRead >= d->sharedItems)
+        return false;
+
+    qint32 role = 0;
+    *item = MvdSdItem();
+    d->stream >> *id >> role >> item->value >> item->description >> item->id;
+    item->urls = readUrls(d->stream);
+    item->role = (Movida::DataRole)role;
+
+    if (d->stream.status() != QDataStream::Ok)
+        return false;
+
+    ++d->sharedRead;
+    return true;
+}
+
+/*!
+    Reads the next movie and its ID in the snapshot. Shared item IDs are
+    mapped to the IDs in the collection using \p idMapper. Returns false
+    if all the movies have been read or if the snapshot is corrupted.
+*/
+bool MvdCollectionSnapshot::readMovie(mvdid *id, MvdMovie *movie,
+    const QHash<mvdid, mvdid> &idMapper)
+{
+    Q_ASSERT(id && movie);
+
+    if (!isOpen() || d->moviesRead >= d->movies)
+        return false;
+
+    if (!d->readingMovies) {
+        d->buffer.seek(d->moviesOffset);
+        d->readingMovies = true;
+    }
+
+    QString title, originalTitle, year, imdbId, plot, notes, storageId, poster;
+    quint16 runningTime = 0;
+    quint8 rating = 0;
+    qint32 colorMode = 0;
+    qint32 specialTags = 0;
+    QStringList specialContents;
+    QHash<QString, QVariant> extra;
+
+    d->stream >> *id >> title >> originalTitle >> year >> imdbId >> plot >> notes
+        >> storageId >> poster >> runningTime >> rating >> colorMode >> specialTags
+        >> specialContents >> extra;
+
+    MvdMovie m;
+    m.setTitle(title);
+    m.setOriginalTitle(originalTitle);
+    m.setYear(year);
+    m.setImdbId(imdbId);
+    m.setPlot(plot);
+    m.setNotes(notes);
+    m.setStorageId(storageId);
+    m.setPoster(poster);
+    m.setRunningTime(runningTime);
+    m.setRating(rating);
+    m.setColorMode((Movida::ColorMode)colorMode);
+    m.setSpecialTags((Movida::Tags)specialTags);
+    m.setSpecialContents(specialContents);
+    m.setExtendedAttributes(extra);
+    m.setLanguages(readIds(d->stream, idMapper));
+    m.setCountries(readIds(d->stream, idMapper));
+    m.setTags(readIds(d->stream, idMapper));
+    m.setGenres(readIds(d->stream, idMapper));
+    m.setDirectors(readIds(d->stream, idMapper));
+    m.setProducers(readIds(d->stream, idMapper));
+    m.setCrewMembers(readRoleItems(d->stream, idMapper));
+    m.setActors(readRoleItems(d->stream, idMapper));
+    m.setUrls(readUrls(d->stream));
+
+    if (d->stream.status() != QDataStream::Ok)
+        return false;
+
+    *movie = m;
+    ++d->moviesRead;
+    return true;
+}
+
+//! Returns true if all the shared items and movies have been read.
+bool MvdCollectionSnapshot::atEnd() const
+{
+    return d->sharedRead >= d->sharedItems && d->moviesRead >= d->movies;
+}
@@ -0,0 +1,65 @@
+/**************************************************************************
+** Filename: collectionsnapshot.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_COLLECTIONSNAPSHOT_H
+#define MVD_COLLECTIONSNAPSHOT_H
+
+#include "global.h"
+
+#include <QtCore/QHash>
+#include <QtCore/QString>
+
+class MvdMovie;
+class MvdMovieCollection;
+class MvdSdItem;
+class MvdUnZip;
+
+class MVD_EXPORT MvdCollectionSnapshot
+{
+public:
+    MvdCollectionSnapshot();
+    ~MvdCollectionSnapshot();
+
+    static QString archiveChecksum(MvdUnZip *archive);
+    static QString snapshotPath(const QString &archive);
+    static bool write(MvdMovieCollection *collection, const QString &archive,
+        const QString &checksum);
+    static void remove(const QString &archive);
+
+    bool open(const QString &archive, const QString &checksum);
+    void close();
+    bool isOpen() const;
+
+    QHash<QString, QString> metaData() const;
+    int sharedItemCount() const;
+    int movieCount() const;
+
+    bool readSharedItem(mvdid *id, MvdSdItem *item);
+    bool readMovie(mvdid *id, MvdMovie *movie, const QHash<mvdid, mvdid> &idMapper);
+    bool atEnd() const;
+
+private:
+    Q_DISABLE_COPY(MvdCollectionSnapshot)
+
+    class Private;
+    Private *d;
+};
+
+#endif // MVD_COLLECTIONSNAPSHOT_H
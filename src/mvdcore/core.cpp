@@ -126,6 +126,20 @@ public:
         parameters.insert("mvdcore/max-poster-kb", 512);
         parameters.insert("mvdcore/max-poster-size", QSize(400, 150));
 
+        // Movies loaded in background are handed to the collection in batches.
+        parameters.insert("mvdcore/loader-batch-size", 100);
+
+        // Journaled saves write the whole collection again when the journal
+        // grows beyond this percentage of the last full save.
+        parameters.insert("mvdcore/journal-compaction-percent", 50);
+        // Binary copies of saved collections are kept to speed up loading.
+        parameters.insert("mvdcore/collection-snapshots", true);
+
+        // Memory used by rendered browser pages and their images.
+        parameters.insert("mvdcore/template-cache-kb", 8192);
+        // Rendered browser pages evicted from memory are written to the temp directory.
+        parameters.insert("mvdcore/template-cache-overflow", false);
+
         parameters.insert("mvdcore/website-url", "http://movida.42cows.org");
 
         // Max length for some string values
@@ -18,14 +18,20 @@
 **
 **************************************************************************/
 
+
 #include "logger.h"
 
 #include "pathresolver.h"
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QDateTime>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
+#include <QtCore/QHash>
 #include <QtCore/QMutex>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
 #include <QtCore/QtGlobal>
 
 #include <stdexcept>
@@ -34,12 +40,40 @@ using namespace Movida;
 
 Q_GLOBAL_STATIC(QMutex, MvdLoggerLock)
 
+namespace {
+//! Log levels overriding the global level for single modules.
+struct ModuleLevels {
+    QReadWriteLock lock;
+    QHash<QByteArray, int> levels;
+};
+}
+
+Q_GLOBAL_STATIC(ModuleLevels, MvdLoggerModuleLevels)
+
 /*!
     \class MvdLogger logger.h
     \ingroup MvdCore Singletons
 
     <b>Movida::iLog()</b>, <b>Movida::eLog()</b> and <b>Movida::wLog()</b> can be used as a
     convenience methods to write information, warning or error messages.
+    <b>Movida::dLog()</b> writes debug messages, which are disabled by default.
+
+    Messages are queued in a lock-free ring buffer and written by a
+    background thread, which flushes the log file once per batch. Error
+    messages and a buffer filling up wake the thread immediately. If the
+    buffer is full, the calling thread writes the queued messages itself, so
+    no message is lost.
+
+    Messages below the current level() are discarded. The level can be
+    overridden for single modules with setModuleLevel(); the module of a
+    message written with the convenience methods is the "ClassName" prefix
+    in the usual "ClassName: message" form. The MVD_ILOG(module) family of
+    macros skips formatting the message entirely when it would be discarded,
+    and MVD_LOG_MIN_LEVEL removes the lower levels at compile time:
+
+    \code
+    MVD_ILOG("MvdSharedData") << QString("MvdSharedData: Item %1 updated.").arg(value);
+    \endcode
 
     \brief Application log handling.
 */
@@ -53,32 +87,223 @@ Q_GLOBAL_STATIC(QMutex, MvdLoggerLock)
 class MvdLogger::Private
 {
 public:
+    enum {
+        //! Number of messages in the ring buffer (a power of 2).
+        Capacity = 4096,
+        //! Milliseconds between two flushes of the log file.
+        FlushInterval = 250
+    };
+
+    //! \internal A ring buffer slot.
+    struct Entry {
+        QAtomicInt sequence;
+        int level;
+        QDateTime time;
+        QString text;
+    };
+
+    class Writer;
+
     Private();
     ~Private();
 
+    int push(int level, const QDateTime &time, const QString &text);
+    void drain();
+    void wakeWriter();
+    QString format(const Entry &entry) const;
+
     QTextStream *stream;
     QFile *file;
+
+    Entry *entries;
+    //! Next position to be written by the producers.
+    QAtomicInt enqueuePos;
+    //! Next position to be read. Guarded by flushLock.
+    int dequeuePos;
+    //! Serializes writes to the log file.
+    QMutex flushLock;
+
+    QMutex waitLock;
+    QWaitCondition waitCondition;
+    Writer *writer;
+    volatile bool stopping;
+
     static bool html;
+    static volatile int level;
+    static volatile bool moduleLevels;
 };
 
 bool MvdLogger::Private::html = false;
+volatile int MvdLogger::Private::level = MvdLogger::InfoLevel;
+volatile bool MvdLogger::Private::moduleLevels = false;
+
+//! \internal Writes the queued messages in the background.
+class MvdLogger::Private::Writer : public QThread
+{
+public:
+    Writer(MvdLogger::Private *p) :
+        QThread(),
+        d(p)
+    {
+        setObjectName(QLatin1String("MvdLogger"));
+    }
+
+protected:
+    void run()
+    {
+        forever {
+            d->waitLock.lock();
+            if (!d->stopping)
+                d->waitCondition.wait(&d->waitLock, FlushInterval);
+            const bool stop = d->stopping;
+            d->waitLock.unlock();
+
+            {
+                QMutexLocker locker(&d->flushLock);
+                d->drain();
+            }
+
+            if (stop)
+                return;
+        }
+    }
+
+private:
+    MvdLogger::Private *d;
+};
 
 //! \internal
 MvdLogger::Private::Private() :
     stream(0),
-    file(0)
-{ }
+    file(0),
+    entries(new Entry[Capacity]),
+    enqueuePos(0),
+    dequeuePos(0),
+    writer(0),
+    stopping(false)
+{
+    for (int i = 0; i < Capacity; ++i)
+        entries[i].sequence = i;
+}
 
 //! \internal
 MvdLogger::Private::~Private()
 {
+    if (writer) {
+        waitLock.lock();
+        stopping = true;
+        waitCondition.wakeOne();
+        waitLock.unlock();
+        writer->wait();
+        delete writer;
+    }
+
     if (stream) {
+        drain();
         if (html)
             *stream << MVD_LINEBREAK << "</body>" << MVD_LINEBREAK << "</html>";
         stream->flush();
     }
     delete stream;
     delete file;
+    delete [] entries;
+}
+
+/*!
+    \internal Queues a message. Returns the position of the message in the
+    buffer or -1 if the buffer is full. Safe to call from any thread.
+*/
+int MvdLogger::Private::push(int level, const QDateTime &time, const QString &text)
+{
+    int pos = enqueuePos;
+    Entry *entry;
+
+    forever {
+        entry = &entries[pos & (Capacity - 1)];
+        const int sequence = entry->sequence.fetchAndAddAcquire(0);
+        const int diff = int(uint(sequence) - uint(pos));
+        if (diff == 0) {
+            if (enqueuePos.testAndSetRelaxed(pos, int(uint(pos) + 1)))
+                break;
+        } else if (diff < 0)
+            return -1;
+        pos = enqueuePos;
+    }
+
+    entry->level = level;
+    entry->time = time;
+    entry->text = text;
+    entry->sequence.fetchAndStoreRelease(int(uint(pos) + 1));
+    return pos;
+}
+
+/*!
+    \internal Writes the queued messages to the log file and flushes it.
+    Messages are written in the order they have been queued: the loop stops
+    at the first slot that is still being filled. flushLock must be held.
+*/
+void MvdLogger::Private::drain()
+{
+    if (!stream)
+        return;
+
+    QString out;
+
+    forever {
+        Entry &entry = entries[dequeuePos & (Capacity - 1)];
+        const int sequence = entry.sequence.fetchAndAddAcquire(0);
+        if (sequence != int(uint(dequeuePos) + 1))
+            break;
+
+        out.append(format(entry));
+        entry.text.clear();
+        entry.sequence.fetchAndStoreRelease(int(uint(dequeuePos) + Capacity));
+        dequeuePos = int(uint(dequeuePos) + 1);
+    }
+
+    if (!out.isEmpty()) {
+        *stream << out;
+        stream->flush();
+    }
+}
+
+//! \internal Wakes the writer thread up before the flush interval has elapsed.
+void MvdLogger::Private::wakeWriter()
+{
+    QMutexLocker locker(&waitLock);
+    waitCondition.wakeOne();
+}
+
+/*!
+    \internal Returns the log line for a message: the timestamp in ISO format
+    and the message type between square brackets, followed by a whitespace
+    and the message.
+    Example: "[2007-01-02T18:11:00 - WARNING] MESSAGE"
+*/
+QString MvdLogger::Private::format(const Entry &entry) const
+{
+    QString line(html ? QString("<br />").append(MVD_LINEBREAK) : QString(MVD_LINEBREAK));
+    line.append(QLatin1Char('[')).append(entry.time.toString(Qt::ISODate)).append(" - ");
+
+    switch (entry.level) {
+        case MvdLogger::DebugLevel:
+            line.append("DEBUG"); break;
+
+        case MvdLogger::InfoLevel:
+            line.append("INFO"); break;
+
+        case MvdLogger::WarningLevel:
+            line.append(html ? "<span style='color:orange;'>WARNING</span>" : "WARNING"); break;
+
+        default:
+            line.append(html ? "<span style='color:red;'>ERROR</span>" : "ERROR");
+    }
+
+    line.append("] ");
+    if (html)
+        line.append(QString(entry.text).replace(MVD_LINEBREAK, QString("<br />").append(MVD_LINEBREAK)));
+    else line.append(entry.text);
+    return line;
 }
 
 /************************************************************************
@@ -118,7 +343,11 @@ MvdLogger::MvdLogger() :
         QString header = QString(QLatin1String("Movida log: application started at %1"))
             .arg(dt.toString(Qt::ISODate)).append(sep);
         *(d->stream) << header << sep;
+        d->stream->flush();
     }
+
+    d->writer = new Private::Writer(d);
+    d->writer->start(QThread::LowPriority);
 }
 
 //! \internal
@@ -141,7 +370,7 @@ MvdLogger &MvdLogger::instance()
     return (MvdLogger &) * mInstance;
 }
 
-//! Destructor.
+//! Destructor. Writes any queued message.
 MvdLogger::~MvdLogger()
 {
     delete d;
@@ -171,208 +400,337 @@ bool MvdLogger::isUsingHtml()
     return MvdLogger::Private::html;
 }
 
+/*!
+    Sets the minimum level of the messages to be written. The default level
+    is InfoLevel. Use NoLevel to disable the log.
+*/
+void MvdLogger::setLevel(Level level)
+{
+    MvdLogger::Private::level = level;
+}
+
+//! Returns the minimum level of the messages to be written.
+MvdLogger::Level MvdLogger::level()
+{
+    return (Level) MvdLogger::Private::level;
+}
+
+/*!
+    Overrides the minimum level for the messages of \p module (usually a
+    class name like "MvdSharedData").
+*/
+void MvdLogger::setModuleLevel(const QString &module, Level level)
+{
+    ModuleLevels *ml = MvdLoggerModuleLevels();
+    QWriteLocker locker(&ml->lock);
+    ml->levels.insert(module.toLatin1(), level);
+    MvdLogger::Private::moduleLevels = true;
+}
+
+//! Removes all the levels set with setModuleLevel().
+void MvdLogger::clearModuleLevels()
+{
+    ModuleLevels *ml = MvdLoggerModuleLevels();
+    QWriteLocker locker(&ml->lock);
+    ml->levels.clear();
+    MvdLogger::Private::moduleLevels = false;
+}
+
+/*!
+    Returns true if messages of the given \p level and \p module are
+    written. The global level is used if \p module is null or has no level
+    of its own.
+*/
+bool MvdLogger::isEnabled(Level level, const char *module)
+{
+    if (module && MvdLogger::Private::moduleLevels) {
+        ModuleLevels *ml = MvdLoggerModuleLevels();
+        QReadLocker locker(&ml->lock);
+        QHash<QByteArray, int>::ConstIterator it =
+            ml->levels.constFind(QByteArray::fromRawData(module, qstrlen(module)));
+        if (it != ml->levels.constEnd())
+            return level >= it.value();
+    }
+
+    return level >= MvdLogger::Private::level;
+}
+
+/*!
+    Writes the queued messages to the log file before returning.
+*/
+void MvdLogger::flush()
+{
+    QMutexLocker locker(&d->flushLock);
+    d->drain();
+}
+
+//! \internal Queues a complete message for the writer thread.
+void MvdLogger::post(Level level, const QDateTime &time, const QString &text)
+{
+    int pos;
+    while ((pos = d->push(level, time, text)) < 0) {
+        // The buffer is full: write the queued messages in this thread
+        QMutexLocker locker(&d->flushLock);
+        d->drain();
+    }
+
+    if (d->stopping) {
+        flush();
+    } else if (level >= ErrorLevel || (pos & (Private::Capacity / 2 - 1)) == 0)
+        d->wakeWriter();
+}
+
+
+/************************************************************************
+    MvdLogMessage
+ *************************************************************************/
+
+/*!
+    \class MvdLogMessage logger.h
+    \ingroup MvdCore
+
+    \brief A single log message.
+
+    The message is built by the streaming operators and queued for the
+    log file when the object is destroyed, that is at the end of the
+    statement for the temporary returned by Movida::iLog() and the other
+    convenience methods. Messages of disabled levels are not built at all.
+*/
+
+/*!
+    Creates a new message with the given \p level. \p module is used to
+    filter the message (see MvdLogger::setModuleLevel()) and must be a
+    string literal. If \p module is null, the module is taken from the
+    "ClassName: " prefix of the message.
+*/
+MvdLogMessage::MvdLogMessage(MvdLogger::Level level, const char *module) :
+    mLevel(level),
+    mModule(module),
+    mActive(true)
+{
+    // The module of the message is not known yet if it has to be parsed
+    if (module || !MvdLogger::Private::moduleLevels)
+        mActive = MvdLogger::isEnabled(level, module);
+    if (mActive)
+        mTime = QDateTime::currentDateTime();
+}
+
+/*!
+    Takes over the message from \p other, which will not be written.
+*/
+MvdLogMessage::MvdLogMessage(const MvdLogMessage &other) :
+    mLevel(other.mLevel),
+    mModule(other.mModule),
+    mTime(other.mTime),
+    mText(other.mText),
+    mActive(other.mActive)
+{
+    other.mActive = false;
+}
+
+//! Queues the message.
+MvdLogMessage::~MvdLogMessage()
+{
+    if (!mActive)
+        return;
+
+    if (!mModule && MvdLogger::Private::moduleLevels) {
+        int sep = mText.indexOf(QLatin1Char(':'));
+        QByteArray module = sep > 0 ? mText.left(sep).toLatin1() : QByteArray();
+        if (!MvdLogger::isEnabled(mLevel, module.isEmpty() ? 0 : module.constData()))
+            return;
+    }
+
+    MvdLogger::instance().post(mLevel, mTime, mText);
+}
+
 //! Writes a single char to the log file.
-MvdLogger &MvdLogger::operator<<(QChar t)
+MvdLogMessage &MvdLogMessage::operator<<(QChar t)
 {
-    *(d->stream) << "\'" << t << "\'";
-    d->stream->flush();
+    if (mActive)
+        mText.append(QLatin1Char('\'')).append(t).append(QLatin1Char('\''));
     return *this;
 }
 
 //! Writes the string representation of a bool to the log file.
-MvdLogger &MvdLogger::operator<<(bool t)
+MvdLogMessage &MvdLogMessage::operator<<(bool t)
 {
-    *(d->stream) << (t ? "true" : "false");
-    d->stream->flush();
+    if (mActive)
+        mText.append(t ? "true" : "false");
     return *this;
 }
 
 //! Writes a single char to the log file.
-MvdLogger &MvdLogger::operator<<(char t)
+MvdLogMessage &MvdLogMessage::operator<<(char t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QLatin1Char(t));
     return *this;
 }
 
 //! Writes a single short to the log file.
-MvdLogger &MvdLogger::operator<<(signed short t)
+MvdLogMessage &MvdLogMessage::operator<<(signed short t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single short to the log file.
-MvdLogger &MvdLogger::operator<<(unsigned short t)
+MvdLogMessage &MvdLogMessage::operator<<(unsigned short t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single int to the log file.
-MvdLogger &MvdLogger::operator<<(signed int t)
+MvdLogMessage &MvdLogMessage::operator<<(signed int t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single int to the log file.
-MvdLogger &MvdLogger::operator<<(unsigned int t)
+MvdLogMessage &MvdLogMessage::operator<<(unsigned int t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single long to the log file.
-MvdLogger &MvdLogger::operator<<(signed long t)
+MvdLogMessage &MvdLogMessage::operator<<(signed long t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single long to the log file.
-MvdLogger &MvdLogger::operator<<(unsigned long t)
+MvdLogMessage &MvdLogMessage::operator<<(unsigned long t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single qint64 to the log file.
-MvdLogger &MvdLogger::operator<<(qint64 t)
+MvdLogMessage &MvdLogMessage::operator<<(qint64 t)
 {
-    *(d->stream) << QString::number(t);
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single quint64 to the log file.
-MvdLogger &MvdLogger::operator<<(quint64 t)
+MvdLogMessage &MvdLogMessage::operator<<(quint64 t)
 {
-    *(d->stream) << QString::number(t);
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single float to the log file.
-MvdLogger &MvdLogger::operator<<(float t)
+MvdLogMessage &MvdLogMessage::operator<<(float t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a single double to the log file.
-MvdLogger &MvdLogger::operator<<(double t)
+MvdLogMessage &MvdLogMessage::operator<<(double t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::number(t));
     return *this;
 }
 
 //! Writes a string to the log file.
-MvdLogger &MvdLogger::operator<<(const char *t)
+MvdLogMessage &MvdLogMessage::operator<<(const char *t)
 {
-    if (MvdLogger::isUsingHtml())
-        *(d->stream) << QString(t).replace(MVD_LINEBREAK, QString("<br />").append(MVD_LINEBREAK));
-    else *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QLatin1String(t));
     return *this;
 }
 
 //! Writes a string to the log file.
-MvdLogger &MvdLogger::operator<<(const QString &t)
+MvdLogMessage &MvdLogMessage::operator<<(const QString &t)
 {
-    if (MvdLogger::isUsingHtml())
-        *(d->stream) << QString(t).replace(MVD_LINEBREAK, QString("<br />").append(MVD_LINEBREAK));
-    else *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(t);
     return *this;
 }
 
 //! Writes a string to the log file.
-MvdLogger &MvdLogger::operator<<(const QLatin1String &t)
+MvdLogMessage &MvdLogMessage::operator<<(const QLatin1String &t)
 {
-    if (MvdLogger::isUsingHtml())
-        *(d->stream) << QString(t).replace(MVD_LINEBREAK, QString("<br />").append(MVD_LINEBREAK));
-    else *(d->stream) << t.latin1();
-    d->stream->flush();
+    if (mActive)
+        mText.append(t);
     return *this;
 }
 
 //! Writes a byte array to the log file.
-MvdLogger &MvdLogger::operator<<(const QByteArray &t)
+MvdLogMessage &MvdLogMessage::operator<<(const QByteArray &t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString::fromLocal8Bit(t.constData(), t.size()));
     return *this;
 }
 
 //! Writes a void pointer to the log file.
-MvdLogger &MvdLogger::operator<<(const void *t)
+MvdLogMessage &MvdLogMessage::operator<<(const void *t)
 {
-    *(d->stream) << t;
-    d->stream->flush();
+    if (mActive)
+        mText.append(QString("0x%1").arg((quintptr) t, 0, 16));
     return *this;
 }
 
-//! Writes a QTextStreamFunction to the log file.
-MvdLogger &MvdLogger::operator<<(QTextStreamFunction f)
+/*!
+    Writes a QTextStreamFunction to the log file. Only endl is supported,
+    other manipulators are ignored.
+*/
+MvdLogMessage &MvdLogMessage::operator<<(QTextStreamFunction f)
 {
-    *(d->stream) << f;
-    d->stream->flush();
+    if (mActive && f == endl)
+        mText.append(MVD_LINEBREAK);
     return *this;
 }
 
 /*!
-    This is mainly for internal use.
-    Writes the current timestamp in ISO format between square brackets,
-    evtl. followed by " - " and \p message (if \p message is not empty).
-    An additional whitespace is added after the closing bracket.
-    Example: "[2007-01-02T18:11:00 - MYMESSAGE] "
+    Convenience method to write a message with the MvdLogger singleton.
+    The message is prefixed with the date and message type (debug in this case).
 */
-MvdLogger &MvdLogger::appendTimestamp(const QString &message)
+MvdLogMessage Movida::dLog()
 {
-    QString timestamp = QDateTime::currentDateTime().toString(Qt::ISODate);
-
-    *(d->stream) << (MvdLogger::isUsingHtml() ? QString("<br />").append(MVD_LINEBREAK) : MVD_LINEBREAK) << (message.isEmpty() ?
-                                                                                                             QString("[%1] ").arg(timestamp) :
-                                                                                                             QString("[%1 - %2] ").arg(timestamp).arg(message));
-    return *this;
+    return MvdLogMessage(MvdLogger::DebugLevel);
 }
 
 /*!
-    Convenience method to access the MvdLogger singleton.
-    Prepends date and message type (error in this case) to the message.
+    Convenience method to write a message with the MvdLogger singleton.
+    The message is prefixed with the date and message type (info in this case).
 */
-MvdLogger &Movida::eLog()
+MvdLogMessage Movida::iLog()
 {
-    QString s = MvdLogger::instance().isUsingHtml() ? "<span style='color:red;'>ERROR</span>" : "ERROR";
-
-    return MvdLogger::instance().appendTimestamp(s);
+    return MvdLogMessage(MvdLogger::InfoLevel);
 }
 
 /*!
-    Convenience method to access the MvdLogger singleton.
-    Prepends date and message type (warning in this case) to the message.
+    Convenience method to write a message with the MvdLogger singleton.
+    The message is prefixed with the date and message type (warning in this case).
 */
-MvdLogger &Movida::wLog()
+MvdLogMessage Movida::wLog()
 {
-    QString s = MvdLogger::instance().isUsingHtml() ? "<span style='color:orange;'>WARNING</span>" : "WARNING";
-
-    return MvdLogger::instance().appendTimestamp(s);
+    return MvdLogMessage(MvdLogger::WarningLevel);
 }
 
 /*!
-    Convenience method to access the MvdLogger singleton.
-    Prepends date and message type (info in this case) to the message.
+    Convenience method to write a message with the MvdLogger singleton.
+    The message is prefixed with the date and message type (error in this case).
 */
-MvdLogger &Movida::iLog()
+MvdLogMessage Movida::eLog()
 {
-    return MvdLogger::instance().appendTimestamp("INFO");
+    return MvdLogMessage(MvdLogger::ErrorLevel);
 }
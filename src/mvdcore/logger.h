@@ -23,46 +23,48 @@
 
 #include "global.h"
 
+#include <QtCore/QDateTime>
 #include <QtCore/QString>
 #include <QtCore/QTextStream>
 
+class MvdLogMessage;
+
 class MVD_EXPORT MvdLogger : public QObject
 {
     Q_OBJECT
 
 public:
+    enum Level {
+        DebugLevel = 0,
+        InfoLevel,
+        WarningLevel,
+        ErrorLevel,
+        NoLevel
+    };
+
     static MvdLogger &instance();
 
     static void setUseHtml(bool useHtml);
     static bool isUsingHtml();
 
-    MvdLogger &operator<<(QChar t);
-    MvdLogger &operator<<(bool t);
-    MvdLogger &operator<<(char t);
-    MvdLogger &operator<<(signed short t);
-    MvdLogger &operator<<(unsigned short t);
-    MvdLogger &operator<<(signed int t);
-    MvdLogger &operator<<(unsigned int t);
-    MvdLogger &operator<<(signed long t);
-    MvdLogger &operator<<(unsigned long t);
-    MvdLogger &operator<<(qint64 t);
-    MvdLogger &operator<<(quint64 t);
-    MvdLogger &operator<<(float t);
-    MvdLogger &operator<<(double t);
-    MvdLogger &operator<<(const char *t);
-    MvdLogger &operator<<(const QString &t);
-    MvdLogger &operator<<(const QLatin1String &t);
-    MvdLogger &operator<<(const QByteArray &t);
-    MvdLogger &operator<<(const void *t);
-    MvdLogger &operator<<(QTextStreamFunction f);
-    inline MvdLogger &appendTimestamp(const QString &message = QString());
+    static void setLevel(Level level);
+    static Level level();
+    static void setModuleLevel(const QString &module, Level level);
+    static void clearModuleLevels();
+    static bool isEnabled(Level level, const char *module = 0);
+
+    void flush();
 
 private:
+    friend class MvdLogMessage;
+
     MvdLogger();
     MvdLogger(const MvdLogger &);
     MvdLogger &operator=(const MvdLogger &);
     virtual ~MvdLogger();
 
+    void post(Level level, const QDateTime &time, const QString &text);
+
     static void create();
     static volatile MvdLogger *mInstance;
     static bool mDestroyed;
@@ -71,10 +73,64 @@ private:
     Private *d;
 };
 
+class MVD_EXPORT MvdLogMessage
+{
+public:
+    MvdLogMessage(MvdLogger::Level level, const char *module = 0);
+    MvdLogMessage(const MvdLogMessage &other);
+    ~MvdLogMessage();
+
+    MvdLogMessage &operator<<(QChar t);
+    MvdLogMessage &operator<<(bool t);
+    MvdLogMessage &operator<<(char t);
+    MvdLogMessage &operator<<(signed short t);
+    MvdLogMessage &operator<<(unsigned short t);
+    MvdLogMessage &operator<<(signed int t);
+    MvdLogMessage &operator<<(unsigned int t);
+    MvdLogMessage &operator<<(signed long t);
+    MvdLogMessage &operator<<(unsigned long t);
+    MvdLogMessage &operator<<(qint64 t);
+    MvdLogMessage &operator<<(quint64 t);
+    MvdLogMessage &operator<<(float t);
+    MvdLogMessage &operator<<(double t);
+    MvdLogMessage &operator<<(const char *t);
+    MvdLogMessage &operator<<(const QString &t);
+    MvdLogMessage &operator<<(const QLatin1String &t);
+    MvdLogMessage &operator<<(const QByteArray &t);
+    MvdLogMessage &operator<<(const void *t);
+    MvdLogMessage &operator<<(QTextStreamFunction f);
+
+private:
+    MvdLogMessage &operator=(const MvdLogMessage &);
+
+    MvdLogger::Level mLevel;
+    const char *mModule;
+    QDateTime mTime;
+    QString mText;
+    mutable bool mActive;
+};
+
 namespace Movida {
-MVD_EXPORT extern MvdLogger &iLog();
-MVD_EXPORT extern MvdLogger &wLog();
-MVD_EXPORT extern MvdLogger &eLog();
+MVD_EXPORT extern MvdLogMessage dLog();
+MVD_EXPORT extern MvdLogMessage iLog();
+MVD_EXPORT extern MvdLogMessage wLog();
+MVD_EXPORT extern MvdLogMessage eLog();
 }
 
+// Messages below this level are removed at compile time by the macros below
+#ifndef MVD_LOG_MIN_LEVEL
+# define MVD_LOG_MIN_LEVEL 0
+#endif
+
+// Same as the Movida::*Log() functions, but the message is not even
+// formatted if the level is disabled for the given module
+#define MVD_LOG(level, module) \
+    if ((level) < MVD_LOG_MIN_LEVEL || !MvdLogger::isEnabled(level, module)) { } \
+    else MvdLogMessage(level, module)
+
+#define MVD_DLOG(module) MVD_LOG(MvdLogger::DebugLevel, module)
+#define MVD_ILOG(module) MVD_LOG(MvdLogger::InfoLevel, module)
+#define MVD_WLOG(module) MVD_LOG(MvdLogger::WarningLevel, module)
+#define MVD_ELOG(module) MVD_LOG(MvdLogger::ErrorLevel, module)
+
 #endif // MVD_LOGGER_H
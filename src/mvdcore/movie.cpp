@@ -1074,7 +1074,7 @@ QString MvdMovie::posterPath(MvdMovieCollection *c) const
 {
     if (!c || d->poster.isEmpty())
         return QString();
-    return c->metaData(MvdMovieCollection::DataPathInfo).append("/images/").append(d->poster);
+    return c->imagePath(d->poster);
 }
 
 /*!
@@ -28,14 +28,17 @@
 #include "moviedata.h"
 #include "pathresolver.h"
 #include "sditem.h"
+#include "unzip.h"
 
 #include <QtCore/QDateTime>
 #include <QtCore/QDir>
 #include <QtCore/QFileInfo>
+#include <QtCore/QMutex>
 #include <QtCore/QUuid>
 #include <QtGui/QPixmap>
 
 #define __COLLECTION_CHANGED \
+    ++d->revision; \
     if (!d->modified) { d->modified = true; emit modified(); } \
     emit changed();
 
@@ -86,6 +89,9 @@ class MvdMovieCollection::Private
 public:
     Private();
     Private(const MvdMovieCollection::Private &m);
+    ~Private();
+
+    class ImageArchive;
 
     typedef QList<QuickLookupEntry> QuickLookupList;
     typedef QHash<QString, QuickLookupList> QuickLookupTable;
@@ -107,15 +113,127 @@ public:
     QuickLookupTable quickLookupTable;
     MvdMovieCollection::MovieList movies;
 
+    // All the movies and the movies with each special tag
+    MvdBitmap movieBitmap;
+    QHash<int, MvdBitmap> tagBitmaps;
+
+    void indexTags(mvdid id, Movida::Tags tags);
+    void unindexTags(mvdid id, Movida::Tags tags);
+
     mvdid id;
     bool modified;
+    uint revision;
 
     QString fileName;
     QString path;
 
     MvdSharedData smd;
+
+    // Images that are still stored in the collection archive, shared
+    // with the copies of this collection, see setImageArchive()
+    ImageArchive *images;
+
+    void resetImageArchive();
+
+    // Journal of the collection file and revision of the last change to
+    // each movie since the journal revision, see setJournalInfo()
+    MvdMovieCollection::JournalInfo journal;
+    QHash<mvdid, uint> changes;
+
+    inline void touch(mvdid id);
+};
+
+/*!
+    \internal Images that are still stored in the collection archive. The
+    state is not copied on detach(): copies of a collection share the images
+    directory of the data path, so they also share the knowledge of which
+    images have been extracted to it. All the members are guarded by lock,
+    as a snapshot may be used in a different thread.
+*/
+class MvdMovieCollection::Private::ImageArchive
+{
+public:
+    ImageArchive() :
+        unzip(0),
+        suspended(false)
+    {
+        ref = 1;
+    }
+
+    ~ImageArchive()
+    {
+        delete unzip;
+    }
+
+    bool extract(const QString &image, const QString &dataPath);
+    void close();
+
+    QAtomicInt ref;
+    QMutex lock;
+
+    QString path;
+    //! Image name -> archive entry
+    QHash<QString, QString> entries;
+    MvdUnZip *unzip;
+    bool suspended;
 };
 
+/*!
+    \internal Extracts an image from the archive to the images directory in
+    \p dataPath. The image is only removed from the archived images once it
+    has been written, so it is never lost if the extraction fails.
+    Returns false if the image could not be extracted. lock must be held.
+*/
+bool MvdMovieCollection::Private::ImageArchive::extract(const QString &image,
+    const QString &dataPath)
+{
+    QHash<QString, QString>::ConstIterator it = entries.constFind(image);
+    if (it == entries.constEnd())
+        return false;
+
+    const QString entry = it.value();
+
+    if (!unzip) {
+        unzip = new MvdUnZip;
+        if (unzip->openArchive(path) != MvdUnZip::NoError) {
+            Movida::wLog() << QString("MvdCollection: Unable to open archive: %1").arg(path);
+            close();
+            return false;
+        }
+    }
+
+    MvdUnZip::ErrorCode ec;
+    QByteArray data = unzip->readFile(entry, &ec);
+    if (ec != MvdUnZip::NoError) {
+        Movida::wLog() << QString("MvdCollection: Unable to extract %1").arg(entry);
+        return false;
+    }
+
+    QFile file(dataPath + "/images/" + image);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size()) {
+        Movida::wLog() << QString("MvdCollection: Failed to write %1: %2")
+            .arg(file.fileName()).arg(file.errorString());
+        file.close();
+        file.remove();
+        return false;
+    }
+
+    entries.remove(image);
+    if (entries.isEmpty()) {
+        close();
+        path.clear();
+    }
+
+    return true;
+}
+
+//! \internal Closes the archive. lock must be held.
+void MvdMovieCollection::Private::ImageArchive::close()
+{
+    delete unzip;
+    unzip = 0;
+}
+
 //! \internal
 bool operator==(int i, const QuickLookupEntry &e)
 {
@@ -128,6 +246,8 @@ MvdMovieCollection::Private::Private()
     ref = 1;
     id = 1;
     modified = false;
+    revision = 0;
+    images = new ImageArchive;
 }
 
 //! \internal
@@ -135,8 +255,9 @@ MvdMovieCollection::Private::Private(const MvdMovieCollection::Private &m)
 {
     ref = 1;
 
-    id = 1;
-    modified = false;
+    id = m.id;
+    modified = m.modified;
+    revision = m.revision;
 
     name = m.name;
     owner = m.owner;
@@ -148,13 +269,65 @@ MvdMovieCollection::Private::Private(const MvdMovieCollection::Private &m)
 
     quickLookupTable = m.quickLookupTable;
     movies = m.movies;
+    movieBitmap = m.movieBitmap;
+    tagBitmaps = m.tagBitmaps;
 
     fileName = m.fileName;
     path = m.path;
 
     smd = m.smd;
+
+    images = m.images;
+    images->ref.ref();
+
+    journal = m.journal;
+    changes = m.changes;
+}
+
+//! \internal Records a change to movie \p id that is about to increment the revision.
+void MvdMovieCollection::Private::touch(mvdid id)
+{
+    if (journal.isValid())
+        changes.insert(id, revision + 1);
+}
+
+//! \internal Adds a movie to the bitmaps of its special tags.
+void MvdMovieCollection::Private::indexTags(mvdid id, Movida::Tags tags)
+{
+    static const Movida::Tag all[] = { Movida::SeenTag, Movida::LoanedTag, Movida::SpecialTag };
+
+    for (uint i = 0; i < sizeof(all) / sizeof(Movida::Tag); ++i)
+        if (tags.testFlag(all[i]))
+            tagBitmaps[(int)all[i]].insert(id);
+}
+
+//! \internal Removes a movie from the bitmaps of its special tags.
+void MvdMovieCollection::Private::unindexTags(mvdid id, Movida::Tags tags)
+{
+    static const Movida::Tag all[] = { Movida::SeenTag, Movida::LoanedTag, Movida::SpecialTag };
+
+    for (uint i = 0; i < sizeof(all) / sizeof(Movida::Tag); ++i)
+        if (tags.testFlag(all[i]))
+            tagBitmaps[(int)all[i]].remove(id);
 }
 
+//! \internal
+MvdMovieCollection::Private::~Private()
+{
+    if (!images->ref.deref())
+        delete images;
+}
+
+/*!
+    \internal Stops sharing the archived images with the other copies of
+    the collection and clears them.
+*/
+void MvdMovieCollection::Private::resetImageArchive()
+{
+    if (!images->ref.deref())
+        delete images;
+    images = new ImageArchive;
+}
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -199,6 +372,24 @@ MvdMovieCollection &MvdMovieCollection::operator=(const MvdMovieCollection &othe
     return *this;
 }
 
+/*!
+    Returns a copy of this collection that is not affected by later changes
+    and that can be read from a different thread (i.e. to save the collection
+    in background). The snapshot shares the persistent data directory with
+    this collection but it will not remove any directory when deleted.
+    The list of images that are still stored in the collection archive is
+    shared with the snapshot, so it always reflects the images that have
+    already been extracted to the data directory.
+    The caller takes ownership of the returned object.
+*/
+MvdMovieCollection *MvdMovieCollection::createSnapshot() const
+{
+    MvdMovieCollection *snapshot = new MvdMovieCollection(*this);
+    snapshot->detach();
+    snapshot->d->tempPath.clear();
+    return snapshot;
+}
+
 //! \internal Forces a detach.
 void MvdMovieCollection::detach()
 {
@@ -327,8 +518,23 @@ MvdMovie MvdMovieCollection::movie(mvdid id) const
     if (id == MvdNull || d->movies.isEmpty())
         return MvdMovie();
 
-    MovieList::ConstIterator itr = d->movies.find(id);
-    return itr == d->movies.constEnd() ? MvdMovie() : itr.value();
+    return d->movies.value(id);
+}
+
+/*!
+    Returns the IDs of all the movies in the collection. Movie IDs are used
+    as bit positions, so this is the universe for movie bitmap operations
+    (e.g. to negate a filter).
+*/
+MvdBitmap MvdMovieCollection::movieBitmap() const
+{
+    return d->movieBitmap;
+}
+
+//! Returns the IDs of the movies with the given special tag enabled.
+MvdBitmap MvdMovieCollection::tagBitmap(Movida::Tag tag) const
+{
+    return d->tagBitmaps.value((int)tag);
 }
 
 /*!
@@ -339,6 +545,46 @@ MvdMovie MvdMovieCollection::movie(mvdid id) const
     The collection will automatically update references to shared items.
 */
 mvdid MvdMovieCollection::addMovie(MvdMovie &movie)
+{
+    mvdid id = insertMovie(movie);
+    if (id == MvdNull)
+        return MvdNull;
+
+    __COLLECTION_CHANGED
+    emit movieAdded(id);
+
+    return id;
+}
+
+/*!
+    Adds a list of movies to the database and returns their IDs. The returned
+    list contains MvdNull for movies that could not be added.
+    A single moviesAdded() signal is emitted for all the added movies, no
+    movieAdded() signal is emitted.
+*/
+QList<mvdid> MvdMovieCollection::addMovies(const QList<MvdMovie> &movies)
+{
+    QList<mvdid> ids;
+    QList<mvdid> added;
+
+    for (int i = 0; i < movies.size(); ++i) {
+        MvdMovie movie = movies.at(i);
+        mvdid id = insertMovie(movie);
+        ids.append(id);
+        if (id != MvdNull)
+            added.append(id);
+    }
+
+    if (!added.isEmpty()) {
+        __COLLECTION_CHANGED
+        emit moviesAdded(added);
+    }
+
+    return ids;
+}
+
+//! \internal Adds a movie without emitting any signal.
+mvdid MvdMovieCollection::insertMovie(MvdMovie &movie)
 {
     if (!movie.isValid())
         return MvdNull;
@@ -396,7 +642,10 @@ mvdid MvdMovieCollection::addMovie(MvdMovie &movie)
         movie.setExtendedAttribute(_importDate, QDateTime::currentDateTime());
 
     mvdid movie_id = d->id++;
+    d->touch(movie_id);
     d->movies.insert(movie_id, movie);
+    d->movieBitmap.insert(movie_id);
+    d->indexTags(movie_id, movie.specialTags());
 
     MvdSharedData &sd = sharedData();
     QList<mvdid> sharedItems = movie.sharedItemIds();
@@ -405,12 +654,6 @@ mvdid MvdMovieCollection::addMovie(MvdMovie &movie)
         sd.addMovieLink(sd_id, movie_id);
     }
 
-    __COLLECTION_CHANGED
-    emit movieAdded(movie_id);
-
-    // Need a better way to report the loading status to the GUI. This is terribly slow!
-    // QCoreApplication::processEvents(QEventLoop::ExcludeUserInputEvents);
-
     return movie_id;
 }
 
@@ -534,15 +777,46 @@ mvdid MvdMovieCollection::addMovie(const MvdMovieData &movie,
 */
 void MvdMovieCollection::updateMovie(mvdid id, const MvdMovie &movie)
 {
-    if (d->movies.isEmpty())
+    if (!replaceMovie(id, movie))
         return;
 
+    __COLLECTION_CHANGED
+    emit movieChanged(id);
+}
+
+/*!
+    Changes a set of movies at once. Invalid movies and IDs not in the
+    collection are skipped.
+    A single moviesChanged() signal is emitted for all the changed movies, no
+    movieChanged() signal is emitted.
+*/
+void MvdMovieCollection::updateMovies(const MovieList &movies)
+{
+    QList<mvdid> changed;
+
+    for (MovieList::ConstIterator it = movies.constBegin(); it != movies.constEnd(); ++it) {
+        if (replaceMovie(it.key(), it.value()))
+            changed.append(it.key());
+    }
+
+    if (!changed.isEmpty()) {
+        __COLLECTION_CHANGED
+        emit moviesChanged(changed);
+    }
+}
+
+//! \internal Changes a movie without emitting any signal. Returns false if nothing was changed.
+bool MvdMovieCollection::replaceMovie(mvdid id, const MvdMovie &movie)
+{
+    if (d->movies.isEmpty())
+        return false;
+
     if (id == MvdNull || !movie.isValid())
-        return;
+        return false;
 
-    MovieList::Iterator oldMovieItr = d->movies.find(id);
-    if (oldMovieItr == d->movies.end())
-        return;
+    const int position = d->movies.indexOf(id);
+    if (position < 0)
+        return false;
 
     detach();
 
@@ -560,7 +834,7 @@ void MvdMovieCollection::updateMovie(mvdid id, const MvdMovie &movie)
     if (!ok)
         releasedInt = -1;
 
-    const MvdMovie &oldMovie = oldMovieItr.value();
+    const MvdMovie oldMovie = d->movies.at(position);
 
     MvdSharedData &sd = sharedData();
     QList<mvdid> sharedItems = oldMovie.sharedItemIds();
@@ -569,6 +843,8 @@ void MvdMovieCollection::updateMovie(mvdid id, const MvdMovie &movie)
         sd.removeMovieLink(sd_id, id);
     }
 
+    d->unindexTags(id, oldMovie.specialTags());
+
     // remove title & year of old movie from the lookup table
     if (!d->quickLookupTable.isEmpty()) {
         QString oldTitle = oldMovie.title();
@@ -633,8 +909,9 @@ void MvdMovieCollection::updateMovie(mvdid id, const MvdMovie &movie)
         d->quickLookupTable.insert(title, ql);
     }
 
-    d->movies.erase(oldMovieItr);     //! \todo CHECK IF WE REALLY NEED TO CALL REMOVE
     d->movies.insert(id, movie);
+    d->indexTags(id, movie.specialTags());
+    d->touch(id);
 
     sharedItems = movie.sharedItemIds();
     foreach(mvdid sd_id, sharedItems)
@@ -642,8 +919,7 @@ void MvdMovieCollection::updateMovie(mvdid id, const MvdMovie &movie)
         sd.addMovieLink(sd_id, id);
     }
 
-    __COLLECTION_CHANGED
-    emit movieChanged(id);
+    return true;
 }
 
 /*!
@@ -654,16 +930,46 @@ void MvdMovieCollection::updateMovie(mvdid id, const MvdMovie &movie)
 */
 void MvdMovieCollection::removeMovie(mvdid id)
 {
-    if (id == MvdNull || d->movies.isEmpty())
+    if (!eraseMovie(id))
         return;
 
-    MovieList::Iterator movieIterator = d->movies.find(id);
-    if (movieIterator == d->movies.end())
-        return;
+    __COLLECTION_CHANGED
+    emit movieRemoved(id);
+}
+
+/*!
+    Removes a list of movies from the database.
+    A single moviesRemoved() signal is emitted for all the removed movies, no
+    movieRemoved() signal is emitted.
+*/
+void MvdMovieCollection::removeMovies(const QList<mvdid> &ids)
+{
+    QList<mvdid> removed;
+
+    for (int i = 0; i < ids.size(); ++i) {
+        if (eraseMovie(ids.at(i)))
+            removed.append(ids.at(i));
+    }
+
+    if (!removed.isEmpty()) {
+        __COLLECTION_CHANGED
+        emit moviesRemoved(removed);
+    }
+}
+
+//! \internal Removes a movie without emitting any signal. Returns false if no movie was removed.
+bool MvdMovieCollection::eraseMovie(mvdid id)
+{
+    if (id == MvdNull || d->movies.isEmpty())
+        return false;
+
+    const int position = d->movies.indexOf(id);
+    if (position < 0)
+        return false;
 
     detach();
 
-    const MvdMovie &movie = movieIterator.value();
+    const MvdMovie movie = d->movies.at(position);
 
     MvdSharedData &sd = sharedData();
     QList<mvdid> sharedItems = movie.sharedItemIds();
@@ -706,10 +1012,12 @@ void MvdMovieCollection::removeMovie(mvdid id)
         }
     }
 
-    d->movies.erase(movieIterator);
+    d->unindexTags(id, movie.specialTags());
+    d->movieBitmap.remove(id);
+    d->movies.remove(id);
+    d->touch(id);
 
-    __COLLECTION_CHANGED
-    emit movieRemoved(id);
+    return true;
 }
 
 /*!
@@ -722,9 +1030,16 @@ void MvdMovieCollection::clear()
 {
     detach();
     d->movies.clear();
+    d->movieBitmap.clear();
+    d->tagBitmaps.clear();
     d->quickLookupTable.clear();
     d->id = 1;
 
+    // IDs will be reused
+    d->journal = JournalInfo();
+    d->changes.clear();
+    d->smd.setChangeTracking(false);
+
     __COLLECTION_CHANGED
     emit cleared();
 }
@@ -749,7 +1064,99 @@ void MvdMovieCollection::setModifiedStatus(bool modified)
 }
 
 /*!
-    Returns all the movies stored in this collection.
+    Returns a number that changes every time the collection is modified.
+    Can be used to detect changes made while the collection is being saved
+    (see notifySaved()).
+*/
+uint MvdMovieCollection::revision() const
+{
+    return d->revision;
+}
+
+/*!
+    Notifies that the collection contents as of \p revision have been written
+    to disk and emits the saved() signal.
+    The modified status is only reset if the collection has not been changed
+    since \p revision.
+*/
+void MvdMovieCollection::notifySaved(uint revision)
+{
+    if (d->revision == revision && d->modified) {
+        detach();
+        d->modified = false;
+    }
+
+    emit saved();
+}
+
+/*!
+    Returns the information about the journal of the collection file, set
+    by the last call to setJournalInfo().
+*/
+MvdMovieCollection::JournalInfo MvdMovieCollection::journalInfo() const
+{
+    return d->journal;
+}
+
+/*!
+    Sets the information about the journal of the collection file.
+    MvdCollectionSaver uses it to append the changes made after
+    \p info.revision to the archive instead of writing the whole collection.
+
+    A valid \p info enables change tracking for movies and shared data and
+    discards the changes made up to \p info.revision (and
+    \p info.sharedRevision for shared data). An invalid \p info disables
+    change tracking.
+
+    Journal records and binary snapshots refer to movies and shared items
+    by their ID in the archive, see JournalInfo::archiveMovieId() and
+    JournalInfo::archiveSharedItemId(). The IDs match the collection IDs
+    after a full save; MvdCollectionLoader stores the mapping for a loaded
+    collection.
+*/
+void MvdMovieCollection::setJournalInfo(const JournalInfo &info)
+{
+    detach();
+    d->journal = info;
+
+    if (!info.isValid()) {
+        d->changes.clear();
+        d->smd.setChangeTracking(false);
+        return;
+    }
+
+    QHash<mvdid, uint>::Iterator it = d->changes.begin();
+    while (it != d->changes.end()) {
+        if (it.value() <= info.revision)
+            it = d->changes.erase(it);
+        else ++it;
+    }
+
+    d->smd.setChangeTracking(true);
+    d->smd.discardChanges(info.sharedRevision);
+}
+
+/*!
+    Returns the IDs of the movies that have been added, changed or removed
+    after \p revision. Changes are only recorded while a valid journal info
+    is set (see setJournalInfo()).
+    Use movie() to find out whether a movie still exists.
+*/
+QList<mvdid> MvdMovieCollection::changedMovies(uint revision) const
+{
+    QList<mvdid> ids;
+    for (QHash<mvdid, uint>::ConstIterator it = d->changes.constBegin();
+         it != d->changes.constEnd(); ++it)
+        if (it.value() > revision)
+            ids.append(it.key());
+    qSort(ids);
+    return ids;
+}
+
+/*!
+    Returns all the movies stored in this collection. The movies are stored
+    contiguously, so iterating over the returned map is cheap; it shares its
+    data with the collection until either of them is modified.
 */
 MvdMovieCollection::MovieList MvdMovieCollection::movies() const
 {
@@ -878,7 +1285,12 @@ QString MvdMovieCollection::addImage(const QString &path,
 
     // Check if file has been already added
     QString srcHash = MvdMd5::hashFile(path);
-    if (QFile::exists(d->dataPath + "/images/" + srcHash))
+    bool archived;
+    {
+        QMutexLocker locker(&d->images->lock);
+        archived = d->images->entries.contains(srcHash);
+    }
+    if (archived || QFile::exists(d->dataPath + "/images/" + srcHash))
         return srcHash;
 
     // Compute internal filename
@@ -926,11 +1338,130 @@ QString MvdMovieCollection::addImage(const QString &path,
     return internalName;
 }
 
+/*!
+    Returns the full path to an image added with addImage().
+    Images that are still stored in the collection archive (see
+    setImageArchive()) are extracted the first time they are requested,
+    unless extraction has been suspended with suspendImageExtraction().
+*/
+QString MvdMovieCollection::imagePath(const QString &image) const
+{
+    if (image.isEmpty())
+        return QString();
+
+    const QString dataPath = metaData(DataPathInfo);
+
+    QMutexLocker locker(&d->images->lock);
+    if (!d->images->suspended && d->images->entries.contains(image))
+        d->images->extract(image, dataPath);
+
+    return dataPath + "/images/" + image;
+}
+
+/*!
+    Registers images that have not been extracted from the collection
+    archive. \p entries are the archive paths of the images; the file name
+    of each entry is the image name as returned by addImage().
+    The images will be extracted to the data path when first requested
+    with imagePath() or when extractArchivedImages() is called.
+
+    The list of archived images is shared with the copies of this collection
+    (e.g. a snapshot), as they share the images directory too.
+*/
+void MvdMovieCollection::setImageArchive(const QString &archive, const QStringList &entries)
+{
+    detach();
+    d->resetImageArchive();
+
+    for (int i = 0; i < entries.size(); ++i) {
+        const QString &entry = entries.at(i);
+        QString name = entry.mid(entry.lastIndexOf('/') + 1);
+        if (!name.isEmpty())
+            d->images->entries.insert(name, entry);
+    }
+
+    if (!d->images->entries.isEmpty())
+        d->images->path = archive;
+}
+
+/*!
+    Returns the path of the archive images are extracted from or an empty
+    string if all the images have been extracted.
+*/
+QString MvdMovieCollection::imageArchive() const
+{
+    QMutexLocker locker(&d->images->lock);
+    return d->images->path;
+}
+
+/*!
+    Returns the images that have not been extracted from the collection
+    archive yet, mapped to their archive paths.
+*/
+QHash<QString, QString> MvdMovieCollection::archivedImages() const
+{
+    QMutexLocker locker(&d->images->lock);
+    return d->images->entries;
+}
+
+/*!
+    Extracts all the images that are still stored in the collection archive
+    and closes the archive.
+*/
+void MvdMovieCollection::extractArchivedImages()
+{
+    const QString dataPath = metaData(DataPathInfo);
+
+    QMutexLocker locker(&d->images->lock);
+    if (d->images->entries.isEmpty())
+        return;
+
+    QStringList images = d->images->entries.keys();
+    for (int i = 0; i < images.size(); ++i)
+        d->images->extract(images.at(i), dataPath);
+
+    // Images that could not be extracted are still available for saving
+    d->images->close();
+}
+
+/*!
+    Closes the collection archive if it has been opened to extract some
+    image. It will be opened again when the next image is requested.
+*/
+void MvdMovieCollection::closeImageArchive()
+{
+    QMutexLocker locker(&d->images->lock);
+    d->images->close();
+}
+
+/*!
+    Closes the collection archive and stops extracting images from it until
+    resumeImageExtraction() is called, so that the archive file can be
+    replaced or modified. imagePath() still returns the path of archived
+    images while extraction is suspended. Copies of this collection are
+    affected too.
+*/
+void MvdMovieCollection::suspendImageExtraction()
+{
+    QMutexLocker locker(&d->images->lock);
+    d->images->close();
+    d->images->suspended = true;
+}
+
+//! Resumes the extraction of archived images, see suspendImageExtraction().
+void MvdMovieCollection::resumeImageExtraction()
+{
+    QMutexLocker locker(&d->images->lock);
+    d->images->suspended = false;
+}
+
 /*!
     Removes any persistent data stored in the system's temporary directory.
 */
 void MvdMovieCollection::clearPersistentData()
 {
+    d->resetImageArchive();
+
     if (d->dataPath.isEmpty())
         return;
 
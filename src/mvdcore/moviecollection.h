@@ -21,8 +21,10 @@
 #ifndef MVD_MOVIECOLLECTION_H
 #define MVD_MOVIECOLLECTION_H
 
+#include "bitmap.h"
 #include "global.h"
 #include "shareddata.h"
+#include "slotmap.h"
 
 #include <QtCore/QHash>
 #include <QtCore/QList>
@@ -44,7 +46,7 @@ public:
     virtual ~MvdMovieCollection();
     MvdMovieCollection &operator=(const MvdMovieCollection &m);
 
-    typedef QHash<mvdid, MvdMovie> MovieList;
+    typedef MvdSlotMap<MvdMovie> MovieList;
 
     enum MetaDataType {
         NameInfo, OwnerInfo, EMailInfo, WebsiteInfo, NotesInfo,
@@ -56,6 +58,38 @@ public:
         MoviePosterImage, GenericImage
     };
 
+    struct JournalInfo {
+        JournalInfo() :
+            revision(0),
+            sharedRevision(0),
+            records(0),
+            baseSize(0),
+            size(0),
+            movieIdBase(0),
+            sharedItemIdBase(0) { }
+
+        inline bool isValid() const { return !archive.isEmpty(); }
+
+        inline mvdid archiveMovieId(mvdid id) const
+        { return id == MvdNull ? id : movieIds.value(id, id + movieIdBase); }
+        inline mvdid archiveSharedItemId(mvdid id) const
+        { return id == MvdNull ? id : sharedItemIds.value(id, id + sharedItemIdBase); }
+
+        QString archive;
+        uint revision;
+        uint sharedRevision;
+        int records;
+        qint64 baseSize;
+        qint64 size;
+
+        // Collection ID -> archive ID of the movies and shared items loaded
+        // from the archive. Other IDs are offset by the largest archive ID.
+        QHash<mvdid, mvdid> movieIds;
+        QHash<mvdid, mvdid> sharedItemIds;
+        mvdid movieIdBase;
+        mvdid sharedItemIdBase;
+    };
+
     MvdSharedData &sharedData() const;
 
     void setMetaData(MetaDataType ci, const QString &val);
@@ -68,10 +102,17 @@ public:
     QList<mvdid> movieIds() const;
     MvdMovie movie(mvdid id) const;
 
+    MvdBitmap movieBitmap() const;
+    MvdBitmap tagBitmap(Movida::Tag tag) const;
+
     mvdid addMovie(MvdMovie &movie);
     void updateMovie(mvdid id, const MvdMovie &movie);
     void removeMovie(mvdid id);
 
+    QList<mvdid> addMovies(const QList<MvdMovie> &movies);
+    void updateMovies(const MovieList &movies);
+    void removeMovies(const QList<mvdid> &ids);
+
     mvdid addMovie(const MvdMovieData &movie,
     const QHash<QString, QVariant> &extra = (QHash<QString, QVariant>()));
 
@@ -82,6 +123,13 @@ public:
     bool isModified() const;
     void setModifiedStatus(bool modified);
 
+    uint revision() const;
+    void notifySaved(uint revision);
+
+    JournalInfo journalInfo() const;
+    void setJournalInfo(const JournalInfo &info);
+    QList<mvdid> changedMovies(uint revision) const;
+
     QString fileName() const;
     void setFileName(const QString &f);
 
@@ -89,13 +137,27 @@ public:
     void setPath(const QString &p);
 
     QString addImage(const QString &path, ImageCategory category = GenericImage);
+    QString imagePath(const QString &image) const;
+
+    void setImageArchive(const QString &archive, const QStringList &entries);
+    QString imageArchive() const;
+    QHash<QString, QString> archivedImages() const;
+    void extractArchivedImages();
+    void closeImageArchive();
+    void suspendImageExtraction();
+    void resumeImageExtraction();
 
     void clearPersistentData();
 
+    MvdMovieCollection *createSnapshot() const;
+
 signals:
     void movieAdded(mvdid id);
     void movieChanged(mvdid id);
     void movieRemoved(mvdid id);
+    void moviesAdded(const QList<mvdid> &ids);
+    void moviesChanged(const QList<mvdid> &ids);
+    void moviesRemoved(const QList<mvdid> &ids);
     void metaDataChanged(int t, const QString &v);
     void changed();
     void cleared();
@@ -104,6 +166,10 @@ signals:
     void destroyed();
 
 private:
+    mvdid insertMovie(MvdMovie &movie);
+    bool replaceMovie(mvdid id, const MvdMovie &movie);
+    bool eraseMovie(mvdid id);
+
     class Private;
     Private *d;
 
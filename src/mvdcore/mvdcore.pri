@@ -1,7 +1,9 @@
 HEADERS += \
 	base64.h \
+	bitmap.h \
 	collectionloader.h \
 	collectionsaver.h \
+	collectionsnapshot.h \
 	core.h \
 	global.h \
 	logger.h \
@@ -15,8 +17,11 @@ HEADERS += \
 	sditem.h \
 	settings.h \
 	shareddata.h \
+	slotmap.h \
 	templatecache.h \
 	templatemanager.h \
+	thumbnailcache.h \
+	trace.h \
 	unzip.h \
 	utils.h \
 	xmlwriter.h \
@@ -26,8 +31,10 @@ HEADERS += \
 	
 SOURCES += \
 	base64.cpp \
+	bitmap.cpp \
 	collectionloader.cpp \
 	collectionsaver.cpp \
+	collectionsnapshot.cpp \
 	core.cpp \
 	logger.cpp \
 	md5.cpp \
@@ -41,6 +48,8 @@ SOURCES += \
 	shareddata.cpp \
 	templatecache.cpp \
 	templatemanager.cpp \
+	thumbnailcache.cpp \
+	trace.cpp \
 	unzip.cpp \
 	utils.cpp \
 	xmlwriter.cpp \
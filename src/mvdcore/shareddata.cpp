@@ -25,6 +25,7 @@
 #include "logger.h"
 #include "sditem.h"
 
+#include <QtCore/QSet>
 #include <QtCore/QStringList>
 #include <QtGui/QImage>
 
@@ -75,14 +76,34 @@ public:
 
     inline void logNewItem(const MvdSdItem &item);
 
+    inline void indexItem(mvdid id, const MvdSdItem &item);
+    inline void unindexItem(mvdid id, const MvdSdItem &item);
+    void clearIndexes();
+
+    inline void touch(mvdid id);
+
     QHash<mvdid, MvdSdItem> data;
 
+    // Secondary indexes, kept in sync with data. Values and identifiers are
+    // normalized (lower case) as in MvdSdItem::operator==().
+    QMultiHash<QString, mvdid> valueIndex;
+    QMultiHash<QString, mvdid> identifierIndex;
+    QHash<int, QSet<mvdid> > roleIndex;
+    // Movies referencing each item
+    QHash<mvdid, MvdBitmap> movieIndex;
+
     mvdid nextId;
 
     //! true if items with nobody referencing them should be removed.
     bool autoPurge;
     //! true if there is some data in the SDB and if purgeData has not been called since last insert.
     bool canPurge;
+
+    //! Incremented each time an item is added, updated or removed.
+    uint revision;
+    bool trackChanges;
+    //! Revision of the last change to each item, if change tracking is enabled.
+    QHash<mvdid, uint> changes;
 };
 
 //! \internal
@@ -91,30 +112,88 @@ MvdSharedData::Private::Private()
     nextId = 1;
     autoPurge = true;
     canPurge = false;
+    revision = 0;
+    trackChanges = false;
 }
 
 //! \internal
 MvdSharedData::Private::Private(const MvdSharedData::Private &s)
 {
     data = s.data;
+    valueIndex = s.valueIndex;
+    identifierIndex = s.identifierIndex;
+    roleIndex = s.roleIndex;
+    movieIndex = s.movieIndex;
     nextId = s.nextId;
     autoPurge = s.autoPurge;
     canPurge = s.canPurge;
+    revision = s.revision;
+    trackChanges = s.trackChanges;
+    changes = s.changes;
 }
 
 //! \internal
 MvdSharedData::Private::~Private()
 { }
 
+//! \internal Records a change to item \p id.
+void MvdSharedData::Private::touch(mvdid id)
+{
+    ++revision;
+    if (trackChanges)
+        changes.insert(id, revision);
+}
+
 //! \internal
 void MvdSharedData::Private::logNewItem(const MvdSdItem &item)
 {
-    iLog() << "MvdSharedData: Item added: " << item.value << "("
+    MVD_ILOG("MvdSharedData") << "MvdSharedData: Item added: " << item.value << "("
            << (item.id.isEmpty() ? QString("no id; ") : QString("id: %1; ").arg(item.id))
            << (item.description.isEmpty() ? QString("no descr.") : QString("descr.: %1").arg(item.description))
            << ")";
 }
 
+//! \internal Adds \p item to the secondary indexes.
+void MvdSharedData::Private::indexItem(mvdid id, const MvdSdItem &item)
+{
+    valueIndex.insert(item.value.toLower(), id);
+    if (!item.id.isEmpty())
+        identifierIndex.insert(item.id.toLower(), id);
+    roleIndex[(int)item.role].insert(id);
+
+    if (!item.movies.isEmpty()) {
+        MvdBitmap &movies = movieIndex[id];
+        for (int i = 0; i < item.movies.size(); ++i)
+            movies.insert(item.movies.at(i));
+    }
+}
+
+//! \internal Removes \p item from the secondary indexes.
+void MvdSharedData::Private::unindexItem(mvdid id, const MvdSdItem &item)
+{
+    valueIndex.remove(item.value.toLower(), id);
+    if (!item.id.isEmpty())
+        identifierIndex.remove(item.id.toLower(), id);
+
+    QHash<int, QSet<mvdid> >::Iterator it = roleIndex.find((int)item.role);
+    if (it != roleIndex.end()) {
+        it.value().remove(id);
+        if (it.value().isEmpty())
+            roleIndex.erase(it);
+    }
+
+    movieIndex.remove(id);
+}
+
+//! \internal
+void MvdSharedData::Private::clearIndexes()
+{
+    valueIndex.clear();
+    identifierIndex.clear();
+    roleIndex.clear();
+    movieIndex.clear();
+}
+
 /************************************************************************
     MvdSharedData
  *************************************************************************/
@@ -229,10 +308,14 @@ MvdSharedData::ItemList MvdSharedData::items(Movida::DataRole role) const
         return d->data;
 
     QHash<mvdid, MvdSdItem> results;
-    for (QHash<mvdid, MvdSdItem>::ConstIterator it = d->data.constBegin();
-         it != d->data.constEnd(); ++it) {
-        if (it.value().role & role)
-            results.insert(it.key(), it.value());
+    for (QHash<int, QSet<mvdid> >::ConstIterator it = d->roleIndex.constBegin();
+         it != d->roleIndex.constEnd(); ++it) {
+        if (!(it.key() & role))
+            continue;
+
+        const QSet<mvdid> &ids = it.value();
+        for (QSet<mvdid>::ConstIterator idIt = ids.constBegin(); idIt != ids.constEnd(); ++idIt)
+            results.insert(*idIt, d->data.value(*idIt));
     }
 
     return results;
@@ -243,10 +326,20 @@ MvdSharedData::ItemList MvdSharedData::items(Movida::DataRole role) const
 */
 mvdid MvdSharedData::findItem(const MvdSdItem &item) const
 {
-    for (QHash<mvdid, MvdSdItem>::ConstIterator it = d->data.constBegin();
-         it != d->data.constEnd(); ++it) {
-        if (it.value() == item)
-            return it.key();
+    // Same rules as MvdSdItem::operator==(): identifiers are compared if
+    // both items have one, values are compared otherwise.
+    if (!item.id.isEmpty()) {
+        mvdid id = d->identifierIndex.value(item.id.toLower(), MvdNull);
+        if (id != MvdNull)
+            return id;
+    }
+
+    const QString key = item.value.toLower();
+    QMultiHash<QString, mvdid>::ConstIterator it = d->valueIndex.constFind(key);
+    while (it != d->valueIndex.constEnd() && it.key() == key) {
+        if (item.id.isEmpty() || d->data.value(it.value()).id.isEmpty())
+            return it.value();
+        ++it;
     }
 
     return MvdNull;
@@ -258,10 +351,13 @@ mvdid MvdSharedData::findItem(const MvdSdItem &item) const
 mvdid MvdSharedData::findItemByValue(QString value, Qt::CaseSensitivity cs) const
 {
     value = value.trimmed();
-    for (QHash<mvdid, MvdSdItem>::ConstIterator it = d->data.constBegin();
-         it != d->data.constEnd(); ++it) {
-        if (!QString::compare(it.value().value, value, cs))
-            return it.key();
+
+    const QString key = value.toLower();
+    QMultiHash<QString, mvdid>::ConstIterator it = d->valueIndex.constFind(key);
+    while (it != d->valueIndex.constEnd() && it.key() == key) {
+        if (cs == Qt::CaseInsensitive || d->data.value(it.value()).value == value)
+            return it.value();
+        ++it;
     }
 
     return MvdNull;
@@ -279,17 +375,27 @@ int MvdSharedData::usageCount(mvdid id, ReferenceTypes rt) const
 
     int count = 0;
 
-    QHash<mvdid, MvdSdItem>::ConstIterator it = d->data.find(id);
-    if (it != d->data.end()) {
-        if (rt.testFlag(MovieReferences))
-            count += it.value().movies.size();
-        if (rt.testFlag(PersonReferences))
+    if (rt.testFlag(MovieReferences))
+        count += d->movieIndex.value(id).count();
+
+    if (rt.testFlag(PersonReferences)) {
+        QHash<mvdid, MvdSdItem>::ConstIterator it = d->data.find(id);
+        if (it != d->data.end())
             count += it.value().persons.size();
     }
 
     return count;
 }
 
+/*!
+    Returns the movies referencing a specific item. Bitmaps can be combined
+    to find movies referencing more items (e.g. a genre and an actor).
+*/
+MvdBitmap MvdSharedData::movieBitmap(mvdid id) const
+{
+    return d->movieIndex.value(id);
+}
+
 /************************************************************************
     Adds a new item to the SD (if no similar item exists)
  *************************************************************************/
@@ -305,12 +411,10 @@ mvdid MvdSharedData::addItem(const MvdSdItem &item)
     if (item.value.isEmpty())
         return MvdNull;
 
-    for (QHash<mvdid, MvdSdItem>::ConstIterator it = d->data.constBegin();
-         it != d->data.constEnd(); ++it) {
-        if (it.value() == item) {
-            iLog() << QString("MvdSharedData: Item %1 already registered").arg(item.value);
-            return it.key();
-        }
+    mvdid existingId = findItem(item);
+    if (existingId != MvdNull) {
+        MVD_ILOG("MvdSharedData") << QString("MvdSharedData: Item %1 already registered").arg(item.value);
+        return existingId;
     }
 
     d->canPurge = true;
@@ -323,11 +427,14 @@ mvdid MvdSharedData::addItem(const MvdSdItem &item)
         _item.value.truncate(maxLength);
         _item.description.truncate(maxLength);
         d->data.insert(newId, _item);
+        d->indexItem(newId, _item);
         //d->logNewItem(_item);
     } else {
         d->data.insert(newId, item);
+        d->indexItem(newId, item);
         //d->logNewItem(item);
     }
+    d->touch(newId);
     emit itemAdded(newId);
     return newId;
 }
@@ -354,7 +461,10 @@ bool MvdSharedData::updateItem(mvdid id, const MvdSdItem &item)
 
     iLog() << QString("MvdSharedData: Item %1 updated.").arg(it.value().value);
 
-    d->data.insert(id, item);
+    d->unindexItem(id, it.value());
+    it.value() = item;
+    d->indexItem(id, item);
+    d->touch(id);
     emit itemUpdated(id);
     return true;
 }
@@ -377,9 +487,10 @@ void MvdSharedData::addMovieLink(mvdid sd_id, mvdid movie_id)
         QList<mvdid> &list = it.value().movies;
         for (int i = 0; i < list.size(); ++i) {
             mvdid m = list.at(i);
-            if (m == movie_id)
+            if (m == movie_id) {
+                linked = true;
                 break;
-            else if (m > movie_id) {
+            } else if (m > movie_id) {
                 list.insert(i, movie_id);
                 linked = true;
                 break;
@@ -389,6 +500,7 @@ void MvdSharedData::addMovieLink(mvdid sd_id, mvdid movie_id)
         if (!linked)
             list.append(movie_id);
 
+        d->movieIndex[sd_id].insert(movie_id);
         emit itemReferenceChanged(sd_id);
     }
 }
@@ -408,6 +520,12 @@ void MvdSharedData::removeMovieLink(mvdid sd_id, mvdid movie_id)
             mvdid m = list.at(i);
             if (m == movie_id) {
                 list.removeAt(i);
+                QHash<mvdid, MvdBitmap>::Iterator bm = d->movieIndex.find(sd_id);
+                if (bm != d->movieIndex.end()) {
+                    bm.value().remove(movie_id);
+                    if (bm.value().isEmpty())
+                        d->movieIndex.erase(bm);
+                }
                 emit itemReferenceChanged(sd_id);
                 break;
             } else if (m > movie_id)
@@ -477,11 +595,16 @@ void MvdSharedData::removePersonLink(mvdid sd_id, mvdid person_sd_id)
 */
 bool MvdSharedData::removeItem(mvdid id)
 {
-    bool removed = d->data.remove(id) > 0;
+    QHash<mvdid, MvdSdItem>::Iterator it = d->data.find(id);
+    if (it == d->data.end())
+        return false;
+
+    d->unindexItem(id, it.value());
+    d->data.erase(it);
+    d->touch(id);
 
-    if (removed)
-        emit itemRemoved(id);
-    return removed;
+    emit itemRemoved(id);
+    return true;
 }
 
 /************************************************************************
@@ -500,10 +623,10 @@ int MvdSharedData::countItems(Movida::DataRole role) const
         return d->data.size();
 
     int count = 0;
-    for (QHash<mvdid, MvdSdItem>::ConstIterator it = d->data.constBegin();
-         it != d->data.constEnd(); ++it)
-        if (it.value().role & role)
-            count++;
+    for (QHash<int, QSet<mvdid> >::ConstIterator it = d->roleIndex.constBegin();
+         it != d->roleIndex.constEnd(); ++it)
+        if (it.key() & role)
+            count += it.value().size();
     return count;
 }
 
@@ -536,6 +659,68 @@ bool MvdSharedData::canPurge() const
     return d->canPurge;
 }
 
+/************************************************************************
+    Change tracking
+ *************************************************************************/
+
+/*!
+    Returns a number that is incremented each time an item is added,
+    updated or removed.
+*/
+uint MvdSharedData::revision() const
+{
+    return d->revision;
+}
+
+/*!
+    Enables or disables change tracking. If enabled, the SD records the
+    revision of the last change to each item (see changedItems()).
+    Disabling change tracking discards any recorded change.
+*/
+void MvdSharedData::setChangeTracking(bool enable)
+{
+    d->trackChanges = enable;
+    if (!enable)
+        d->changes.clear();
+}
+
+/*!
+    Returns true if change tracking is enabled.
+*/
+bool MvdSharedData::changeTracking() const
+{
+    return d->trackChanges;
+}
+
+/*!
+    Returns the IDs of the items that have been added, updated or removed
+    after \p revision. Requires change tracking to be enabled.
+    Use item() to find out whether an item still exists.
+*/
+QList<mvdid> MvdSharedData::changedItems(uint revision) const
+{
+    QList<mvdid> ids;
+    for (QHash<mvdid, uint>::ConstIterator it = d->changes.constBegin();
+         it != d->changes.constEnd(); ++it)
+        if (it.value() > revision)
+            ids.append(it.key());
+    qSort(ids);
+    return ids;
+}
+
+/*!
+    Discards the changes recorded up to and including \p revision.
+*/
+void MvdSharedData::discardChanges(uint revision)
+{
+    QHash<mvdid, uint>::Iterator it = d->changes.begin();
+    while (it != d->changes.end()) {
+        if (it.value() <= revision)
+            it = d->changes.erase(it);
+        else ++it;
+    }
+}
+
 /************************************************************************
     Slots
  *************************************************************************/
@@ -546,7 +731,11 @@ bool MvdSharedData::canPurge() const
 void MvdSharedData::clear()
 {
     // clear data
+    for (QHash<mvdid, MvdSdItem>::ConstIterator it = d->data.constBegin();
+         it != d->data.constEnd(); ++it)
+        d->touch(it.key());
     d->data.clear();
+    d->clearIndexes();
     d->nextId = 1;
     d->canPurge = false;
 
@@ -571,6 +760,8 @@ bool MvdSharedData::purgeData()
             if (pdIt.value().movies.isEmpty() && pdIt.value().persons.isEmpty()) {
                 pdIt2 = pdIt;
                 ++pdIt;
+                d->unindexItem(pdIt2.key(), pdIt2.value());
+                d->touch(pdIt2.key());
                 d->data.erase(pdIt2);
                 itemRemoved = true;
                 if (pdIt == d->data.end())
@@ -21,6 +21,7 @@
 #ifndef MVD_SHAREDDATA_H
 #define MVD_SHAREDDATA_H
 
+#include "bitmap.h"
 #include "global.h"
 
 #include <QtCore/QHash>
@@ -69,6 +70,7 @@ public:
 
     // Misc
     int usageCount(mvdid id, ReferenceTypes rt = AllReferences) const;
+    MvdBitmap movieBitmap(mvdid id) const;
 
     // Add/edit
     mvdid addItem(const MvdSdItem &item);
@@ -91,6 +93,13 @@ public:
     bool autoPurge() const;
     bool canPurge() const;
 
+    // Change tracking
+    uint revision() const;
+    void setChangeTracking(bool enable);
+    bool changeTracking() const;
+    QList<mvdid> changedItems(uint revision) const;
+    void discardChanges(uint revision);
+
     static ItemPairList sortedItemList(const ItemList &list);
     static ItemPairVector sortedItemVector(const ItemList &list);
 
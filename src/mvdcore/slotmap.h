@@ -0,0 +1,245 @@
+/**************************************************************************
+** Filename: slotmap.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_SLOTMAP_H
+#define MVD_SLOTMAP_H
+
+#include "global.h"
+
+#include <QtCore/QList>
+#include <QtCore/QVector>
+
+/*!
+    \class MvdSlotMap slotmap.h
+    \ingroup MvdCore
+
+    \brief Maps sequential IDs to values stored in a contiguous array.
+
+    Values are kept densely packed, so iterating over them touches a single
+    block of memory. A second array indexed by ID maps each ID to the
+    position of its value (see indexOf() and at()), so lookups by ID are
+    O(1) without hashing. IDs are expected to be small and mostly contiguous
+    (like the IDs handed out by MvdMovieCollection): the index grows up to
+    the largest ID.
+
+    Removing a value moves the last value to its position, so positions are
+    only stable until the next removal. IDs are stable.
+
+    The class provides the subset of the QHash API used with
+    MvdMovieCollection::MovieList (ConstIterator, key(), value(), insert(),
+    find(), ...), so existing code keeps working. Iteration follows the
+    storage order instead of the hash order.
+*/
+
+template <typename T>
+class MvdSlotMap
+{
+    struct Slot {
+        Slot() :
+            position(-1) { }
+
+        int position;
+    };
+
+public:
+    class iterator;
+    class const_iterator;
+    friend class iterator;
+    friend class const_iterator;
+
+    class const_iterator
+    {
+        friend class MvdSlotMap<T>;
+
+    public:
+        inline const_iterator() : m(0), i(0) { }
+        inline const_iterator(const iterator &o) : m(o.m), i(o.i) { }
+
+        inline mvdid key() const { return m->mIds.at(i); }
+        inline const T &value() const { return m->mValues.at(i); }
+        inline const T &operator*() const { return value(); }
+        inline const T *operator->() const { return &value(); }
+        inline int position() const { return i; }
+
+        inline bool operator==(const const_iterator &o) const { return i == o.i; }
+        inline bool operator!=(const const_iterator &o) const { return i != o.i; }
+        inline const_iterator &operator++() { ++i; return *this; }
+        inline const_iterator operator++(int) { const_iterator r = *this; ++i; return r; }
+        inline const_iterator &operator--() { --i; return *this; }
+        inline const_iterator operator--(int) { const_iterator r = *this; --i; return r; }
+
+    private:
+        inline const_iterator(const MvdSlotMap<T> *map, int pos) : m(map), i(pos) { }
+
+        const MvdSlotMap<T> *m;
+        int i;
+    };
+
+    class iterator
+    {
+        friend class MvdSlotMap<T>;
+        friend class const_iterator;
+
+    public:
+        inline iterator() : m(0), i(0) { }
+
+        inline mvdid key() const { return m->mIds.at(i); }
+        inline T &value() const { return m->mValues[i]; }
+        inline T &operator*() const { return value(); }
+        inline T *operator->() const { return &value(); }
+        inline int position() const { return i; }
+
+        inline bool operator==(const iterator &o) const { return i == o.i; }
+        inline bool operator!=(const iterator &o) const { return i != o.i; }
+        inline iterator &operator++() { ++i; return *this; }
+        inline iterator operator++(int) { iterator r = *this; ++i; return r; }
+        inline iterator &operator--() { --i; return *this; }
+        inline iterator operator--(int) { iterator r = *this; --i; return r; }
+
+    private:
+        inline iterator(MvdSlotMap<T> *map, int pos) : m(map), i(pos) { }
+
+        MvdSlotMap<T> *m;
+        int i;
+    };
+
+    typedef const_iterator ConstIterator;
+    typedef iterator Iterator;
+
+    inline int size() const { return mValues.size(); }
+    inline int count() const { return mValues.size(); }
+    inline bool isEmpty() const { return mValues.isEmpty(); }
+
+    inline void reserve(int size) { mIds.reserve(size); mValues.reserve(size); }
+
+    //! Returns the position of the value with the given ID or -1.
+    inline int indexOf(mvdid id) const
+    {
+        return id < (mvdid) mSlots.size() ? mSlots.at(id).position : -1;
+    }
+
+    inline bool contains(mvdid id) const { return indexOf(id) >= 0; }
+
+    //! Returns the value at position \p i, which must be valid.
+    inline const T &at(int i) const { return mValues.at(i); }
+
+    inline T value(mvdid id) const
+    {
+        const int i = indexOf(id);
+        return i < 0 ? T() : mValues.at(i);
+    }
+
+    inline T value(mvdid id, const T &defaultValue) const
+    {
+        const int i = indexOf(id);
+        return i < 0 ? defaultValue : mValues.at(i);
+    }
+
+    //! Returns the IDs in storage order.
+    inline QList<mvdid> keys() const { return mIds.toList(); }
+    //! Returns the values in storage order.
+    inline QList<T> values() const { return mValues.toList(); }
+
+    //! Inserts \p value with the given ID, replacing any existing value.
+    iterator insert(mvdid id, const T &value)
+    {
+        Q_ASSERT(id != MvdNull);
+
+        if (id >= (mvdid) mSlots.size())
+            mSlots.resize(id + 1);
+
+        Slot &slot = mSlots[id];
+        if (slot.position < 0) {
+            slot.position = mValues.size();
+            mIds.append(id);
+            mValues.append(value);
+        } else mValues[slot.position] = value;
+
+        return iterator(this, slot.position);
+    }
+
+    //! Removes the value with the given ID. Returns the number of removed values.
+    int remove(mvdid id)
+    {
+        const int i = indexOf(id);
+        if (i < 0)
+            return 0;
+        erase(iterator(this, i));
+        return 1;
+    }
+
+    /*!
+        Removes the value at \p it and returns an iterator to the value that
+        took its position (the last one), or end().
+    */
+    iterator erase(iterator it)
+    {
+        const int i = it.i;
+        const int last = mValues.size() - 1;
+        mSlots[mIds.at(i)].position = -1;
+
+        if (i != last) {
+            mIds[i] = mIds.at(last);
+            mValues[i] = mValues.at(last);
+            mSlots[mIds.at(i)].position = i;
+        }
+
+        mIds.resize(last);
+        mValues.resize(last);
+        return iterator(this, i);
+    }
+
+    //! Removes all the values.
+    void clear()
+    {
+        for (int i = 0; i < mIds.size(); ++i)
+            mSlots[mIds.at(i)].position = -1;
+        mIds.clear();
+        mValues.clear();
+    }
+
+    inline const_iterator constBegin() const { return const_iterator(this, 0); }
+    inline const_iterator constEnd() const { return const_iterator(this, mValues.size()); }
+    inline const_iterator begin() const { return constBegin(); }
+    inline const_iterator end() const { return constEnd(); }
+    inline iterator begin() { return iterator(this, 0); }
+    inline iterator end() { return iterator(this, mValues.size()); }
+
+    inline const_iterator constFind(mvdid id) const
+    {
+        const int i = indexOf(id);
+        return i < 0 ? constEnd() : const_iterator(this, i);
+    }
+
+    inline const_iterator find(mvdid id) const { return constFind(id); }
+
+    inline iterator find(mvdid id)
+    {
+        const int i = indexOf(id);
+        return i < 0 ? end() : iterator(this, i);
+    }
+
+private:
+    QVector<Slot> mSlots;
+    QVector<mvdid> mIds;
+    QVector<T> mValues;
+};
+
+#endif // MVD_SLOTMAP_H
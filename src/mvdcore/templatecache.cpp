@@ -21,24 +21,31 @@
 #include "templatecache.h"
 
 #include "core.h"
+#include "logger.h"
 #include "moviecollection.h"
 #include "pathresolver.h"
 #include "templatemanager.h"
+#include "trace.h"
+#include "xsltproc.h"
 
+#include <QtCore/QAtomicInt>
 #include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
 #include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
 #include <QtCore/QUrl>
 
+#include <libxml/tree.h>
+
 #include <stdexcept>
 
 using namespace Movida;
 
 Q_GLOBAL_STATIC(QMutex, MvdTemplateCacheLock)
 
-namespace {
-static const int MaxCachedPages = 100;
-}
-
 
 /*!
     \class MvdTemplateCache templatecache.h
@@ -47,6 +54,21 @@ static const int MaxCachedPages = 100;
     <b>Movida::tcache()</b> can be used as a convenience method to access the singleton.
 
     \brief Caches global or collection specific template instantiations.
+
+    Rendered pages are kept in memory and identified by URLs with the
+    scheme returned by scheme(). Use data() to retrieve the contents of a
+    page or of a local file referenced by a page (i.e. a movie poster, see
+    MvdTemplateManager::movieToXml()): root relative references in a page
+    resolve to URLs with the same scheme and the file path.
+
+    Movie pages and resources share a memory budget, set in KB by the
+    "mvdcore/template-cache-kb" core parameter, and the least recently
+    used are evicted first. Evicted movie pages are written to the temporary
+    directory if the "mvdcore/template-cache-overflow" core parameter is
+    set, otherwise they are rendered again when needed.
+
+    Movie pages can be rendered in background with prerender(), i.e. for
+    the movies next to the current one in a view.
 */
 
 
@@ -58,46 +80,126 @@ static const int MaxCachedPages = 100;
 class MvdTemplateCache::Private
 {
 public:
+    struct CachedPage {
+        CachedPage(const QString &k = QString(), MvdMovieCollection *c = 0, mvdid m = MvdNull) :
+            key(k),
+            collection(c),
+            movie(m),
+            previous(0),
+            next(0) { }
+
+        QString key;
+        MvdMovieCollection *collection;
+        mvdid movie;
+        QByteArray data;
+        QString overflowPath;
+
+        // Usage list, only for pages in memory
+        CachedPage *previous;
+        CachedPage *next;
+    };
+
+    struct PendingRender {
+        PendingRender() :
+            job(0),
+            collection(0) { }
+
+        int job;
+        MvdMovieCollection *collection;
+    };
+
+    class Renderer;
+
     Private() :
-        manualCacheId(0) { }
+        manualCacheId(0),
+        memoryUsage(0),
+        leastRecentlyUsed(0),
+        mostRecentlyUsed(0),
+        lastRenderJob(0)
+    {
+        // Rendering in background is speculative, do not compete with the GUI thread
+        renderPool.setMaxThreadCount(1);
+    }
 
     ~Private() {
+        renderPool.waitForDone();
         purgeCache();
     };
 
+    CachedPage *find(const QString &key) const { return pages.value(key); }
+    QByteArray use(CachedPage *page);
+    void insert(CachedPage *page);
+    void remove(CachedPage *page);
+    void link(CachedPage *page);
+    void unlink(CachedPage *page);
     void reduceCache();
     void purgeCache();
     QString retrievePath(MvdMovieCollection *collection);
+    bool isResourcePath(const QString &path) const;
+    CachedPage *renderMovie(MvdMovieCollection *collection, mvdid id);
 
-    struct CachedPage {
-        CachedPage(quint64 id, const QString &s, MvdMovieCollection *c = 0) :
-            id(id),
-            collection(c),
-            path(s),
-            usage(0) { }
-
-        bool operator<(const CachedPage &o) const { return usage > o.usage; }
-
-        bool operator==(const CachedPage &o) const { return id == o.id && collection == o.collection; }
+    static QUrl pageUrl(const QString &key);
+    static QString movieKey(mvdid id) { return QString("movie=%1").arg(id); }
 
-        quint64 id;
-        MvdMovieCollection *collection;
-        QString path;
-        int usage;
-    };
-    typedef QList<CachedPage> PageCache;
-
-    PageCache automaticCache;
-    PageCache manualCache;
+    QHash<QString, CachedPage *> pages;
+    QHash<quint64, QByteArray> manualCache;
     quint64 manualCacheId;
+    int memoryUsage;
+    CachedPage *leastRecentlyUsed;
+    CachedPage *mostRecentlyUsed;
+
+    QThreadPool renderPool;
+    QHash<mvdid, PendingRender> pendingRenders;
+    int lastRenderJob;
+    // Jobs older than this are not wanted anymore
+    QAtomicInt firstWantedJob;
 
     QString cacheDir;
     QString templateName;
-    QString blank;
+    QByteArray blank;
 
     QList<MvdMovieCollection *> registeredCollections;
 };
 
+//! \internal Applies a movie template in a worker thread.
+class MvdTemplateCache::Private::Renderer : public QRunnable
+{
+public:
+    Renderer(MvdTemplateCache *c, mvdid id, int job, xmlDoc *doc, const QString &path) :
+        cache(c),
+        id(id),
+        job(job),
+        doc(doc),
+        path(path)
+    { }
+
+    ~Renderer()
+    {
+        xmlFreeDoc(doc);
+    }
+
+    void run()
+    {
+        if (job < (int) cache->d->firstWantedJob)
+            return;
+
+        MVD_TRACE_SPAN(span, "MvdTemplateCache::Renderer", "template");
+
+        MvdXsltProc xsl(path);
+        QByteArray html = xsl.processDocument(doc).toUtf8();
+
+        QMetaObject::invokeMethod(cache, "prerendered", Qt::QueuedConnection,
+            Q_ARG(uint, id), Q_ARG(int, job), Q_ARG(QByteArray, html));
+    }
+
+private:
+    MvdTemplateCache *cache;
+    mvdid id;
+    int job;
+    xmlDoc *doc;
+    QString path;
+};
+
 QString MvdTemplateCache::Private::retrievePath(MvdMovieCollection *collection)
 {
     QString path;
@@ -119,29 +221,180 @@ QString MvdTemplateCache::Private::retrievePath(MvdMovieCollection *collection)
     return path;
 }
 
-void MvdTemplateCache::Private::reduceCache()
+/*!
+    Returns true if \p path is inside a directory with resources that pages
+    may reference: the images directory of a registered collection or a
+    template directory.
+*/
+bool MvdTemplateCache::Private::isResourcePath(const QString &path) const
 {
-    qSort(automaticCache);
-    int last = automaticCache.size();
-    while (automaticCache.size() > (MaxCachedPages / 2)) {
-        CachedPage p = automaticCache.takeAt(--last);
-        QFile::remove(p.path);
+    const QString canonicalPath = QFileInfo(path).canonicalFilePath();
+    if (canonicalPath.isEmpty())
+        return false;
+
+    QStringList dirs;
+    for (int i = 0; i < registeredCollections.size(); ++i) {
+        QString dataPath = registeredCollections.at(i)->metaData(MvdMovieCollection::DataPathInfo);
+        if (!dataPath.isEmpty())
+            dirs << dataPath.append("/images");
+    }
+    QString resources = Movida::paths().resourcesDir(Movida::UserScope);
+    if (!resources.isEmpty())
+        dirs << resources.append("Templates");
+    resources = Movida::paths().resourcesDir(Movida::SystemScope);
+    if (!resources.isEmpty())
+        dirs << resources.append("Templates");
+
+#ifdef Q_OS_WIN
+    const Qt::CaseSensitivity cs = Qt::CaseInsensitive;
+#else
+    const Qt::CaseSensitivity cs = Qt::CaseSensitive;
+#endif
+
+    for (int i = 0; i < dirs.size(); ++i) {
+        const QString dir = QFileInfo(dirs.at(i)).canonicalFilePath();
+        if (!dir.isEmpty() && canonicalPath.startsWith(dir + QLatin1Char('/'), cs))
+            return true;
     }
+
+    return false;
 }
 
-void MvdTemplateCache::Private::purgeCache()
+//! Appends a page to the usage list as the most recently used.
+void MvdTemplateCache::Private::link(CachedPage *page)
 {
-    while (!automaticCache.isEmpty()) {
-        CachedPage p = automaticCache.takeAt(0);
-        QFile::remove(p.path);
+    page->previous = mostRecentlyUsed;
+    page->next = 0;
+    if (mostRecentlyUsed)
+        mostRecentlyUsed->next = page;
+    else leastRecentlyUsed = page;
+    mostRecentlyUsed = page;
+
+    memoryUsage += page->data.size();
+}
+
+void MvdTemplateCache::Private::unlink(CachedPage *page)
+{
+    if (page->previous)
+        page->previous->next = page->next;
+    else leastRecentlyUsed = page->next;
+    if (page->next)
+        page->next->previous = page->previous;
+    else mostRecentlyUsed = page->previous;
+    page->previous = page->next = 0;
+
+    memoryUsage -= page->data.size();
+}
+
+//! Marks a cached page as the most recently used and returns its contents.
+QByteArray MvdTemplateCache::Private::use(CachedPage *page)
+{
+    if (page->overflowPath.isEmpty()) {
+        if (page != mostRecentlyUsed) {
+            unlink(page);
+            link(page);
+        }
+        return page->data;
     }
 
-    while (!manualCache.isEmpty()) {
-        CachedPage p = manualCache.takeAt(0);
-        QFile::remove(p.path);
+    QFile file(page->overflowPath);
+    if (file.open(QIODevice::ReadOnly))
+        page->data = file.readAll();
+    file.remove();
+    page->overflowPath.clear();
+
+    link(page);
+    reduceCache();
+    return page->data;
+}
+
+void MvdTemplateCache::Private::insert(CachedPage *page)
+{
+    CachedPage *old = pages.value(page->key);
+    if (old)
+        remove(old);
+
+    pages.insert(page->key, page);
+    link(page);
+    reduceCache();
+}
+
+void MvdTemplateCache::Private::remove(CachedPage *page)
+{
+    pages.remove(page->key);
+
+    if (page->overflowPath.isEmpty())
+        unlink(page);
+    else QFile::remove(page->overflowPath);
+
+    delete page;
+}
+
+/*!
+    Evicts the least recently used pages until the memory budget is met.
+    The most recently used page is never evicted.
+*/
+void MvdTemplateCache::Private::reduceCache()
+{
+    const int maxBytes = Movida::core().parameter("mvdcore/template-cache-kb").toInt() * 1024;
+    const bool overflow = Movida::core().parameter("mvdcore/template-cache-overflow").toBool();
+
+    while (memoryUsage > maxBytes && leastRecentlyUsed != mostRecentlyUsed) {
+        CachedPage *page = leastRecentlyUsed;
+
+        if (overflow && page->movie != MvdNull) {
+            QString path = retrievePath(0).append(QString("bvt_%1.html").arg(page->movie));
+            QFile file(path);
+            if (file.open(QIODevice::WriteOnly) && file.write(page->data) == page->data.size()) {
+                unlink(page);
+                page->data.clear();
+                page->overflowPath = path;
+                continue;
+            }
+            wLog() << QString("MvdTemplateCache: Failed to write %1 (%2).").arg(path).arg(file.errorString());
+            file.remove();
+        }
+
+        remove(page);
     }
 }
 
+void MvdTemplateCache::Private::purgeCache()
+{
+    QList<CachedPage *> list = pages.values();
+    for (int i = 0; i < list.size(); ++i)
+        remove(list.at(i));
+
+    manualCache.clear();
+    blank.clear();
+}
+
+//! Renders a movie page and adds it to the cache.
+MvdTemplateCache::Private::CachedPage *MvdTemplateCache::Private::renderMovie(
+    MvdMovieCollection *collection, mvdid id)
+{
+    MVD_TRACE_SPAN(span, "MvdTemplateCache::renderMovie", "template");
+
+    QString html = Movida::tmanager().movieToHtml(collection->movie(id), *collection,
+        QLatin1String("BrowserView"), templateName);
+    if (html.isEmpty())
+        return 0;
+
+    CachedPage *page = new CachedPage(movieKey(id), collection, id);
+    page->data = html.toUtf8();
+    insert(page);
+    return page;
+}
+
+QUrl MvdTemplateCache::Private::pageUrl(const QString &key)
+{
+    QUrl url;
+    url.setScheme(MvdTemplateCache::scheme());
+    url.setPath(QLatin1String("/"));
+    url.setEncodedQuery(key.toLatin1());
+    return url;
+}
+
 /************************************************************************
     MvdTemplateCache
  *************************************************************************/
@@ -189,133 +442,233 @@ void MvdTemplateCache::create()
     mInstance = &instance;
 }
 
-QString MvdTemplateCache::blank(MvdMovieCollection *collection)
+//! Returns the URL scheme used for cached pages and the resources they reference.
+QString MvdTemplateCache::scheme()
+{
+    return QLatin1String("mvdpage");
+}
+
+//! Returns true if \p url identifies a cached page rather than a resource.
+bool MvdTemplateCache::isPageUrl(const QUrl &url)
+{
+    return url.scheme() == scheme() && !url.encodedQuery().isEmpty();
+}
+
+QUrl MvdTemplateCache::blank(MvdMovieCollection *collection)
 {
     if (collection)
         registerCollection(collection);
 
     if (d->blank.isEmpty()) {
-        d->blank = d->retrievePath(collection);
-        d->blank.append("blank.html");
-        if (QFile::exists(d->blank))
-            QFile::remove(d->blank);
-        bool res = Movida::tmanager().collectionToHtmlFile(
-            collection, d->blank, QLatin1String("BrowserView"), d->templateName);
-        if (!res) {
-            d->blank.clear();
-            return QString();
-        }
+        MVD_TRACE_SPAN(span, "MvdTemplateCache::blank", "template");
+        QString html = Movida::tmanager().collectionToHtml(
+            collection, QLatin1String("BrowserView"), d->templateName);
+        if (html.isEmpty())
+            return QUrl();
+        d->blank = html.toUtf8();
     }
 
-    return d->blank;
+    return Private::pageUrl(QLatin1String("blank"));
 }
 
-QString MvdTemplateCache::movie(MvdMovieCollection *collection, mvdid id)
+QUrl MvdTemplateCache::movie(MvdMovieCollection *collection, mvdid id)
 {
-    QString path;
-
     if (!collection || id == MvdNull)
-        return path;
+        return QUrl();
 
     registerCollection(collection);
-    int idx = d->automaticCache.indexOf(Private::CachedPage(id, QString(), collection));
-    if (idx >= 0) {
-        Private::CachedPage &cp = d->automaticCache[idx];
-        ++cp.usage;
-        path = cp.path;
-    }
 
     //! \todo support multiple collections
 
-    if (path.isEmpty()) {
-        // Parse and cache HTML
-        path = d->retrievePath(false);
-        path.append(QString("bvt_%1.html").arg(id));
-        if (QFile::exists(path)) QFile::remove(path);
+    QString key = Private::movieKey(id);
+    if (!d->find(key) && !d->renderMovie(collection, id))
+        return QUrl();
+
+    return Private::pageUrl(key);
+}
+
+/*!
+    Renders the pages of the given movies in a background thread, so that
+    they can be shown later with no delay. Movies that are already cached
+    are skipped. Requests from previous calls that have not been started
+    yet are cancelled.
+
+    The template input is built in the calling thread, so the collection
+    is never accessed by the background thread.
+*/
+void MvdTemplateCache::prerender(MvdMovieCollection *collection, const QList<mvdid> &ids)
+{
+    d->firstWantedJob = d->lastRenderJob + 1;
+    d->pendingRenders.clear();
 
-        bool res = Movida::tmanager().movieToHtmlFile(collection->movie(id), *collection,
-            path, QLatin1String("BrowserView"), d->templateName);
+    if (!collection)
+        return;
 
-        if (res) {
-            if (d->automaticCache.size() == MaxCachedPages)
-                d->reduceCache();
-            d->automaticCache.append(Private::CachedPage(id, path, collection));
-        } else path.clear();
+    registerCollection(collection);
+
+    QString path = Movida::tmanager().templatePath(QLatin1String("BrowserView"),
+        d->templateName, QLatin1String("Movie.xsl"));
+
+    for (int i = 0; i < ids.size(); ++i) {
+        mvdid id = ids.at(i);
+        if (id == MvdNull || d->find(Private::movieKey(id)))
+            continue;
+
+        xmlDoc *doc = Movida::tmanager().movieToXmlDoc(collection->movie(id), *collection);
+        if (!doc)
+            continue;
+
+        Private::PendingRender pending;
+        pending.job = ++d->lastRenderJob;
+        pending.collection = collection;
+        d->pendingRenders.insert(id, pending);
+
+        d->renderPool.start(new Private::Renderer(this, id, pending.job, doc, path));
     }
+}
 
-    return path;
+//! \internal Adds a page rendered in background, unless the movie has changed in the meantime.
+void MvdTemplateCache::prerendered(uint id, int job, const QByteArray &html)
+{
+    QHash<mvdid, Private::PendingRender>::Iterator it = d->pendingRenders.find(id);
+    if (it == d->pendingRenders.end() || it.value().job != job)
+        return;
+
+    MvdMovieCollection *collection = it.value().collection;
+    d->pendingRenders.erase(it);
+
+    QString key = Private::movieKey(id);
+    if (html.isEmpty() || d->find(key) || !d->registeredCollections.contains(collection))
+        return;
+
+    Private::CachedPage *page = new Private::CachedPage(key, collection, id);
+    page->data = html;
+    d->insert(page);
 }
 
 int MvdTemplateCache::cacheMovieData(const MvdMovieData &md)
 {
-    QString path = d->retrievePath(0);
+    QString html = Movida::tmanager().movieDataToHtml(md,
+        QLatin1String("BrowserView"), d->templateName);
 
-    if (!QFile::exists(path)) {
-        QDir dir;
-        dir.mkpath(path);
-    }
+    if (html.isEmpty())
+        return -1;
 
     quint64 id = ++d->manualCacheId;
-    path.append(QString("bvrt_%1.html").arg(id));
-    if (QFile::exists(path)) QFile::remove(path);
+    d->manualCache.insert(id, html.toUtf8());
+    return id;
+}
 
-    bool res = Movida::tmanager().movieDataToHtmlFile(md,
-        path, QLatin1String("BrowserView"), d->templateName);
+QUrl MvdTemplateCache::movieData(int id)
+{
+    if (id < 0 || !d->manualCache.contains(id))
+        return QUrl();
 
-    if (res) {
-        d->manualCache.append(Private::CachedPage(id, path));
-        return id;
-    }
+    return Private::pageUrl(QString("moviedata=%1").arg(id));
+}
 
-    return -1;
+void MvdTemplateCache::clearCachedMovieData(int id)
+{
+    d->manualCache.remove(id);
 }
 
-QString MvdTemplateCache::movieData(int id)
+/*!
+    Returns the contents of a page or of a resource referenced by a page.
+    Movie pages that have been evicted from the cache are rendered again.
+    Resources are only read from the images directory of a registered
+    collection and from the template directories. Files bigger than a
+    quarter of the cache budget are not cached.
+    Returns a null byte array if the URL does not identify a page or a
+    readable resource.
+*/
+QByteArray MvdTemplateCache::data(const QUrl &url)
 {
-    if (id < 0) {
-        return QString();
+    if (url.scheme() != scheme())
+        return QByteArray();
+
+    if (isPageUrl(url)) {
+        QString key = QString::fromLatin1(url.encodedQuery());
+        if (key == QLatin1String("blank"))
+            return d->blank;
+        if (key.startsWith(QLatin1String("moviedata=")))
+            return d->manualCache.value(key.mid(10).toULongLong());
+
+        Private::CachedPage *page = d->find(key);
+        if (page)
+            return d->use(page);
+
+        //! \todo support multiple collections
+        if (!key.startsWith(QLatin1String("movie=")) || d->registeredCollections.isEmpty())
+            return QByteArray();
+
+        mvdid id = key.mid(6).toUInt();
+        if (id == MvdNull)
+            return QByteArray();
+        page = d->renderMovie(d->registeredCollections.last(), id);
+        return page ? page->data : QByteArray();
     }
 
-    foreach(const Private::CachedPage & p, d->manualCache)
-    {
-        if (p.id == (quint64)id) {
-            return p.path;
-        }
-    }
+    QUrl fileUrl(url);
+    fileUrl.setScheme(QLatin1String("file"));
+    QString path = fileUrl.toLocalFile();
 
-    return QString();
-}
+    Private::CachedPage *page = d->find(path);
+    if (page)
+        return d->use(page);
 
-void MvdTemplateCache::clearCachedMovieData(int id)
-{
-    for (int i = 0; i < d->manualCache.size(); ++i) {
-        const Private::CachedPage &p = d->manualCache.at(i);
-        if (p.id == (quint64)id) {
-            d->manualCache.removeAt(i);
-            break;
-        }
+    if (!d->isResourcePath(path)) {
+        wLog() << QString("MvdTemplateCache: Access denied to %1").arg(path);
+        return QByteArray();
     }
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    // A quarter of the budget (set in KB)
+    const qint64 maxBytes = Movida::core().parameter("mvdcore/template-cache-kb").toInt() * 256;
+    if (file.size() > maxBytes)
+        return file.readAll();
+
+    page = new Private::CachedPage(path);
+    page->data = file.readAll();
+    d->insert(page);
+    return page->data;
 }
 
 void MvdTemplateCache::invalidateMovie(mvdid id)
 {
     MvdMovieCollection *collection = qobject_cast<MvdMovieCollection *>(sender());
+
+    if (d->pendingRenders.value(id).collection == collection)
+        d->pendingRenders.remove(id);
+
     // Remove movie from cache
-    int idx = d->automaticCache.indexOf(Private::CachedPage(id, QString(), collection));
+    Private::CachedPage *page = d->find(Private::movieKey(id));
+    if (page && page->collection == collection)
+        d->remove(page);
+}
 
-    if (idx < 0)
-        return;
+//! Removes the cached pages of a set of movies.
+void MvdTemplateCache::invalidateMovies(const QList<mvdid> &ids)
+{
+    MvdMovieCollection *collection = qobject_cast<MvdMovieCollection *>(sender());
+
+    for (int i = 0; i < ids.size(); ++i) {
+        mvdid id = ids.at(i);
 
-    QString path = d->automaticCache[idx].path;
-    QFile::remove(path);
-    d->automaticCache.removeAt(idx);
+        if (d->pendingRenders.value(id).collection == collection)
+            d->pendingRenders.remove(id);
+
+        Private::CachedPage *page = d->find(Private::movieKey(id));
+        if (page && page->collection == collection)
+            d->remove(page);
+    }
 }
 
 void MvdTemplateCache::invalidateCollection()
 {
     // Remove blank page from cache
-    if (d->blank.isEmpty()) return;
-    QFile::remove(d->blank);
     d->blank.clear();
 }
 
@@ -325,6 +678,8 @@ void MvdTemplateCache::registerCollection(MvdMovieCollection *collection)
         if (d->registeredCollections.indexOf(collection) >= 0) return;
         connect(collection, SIGNAL(movieRemoved(mvdid)), SLOT(invalidateMovie(mvdid)));
         connect(collection, SIGNAL(movieChanged(mvdid)), SLOT(invalidateMovie(mvdid)));
+        connect(collection, SIGNAL(moviesRemoved(QList<mvdid>)), SLOT(invalidateMovies(QList<mvdid>)));
+        connect(collection, SIGNAL(moviesChanged(QList<mvdid>)), SLOT(invalidateMovies(QList<mvdid>)));
         connect(collection, SIGNAL(changed()), SLOT(invalidateCollection()));
         connect(collection, SIGNAL(destroyed(QObject *)), SLOT(deregisterCollection(QObject *)));
         d->registeredCollections.append(collection);
@@ -337,13 +692,11 @@ void MvdTemplateCache::deregisterCollection(QObject *o)
 
     if (collection) {
         d->registeredCollections.removeAll(collection);
-        for (int i = 0; i < d->automaticCache.size(); ++i) {
-            const Private::CachedPage &p = d->automaticCache.takeAt(i);
-            if (p.collection != collection) continue;
-            QFile::remove(p.path);
-            d->automaticCache.removeAt(i);
-            --i;
-        }
+
+        QList<Private::CachedPage *> list = d->pages.values();
+        for (int i = 0; i < list.size(); ++i)
+            if (list.at(i)->collection == collection)
+                d->remove(list.at(i));
     }
 }
 
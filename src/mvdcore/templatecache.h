@@ -24,6 +24,8 @@
 #include "global.h"
 #include "moviedata.h"
 
+#include <QtCore/QUrl>
+
 class MvdMovieCollection;
 
 class MVD_EXPORT MvdTemplateCache : public QObject
@@ -33,16 +35,24 @@ class MVD_EXPORT MvdTemplateCache : public QObject
 public:
     static MvdTemplateCache &instance();
 
-    QString blank(MvdMovieCollection *collection);
-    QString movie(MvdMovieCollection *collection, mvdid id);
+    static QString scheme();
+    static bool isPageUrl(const QUrl &url);
+
+    QUrl blank(MvdMovieCollection *collection);
+    QUrl movie(MvdMovieCollection *collection, mvdid id);
+    void prerender(MvdMovieCollection *collection, const QList<mvdid> &ids);
     int cacheMovieData(const MvdMovieData &md);
-    QString movieData(int id);
+    QUrl movieData(int id);
     void clearCachedMovieData(int id);
 
+    QByteArray data(const QUrl &url);
+
     QString cacheDirectory() const;
 
 private slots:
+    void prerendered(uint id, int job, const QByteArray &html);
     void invalidateMovie(mvdid id);
+    void invalidateMovies(const QList<mvdid> &ids);
     void invalidateCollection();
     void deregisterCollection(QObject *o);
 
@@ -30,6 +30,8 @@
 #include <QtCore/QMutex>
 #include <QtCore/QUrl>
 
+#include <libxml/tree.h>
+
 #include <stdexcept>
 
 using namespace Movida;
@@ -55,12 +57,83 @@ class MvdTemplateManager::Private
 {
 public:
     Private();
+
+    static QString collectionToXml(MvdMovieCollection *collection);
+    static QString imageReference(const MvdMovieCollection &collection, const QString &image);
 };
 
+namespace {
+xmlNodePtr addTextNode(xmlNodePtr parent, const char *name, const QString &text)
+{
+    return xmlNewTextChild(parent, 0, BAD_CAST name, BAD_CAST text.toUtf8().constData());
+}
+
+void addCDataNode(xmlNodePtr parent, const char *name, const QString &text)
+{
+    xmlNodePtr node = xmlNewChild(parent, 0, BAD_CAST name, 0);
+    QByteArray buffer = text.toUtf8();
+    xmlAddChild(node, xmlNewCDataBlock(parent->doc, BAD_CAST buffer.constData(), buffer.size()));
+}
+
+void addSharedDataList(xmlNodePtr parent, const char *listName, const char *itemName,
+    const QList<mvdid> &ids, const MvdMovieCollection &collection)
+{
+    if (ids.isEmpty())
+        return;
+
+    xmlNodePtr list = xmlNewChild(parent, 0, BAD_CAST listName, 0);
+    for (int i = 0; i < ids.size(); ++i) {
+        const MvdSdItem &sd = collection.sharedData().item(ids.at(i));
+        if (!sd.value.isEmpty())
+            addTextNode(list, itemName, sd.value);
+    }
+}
+
+void addPersonList(xmlNodePtr parent, const char *listName,
+    const QList<MvdRoleItem> &items, const MvdMovieCollection &collection)
+{
+    if (items.isEmpty())
+        return;
+
+    xmlNodePtr list = xmlNewChild(parent, 0, BAD_CAST listName, 0);
+    for (int i = 0; i < items.size(); ++i) {
+        const MvdRoleItem &item = items.at(i);
+        const MvdSdItem &sd = collection.sharedData().item(item.first);
+        if (sd.value.isEmpty())
+            continue;
+
+        xmlNodePtr person = xmlNewChild(list, 0, BAD_CAST "person", 0);
+        addTextNode(person, "name", sd.value);
+        addTextNode(person, "imdb-id", sd.id);
+
+        const QStringList &roles = item.second;
+        if (!roles.isEmpty()) {
+            xmlNodePtr roleList = xmlNewChild(person, 0, BAD_CAST "roles", 0);
+            for (int j = 0; j < roles.size(); ++j)
+                if (!roles.at(j).isEmpty())
+                    addTextNode(roleList, "role", roles.at(j));
+        }
+    }
+}
+}
+
 //! \internal
 MvdTemplateManager::Private::Private()
 { }
 
+/*!
+    \internal Returns a root relative reference to a collection image (i.e.
+    "/path/to/image"), so that it resolves to the image both in pages stored
+    as local files and in pages served through a custom URL scheme (see
+    MvdTemplateCache::scheme()).
+*/
+QString MvdTemplateManager::Private::imageReference(const MvdMovieCollection &collection,
+    const QString &image)
+{
+    QUrl url = QUrl::fromLocalFile(collection.imagePath(image));
+    return QString::fromLatin1(url.toEncoded(QUrl::RemoveScheme | QUrl::RemoveAuthority));
+}
+
 /************************************************************************
     MvdTemplateManager
  *************************************************************************/
@@ -108,6 +181,25 @@ void MvdTemplateManager::create()
     mInstance = &instance;
 }
 
+/*!
+    Returns the path of a template file, falling back to the default
+    template if \p name is empty or the user template does not exist.
+    MvdXsltProc caches the compiled stylesheet for each path, so a template
+    is compiled only once per category and name unless it changes on disk.
+*/
+QString MvdTemplateManager::templatePath(const QString &category,
+    const QString &name, const QString &file) const
+{
+    if (!name.isEmpty()) {
+        QString path = paths().resourcesDir().append("Templates/").append(category)
+            .append("/").append(name).append("/").append(file);
+        if (QFile::exists(path))
+            return path;
+    }
+
+    return QString(":/Templates/%1/Default/%2").arg(category).arg(file);
+}
+
 /*!
     Returns the name of the available movie templates.
     \todo Templates will have an xml descriptor with name, author, etc and a thumbnail!
@@ -137,241 +229,141 @@ QStringList MvdTemplateManager::templates(const QString &category) const
     return names;
 }
 
-//! Returns an empty string if \p movie is not valid. \todo Use XmlWriter or encode special chars (i.e. "&").
+/*!
+    Returns the template input for \p movie as an XML string, i.e. the
+    serialized movieToXmlDoc() document.
+    Returns an empty string if \p movie is not valid.
+*/
 QString MvdTemplateManager::movieToXml(const MvdMovie &movie,
     const MvdMovieCollection &collection)
 {
-    //! \todo movie to MvdMovie class!
-    //! \todo sanitize xml (maybe in mvdmovie or moviedata class?)
+    xmlDocPtr doc = movieToXmlDoc(movie, collection);
+    if (!doc)
+        return QString();
+
+    xmlChar *buffer = 0;
+    int size = 0;
+    xmlDocDumpFormatMemoryEnc(doc, &buffer, &size, "UTF-8", 1);
+    xmlFreeDoc(doc);
+
+    QString xml = QString::fromUtf8((const char *)buffer, size);
+    xmlFree(buffer);
+    return xml;
+}
 
+/*!
+    Builds the template input for \p movie as a libxml2 tree, so that it can
+    be transformed with MvdXsltProc::processDocument() without being
+    serialized and parsed again. Text is escaped by libxml2. The caller
+    takes ownership of the document and must free it with xmlFreeDoc().
+    Returns 0 if \p movie is not valid.
+*/
+xmlDoc *MvdTemplateManager::movieToXmlDoc(const MvdMovie &movie,
+    const MvdMovieCollection &collection)
+{
     if (!movie.isValid())
-        return QString();
+        return 0;
 
-    QString xml = "<movie>\n";
+    xmlDocPtr doc = xmlNewDoc(BAD_CAST "1.0");
+    xmlNodePtr root = xmlNewDocNode(doc, 0, BAD_CAST "movie", 0);
+    xmlDocSetRootElement(doc, root);
 
-    QString s = movie.validTitle();
-    xml.append(QString("\t<title>%1</title>\n").arg(s));
+    addTextNode(root, "title", movie.validTitle());
 
-    s = movie.title();
+    QString s = movie.title();
     if (!s.isEmpty()) {
         s = movie.originalTitle();
         if (!s.isEmpty())
-            xml.append(QString("\t<original-title>%1</original-title>\n").arg(s));
+            addTextNode(root, "original-title", s);
     }
 
     s = movie.year();
     if (!s.isEmpty())
-        xml.append(QString("\t<year>%1</year>\n").arg(s));
+        addTextNode(root, "year", s);
 
     s = movie.imdbId();
-    if (!s.isEmpty()) {
-        s = Movida::core().parameter("mvdcore/imdb-movie-url").toString().arg(s);
-        xml.append(QString("\t<imdb-url>%1</imdb-url>\n").arg(s));
-    }
+    if (!s.isEmpty())
+        addTextNode(root, "imdb-url", Movida::core().parameter("mvdcore/imdb-movie-url").toString().arg(s));
 
     s = movie.plot();
     if (!s.isEmpty())
-        xml.append(QString("\t<plot>\n\t\t<![CDATA[%1]]>\n\t</plot>\n").arg(s));
+        addCDataNode(root, "plot", s);
 
     s = movie.notes();
     if (!s.isEmpty())
-        xml.append(QString("\t<notes>\n\t\t<![CDATA[%1]]>\n\t</notes>\n").arg(s));
+        addCDataNode(root, "notes", s);
 
     s = movie.storageId();
     if (!s.isEmpty())
-        xml.append(QString("\t<storage-id>%1</storage-id>\n").arg(s));
+        addTextNode(root, "storage-id", s);
 
     quint8 sh = movie.rating();
     if (sh != 0)
-        xml.append(QString("\t<rating>%1</rating>\n").arg(sh));
+        addTextNode(root, "rating", QString::number(sh));
 
     sh = movie.runningTime();
     if (sh != 0) {
-        xml.append(QString("\t<running-time>%1</running-time>\n").arg(sh));
-        s = movie.runningTimeString();
-        xml.append(QString("\t<running-time-string>%1</running-time-string>\n").arg(s));
+        addTextNode(root, "running-time", QString::number(sh));
+        addTextNode(root, "running-time-string", movie.runningTimeString());
     }
 
     s = movie.colorModeString();
     if (!s.isEmpty())
-        xml.append(QString("\t<color-mode>%1</color-mode>\n").arg(s));
-
-    QList<mvdid> idList = movie.languages();
-    if (!idList.isEmpty()) {
-        xml.append("\t<languages>\n");
-        for (int i = 0; i < idList.size(); ++i) {
-            mvdid id = idList.at(i);
-            const MvdSdItem &sd = collection.sharedData().item(id);
-            if (!sd.value.isEmpty())
-                xml.append(QString("\t\t<language>%1</language>\n").arg(sd.value));
-        }
-        xml.append("\t</languages>\n");
-    }
-
-    idList = movie.countries();
-    if (!idList.isEmpty()) {
-        xml.append("\t<countries>\n");
-        for (int i = 0; i < idList.size(); ++i) {
-            mvdid id = idList.at(i);
-            const MvdSdItem &sd = collection.sharedData().item(id);
-            if (!sd.value.isEmpty())
-                xml.append(QString("\t\t<country>%1</country>\n").arg(sd.value));
-        }
-        xml.append("\t</countries>\n");
-    }
+        addTextNode(root, "color-mode", s);
 
-    idList = movie.tags();
-    if (!idList.isEmpty()) {
-        xml.append("\t<tags>\n");
-        for (int i = 0; i < idList.size(); ++i) {
-            mvdid id = idList.at(i);
-            const MvdSdItem &sd = collection.sharedData().item(id);
-            if (!sd.value.isEmpty())
-                xml.append(QString("\t\t<tag>%1</tag>\n").arg(sd.value));
-        }
-        xml.append("\t</tags>\n");
-    }
+    addSharedDataList(root, "languages", "language", movie.languages(), collection);
+    addSharedDataList(root, "countries", "country", movie.countries(), collection);
+    addSharedDataList(root, "tags", "tag", movie.tags(), collection);
+    addSharedDataList(root, "genres", "genre", movie.genres(), collection);
 
-    idList = movie.genres();
-    if (!idList.isEmpty()) {
-        xml.append("\t<genres>\n");
-        for (int i = 0; i < idList.size(); ++i) {
-            mvdid id = idList.at(i);
-            const MvdSdItem &sd = collection.sharedData().item(id);
-            if (!sd.value.isEmpty())
-                xml.append(QString("\t\t<genre>%1</genre>\n").arg(sd.value));
-        }
-        xml.append("\t</genres>\n");
-    }
-
-    idList = movie.directors();
-    if (!idList.isEmpty()) {
-        xml.append("\t<directors>\n");
-        for (int i = 0; i < idList.size(); ++i) {
-            mvdid id = idList.at(i);
-            const MvdSdItem &sd = collection.sharedData().item(id);
-            if (!sd.value.isEmpty()) {
-                xml.append("\t\t<person>\n");
-                xml.append(QString("\t\t\t<name>%1</name>\n").arg(sd.value));
-                xml.append(QString("\t\t\t<imdb-id>%1</imdb-id>\n").arg(sd.id));
-                xml.append("\t\t</person>\n");
-            }
-        }
-        xml.append("\t</directors>\n");
-    }
+    QList<mvdid> idList = movie.directors();
+    QList<MvdRoleItem> people;
+    for (int i = 0; i < idList.size(); ++i)
+        people.append(MvdRoleItem(idList.at(i), QStringList()));
+    addPersonList(root, "directors", people, collection);
 
     idList = movie.producers();
-    if (!idList.isEmpty()) {
-        xml.append("\t<producers>\n");
-        for (int i = 0; i < idList.size(); ++i) {
-            mvdid id = idList.at(i);
-            const MvdSdItem &sd = collection.sharedData().item(id);
-            if (!sd.value.isEmpty()) {
-                xml.append("\t\t<person>\n");
-                xml.append(QString("\t\t\t<name>%1</name>\n").arg(sd.value));
-                xml.append(QString("\t\t\t<imdb-id>%1</imdb-id>\n").arg(sd.id));
-                xml.append("\t\t</person>\n");
-            }
-        }
-        xml.append("\t</producers>\n");
-    }
+    people.clear();
+    for (int i = 0; i < idList.size(); ++i)
+        people.append(MvdRoleItem(idList.at(i), QStringList()));
+    addPersonList(root, "producers", people, collection);
 
-    QList<MvdRoleItem> idRoleList = movie.actors();
-    if (!idRoleList.isEmpty()) {
-        xml.append("\t<cast>\n");
-        for (int i = 0; i < idRoleList.size(); ++i) {
-            const MvdRoleItem &item = idRoleList.at(i);
-            mvdid id = item.first;
-            QStringList roles = item.second;
-            const MvdSdItem &sd = collection.sharedData().item(id);
-            if (!sd.value.isEmpty()) {
-                xml.append("\t\t<person>\n");
-                xml.append(QString("\t\t\t<name>%1</name>\n").arg(sd.value));
-                xml.append(QString("\t\t\t<imdb-id>%1</imdb-id>\n").arg(sd.id));
-                if (!roles.isEmpty()) {
-                    xml.append("\t\t\t<roles>\n");
-                    for (int i = 0; i < roles.size(); ++i)
-                        if (!roles.at(i).isEmpty())
-                            xml.append(QString("\t\t\t\t<role>%1</role>\n").arg(roles.at(i)));
-                    xml.append("\t\t\t</roles>\n");
-                }
-                xml.append("\t\t</person>\n");
-            }
-        }
-        xml.append("\t</cast>\n");
-    }
-
-    idRoleList = movie.crewMembers();
-    if (!idRoleList.isEmpty()) {
-        xml.append("\t<crew>\n");
-        for (int i = 0; i < idRoleList.size(); ++i) {
-            const MvdRoleItem &item = idRoleList.at(i);
-            mvdid id = item.first;
-            QStringList roles = item.second;
-            const MvdSdItem &sd = collection.sharedData().item(id);
-            if (!sd.value.isEmpty()) {
-                xml.append("\t\t<person>\n");
-                xml.append(QString("\t\t\t<name>%1</name>\n").arg(sd.value));
-                xml.append(QString("\t\t\t<imdb-id>%1</imdb-id>\n").arg(sd.id));
-                if (!roles.isEmpty()) {
-                    xml.append("\t\t\t<roles>\n");
-                    for (int i = 0; i < roles.size(); ++i)
-                        if (!roles.at(i).isEmpty())
-                            xml.append(QString("\t\t\t\t<role>%1</role>\n").arg(roles.at(i)));
-                    xml.append("\t\t\t</roles>\n");
-                }
-                xml.append("\t\t</person>\n");
-            }
-        }
-        xml.append("\t</crew>\n");
-    }
+    addPersonList(root, "cast", movie.actors(), collection);
+    addPersonList(root, "crew", movie.crewMembers(), collection);
 
     QList<MvdUrl> urlList = movie.urls();
     if (!urlList.isEmpty()) {
-        xml.append("\t<urls>\n");
+        xmlNodePtr urls = xmlNewChild(root, 0, BAD_CAST "urls", 0);
         for (int i = 0; i < urlList.size(); ++i) {
-            MvdUrl url = urlList.at(i);
-
-            xml.append("\t\t<url>\n");
-            if (url.description.isEmpty())
-                xml.append(QString("\t\t\t<url>%1</url>\n").arg(url.url));
-            else xml.append(QString("\t\t\t<url description=\"%1\">%2</url>\n").arg(url.description).arg(url.url));
-            xml.append("\t\t</url>\n");
+            const MvdUrl &url = urlList.at(i);
+            xmlNodePtr item = xmlNewChild(urls, 0, BAD_CAST "url", 0);
+            xmlNodePtr node = addTextNode(item, "url", url.url);
+            if (!url.description.isEmpty())
+                xmlNewProp(node, BAD_CAST "description", BAD_CAST url.description.toUtf8().constData());
         }
-        xml.append("\t</urls>\n");
     }
 
     QStringList sl = movie.specialContents();
     if (!sl.isEmpty()) {
-        xml.append("\t<special-contents>\n");
-        for (int i = 0; i < sl.size(); ++i) {
+        xmlNodePtr contents = xmlNewChild(root, 0, BAD_CAST "special-contents", 0);
+        for (int i = 0; i < sl.size(); ++i)
             if (!sl.at(i).isEmpty())
-                xml.append(QString("\t\t<item>%1</item>\n").arg(sl.at(i)));
-        }
-        xml.append("\t</special-contents>\n");
+                addTextNode(contents, "item", sl.at(i));
     }
 
     Movida::Tags tags = movie.specialTags();
-    if (tags & Movida::SeenTag) {
-        xml.append("\t<seen>true</seen>\n");
-    }
-    if (tags & Movida::LoanedTag) {
-        xml.append("\t<loaned>true</loaned>\n");
-    }
-    if (tags & Movida::SpecialTag) {
-        xml.append("\t<special>true</special>\n");
-    }
+    if (tags & Movida::SeenTag)
+        addTextNode(root, "seen", "true");
+    if (tags & Movida::LoanedTag)
+        addTextNode(root, "loaned", "true");
+    if (tags & Movida::SpecialTag)
+        addTextNode(root, "special", "true");
 
     s = movie.poster();
-    if (!s.isEmpty()) {
-        QString p = collection.metaData(MvdMovieCollection::DataPathInfo);
-        p.append("/images/").append(s);
-        QUrl url = QUrl::fromLocalFile(p);
-        xml.append(QString("\t<poster>%1</poster>\n").arg(url.toString()));
-    }
+    if (!s.isEmpty())
+        addTextNode(root, "poster", Private::imageReference(collection, s));
 
-    xml.append("</movie>");
-    return xml;
+    return doc;
 }
 
 //! Uses the default template if \p templateName is empty.
@@ -381,12 +373,13 @@ QString MvdTemplateManager::movieToHtml(const MvdMovie &movie, const MvdMovieCol
     if (!movie.isValid())
         return QString();
 
-    QString path = paths().resourcesDir().append("Templates/").append(templateCategory).append("/").append(templateName).append("/Movie.xsl");
-    if (templateName.isEmpty() || !QFile::exists(path))
-        path = QString(":/Templates/%1/Default/Movie.xsl").arg(templateCategory);
+    QString path = templatePath(templateCategory, templateName, "Movie.xsl");
 
+    xmlDocPtr doc = movieToXmlDoc(movie, collection);
     MvdXsltProc xsl(path);
-    return xsl.processText(movieToXml(movie, collection));
+    QString html = xsl.processDocument(doc);
+    xmlFreeDoc(doc);
+    return html;
 }
 
 //! Uses the default template if \p templateName is empty.
@@ -396,16 +389,17 @@ bool MvdTemplateManager::movieToHtmlFile(const MvdMovie &movie, const MvdMovieCo
     if (!movie.isValid())
         return false;
 
-    QString path = paths().resourcesDir().append("Templates/").append(templateCategory).append("/").append(templateName).append("/Movie.xsl");
-    if (templateName.isEmpty() || !QFile::exists(path))
-        path = QString(":/Templates/%1/Default/Movie.xsl").arg(templateCategory);
+    QString path = templatePath(templateCategory, templateName, "Movie.xsl");
 
     QFile file(filename);
     if (!file.open(QIODevice::ReadWrite))
         return false;
 
+    xmlDocPtr doc = movieToXmlDoc(movie, collection);
     MvdXsltProc xsl(path);
-    return xsl.processTextToDevice(movieToXml(movie, collection), &file);
+    bool res = xsl.processDocumentToDevice(doc, &file);
+    xmlFreeDoc(doc);
+    return res;
 }
 
 //! Uses the default template if \p templateName is empty.
@@ -415,9 +409,7 @@ QString MvdTemplateManager::movieDataToHtml(const MvdMovieData &movieData,
     if (!movieData.isValid())
         return QString();
 
-    QString path = paths().resourcesDir().append("Templates/").append(templateCategory).append("/").append(templateName).append("/Movie.xsl");
-    if (templateName.isEmpty() || !QFile::exists(path))
-        path = QString(":/Templates/%1/Default/Movie.xsl").arg(templateCategory);
+    QString path = templatePath(templateCategory, templateName, "Movie.xsl");
 
     MvdXsltProc xsl(path);
     QString xml;
@@ -432,9 +424,7 @@ bool MvdTemplateManager::movieDataToHtmlFile(const MvdMovieData &movieData,
     if (!movieData.isValid())
         return false;
 
-    QString path = paths().resourcesDir().append("Templates/").append(templateCategory).append("/").append(templateName).append("/Movie.xsl");
-    if (templateName.isEmpty() || !QFile::exists(path))
-        path = QString(":/Templates/%1/Default/Movie.xsl").arg(templateCategory);
+    QString path = templatePath(templateCategory, templateName, "Movie.xsl");
 
     MvdXsltProc xsl(path);
     QString xml;
@@ -455,9 +445,7 @@ QString MvdTemplateManager::movieDataFileToHtml(const QString &movieDataFile,
     if (!QFile::exists(movieDataFile))
         return QString();
 
-    QString path = paths().resourcesDir().append("Templates/").append(templateCategory).append("/").append(templateName).append("/Movie.xsl");
-    if (templateName.isEmpty() || !QFile::exists(path))
-        path = QString(":/Templates/%1/Default/Movie.xsl").arg(templateCategory);
+    QString path = templatePath(templateCategory, templateName, "Movie.xsl");
 
     MvdXsltProc xsl(path);
     return xsl.processFile(movieDataFile);
@@ -472,17 +460,14 @@ QString MvdTemplateManager::movieDataStringToHtml(const QString &movieDataString
     if (!QFile::exists(movieDataString))
         return QString();
 
-    QString path = paths().resourcesDir().append("Templates/").append(templateCategory).append("/").append(templateName).append("/Movie.xsl");
-    if (templateName.isEmpty() || !QFile::exists(path))
-        path = QString(":/Templates/%1/Default/Movie.xsl").arg(templateCategory);
+    QString path = templatePath(templateCategory, templateName, "Movie.xsl");
 
     MvdXsltProc xsl(path);
     return xsl.processText(movieDataString);
 }
 
-//! Uses the default template if \p templateName is empty.
-bool MvdTemplateManager::collectionToHtmlFile(MvdMovieCollection *collection,
-    const QString &filename, const QString &templateCategory, const QString &templateName)
+//! \internal Returns the template input for the collection pages.
+QString MvdTemplateManager::Private::collectionToXml(MvdMovieCollection *collection)
 {
     QString out;
     MvdXmlWriter xml(&out);
@@ -507,15 +492,30 @@ bool MvdTemplateManager::collectionToHtmlFile(MvdMovieCollection *collection,
 
     xml.writeCloseTag("collection-info");
 
-    QString path = paths().resourcesDir().append("Templates/").append(templateCategory).append("/").append(templateName).append("/Collection.xsl");
-    if (templateName.isEmpty() || !QFile::exists(path))
-        path = QString(":/Templates/%1/Default/Collection.xsl").arg(templateCategory);
+    return out;
+}
+
+//! Uses the default template if \p templateName is empty.
+QString MvdTemplateManager::collectionToHtml(MvdMovieCollection *collection,
+    const QString &templateCategory, const QString &templateName)
+{
+    QString path = templatePath(templateCategory, templateName, "Collection.xsl");
+
+    MvdXsltProc xsl(path);
+    return xsl.processText(Private::collectionToXml(collection));
+}
+
+//! Uses the default template if \p templateName is empty.
+bool MvdTemplateManager::collectionToHtmlFile(MvdMovieCollection *collection,
+    const QString &filename, const QString &templateCategory, const QString &templateName)
+{
+    QString path = templatePath(templateCategory, templateName, "Collection.xsl");
 
     MvdXsltProc xsl(path);
     QFile file(filename);
     if (!file.open(QIODevice::WriteOnly))
         return false;
-    return xsl.processTextToDevice(out, &file);
+    return xsl.processTextToDevice(Private::collectionToXml(collection), &file);
 }
 
 //! Convenience method to access the MvdTemplateManager singleton.
@@ -26,14 +26,19 @@
 #include "moviecollection.h"
 #include "moviedata.h"
 
+struct _xmlDoc;
+typedef struct _xmlDoc xmlDoc;
+
 class MVD_EXPORT MvdTemplateManager
 {
 public:
     static MvdTemplateManager &instance();
 
     QStringList templates(const QString &category) const;
+    QString templatePath(const QString &category, const QString &name, const QString &file) const;
 
     QString movieToXml(const MvdMovie &movie, const MvdMovieCollection &collection);
+    xmlDoc *movieToXmlDoc(const MvdMovie &movie, const MvdMovieCollection &collection);
     QString movieToHtml(const MvdMovie &movie, const MvdMovieCollection &collection,
     const QString &templateCategory, const QString &templateName = QString());
 
@@ -52,6 +57,8 @@ public:
     QString movieDataStringToHtml(const QString &movieDataString,
     const QString &templateCategory, const QString &templateName = QString());
 
+    QString collectionToHtml(MvdMovieCollection *collection,
+    const QString &templateCategory, const QString &templateName = QString());
     bool collectionToHtmlFile(MvdMovieCollection *collection,
     const QString &filename,
     const QString &templateCategory, const QString &templateName = QString());
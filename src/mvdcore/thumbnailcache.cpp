@@ -0,0 +1,406 @@
+/**************************************************************************
+** Filename: thumbnailcache.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#include "thumbnailcache.h"
+
+#include "logger.h"
+#include "pathresolver.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+#include <QtCore/QtAlgorithms>
+#include <QtGui/QImageReader>
+
+/*!
+    \class MvdThumbnailCache thumbnailcache.h
+    \ingroup MvdCore
+
+    \brief Persistent store of pre-scaled collection images.
+
+    Collection images are named after the MD5 hash of their contents (see
+    MvdMovieCollection::addImage()), so thumbnails are stored once for all
+    the collections in the user resources directory, one directory for each
+    thumbnail size. A changed image has a different name and thus different
+    thumbnails, so no explicit invalidation is needed; images with a name
+    that is not a content hash are never cached.
+
+    When a thumbnail is created, the image is decoded only once and all the
+    registered sizes are created and stored at the same time.
+
+    The thumbnails of images that are no longer used are never removed
+    explicitly, as other collections might still use them. Instead, the
+    least recently used thumbnails are removed when the total size of the
+    store exceeds maximumSize().
+
+    All the methods are thread safe.
+*/
+
+Q_GLOBAL_STATIC(QMutex, MvdThumbnailCacheLock)
+
+namespace {
+const qint64 DefaultMaximumSize = 64 * 1024 * 1024;
+
+struct ThumbnailCacheData {
+    ThumbnailCacheData() :
+        maximumSize(DefaultMaximumSize),
+        totalSize(-1) { }
+
+    QList<QSize> sizes;
+    // Size directory -> cached images
+    QHash<QString, QSet<QString> > index;
+    // Image -> last time a thumbnail has been read in this session
+    QHash<QString, QDateTime> used;
+    qint64 maximumSize;
+    // Size of all the stored thumbnails, -1 if it has not been computed yet
+    qint64 totalSize;
+};
+
+Q_GLOBAL_STATIC(ThumbnailCacheData, MvdThumbnailCacheData)
+
+struct StoredThumbnail {
+    QString dir;
+    QString image;
+    qint64 size;
+    QDateTime lastUsed;
+};
+
+bool lessRecentlyUsed(const StoredThumbnail &a, const StoredThumbnail &b)
+{
+    return a.lastUsed < b.lastUsed;
+}
+
+QString thumbnailsRoot()
+{
+    return Movida::paths().resourcesDir(Movida::UserScope).append("Thumbnails/");
+}
+
+QString sizeDirectory(const QSize &size)
+{
+    return thumbnailsRoot().append(QString("%1x%2/").arg(size.width()).arg(size.height()));
+}
+
+//! Lists all the stored thumbnails. Call with the lock held.
+QList<StoredThumbnail> storedThumbnails()
+{
+    ThumbnailCacheData *data = MvdThumbnailCacheData();
+    QList<StoredThumbnail> thumbnails;
+
+    QDir root(thumbnailsRoot());
+    QStringList dirs = root.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    foreach(QString dir, dirs) {
+        QString path = root.absoluteFilePath(dir) + "/";
+        QFileInfoList files = QDir(path).entryInfoList(QStringList() << "*.png", QDir::Files);
+        foreach(QFileInfo fi, files) {
+            StoredThumbnail t;
+            t.dir = thumbnailsRoot() + dir + "/";
+            t.image = fi.completeBaseName();
+            t.size = fi.size();
+            t.lastUsed = fi.lastModified();
+            QHash<QString, QDateTime>::ConstIterator it = data->used.constFind(t.image);
+            if (it != data->used.constEnd() && t.lastUsed < it.value())
+                t.lastUsed = it.value();
+            thumbnails.append(t);
+        }
+    }
+
+    return thumbnails;
+}
+
+/*!
+    Removes the least recently used thumbnails until the store is 10% below
+    its maximum size, so that it is not pruned again for every new image.
+    Thumbnails that have not been read in this session are considered used
+    when they were created. Call with the lock held.
+*/
+void pruneThumbnails()
+{
+    ThumbnailCacheData *data = MvdThumbnailCacheData();
+    if (data->maximumSize <= 0)
+        return;
+    if (data->totalSize >= 0 && data->totalSize <= data->maximumSize)
+        return;
+
+    QList<StoredThumbnail> thumbnails = storedThumbnails();
+    qint64 total = 0;
+    for (int i = 0; i < thumbnails.size(); ++i)
+        total += thumbnails.at(i).size;
+
+    data->totalSize = total;
+    if (total <= data->maximumSize)
+        return;
+
+    qSort(thumbnails.begin(), thumbnails.end(), lessRecentlyUsed);
+
+    const qint64 target = data->maximumSize - data->maximumSize / 10;
+    int removed = 0;
+    for (int i = 0; i < thumbnails.size() && total > target; ++i) {
+        const StoredThumbnail &t = thumbnails.at(i);
+        if (!QFile::remove(t.dir + t.image + ".png"))
+            continue;
+
+        total -= t.size;
+        ++removed;
+
+        QHash<QString, QSet<QString> >::Iterator it = data->index.find(t.dir);
+        if (it != data->index.end())
+            it.value().remove(t.image);
+    }
+
+    data->totalSize = total;
+    Movida::iLog() << QString("MvdThumbnailCache: Removed %1 unused thumbnails").arg(removed);
+}
+
+//! Returns the cached images for a size, listing the directory the first time. Call with the lock held.
+QSet<QString> &indexForDirectory(const QString &dir)
+{
+    ThumbnailCacheData *data = MvdThumbnailCacheData();
+
+    QHash<QString, QSet<QString> >::Iterator it = data->index.find(dir);
+    if (it == data->index.end()) {
+        QSet<QString> images = QDir(dir).entryList(QStringList() << "*.png", QDir::Files).toSet();
+        QSet<QString> names;
+        foreach(QString s, images)
+            names.insert(s.left(s.length() - 4));
+        it = data->index.insert(dir, names);
+    }
+
+    return it.value();
+}
+
+//! Stores a thumbnail. The image is written to a temporary file first so that no partial image is ever read.
+bool storeThumbnail(const QString &image, const QSize &size, const QImage &thumbnail)
+{
+    QString dir = sizeDirectory(size);
+    if (!QDir().mkpath(dir))
+        return false;
+
+    QString path = dir + image + ".png";
+    QString tmp = path + QString(".%1.tmp").arg((quintptr)QThread::currentThreadId());
+    if (!thumbnail.save(tmp, "PNG")) {
+        QFile::remove(tmp);
+        return false;
+    }
+
+    QFile::remove(path);
+    if (!QFile::rename(tmp, path)) {
+        QFile::remove(tmp);
+        return false;
+    }
+
+    QMutexLocker locker(MvdThumbnailCacheLock());
+    indexForDirectory(dir).insert(image);
+
+    ThumbnailCacheData *data = MvdThumbnailCacheData();
+    if (data->totalSize >= 0)
+        data->totalSize += QFileInfo(path).size();
+    pruneThumbnails();
+
+    return true;
+}
+}
+
+//! Returns true if \p image is named after its content hash and can be cached.
+bool MvdThumbnailCache::isCacheable(const QString &image)
+{
+    if (image.length() != 32)
+        return false;
+
+    for (int i = 0; i < image.length(); ++i) {
+        const ushort c = image.at(i).unicode();
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F')))
+            return false;
+    }
+
+    return true;
+}
+
+/*!
+    Registers a thumbnail size. Thumbnails for all the registered sizes are
+    created when an image is decoded for the first time.
+*/
+void MvdThumbnailCache::registerSize(const QSize &size)
+{
+    if (!size.isValid())
+        return;
+
+    QMutexLocker locker(MvdThumbnailCacheLock());
+    ThumbnailCacheData *data = MvdThumbnailCacheData();
+    if (!data->sizes.contains(size))
+        data->sizes.append(size);
+}
+
+//! Returns the registered thumbnail sizes.
+QList<QSize> MvdThumbnailCache::registeredSizes()
+{
+    QMutexLocker locker(MvdThumbnailCacheLock());
+    return MvdThumbnailCacheData()->sizes;
+}
+
+//! Returns true if a thumbnail of the given size is stored for \p image.
+bool MvdThumbnailCache::contains(const QString &image, const QSize &size)
+{
+    if (!isCacheable(image))
+        return false;
+
+    QMutexLocker locker(MvdThumbnailCacheLock());
+    return indexForDirectory(sizeDirectory(size)).contains(image);
+}
+
+//! Returns a stored thumbnail or a null image.
+QImage MvdThumbnailCache::thumbnail(const QString &image, const QSize &size)
+{
+    if (!contains(image, size))
+        return QImage();
+
+    QImage thumbnail(sizeDirectory(size) + image + ".png");
+    if (thumbnail.isNull()) {
+        Movida::wLog() << QString("MvdThumbnailCache: Removing unreadable thumbnail for %1").arg(image);
+        remove(image);
+    } else {
+        QMutexLocker locker(MvdThumbnailCacheLock());
+        MvdThumbnailCacheData()->used.insert(image, QDateTime::currentDateTime());
+    }
+
+    return thumbnail;
+}
+
+/*!
+    Returns the thumbnail of the given size for \p image, decoding the
+    image at \p path if no thumbnail has been stored yet. The thumbnails
+    for all the registered sizes are stored too.
+*/
+QImage MvdThumbnailCache::createThumbnail(const QString &image, const QString &path, const QSize &size)
+{
+    QImage result = thumbnail(image, size);
+    if (!result.isNull() || path.isEmpty())
+        return result;
+
+    QList<QSize> sizes = registeredSizes();
+    if (!sizes.contains(size))
+        sizes.append(size);
+
+    // Decode once, large enough for all the sizes
+    QSize maxSize;
+    for (int i = 0; i < sizes.size(); ++i)
+        maxSize = maxSize.expandedTo(sizes.at(i));
+
+    QImage source = scaledImage(path, maxSize);
+    if (source.isNull())
+        return source;
+
+    bool cacheable = isCacheable(image);
+
+    for (int i = 0; i < sizes.size(); ++i) {
+        const QSize &s = sizes.at(i);
+        if (s != size && (!cacheable || contains(image, s)))
+            continue;
+
+        QSize scaledSize = source.size();
+        scaledSize.scale(s, Qt::KeepAspectRatio);
+        QImage scaled = scaledSize == source.size() ? source
+            : source.scaled(scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+        if (s == size)
+            result = scaled;
+        if (cacheable && !storeThumbnail(image, s, scaled))
+            Movida::wLog() << QString("MvdThumbnailCache: Failed to store %1x%2 thumbnail for %3")
+                .arg(s.width()).arg(s.height()).arg(image);
+    }
+
+    return result;
+}
+
+//! Removes all the thumbnails for \p image.
+void MvdThumbnailCache::remove(const QString &image)
+{
+    if (!isCacheable(image))
+        return;
+
+    QMutexLocker locker(MvdThumbnailCacheLock());
+
+    QDir root(thumbnailsRoot());
+    QStringList dirs = root.entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    foreach(QString dir, dirs)
+        QFile::remove(root.absoluteFilePath(dir) + "/" + image + ".png");
+
+    ThumbnailCacheData *data = MvdThumbnailCacheData();
+    for (QHash<QString, QSet<QString> >::Iterator it = data->index.begin(); it != data->index.end(); ++it)
+        it.value().remove(image);
+
+    data->used.remove(image);
+    data->totalSize = -1;
+}
+
+/*!
+    Sets the maximum size in bytes of the stored thumbnails. The least
+    recently used thumbnails are removed when it is exceeded. A size of 0
+    disables the limit. The default is 64 MB.
+*/
+void MvdThumbnailCache::setMaximumSize(qint64 bytes)
+{
+    QMutexLocker locker(MvdThumbnailCacheLock());
+    ThumbnailCacheData *data = MvdThumbnailCacheData();
+    data->maximumSize = qMax(qint64(0), bytes);
+    pruneThumbnails();
+}
+
+//! Returns the maximum size in bytes of the stored thumbnails.
+qint64 MvdThumbnailCache::maximumSize()
+{
+    QMutexLocker locker(MvdThumbnailCacheLock());
+    return MvdThumbnailCacheData()->maximumSize;
+}
+
+/*!
+    Loads the image at \p path scaled to fit \p size, keeping its aspect
+    ratio. Formats supporting it (e.g. JPEG) are decoded directly at the
+    reduced size.
+*/
+QImage MvdThumbnailCache::scaledImage(const QString &path, const QSize &size)
+{
+    QImageReader reader(path);
+
+    QSize originalSize = reader.size();
+    if (originalSize.isValid() && reader.supportsOption(QImageIOHandler::ScaledSize)) {
+        QSize scaledSize = originalSize;
+        scaledSize.scale(size, Qt::KeepAspectRatio);
+        if (scaledSize.width() < originalSize.width())
+            reader.setScaledSize(scaledSize);
+    }
+
+    QImage image = reader.read();
+    if (image.isNull())
+        return image;
+
+    QSize scaledSize = image.size();
+    scaledSize.scale(size, Qt::KeepAspectRatio);
+    if (scaledSize != image.size())
+        image = image.scaled(scaledSize, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+    return image;
+}
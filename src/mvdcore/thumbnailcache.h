@@ -0,0 +1,51 @@
+/**************************************************************************
+** Filename: thumbnailcache.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_THUMBNAILCACHE_H
+#define MVD_THUMBNAILCACHE_H
+
+#include "global.h"
+
+#include <QtCore/QList>
+#include <QtCore/QSize>
+#include <QtGui/QImage>
+
+class QString;
+
+class MVD_EXPORT MvdThumbnailCache
+{
+public:
+    static bool isCacheable(const QString &image);
+
+    static void registerSize(const QSize &size);
+    static QList<QSize> registeredSizes();
+
+    static bool contains(const QString &image, const QSize &size);
+    static QImage thumbnail(const QString &image, const QSize &size);
+    static QImage createThumbnail(const QString &image, const QString &path, const QSize &size);
+    static void remove(const QString &image);
+
+    static void setMaximumSize(qint64 bytes);
+    static qint64 maximumSize();
+
+    static QImage scaledImage(const QString &path, const QSize &size);
+};
+
+#endif // MVD_THUMBNAILCACHE_H
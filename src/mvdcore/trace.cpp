@@ -0,0 +1,314 @@
+/**************************************************************************
+** Filename: trace.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#include "trace.h"
+
+#include "logger.h"
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QVector>
+
+#ifdef Q_OS_WIN32
+# include <windows.h>
+#else
+# include <sys/time.h>
+# include <time.h>
+#endif
+
+using namespace Movida;
+
+/*!
+    \class MvdTrace trace.h
+    \ingroup MvdCore
+
+    \brief Collects timed spans and writes them in the Chrome trace format.
+
+    Tracing is disabled by default. When enabled, every MvdTraceSpan records
+    its name, category, start time, duration, thread, nesting depth and
+    counters once it goes out of scope. The resulting file can be opened
+    with chrome://tracing or any viewer supporting the Trace Event format.
+
+    Use the MVD_TRACE_SPAN and MVD_TRACE_COUNTER macros rather than the
+    classes: defining MVD_NO_TRACE at compile time removes them entirely.
+    Span names and categories are not copied and must be string literals.
+*/
+
+/*!
+    \class MvdTraceSpan trace.h
+    \ingroup MvdCore
+
+    \brief Records a trace event covering its own lifetime.
+
+    A span created while tracing is disabled costs a single function call
+    and records nothing, even if tracing is enabled before it ends.
+*/
+
+namespace {
+//! Events beyond this limit are dropped to bound memory usage.
+const int MaxEvents = 1 << 20;
+
+struct TraceEvent {
+    const char *name;
+    const char *category;
+    qint64 start;
+    qint64 duration;
+    int thread;
+    int depth;
+    QList<MvdTrace::Counter> counters;
+};
+
+struct TraceThread {
+    int id;
+    QString name;
+};
+
+class TraceData
+{
+public:
+    TraceData() :
+        origin(0),
+        dropped(0) { }
+
+    QMutex lock;
+    QVector<TraceEvent> events;
+    QHash<Qt::HANDLE, TraceThread> threads;
+    qint64 origin;
+    int dropped;
+};
+
+Q_GLOBAL_STATIC(TraceData, traceData)
+
+volatile bool traceEnabled = false;
+
+//! Nesting depth of the open spans in the current thread.
+QThreadStorage<int *> traceDepth;
+
+QByteArray escapeJson(const QByteArray &s)
+{
+    QByteArray escaped;
+    escaped.reserve(s.size());
+    for (int i = 0; i < s.size(); ++i) {
+        char c = s.at(i);
+        if (c == '"' || c == '\\')
+            escaped.append('\\').append(c);
+        else if ((uchar) c < 0x20)
+            escaped.append(QString().sprintf("\\u%04x", (int) c).toLatin1());
+        else escaped.append(c);
+    }
+    return escaped;
+}
+}
+
+/*!
+    Enables or disables tracing. Enabling tracing discards any previously
+    recorded event.
+*/
+void MvdTrace::setEnabled(bool enabled)
+{
+    if (enabled == traceEnabled)
+        return;
+    if (enabled)
+        clear();
+    traceEnabled = enabled;
+}
+
+//! Returns true if spans are currently being recorded.
+bool MvdTrace::isEnabled()
+{
+    return traceEnabled;
+}
+
+//! Discards all the recorded events.
+void MvdTrace::clear()
+{
+    TraceData *td = traceData();
+    QMutexLocker locker(&td->lock);
+    td->events.clear();
+    td->threads.clear();
+    td->dropped = 0;
+    td->origin = timestamp();
+}
+
+//! Returns the number of recorded events.
+int MvdTrace::eventCount()
+{
+    TraceData *td = traceData();
+    QMutexLocker locker(&td->lock);
+    return td->events.size();
+}
+
+/*!
+    Returns a monotonic timestamp in microseconds. Only differences between
+    timestamps are meaningful.
+*/
+qint64 MvdTrace::timestamp()
+{
+#if defined(Q_OS_WIN32)
+    static LARGE_INTEGER frequency = { { 0, 0 } };
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (qint64)(counter.QuadPart * 1000000.0 / frequency.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return qint64(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return qint64(tv.tv_sec) * 1000000 + tv.tv_usec;
+#endif
+}
+
+/*!
+    \internal Opens a span in the current thread and returns its nesting
+    depth. Called by MvdTraceSpan.
+*/
+int MvdTrace::beginSpan()
+{
+    if (!traceDepth.hasLocalData())
+        traceDepth.setLocalData(new int(0));
+    return (*traceDepth.localData())++;
+}
+
+/*!
+    \internal Closes the innermost span of the current thread and records
+    the event. Called by MvdTraceSpan.
+*/
+void MvdTrace::endSpan(const char *name, const char *category, qint64 start,
+    int depth, const QList<Counter> &counters)
+{
+    qint64 end = timestamp();
+
+    if (traceDepth.hasLocalData())
+        *traceDepth.localData() = depth;
+
+    if (!traceEnabled)
+        return;
+
+    TraceData *td = traceData();
+    QMutexLocker locker(&td->lock);
+
+    if (td->events.size() >= MaxEvents) {
+        td->dropped++;
+        return;
+    }
+
+    Qt::HANDLE handle = QThread::currentThreadId();
+    QHash<Qt::HANDLE, TraceThread>::Iterator it = td->threads.find(handle);
+    if (it == td->threads.end()) {
+        TraceThread thread;
+        thread.id = td->threads.size() + 1;
+        QThread *current = QThread::currentThread();
+        if (QCoreApplication::instance() && current == QCoreApplication::instance()->thread())
+            thread.name = QLatin1String("Main thread");
+        else if (current && !current->objectName().isEmpty())
+            thread.name = current->objectName();
+        else thread.name = QString("Worker %1").arg(thread.id);
+        it = td->threads.insert(handle, thread);
+    }
+
+    TraceEvent event;
+    event.name = name;
+    event.category = category;
+    event.start = start;
+    event.duration = end - start;
+    event.thread = it.value().id;
+    event.depth = depth;
+    event.counters = counters;
+    td->events.append(event);
+}
+
+/*!
+    Writes the recorded events to \p path using the Chrome Trace Event
+    format. Returns false if the file could not be written.
+*/
+bool MvdTrace::writeChromeTrace(const QString &path)
+{
+    TraceData *td = traceData();
+    QMutexLocker locker(&td->lock);
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        eLog() << QString("MvdTrace: Unable to write trace file %1").arg(path);
+        return false;
+    }
+
+    qint64 pid = QCoreApplication::instance() ? QCoreApplication::applicationPid() : 0;
+    QByteArray pidString = QByteArray::number(pid);
+    QByteArray out("{\"traceEvents\":[\n");
+    bool first = true;
+
+    for (QHash<Qt::HANDLE, TraceThread>::ConstIterator it = td->threads.constBegin();
+        it != td->threads.constEnd(); ++it) {
+        if (!first)
+            out.append(",\n");
+        first = false;
+        out.append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":").append(pidString)
+            .append(",\"tid\":").append(QByteArray::number(it.value().id))
+            .append(",\"args\":{\"name\":\"").append(escapeJson(it.value().name.toUtf8()))
+            .append("\"}}");
+    }
+
+    for (int i = 0; i < td->events.size(); ++i) {
+        const TraceEvent &e = td->events.at(i);
+        if (!first)
+            out.append(",\n");
+        first = false;
+        out.append("{\"name\":\"").append(escapeJson(e.name))
+            .append("\",\"cat\":\"").append(escapeJson(e.category))
+            .append("\",\"ph\":\"X\",\"ts\":").append(QByteArray::number(e.start - td->origin))
+            .append(",\"dur\":").append(QByteArray::number(e.duration))
+            .append(",\"pid\":").append(pidString)
+            .append(",\"tid\":").append(QByteArray::number(e.thread))
+            .append(",\"args\":{\"depth\":").append(QByteArray::number(e.depth));
+        for (int j = 0; j < e.counters.size(); ++j) {
+            const Counter &c = e.counters.at(j);
+            out.append(",\"").append(escapeJson(c.first)).append("\":")
+                .append(QByteArray::number(c.second));
+        }
+        out.append("}}");
+
+        if (out.size() > 65536) {
+            file.write(out);
+            out.clear();
+        }
+    }
+
+    out.append("\n],\"displayTimeUnit\":\"ms\"}\n");
+    file.write(out);
+
+    if (td->dropped)
+        wLog() << QString("MvdTrace: %1 events were dropped").arg(td->dropped);
+
+    if (file.error() != QFile::NoError) {
+        eLog() << QString("MvdTrace: Unable to write trace file %1").arg(path);
+        return false;
+    }
+
+    iLog() << QString("MvdTrace: %1 events written to %2").arg(td->events.size()).arg(path);
+    return true;
+}
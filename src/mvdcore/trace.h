@@ -0,0 +1,100 @@
+/**************************************************************************
+** Filename: trace.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_TRACE_H
+#define MVD_TRACE_H
+
+#include "global.h"
+
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QString>
+
+class MVD_EXPORT MvdTrace
+{
+public:
+    typedef QPair<const char *, qint64> Counter;
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+    static void clear();
+
+    static int eventCount();
+    static bool writeChromeTrace(const QString &path);
+
+    static qint64 timestamp();
+    static int beginSpan();
+    static void endSpan(const char *name, const char *category, qint64 start,
+        int depth, const QList<Counter> &counters);
+};
+
+class MVD_EXPORT MvdTraceSpan
+{
+public:
+    inline MvdTraceSpan(const char *name, const char *category) :
+        mName(name),
+        mCategory(category),
+        mStart(0),
+        mDepth(-1)
+    {
+        if (MvdTrace::isEnabled()) {
+            mDepth = MvdTrace::beginSpan();
+            mStart = MvdTrace::timestamp();
+        }
+    }
+
+    inline ~MvdTraceSpan()
+    {
+        if (mDepth >= 0)
+            MvdTrace::endSpan(mName, mCategory, mStart, mDepth, mCounters);
+    }
+
+    inline void setCounter(const char *name, qint64 value)
+    {
+        if (mDepth < 0)
+            return;
+        for (int i = 0; i < mCounters.size(); ++i) {
+            if (qstrcmp(mCounters.at(i).first, name) == 0) {
+                mCounters[i].second = value;
+                return;
+            }
+        }
+        mCounters.append(MvdTrace::Counter(name, value));
+    }
+
+private:
+    Q_DISABLE_COPY(MvdTraceSpan)
+
+    const char *mName;
+    const char *mCategory;
+    qint64 mStart;
+    int mDepth;
+    QList<MvdTrace::Counter> mCounters;
+};
+
+#ifndef MVD_NO_TRACE
+# define MVD_TRACE_SPAN(span, name, category) MvdTraceSpan span(name, category)
+# define MVD_TRACE_COUNTER(span, name, value) span.setCounter(name, value)
+#else
+# define MVD_TRACE_SPAN(span, name, category)
+# define MVD_TRACE_COUNTER(span, name, value) do { } while (0)
+#endif
+
+#endif // MVD_TRACE_H
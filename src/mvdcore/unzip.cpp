@@ -22,11 +22,14 @@
 #include "zipentry_p.h"
 
 #include "logger.h"
+#include "trace.h"
 
+#include <QtCore/QBuffer>
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
 #include <QtCore/QMetaObject>
+#include <QtCore/QPointer>
 #include <QtCore/QtGlobal>
 
 using namespace Movida;
@@ -220,6 +223,8 @@ public:
     MvdUnZip::ErrorCode parseCentralDirectoryRecord();
     MvdUnZip::ErrorCode parseLocalHeaderRecord(const QString &path,
     MvdZipEntry &entry);
+    MvdUnZip::ErrorCode findEntry(const QString &path, MvdZipEntry **entry);
+    MvdUnZip::ZipEntry toZipEntry(const QString &path, const MvdZipEntry &entry) const;
 
     void closeArchive();
 
@@ -274,6 +279,8 @@ MvdUnZip::ErrorCode MvdUnZip::Private::openArchive(QIODevice *dev)
 {
     Q_ASSERT(dev != 0);
 
+    MVD_TRACE_SPAN(span, "MvdUnZip::openArchive", "zip");
+
     if (device != 0)
         closeArchive();
 
@@ -1151,6 +1158,285 @@ void MvdUnZip::Private::emitProgress()
     }
 }
 
+/*!
+    \internal Looks up the Central Directory record for \p path and makes sure
+    that its local header record has been parsed, so that the data offset is
+    known and the entry can be accessed directly.
+*/
+MvdUnZip::ErrorCode MvdUnZip::Private::findEntry(const QString &path, MvdZipEntry **entry)
+{
+    if (device == 0)
+        return MvdUnZip::NoOpenArchiveError;
+
+    if (headers == 0)
+        return MvdUnZip::FileNotFoundError;
+
+    QMap<QString, MvdZipEntry *>::Iterator itr = headers->find(path);
+    if (itr == headers->end())
+        return MvdUnZip::FileNotFoundError;
+
+    *entry = itr.value();
+    Q_ASSERT(*entry != 0);
+
+    if (!(*entry)->lhEntryChecked) {
+        MvdUnZip::ErrorCode ec = parseLocalHeaderRecord(path, **entry);
+        (*entry)->lhEntryChecked = true;
+
+        if (ec != MvdUnZip::NoError)
+            return ec;
+    }
+
+    return MvdUnZip::NoError;
+}
+
+//! \internal Returns the public information for an entry.
+MvdUnZip::ZipEntry MvdUnZip::Private::toZipEntry(const QString &path, const MvdZipEntry &entry) const
+{
+    MvdUnZip::ZipEntry z;
+
+    z.filename = path;
+    if (!entry.comment.isEmpty())
+        z.comment = entry.comment;
+    z.compressedSize = entry.szComp;
+    z.uncompressedSize = entry.szUncomp;
+    z.crc32 = entry.crc;
+    z.headerOffset = entry.lhOffset;
+    z.lastModified = convertDateTime(entry.modDate, entry.modTime);
+
+    z.compression = entry.compMethod == 0 ? MvdUnZip::NoCompression
+        : entry.compMethod == 8 ? MvdUnZip::Deflated : MvdUnZip::UnknownCompression;
+    z.type = z.filename.endsWith("/") ? MvdUnZip::Directory : MvdUnZip::File;
+
+    z.encrypted = entry.isEncrypted();
+
+    return z;
+}
+
+
+/************************************************************************
+    MvdUnZipEntryDevice
+ *************************************************************************/
+
+namespace {
+//! Size of the buffer used to read compressed data from the archive.
+const int EntryDeviceBufferSize = 64 * 1024;
+}
+
+/*!
+    \internal Sequential read-only device that decompresses a single archive
+    entry on demand. Compressed data is read directly from the archive
+    device at the offset stored in the Central Directory record, so other
+    entries can be accessed in the meantime.
+*/
+class MvdUnZipEntryDevice : public QIODevice
+{
+public:
+    MvdUnZipEntryDevice(QIODevice *archive, const MvdZipEntry &entry);
+    virtual ~MvdUnZipEntryDevice();
+
+    bool isSequential() const { return true; }
+    bool atEnd() const;
+    qint64 bytesAvailable() const;
+    qint64 size() const { return entry.szUncomp; }
+    void close();
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 size);
+
+private:
+    qint64 readCompressed(char *data, qint64 maxSize);
+    bool checkCrc();
+
+    QPointer<QIODevice> archive;
+    MvdZipEntry entry;
+
+    z_stream zstr;
+    bool zstrInitialized;
+    bool finished;
+
+    QByteArray buffer;
+    quint32 consumed;
+    quint32 produced;
+    quint32 crc;
+};
+
+//! \internal
+MvdUnZipEntryDevice::MvdUnZipEntryDevice(QIODevice *dev, const MvdZipEntry &e) :
+    QIODevice(),
+    archive(dev),
+    entry(e),
+    zstrInitialized(false),
+    finished(false),
+    consumed(0),
+    produced(0)
+{
+    crc = crc32(0L, Z_NULL, 0);
+
+    if (entry.compMethod == 8) {
+        zstr.zalloc = Z_NULL;
+        zstr.zfree = Z_NULL;
+        zstr.opaque = Z_NULL;
+        zstr.next_in = Z_NULL;
+        zstr.avail_in = 0;
+
+        // Use inflateInit2 with negative windowBits to get raw decompression
+        zstrInitialized = inflateInit2_(&zstr, -MAX_WBITS, ZLIB_VERSION, sizeof(z_stream)) == Z_OK;
+        if (zstrInitialized)
+            buffer.resize(EntryDeviceBufferSize);
+    }
+
+    if (entry.szComp == 0)
+        finished = true;
+
+    if (entry.compMethod == 8 && !zstrInitialized)
+        setErrorString(QLatin1String("zlib library error."));
+    else open(QIODevice::ReadOnly);
+}
+
+//! \internal
+MvdUnZipEntryDevice::~MvdUnZipEntryDevice()
+{
+    close();
+}
+
+//! \internal
+void MvdUnZipEntryDevice::close()
+{
+    if (zstrInitialized) {
+        inflateEnd(&zstr);
+        zstrInitialized = false;
+    }
+
+    QIODevice::close();
+}
+
+//! \internal
+bool MvdUnZipEntryDevice::atEnd() const
+{
+    return finished && QIODevice::bytesAvailable() == 0;
+}
+
+//! \internal
+qint64 MvdUnZipEntryDevice::bytesAvailable() const
+{
+    return (entry.szUncomp - produced) + QIODevice::bytesAvailable();
+}
+
+//! \internal Reads up to \p maxSize bytes of compressed data from the archive.
+qint64 MvdUnZipEntryDevice::readCompressed(char *data, qint64 maxSize)
+{
+    if (archive.isNull())
+        return -1;
+
+    qint64 count = qMin<qint64>(maxSize, entry.szComp - consumed);
+    if (count <= 0)
+        return 0;
+
+    if (!archive->seek(entry.dataOffset + consumed))
+        return -1;
+
+    qint64 read = archive->read(data, count);
+    if (read > 0)
+        consumed += read;
+
+    return read;
+}
+
+//! \internal Returns false and sets the error string if the CRC does not match.
+bool MvdUnZipEntryDevice::checkCrc()
+{
+    finished = true;
+    if (crc != entry.crc) {
+        setErrorString(QLatin1String("Corrupted zip archive."));
+        return false;
+    }
+    return true;
+}
+
+//! \internal
+qint64 MvdUnZipEntryDevice::readData(char *data, qint64 maxSize)
+{
+    if (finished || maxSize <= 0)
+        return 0;
+
+    qint64 size = 0;
+
+    if (entry.compMethod == 0) {
+        size = readCompressed(data, maxSize);
+        if (size < 0) {
+            setErrorString(QLatin1String("File read error."));
+            return -1;
+        }
+
+        crc = crc32(crc, (const Bytef *)data, size);
+        produced += size;
+
+        if (consumed == entry.szComp && !checkCrc())
+            return -1;
+
+        return size;
+    }
+
+    if (entry.compMethod != 8 || !zstrInitialized) {
+        setErrorString(QLatin1String("Unsupported compression method."));
+        return -1;
+    }
+
+    zstr.next_out = (Bytef *)data;
+    zstr.avail_out = (uInt)qMin<qint64>(maxSize, 0x7FFFFFFF);
+
+    while (zstr.avail_out != 0) {
+        if (zstr.avail_in == 0) {
+            qint64 read = readCompressed(buffer.data(), buffer.size());
+            if (read < 0) {
+                setErrorString(QLatin1String("File read error."));
+                return -1;
+            }
+            if (read == 0) // Truncated stream
+                break;
+
+            zstr.next_in = (Bytef *)buffer.data();
+            zstr.avail_in = (uInt)read;
+        }
+
+        int zret = inflate(&zstr, Z_NO_FLUSH);
+        if (zret == Z_NEED_DICT || zret == Z_DATA_ERROR || zret == Z_MEM_ERROR) {
+            setErrorString(QLatin1String("zlib library error."));
+            return -1;
+        }
+
+        if (zret == Z_STREAM_END) {
+            finished = true;
+            break;
+        }
+    }
+
+    size = zstr.next_out - (Bytef *)data;
+    crc = crc32(crc, (const Bytef *)data, size);
+    produced += size;
+
+    if (finished && !checkCrc())
+        return -1;
+
+    if (size == 0 && !finished) {
+        setErrorString(QLatin1String("Corrupted zip archive."));
+        finished = true;
+        return -1;
+    }
+
+    return size;
+}
+
+//! \internal
+qint64 MvdUnZipEntryDevice::writeData(const char *data, qint64 size)
+{
+    Q_UNUSED(data);
+    Q_UNUSED(size);
+    return -1;
+}
+
+
 /************************************************************************
     MvdUnZip
  *************************************************************************/
@@ -1349,22 +1635,7 @@ QList<MvdUnZip::ZipEntry> MvdUnZip::entryList() const
             const MvdZipEntry *entry = it.value();
             Q_ASSERT(entry != 0);
 
-            ZipEntry z;
-
-            z.filename = it.key();
-            if (!entry->comment.isEmpty())
-                z.comment = entry->comment;
-            z.compressedSize = entry->szComp;
-            z.uncompressedSize = entry->szUncomp;
-            z.crc32 = entry->crc;
-            z.lastModified = d->convertDateTime(entry->modDate, entry->modTime);
-
-            z.compression = entry->compMethod == 0 ? NoCompression : entry->compMethod == 8 ? Deflated : UnknownCompression;
-            z.type = z.filename.endsWith("/") ? Directory : File;
-
-            z.encrypted = entry->isEncrypted();
-
-            list.append(z);
+            list.append(d->toZipEntry(it.key(), *entry));
         }
     }
 
@@ -1388,6 +1659,8 @@ MvdUnZip::ErrorCode MvdUnZip::extractAll(const QDir &dir, ExtractionOptions opti
     if (d->device == 0)
         return NoOpenArchiveError;
 
+    MVD_TRACE_SPAN(span, "MvdUnZip::extractAll", "zip");
+
     if (d->headers == 0)
         return NoError;
 
@@ -1532,6 +1805,9 @@ MvdUnZip::ErrorCode MvdUnZip::extractFiles(const QStringList &filenames, const Q
 */
 MvdUnZip::ErrorCode MvdUnZip::extractFiles(const QStringList &filenames, const QDir &dir, ExtractionOptions options)
 {
+    MVD_TRACE_SPAN(span, "MvdUnZip::extractFiles", "zip");
+    MVD_TRACE_COUNTER(span, "files", filenames.size());
+
     ErrorCode ec;
 
     d->totalProgress = d->currentProgress = 0;
@@ -1550,12 +1826,148 @@ MvdUnZip::ErrorCode MvdUnZip::extractFiles(const QStringList &filenames, const Q
     return NoError;
 }
 
+/*!
+    Extracts a single file to memory and returns its contents.
+    The file is located using the Central Directory records, so no other
+    entry needs to be read. \p ec is set to the result of the operation if
+    it is not null.
+*/
+QByteArray MvdUnZip::readFile(const QString &filename, MvdUnZip::ErrorCode *ec)
+{
+    MVD_TRACE_SPAN(span, "MvdUnZip::readFile", "zip");
+
+    MvdZipEntry *entry = 0;
+    ErrorCode res = d->findEntry(filename, &entry);
+
+    QByteArray data;
+
+    if (res == NoError) {
+        data.reserve(entry->szUncomp);
+
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+
+        d->totalProgress = entry->szUncomp;
+        d->currentProgress = 0;
+        res = d->extractFile(filename, *entry, &buffer, ExtractPaths);
+        buffer.close();
+        MVD_TRACE_COUNTER(span, "bytes", data.size());
+
+        if (res != NoError)
+            data.clear();
+    }
+
+    if (ec)
+        *ec = res;
+    return data;
+}
+
+/*!
+    Returns a sequential, read-only device that decompresses the given file
+    as data is read from it. Returns 0 if the file could not be found or if
+    some error occurred; \p ec is set to the result of the operation if it
+    is not null.
+
+    The caller takes ownership of the device. The device reads directly from
+    the archive so it must be deleted before the archive is closed.
+    Encrypted files are extracted to memory before the device is returned.
+*/
+QIODevice *MvdUnZip::openFile(const QString &filename, MvdUnZip::ErrorCode *ec)
+{
+    MvdZipEntry *entry = 0;
+    ErrorCode res = d->findEntry(filename, &entry);
+
+    QIODevice *dev = 0;
+
+    if (res == NoError) {
+        if (entry->isEncrypted()) {
+            QByteArray data = readFile(filename, &res);
+            if (res == NoError) {
+                QBuffer *buffer = new QBuffer;
+                buffer->setData(data);
+                buffer->open(QIODevice::ReadOnly);
+                dev = buffer;
+            }
+        } else if (entry->compMethod != 0 && entry->compMethod != 8) {
+            res = InvalidArchiveError;
+        } else {
+            dev = new MvdUnZipEntryDevice(d->device, *entry);
+            if (!dev->isOpen()) {
+                delete dev;
+                dev = 0;
+                res = ZlibInitError;
+            }
+        }
+    }
+
+    if (ec)
+        *ec = res;
+    return dev;
+}
+
+/*!
+    Returns the data of a file as it is stored in the archive, without
+    decompressing or decrypting it, so that it can be copied to another
+    archive (see MvdZip::copyEntry()). \p info is set to the entry
+    information and \p ec to the result of the operation if they are not
+    null. The CRC is not checked.
+*/
+QByteArray MvdUnZip::readRawFile(const QString &filename, ZipEntry *info, MvdUnZip::ErrorCode *ec)
+{
+    MvdZipEntry *entry = 0;
+    ErrorCode res = d->findEntry(filename, &entry);
+
+    QByteArray data;
+
+    if (res == NoError) {
+        if (!d->device->seek(entry->dataOffset))
+            res = SeekError;
+        else {
+            data = d->device->read(entry->szComp);
+            if ((quint32)data.size() != entry->szComp) {
+                data.clear();
+                res = ReadError;
+            }
+        }
+    }
+
+    if (res == NoError && info)
+        *info = d->toZipEntry(filename, *entry);
+
+    if (ec)
+        *ec = res;
+    return data;
+}
+
+/*!
+    \internal Transfers the parsed central directory to the caller, so that
+    new entries can be appended to the archive (see MvdZip::appendArchive()).
+    Returns 0 if no archive is open or if some entry has been skipped, as it
+    would be lost when the new central directory is written. The archive is
+    closed.
+*/
+QMap<QString, MvdZipEntry *> *MvdUnZip::takeCentralDirectory(QString *comment)
+{
+    Q_ASSERT(comment);
+
+    QMap<QString, MvdZipEntry *> *headers = 0;
+
+    if (d->device != 0 && d->unsupportedEntryCount == 0) {
+        headers = d->headers ? d->headers : new QMap<QString, MvdZipEntry *>;
+        d->headers = 0;
+        *comment = d->comment;
+    }
+
+    d->closeArchive();
+    return headers;
+}
+
 /*!
     ZipEntry constructor - initialize data. Type is set to File.
 */
 MvdUnZip::ZipEntry::ZipEntry()
 {
-    compressedSize = uncompressedSize = crc32 = 0;
+    compressedSize = uncompressedSize = crc32 = headerOffset = 0;
     compression = NoCompression;
     type = File;
     encrypted = false;
@@ -23,12 +23,15 @@
 
 #include "global.h"
 
+#include <QtCore/QByteArray>
 #include <QtCore/QDateTime>
 #include <QtCore/QMap>
 #include <QtCore/QtGlobal>
 
 #include <zlib/zlib.h>
 
+class MvdZipEntry;
+
 class QIODevice;
 class QFile;
 class QDir;
@@ -88,6 +91,7 @@ public:
         quint32 compressedSize;
         quint32 uncompressedSize;
         quint32 crc32;
+        quint32 headerOffset;
 
         QDateTime lastModified;
 
@@ -135,7 +139,14 @@ public:
     MvdUnZip::ErrorCode extractFiles(const QStringList &filenames, const QDir &dir,
     ExtractionOptions options = ExtractPaths);
 
+    QByteArray readFile(const QString &filename, MvdUnZip::ErrorCode *ec = 0);
+    QIODevice *openFile(const QString &filename, MvdUnZip::ErrorCode *ec = 0);
+    QByteArray readRawFile(const QString &filename, ZipEntry *info = 0, MvdUnZip::ErrorCode *ec = 0);
+
 private:
+    friend class MvdZip;
+    QMap<QString, MvdZipEntry *> *takeCentralDirectory(QString *comment);
+
     class Private;
     Private *d;
 };
@@ -22,8 +22,14 @@
 
 #include "logger.h"
 
+#include <QtCore/QDateTime>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QHash>
 #include <QtCore/QIODevice>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSharedPointer>
 #include <QtCore/QTextStream>
 
 #include <libxml/tree.h>
@@ -40,6 +46,14 @@ using namespace Movida;
     \ingroup MvdCore
 
     \brief Simple interface to the libxslt library.
+
+    Compiled stylesheets are kept in a process-wide cache keyed by file
+    path and shared by all the processors loading the same file, so a
+    stylesheet is parsed and compiled only once. A cached stylesheet is
+    compiled again if the file has been modified on disk (files in the
+    application resources never change). Processors sharing a stylesheet
+    can be used concurrently from different threads, as libxslt does not
+    modify a compiled stylesheet while applying it.
 */
 
 /*
@@ -81,6 +95,98 @@ int closeTextStream(void *context)
     return 0;
 }
 
+typedef QSharedPointer<xsltStylesheet> Stylesheet;
+
+struct CachedStylesheet {
+    Stylesheet stylesheet;
+    QDateTime lastModified;
+    qint64 size;
+};
+
+typedef QHash<QString, CachedStylesheet> StylesheetCache;
+
+Q_GLOBAL_STATIC(QMutex, MvdXsltCacheLock)
+Q_GLOBAL_STATIC(StylesheetCache, MvdXsltCache)
+
+//! \internal Parses and compiles a stylesheet. Does not use the cache.
+Stylesheet compileStylesheet(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        eLog() << "MvdXsltProc: Failed to open " << path << " for reading (" << file.errorString() << ").";
+        return Stylesheet();
+    }
+
+    QByteArray buffer = file.readAll();
+    if (buffer.isEmpty()) {
+        eLog() << "MvdXsltProc: Failed to read " << path << ".";
+        return Stylesheet();
+    }
+
+    xmlDocPtr stylesheetDoc = xmlParseMemory(buffer.data(), buffer.size());
+    if (!stylesheetDoc) {
+        eLog() << "MvdXsltProc: Invalid XML file: " << path;
+        return Stylesheet();
+    }
+
+    // The stylesheet owns the document from now on
+    xsltStylesheetPtr stylesheet = xsltParseStylesheetDoc(stylesheetDoc);
+    if (!stylesheet) {
+        xmlFreeDoc(stylesheetDoc);
+        eLog() << "MvdXsltProc: Invalid XSL file: " << path;
+        return Stylesheet();
+    }
+
+    return Stylesheet(stylesheet, xsltFreeStylesheet);
+}
+
+/*!
+    \internal Returns the compiled stylesheet for \p path, compiling it only
+    if it is not cached yet or if the file has changed since it was cached.
+*/
+Stylesheet cachedStylesheet(const QString &path)
+{
+    // Resources are compiled in the application and never change
+    const bool resource = path.startsWith(QLatin1Char(':'));
+
+    QFileInfo fi(path);
+    QDateTime lastModified = resource ? QDateTime() : fi.lastModified();
+    qint64 size = fi.size();
+
+    {
+        QMutexLocker locker(MvdXsltCacheLock());
+        StylesheetCache::ConstIterator it = MvdXsltCache()->constFind(path);
+        if (it != MvdXsltCache()->constEnd()
+            && it.value().lastModified == lastModified && it.value().size == size)
+            return it.value().stylesheet;
+    }
+
+    // Compile without holding the lock so that other stylesheets can be used meanwhile
+    Stylesheet stylesheet = compileStylesheet(path);
+
+    QMutexLocker locker(MvdXsltCacheLock());
+    StylesheetCache *cache = MvdXsltCache();
+
+    if (!stylesheet) {
+        cache->remove(path);
+        return stylesheet;
+    }
+
+    // Another thread might have compiled the same file in the meantime
+    StylesheetCache::ConstIterator it = cache->constFind(path);
+    if (it != cache->constEnd()
+        && it.value().lastModified == lastModified && it.value().size == size)
+        return it.value().stylesheet;
+
+    CachedStylesheet entry;
+    entry.stylesheet = stylesheet;
+    entry.lastModified = lastModified;
+    entry.size = size;
+    cache->insert(path, entry);
+
+    return stylesheet;
+}
+
 }
 
 
@@ -93,24 +199,15 @@ class MvdXsltProc::Private
 {
 public:
     Private();
-    ~Private()
-    {
-        if (stylesheet) {
-            xsltFreeStylesheet(stylesheet);
-        }
-    }
 
     bool loadXslt(const QString &path);
     xmlDocPtr applyStylesheet(xmlDocPtr doc, const MvdXsltProc::ParameterList &params) const;
 
-    xsltStylesheetPtr stylesheet;
-    xmlDocPtr stylesheetDoc;
+    MvdXslt::Stylesheet stylesheet;
 };
 
 //! \internal
-MvdXsltProc::Private::Private() :
-    stylesheet(0),
-    stylesheetDoc(0)
+MvdXsltProc::Private::Private()
 {
     // init libxslt
     xmlSubstituteEntitiesDefault(1);
@@ -120,38 +217,8 @@ MvdXsltProc::Private::Private() :
 //! \internal
 bool MvdXsltProc::Private::loadXslt(const QString &path)
 {
-    if (stylesheet) {
-        xsltFreeStylesheet(stylesheet);
-        stylesheet = 0;
-        stylesheetDoc = 0;
-    }
-
-    QFile file(path);
-    if (!file.open(QIODevice::ReadOnly)) {
-        eLog() << "MvdXsltProc: Failed to open " << path << " for reading (" << file.errorString() << ").";
-        return false;
-    }
-
-    QByteArray buffer = file.readAll();
-    if (buffer.isEmpty()) {
-        eLog() << "MvdXsltProc: Failed to read " << path << ".";
-        return false;
-    }
-
-    stylesheetDoc = xmlParseMemory(buffer.data(), buffer.size());
-    if (!stylesheetDoc) {
-        eLog() << "MvdXsltProc: Invalid XML file: " << path;
-        return false;
-    }
-
-    stylesheet = xsltParseStylesheetDoc(stylesheetDoc);
-    if (!stylesheet) {
-        xmlFree(stylesheetDoc);
-        stylesheetDoc = 0;
-        eLog() << "MvdXsltProc: Invalid XSL file: " << path;
-    }
-
-    return stylesheet;
+    stylesheet = MvdXslt::cachedStylesheet(path);
+    return !stylesheet.isNull();
 }
 
 xmlDocPtr MvdXsltProc::Private::applyStylesheet(xmlDocPtr doc,
@@ -184,7 +251,7 @@ xmlDocPtr MvdXsltProc::Private::applyStylesheet(xmlDocPtr doc,
         paramCount += 2;
     }
 
-    xmlDocPtr tDoc = xsltApplyStylesheet(stylesheet, doc, c_params);
+    xmlDocPtr tDoc = xsltApplyStylesheet(stylesheet.data(), doc, c_params);
 
     if (paramCount) {
         for (int i = 0; i < paramCount; ++i)
@@ -222,10 +289,10 @@ MvdXsltProc::~MvdXsltProc()
 //! Returns true if the processor is valid (a stylesheet has been correctly loaded).
 bool MvdXsltProc::isOk() const
 {
-    return d->stylesheet;
+    return !d->stylesheet.isNull();
 }
 
-//! Attempts to load a XSL stylesheet from a file.
+//! Attempts to load a XSL stylesheet from a file. Cached stylesheets are reused if the file has not changed.
 bool MvdXsltProc::loadXslFile(const QString &xslpath)
 {
     return d->loadXslt(xslpath);
@@ -243,25 +310,9 @@ QString MvdXsltProc::processText(const QString &txt, const ParameterList &params
     if (!doc)
         return QString();
 
-    xmlDocPtr sDoc = d->applyStylesheet(doc, params);
+    QString s = processDocument(doc, params);
     xmlFreeDoc(doc);
 
-    if (!sDoc) {
-        return QString();
-    }
-
-    xmlChar *outString = NULL;
-    int outStringLength = 0;
-
-    xsltSaveResultToString(&outString, &outStringLength, sDoc, d->stylesheet);
-    if (!outString || !outStringLength)
-        return QString();
-
-    QString s = QString::fromUtf8(reinterpret_cast<const char *>(outString), outStringLength);
-    xmlFree(outString);
-
-    xmlFreeDoc(sDoc);
-
     return s;
 }
 
@@ -275,24 +326,38 @@ QString MvdXsltProc::processFile(const QString &file, const ParameterList &param
     if (!doc)
         return QString();
 
-    xmlDocPtr sDoc = d->applyStylesheet(doc, params);
+    QString s = processDocument(doc, params);
     xmlFreeDoc(doc);
 
+    return s;
+}
+
+/*!
+    Applies XSL transformations to an already built libxml2 document using
+    the previously loaded stylesheet. Use this to avoid serializing and
+    parsing the document again. The document is not deleted.
+*/
+QString MvdXsltProc::processDocument(xmlDoc *doc, const ParameterList &params)
+{
+    if (!doc || !isOk())
+        return QString();
+
+    xmlDocPtr sDoc = d->applyStylesheet(doc, params);
     if (!sDoc)
         return QString();
 
     xmlChar *outString = NULL;
     int outStringLength = 0;
 
-    xsltSaveResultToString(&outString, &outStringLength, sDoc, d->stylesheet);
+    xsltSaveResultToString(&outString, &outStringLength, sDoc, d->stylesheet.data());
+    xmlFreeDoc(sDoc);
+
     if (!outString || !outStringLength)
         return QString();
 
     QString s = QString::fromUtf8(reinterpret_cast<const char *>(outString), outStringLength);
     xmlFree(outString);
 
-    xmlFreeDoc(sDoc);
-
     return s;
 }
 
@@ -300,7 +365,7 @@ QString MvdXsltProc::processFile(const QString &file, const ParameterList &param
 bool MvdXsltProc::processTextToDevice(const QString &txt, QIODevice *dev,
     const ParameterList &params)
 {
-    if (txt.isEmpty() || !isOk())
+    if (txt.isEmpty() || !isOk() || !dev)
         return false;
 
     QByteArray buffer = txt.toUtf8();
@@ -309,24 +374,10 @@ bool MvdXsltProc::processTextToDevice(const QString &txt, QIODevice *dev,
     if (!doc)
         return false;
 
-    xmlDocPtr sDoc = d->applyStylesheet(doc, params);
+    bool res = processDocumentToDevice(doc, dev, params);
     xmlFreeDoc(doc);
 
-    if (!sDoc)
-        return false;
-
-    QTextStream stream(dev);
-
-    xmlOutputBufferPtr outp = xmlOutputBufferCreateIO(
-        MvdXslt::writeToTextStream, (xmlOutputCloseCallback) MvdXslt::closeTextStream, &stream, 0);
-    outp->written = 0;
-
-    xsltSaveResultTo(outp, sDoc, d->stylesheet);
-    xmlOutputBufferFlush(outp);
-    xmlOutputBufferClose(outp);
-
-    xmlFreeDoc(sDoc);
-    return true;
+    return res;
 }
 
 //! Applies XSL transformations to the file using the previously loaded stylesheet and writes the result to a device.
@@ -340,24 +391,37 @@ bool MvdXsltProc::processFileToDevice(const QString &file, QIODevice *dev,
     if (!doc)
         return false;
 
-    xmlDocPtr sDoc = d->applyStylesheet(doc, params);
+    bool res = processDocumentToDevice(doc, dev, params);
     xmlFreeDoc(doc);
 
+    return res;
+}
+
+/*!
+    Applies XSL transformations to an already built libxml2 document using
+    the previously loaded stylesheet and writes the result to a device.
+    The document is not deleted.
+*/
+bool MvdXsltProc::processDocumentToDevice(xmlDoc *doc, QIODevice *dev,
+    const ParameterList &params)
+{
+    if (!doc || !isOk() || !dev)
+        return false;
+
+    xmlDocPtr sDoc = d->applyStylesheet(doc, params);
     if (!sDoc)
         return false;
 
-    QTextStream *stream = new QTextStream(dev);
+    QTextStream stream(dev);
 
     xmlOutputBufferPtr outp = xmlOutputBufferCreateIO(
         MvdXslt::writeToTextStream, (xmlOutputCloseCallback) MvdXslt::closeTextStream, &stream, 0);
     outp->written = 0;
 
-    xsltSaveResultTo(outp, sDoc, d->stylesheet);
+    xsltSaveResultTo(outp, sDoc, d->stylesheet.data());
     xmlOutputBufferFlush(outp);
     xmlOutputBufferClose(outp);
 
     xmlFreeDoc(sDoc);
-
-    delete stream;
     return true;
 }
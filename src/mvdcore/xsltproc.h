@@ -27,6 +27,9 @@
 
 class QIODevice;
 
+struct _xmlDoc;
+typedef struct _xmlDoc xmlDoc;
+
 class MVD_EXPORT MvdXsltProc
 {
 public:
@@ -50,6 +53,11 @@ public:
     bool processFileToDevice(const QString &file, QIODevice *dev,
     const ParameterList &params = ParameterList());
 
+    QString processDocument(xmlDoc *doc,
+    const ParameterList &params = ParameterList());
+    bool processDocumentToDevice(xmlDoc *doc, QIODevice *dev,
+    const ParameterList &params = ParameterList());
+
 private:
     class Private;
     Private *d;
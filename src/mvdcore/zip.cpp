@@ -22,15 +22,23 @@
 #include "zipentry_p.h"
 
 #include "logger.h"
+#include "trace.h"
+#include "unzip.h"
 
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDateTime>
 #include <QtCore/QDir>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
+#include <QtCore/QIODevice>
 #include <QtCore/QMap>
+#include <QtCore/QMetaObject>
+#include <QtCore/QRunnable>
+#include <QtCore/QSemaphore>
 #include <QtCore/QString>
 #include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTime>
 #include <QtCore/QtGlobal>
 
 #include <cstdlib>
@@ -102,10 +110,15 @@ using namespace Movida;
 //! This macro updates a one-char-only CRC; it's the Info-Zip macro re-adapted
 #define MVD_CRC32(c, b) crcTable[((int)c ^ b) & 0xff] ^ (c >> 8)
 
-// zLib authors suggest using larger buffers (128K or 256K) for (de)compression
-// (especially for inflate()); we use a 256K buffer here - if you want to
-// use this code on a pre ice age mainframe please change it ;)
-#define MVD_ZIP_READ_BUFFER (256 * 1024)
+//! Size of the buffer used to build the zip records (the largest one is the CD record)
+#define MVD_ZIP_RECORD_BUFFER 64
+
+//! Files are split in blocks of this size and the blocks are compressed in parallel (same as pigz)
+#define MVD_ZIP_BLOCK_SIZE (128 * 1024)
+//! Each block is compressed using the tail of the previous one as dictionary
+#define MVD_ZIP_DICT_SIZE (32 * 1024)
+//! Number of blocks (per thread) being compressed ahead of the one being written
+#define MVD_ZIP_BLOCKS_PER_THREAD 4
 
 /*!
     \class MvdZip zip.h
@@ -189,6 +202,14 @@ using namespace Movida;
     myRoot/dir1/dir1.2/file1.2.1
 
     \endverbatim
+
+    Files are split in blocks of 128 KB and the blocks are compressed on a
+    pool of worker threads, while the compressed data is written to the
+    archive in order by the calling thread. Each block is compressed on its
+    own, using the last 32 KB of the previous block as dictionary and ending
+    on a byte boundary, so the concatenated blocks form a single deflate
+    stream (this is the same technique used by pigz). Small files are a
+    single block, so different files are compressed in parallel too.
 */
 
 /*!
@@ -223,6 +244,74 @@ using namespace Movida;
 */
 
 
+/************************************************************************
+    CRC-32 combination
+ *************************************************************************/
+
+namespace {
+// crc32_combine() has been added in zlib 1.2.2.1, this is the same code.
+
+quint32 gf2MatrixTimes(const quint32 *mat, quint32 vec)
+{
+    quint32 sum = 0;
+    while (vec) {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+void gf2MatrixSquare(quint32 *square, const quint32 *mat)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2MatrixTimes(mat, mat[n]);
+}
+
+//! Returns the CRC of two concatenated blocks given the CRC of each block and the length of the second one.
+quint32 crc32Combine(quint32 crc1, quint32 crc2, qint64 len2)
+{
+    if (len2 <= 0)
+        return crc1;
+
+    quint32 even[32]; // even-power-of-two zeros operator
+    quint32 odd[32]; // odd-power-of-two zeros operator
+
+    // Put operator for one zero bit in odd
+    odd[0] = 0xedb88320UL; // CRC-32 polynomial
+    quint32 row = 1;
+    for (int n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    // Put operator for two zero bits in even, then four zero bits in odd
+    gf2MatrixSquare(even, odd);
+    gf2MatrixSquare(odd, even);
+
+    // Apply len2 zeros to crc1 (first square will put the operator for one
+    // zero byte, eight zero bits, in even)
+    do {
+        gf2MatrixSquare(even, odd);
+        if (len2 & 1)
+            crc1 = gf2MatrixTimes(even, crc1);
+        len2 >>= 1;
+
+        if (len2 == 0)
+            break;
+
+        gf2MatrixSquare(odd, even);
+        if (len2 & 1)
+            crc1 = gf2MatrixTimes(odd, crc1);
+        len2 >>= 1;
+    } while (len2 != 0);
+
+    return crc1 ^ crc2;
+}
+}
+
+
 /************************************************************************
     MvdZip::Private
  *************************************************************************/
@@ -231,6 +320,18 @@ using namespace Movida;
 class MvdZip::Private
 {
 public:
+    //! A file or directory to be added to the archive.
+    struct Entry {
+        QFileInfo file;
+        QString name;
+        MvdZip::CompressionLevel level;
+        bool dirOnly;
+        int blocks;
+    };
+
+    class Block;
+    class EntryDevice;
+
     Private();
     ~Private();
 
@@ -238,26 +339,67 @@ public:
 
     QIODevice *device;
 
-    char buffer1[MVD_ZIP_READ_BUFFER];
-    char buffer2[MVD_ZIP_READ_BUFFER];
-
-    unsigned char *uBuffer;
+    char buffer1[MVD_ZIP_RECORD_BUFFER];
 
     const quint32 *crcTable;
 
     QString comment;
     QString password;
 
+    QObject *progressCallbackObject;
+    QString progressCallbackSlot;
+
+    quint64 totalProgress;
+    quint64 currentProgress;
+
+    // Blocks of the entries being written, in archive order.
+    // Only the first queuedBlocks blocks have been started.
+    QThreadPool pool;
+    QList<Block *> blocks;
+    int queuedBlocks;
+
+    // Entry being written through openEntry()
+    EntryDevice *stream;
+    MvdZipEntry *streamHeader;
+    QString streamName;
+    MvdZip::CompressionLevel streamLevel;
+    quint32 streamKeys[3];
+    QByteArray streamBuffer;
+    int streamDictionary;
+    MvdZip::ErrorCode streamError;
+
     MvdZip::ErrorCode createArchive(QIODevice *device);
+    MvdZip::ErrorCode appendArchive(QIODevice *device,
+        QMap<QString, MvdZipEntry *> *headers, const QString &comment);
     MvdZip::ErrorCode closeArchive();
     void reset();
 
     bool zLibInit();
 
-    MvdZip::ErrorCode createEntry(const QFileInfo &file, const QString &root,
-    MvdZip::CompressionLevel level);
+    MvdZip::ErrorCode collectEntries(const QString &path, const QString &root,
+        MvdZip::CompressionOptions options, MvdZip::CompressionLevel level, QList<Entry> *entries);
+    Entry createEntry(const QFileInfo &file, const QString &root,
+        MvdZip::CompressionLevel level);
+    MvdZip::ErrorCode writeEntries(const QList<Entry> &entries);
+    MvdZip::ErrorCode writeEntry(const Entry &entry);
+
+    MvdZipEntry *createHeader(const QDateTime &dt, MvdZip::CompressionLevel level, bool encrypt);
+    MvdZip::ErrorCode writeLocalHeader(MvdZipEntry *h, const QString &name, quint32 *keys);
+    MvdZip::ErrorCode writeBlock(MvdZipEntry *h, quint32 *keys, Block *block);
+    MvdZip::ErrorCode finishEntry(MvdZipEntry *h, const QString &name);
+
+    void appendBlock(Block *block);
+    Block *takeBlock();
+    void discardBlocks();
+
+    QIODevice *openStream(const QString &name, MvdZip::CompressionLevel level);
+    qint64 writeStream(const char *data, qint64 len);
+    void queueStreamBlock(bool last);
+    MvdZip::ErrorCode closeStream();
     MvdZip::CompressionLevel detectCompressionByMime(const QString &ext);
 
+    inline void emitProgress();
+
     inline void encryptBytes(quint32 *keys, char *buffer, qint64 read);
 
     inline void setULong(quint32 v, char *buffer, unsigned int offset);
@@ -268,14 +410,196 @@ public:
     inline QString extractRoot(const QString &p, MvdZip::CompressionOptions o);
 };
 
+/*!
+    \internal Compresses a block of an entry. The compressed data is a raw
+    deflate stream ending on a byte boundary, which is terminated only for
+    the last block of the entry, so that the blocks of an entry can be
+    concatenated.
+*/
+class MvdZip::Private::Block : public QRunnable
+{
+public:
+    //! Reads and compresses \p sz bytes of the file \p p, starting at \p off.
+    Block(const QString &p, qint64 off, int sz, MvdZip::CompressionLevel l, int s, bool last) :
+        path(p), offset(off), size(sz), level(l), strategy(s), lastBlock(last),
+        dictionary(0), crc(0), error(MvdZip::NoError)
+    {
+        setAutoDelete(false);
+    }
+
+    //! Compresses \p in, using its first \p dict bytes as dictionary.
+    Block(const QByteArray &in, int dict, MvdZip::CompressionLevel l, int s, bool last) :
+        offset(0), size(in.size() - dict), level(l), strategy(s), lastBlock(last),
+        input(in), dictionary(dict), crc(0), error(MvdZip::NoError)
+    {
+        setAutoDelete(false);
+    }
+
+    void run()
+    {
+        MVD_TRACE_SPAN(span, "MvdZip::Block", "zip");
+        MVD_TRACE_COUNTER(span, "bytes", size);
+
+        error = process();
+        input.clear();
+        done.release();
+    }
+
+    inline bool isDone() const { return done.available() != 0; }
+
+    const QString path;
+    const qint64 offset;
+    const int size;
+    const MvdZip::CompressionLevel level;
+    const int strategy;
+    const bool lastBlock;
+
+    QByteArray input;
+    int dictionary;
+
+    QByteArray data;
+    quint32 crc;
+    MvdZip::ErrorCode error;
+
+    //! Released when the block has been processed
+    QSemaphore done;
+
+private:
+    MvdZip::ErrorCode process();
+};
+
+//! \internal
+MvdZip::ErrorCode MvdZip::Private::Block::process()
+{
+    if (!path.isEmpty()) {
+        QFile file(path);
+        if (!file.open(QIODevice::ReadOnly)) {
+            eLog() << QString("MvdZip: An error occurred while opening %1").arg(path);
+            return MvdZip::FileOpenError;
+        }
+
+        // Read the tail of the previous block too, so it can be used as dictionary
+        dictionary = level == MvdZip::NoCompression ? 0
+            : (int)qMin<qint64>(offset, MVD_ZIP_DICT_SIZE);
+
+        if (file.seek(offset - dictionary))
+            input = file.read(dictionary + size);
+        if (input.size() != dictionary + size) {
+            eLog() << QString("MvdZip: Error while reading %1").arg(path);
+            return MvdZip::ReadError;
+        }
+    }
+
+    const Bytef *in = (const Bytef *)input.constData() + dictionary;
+    crc = crc32(crc32(0L, Z_NULL, 0), in, size);
+
+    if (level == MvdZip::NoCompression) {
+        data = dictionary == 0 ? input : input.mid(dictionary);
+        return MvdZip::NoError;
+    }
+
+    z_stream zstr;
+
+    // Initialize zalloc, zfree and opaque before calling the init function
+    zstr.zalloc = Z_NULL;
+    zstr.zfree = Z_NULL;
+    zstr.opaque = Z_NULL;
+
+    // Use deflateInit2 with negative windowBits to get raw compression
+    if (deflateInit2_(&zstr, (int)level, Z_DEFLATED, -MAX_WBITS, 8, strategy,
+            ZLIB_VERSION, sizeof(z_stream)) != Z_OK) {
+        eLog() << "MvdZip: Could not initialize zlib for compression";
+        return MvdZip::ZlibError;
+    }
+
+    if (dictionary != 0
+        && deflateSetDictionary(&zstr, (const Bytef *)input.constData(), dictionary) != Z_OK) {
+        deflateEnd(&zstr);
+        eLog() << "MvdZip: Could not initialize zlib for compression";
+        return MvdZip::ZlibError;
+    }
+
+    // A few more bytes than the bound for the empty block emitted by Z_SYNC_FLUSH
+    data.resize(deflateBound(&zstr, size) + 16);
+
+    zstr.next_in = (Bytef *)in;
+    zstr.avail_in = (uInt)size;
+    zstr.next_out = (Bytef *)data.data();
+    zstr.avail_out = (uInt)data.size();
+
+    // Only the last block terminates the stream, the others are flushed
+    // to a byte boundary so the next block can be appended
+    const int flush = lastBlock ? Z_FINISH : Z_SYNC_FLUSH;
+    int zret;
+
+    forever {
+        zret = deflate(&zstr, flush);
+        if (zret == Z_STREAM_ERROR || zstr.avail_out != 0)
+            break;
+
+        int used = data.size();
+        data.resize(used * 2);
+        zstr.next_out = (Bytef *)data.data() + used;
+        zstr.avail_out = (uInt)(data.size() - used);
+    }
+
+    data.resize((int)zstr.total_out);
+    deflateEnd(&zstr);
+
+    if (zret == Z_STREAM_ERROR || (lastBlock && zret != Z_STREAM_END) || zstr.avail_in != 0) {
+        eLog() << "MvdZip: zlib error while compressing data";
+        data.clear();
+        return MvdZip::ZlibError;
+    }
+
+    return MvdZip::NoError;
+}
+
+//! \internal Write-only device returned by MvdZip::openEntry().
+class MvdZip::Private::EntryDevice : public QIODevice
+{
+public:
+    EntryDevice(MvdZip::Private *p) :
+        d(p)
+    { }
+
+    bool isSequential() const { return true; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
+    }
+
+    qint64 writeData(const char *data, qint64 len)
+    {
+        return d->writeStream(data, len);
+    }
+
+private:
+    MvdZip::Private *d;
+};
+
 //! \internal
 MvdZip::Private::Private()
 {
     headers = 0;
     device = 0;
 
-    // keep an unsigned pointer so we avoid to over bloat the code with casts
-    uBuffer = (unsigned char *)buffer1;
+    progressCallbackObject = 0;
+    totalProgress = 0;
+    currentProgress = 0;
+
+    queuedBlocks = 0;
+
+    stream = 0;
+    streamHeader = 0;
+    streamLevel = MvdZip::NoCompression;
+    streamDictionary = 0;
+    streamError = MvdZip::NoError;
+
     crcTable = (quint32 *)get_crc_table();
 }
 
@@ -308,8 +632,32 @@ MvdZip::ErrorCode MvdZip::Private::createArchive(QIODevice *dev)
     return MvdZip::NoError;
 }
 
-//! \internal Writes a new entry in the zip file.
-MvdZip::ErrorCode MvdZip::Private::createEntry(const QFileInfo &file, const QString &root,
+/*!
+    \internal Same as createArchive() but the archive already contains the
+    entries in \p h. The device must be positioned where the new entries
+    are to be written. Takes ownership of \p h.
+*/
+MvdZip::ErrorCode MvdZip::Private::appendArchive(QIODevice *dev,
+    QMap<QString, MvdZipEntry *> *h, const QString &c)
+{
+    Q_ASSERT(h != 0);
+
+    MvdZip::ErrorCode ec = createArchive(dev);
+    if (ec != MvdZip::NoError) {
+        qDeleteAll(*h);
+        delete h;
+        return ec;
+    }
+
+    delete headers;
+    headers = h;
+    comment = c;
+
+    return MvdZip::NoError;
+}
+
+//! \internal Resolves the name and compression level of a new entry.
+MvdZip::Private::Entry MvdZip::Private::createEntry(const QFileInfo &file, const QString &root,
     MvdZip::CompressionLevel level)
 {
     //! \todo Automatic level detection (cpu, extension & file size)
@@ -317,20 +665,17 @@ MvdZip::ErrorCode MvdZip::Private::createEntry(const QFileInfo &file, const QStr
     // Directories and very small files are always stored
     // (small files would get bigger due to the compression headers overhead)
 
-    // Need this for zlib
-    bool isPNGFile = false;
-    bool dirOnly = file.isDir();
-
-    QString entryName = root;
+    Entry entry;
+    entry.file = file;
+    entry.dirOnly = file.isDir();
+    entry.name = root;
+    entry.blocks = 0;
 
     // Directory entry
-    if (dirOnly)
+    if (entry.dirOnly)
         level = MvdZip::NoCompression;
     else {
-        entryName.append(file.fileName());
-
-        QString ext = file.completeSuffix().toLower();
-        isPNGFile = ext == "png";
+        entry.name.append(file.fileName());
 
         if (file.size() < MVD_ZIP_COMPRESSION_THRESHOLD)
             level = MvdZip::NoCompression;
@@ -341,33 +686,210 @@ MvdZip::ErrorCode MvdZip::Private::createEntry(const QFileInfo &file, const QStr
                     break;
 
                 case MvdZip::AutoMimeCompression:
-                    level = detectCompressionByMime(ext);
+                    level = detectCompressionByMime(file.completeSuffix().toLower());
                     break;
 
                 case MvdZip::AutoFullCompression:
-                    level = detectCompressionByMime(ext);
+                    level = detectCompressionByMime(file.completeSuffix().toLower());
                     break;
 
                 default:
                     ;
             }
+
+        // Empty files still need a (empty) terminated deflate stream
+        entry.blocks = qMax<qint64>(1, (file.size() + MVD_ZIP_BLOCK_SIZE - 1) / MVD_ZIP_BLOCK_SIZE);
     }
 
-    // entryName contains the path as it should be written
-    // in the zip file records
+    entry.level = level;
+    return entry;
+}
 
+/*!
+    \internal Recursively collects the files contained in \p path.
+    See MvdZip::addDirectory() for the meaning of the parameters.
+*/
+MvdZip::ErrorCode MvdZip::Private::collectEntries(const QString &path, const QString &root,
+    MvdZip::CompressionOptions options, MvdZip::CompressionLevel level, QList<Entry> *entries)
+{
+    QDir dir(path);
+    if (!dir.exists())
+        return MvdZip::FileNotFoundError;
+
+    // ActualRoot is the path to be written in the zip records
+    // Remove any trailing separator
+    QString actualRoot = root.trimmed();
+
+    // Preserve Unix root
+    if (actualRoot != "/") {
+        while (actualRoot.endsWith("/") || actualRoot.endsWith("\\"))
+            actualRoot.truncate(actualRoot.length() - 1);
+    }
+
+    // QDir::cleanPath() fixes some issues with QDir::dirName()
+    QFileInfo current(QDir::cleanPath(path));
+
+    if (!actualRoot.isEmpty() && actualRoot != "/")
+        actualRoot.append("/");
+
+    /* This part is quite confusing and needs some test or check*/
+    /* An attempt to compress the / root directory evtl. using a root prefix should be a good test */
+    if (options.testFlag(MvdZip::AbsolutePathsOption) && !options.testFlag(MvdZip::IgnorePathsOption)) {
+        QString absolutePath = extractRoot(path, options);
+
+        // addDir("/home/blue/.movida", "myroot") -> absolutePath = "/home/"
+        if (!absolutePath.isEmpty() && absolutePath != "/")
+            absolutePath.append("/");
+
+        // addDir("/home/blue/.movida", "myroot") -> actualRoot = "myroot/home/"
+        if (absolutePath.startsWith("/"))
+            actualRoot.append(absolutePath.right(absolutePath.length() - 1));
+        else
+            actualRoot.append(absolutePath);
+    }
+
+    if (!(options.testFlag(MvdZip::IgnorePathsOption) || options.testFlag(MvdZip::IgnoreRootOption))) {
+        actualRoot.append(QDir(current.absoluteFilePath()).dirName())
+            .append("/");
+    }
+
+    // actualRoot now contains the path of the file relative to the zip archive
+    // with a trailing /
+
+    QFileInfoList list = dir.entryInfoList(
+        QDir::Files |
+        QDir::Dirs |
+        QDir::NoDotAndDotDot |
+        QDir::NoSymLinks);
+
+    MvdZip::ErrorCode ec = MvdZip::NoError;
+    bool filesAdded = false;
+
+    MvdZip::CompressionOptions recursionOptions;
+    if (options.testFlag(MvdZip::IgnorePathsOption))
+        recursionOptions |= MvdZip::IgnorePathsOption;
+    else recursionOptions |= MvdZip::RelativePathsOption;
+
+    for (int i = 0; i < list.size() && ec == MvdZip::NoError; ++i) {
+        QFileInfo info = list.at(i);
+
+        if (info.isDir()) {
+            // Recursion :)
+            ec = collectEntries(info.absoluteFilePath(), actualRoot, recursionOptions, level, entries);
+        } else {
+            entries->append(createEntry(info, actualRoot, level));
+            filesAdded = true;
+        }
+    }
+
+
+    // We need an explicit record for this dir
+    // Non-empty directories don't need it because they have a path component in the filename
+    if (!filesAdded && !options.testFlag(MvdZip::IgnorePathsOption))
+        entries->append(createEntry(current, actualRoot, level));
+
+    return ec;
+}
+
+/*!
+    \internal Writes the entries to the archive. The files are split in
+    blocks and a limited number of blocks is compressed ahead of the one
+    being written, so memory usage does not depend on the file size.
+*/
+MvdZip::ErrorCode MvdZip::Private::writeEntries(const QList<Entry> &entries)
+{
+    Q_ASSERT(blocks.isEmpty());
+
+    MVD_TRACE_SPAN(span, "MvdZip::writeEntries", "zip");
+    MVD_TRACE_COUNTER(span, "entries", entries.size());
+
+    QTime time;
+    time.start();
+
+    totalProgress = currentProgress = 0;
+
+    for (int i = 0; i < entries.size(); ++i) {
+        const Entry &entry = entries.at(i);
+        const qint64 size = entry.dirOnly ? 0 : entry.file.size();
+        const int strategy = entry.file.completeSuffix().toLower() == "png"
+            ? Z_RLE : Z_DEFAULT_STRATEGY;
+
+        for (int j = 0; j < entry.blocks; ++j) {
+            const qint64 offset = (qint64)j * MVD_ZIP_BLOCK_SIZE;
+            appendBlock(new Block(entry.file.absoluteFilePath(), offset,
+                (int)qMin<qint64>(MVD_ZIP_BLOCK_SIZE, size - offset),
+                entry.level, strategy, j == entry.blocks - 1));
+        }
+
+        totalProgress += size;
+    }
+
+    MvdZip::ErrorCode ec = MvdZip::NoError;
+    for (int i = 0; i < entries.size() && ec == MvdZip::NoError; ++i)
+        ec = writeEntry(entries.at(i));
+
+    if (ec != MvdZip::NoError)
+        discardBlocks();
+
+    if (ec == MvdZip::NoError && totalProgress != 0) {
+        int ms = qMax(1, time.elapsed());
+        iLog() << QString("MvdZip: Compressed %1 KB in %2 ms (%3 KB/s, %4 threads).")
+            .arg(totalProgress / 1024).arg(ms).arg((totalProgress * 1000) / (1024 * ms))
+            .arg(pool.maxThreadCount());
+    }
+
+    return ec;
+}
+
+//! \internal Writes a new entry in the zip file.
+MvdZip::ErrorCode MvdZip::Private::writeEntry(const Entry &entry)
+{
     // create header and store it to write a central directory later
+    MvdZipEntry *h = createHeader(entry.file.lastModified(), entry.level,
+        !entry.dirOnly && !password.isEmpty());
+    h->szUncomp = entry.dirOnly ? 0 : entry.file.size();
+
+    // Encryption keys
+    quint32 keys[3] = { 0, 0, 0 };
+
+    MvdZip::ErrorCode ec = writeLocalHeader(h, entry.name, keys);
+    if (ec != MvdZip::NoError) {
+        delete h;
+        return ec;
+    }
+
+    // Write file data as soon as the blocks are compressed
+    for (int i = 0; i < entry.blocks; ++i) {
+        Block *block = takeBlock();
+        ec = writeBlock(h, keys, block);
+        currentProgress += block->size;
+        delete block;
+
+        if (ec != MvdZip::NoError) {
+            eLog() << QString("MvdZip: Error while writing %1").arg(entry.file.absoluteFilePath());
+            delete h;
+            return ec;
+        }
+
+        emitProgress();
+    }
+
+    return finishEntry(h, entry.name);
+}
+
+//! \internal Creates the header of a new entry. The entry size and CRC are set when the data is written.
+MvdZipEntry *MvdZip::Private::createHeader(const QDateTime &dt,
+    MvdZip::CompressionLevel level, bool encrypt)
+{
     MvdZipEntry *h = new MvdZipEntry;
 
     h->compMethod = (level == MvdZip::NoCompression) ? 0 : 0x0008;
 
     // Set encryption bit and set the data descriptor bit
     // so we can use mod time instead of crc for password check
-    bool encrypt = !dirOnly && !password.isEmpty();
     if (encrypt)
         h->gpFlag[0] |= 9;
 
-    QDateTime dt = file.lastModified();
     QDate d = dt.date();
     h->modDate[1] = ((d.year() - 1980) << 1) & 254;
     h->modDate[1] |= ((d.month() >> 3) & 1);
@@ -380,7 +902,17 @@ MvdZip::ErrorCode MvdZip::Private::createEntry(const QFileInfo &file, const QStr
     h->modTime[0] = ((t.minute() & 7) << 5) & 224;
     h->modTime[0] |= t.second() / 2;
 
-    h->szUncomp = dirOnly ? 0 : file.size();
+    return h;
+}
+
+/*!
+    \internal Writes the local header record of an entry, followed by the
+    encryption header if the entry is encrypted (in this case \p keys are
+    initialized to encrypt the entry data).
+*/
+MvdZip::ErrorCode MvdZip::Private::writeLocalHeader(MvdZipEntry *h, const QString &name, quint32 *keys)
+{
+    const bool encrypt = h->isEncrypted();
 
     // **** Write local file header ****
 
@@ -422,7 +954,7 @@ MvdZip::ErrorCode MvdZip::Private::createEntry(const QFileInfo &file, const QStr
     setULong(h->szUncomp, buffer1, MVD_ZIP_LH_OFF_USIZE);
 
     // filename length
-    QByteArray entryNameBytes = entryName.toAscii();
+    QByteArray entryNameBytes = name.toAscii();
     int sz = entryNameBytes.size();
 
     buffer1[MVD_ZIP_LH_OFF_NAMELEN] = sz & 0xFF;
@@ -431,24 +963,18 @@ MvdZip::ErrorCode MvdZip::Private::createEntry(const QFileInfo &file, const QStr
     // extra field length
     buffer1[MVD_ZIP_LH_OFF_XLEN] = buffer1[MVD_ZIP_LH_OFF_XLEN + 1] = 0;
 
-    // NoCompression offset to write crc and compressed size
+    // Offset to write crc and sizes when the entry is complete
     h->lhOffset = device->pos();
-    quint32 crcOffset = h->lhOffset + MVD_ZIP_LH_OFF_CRC;
 
     if (device->write(buffer1, MVD_ZIP_LOCAL_HEADER_SIZE) != MVD_ZIP_LOCAL_HEADER_SIZE) {
-        delete h;
         return MvdZip::WriteError;
     }
 
     // Write out filename
     if (device->write(entryNameBytes) != sz) {
-        delete h;
         return MvdZip::WriteError;
     }
 
-    // Encryption keys
-    quint32 keys[3] = { 0, 0, 0 };
-
     if (encrypt) {
         // **** encryption header ****
 
@@ -485,152 +1011,54 @@ MvdZip::ErrorCode MvdZip::Private::createEntry(const QFileInfo &file, const QStr
         // Write out encryption header
         if (device->write(buffer1, MVD_ZIP_LOCAL_ENC_HEADER_SIZE)
             != MVD_ZIP_LOCAL_ENC_HEADER_SIZE) {
-            delete h;
             return MvdZip::WriteError;
         }
     }
 
-    qint64 written = 0;
-    quint32 crc = crc32(0L, Z_NULL, 0);
-
-    if (!dirOnly) {
-        QFile actualFile(file.absoluteFilePath());
-        if (!actualFile.open(QIODevice::ReadOnly)) {
-            eLog() << QString("MvdZip: An error occurred while opening %1")
-                .arg(file.absoluteFilePath());
-            return MvdZip::FileOpenError;
-        }
-
-        // Write file data
-        qint64 read = 0;
-        qint64 totRead = 0;
-        qint64 toRead = actualFile.size();
-
-        if (level == MvdZip::NoCompression) {
-            while ((read = actualFile.read(buffer1, MVD_ZIP_READ_BUFFER)) > 0) {
-                crc = crc32(crc, uBuffer, read);
-
-                if (password != 0)
-                    encryptBytes(keys, buffer1, read);
-
-                if ((written = device->write(buffer1, read)) != read) {
-                    actualFile.close();
-                    delete h;
-                    return MvdZip::WriteError;
-                }
-            }
-        } else {
-            z_stream zstr;
-
-            // Initialize zalloc, zfree and opaque before calling the init function
-            zstr.zalloc = Z_NULL;
-            zstr.zfree = Z_NULL;
-            zstr.opaque = Z_NULL;
-
-            int zret;
-
-            // Use deflateInit2 with negative windowBits to get raw compression
-            if ((zret = deflateInit2_(
-                     &zstr,
-                     (int)level,
-                     Z_DEFLATED,
-                     -MAX_WBITS,
-                     8,
-                     isPNGFile ? Z_RLE : Z_DEFAULT_STRATEGY,
-                     ZLIB_VERSION,
-                     sizeof(z_stream)
-                     )) != Z_OK) {
-                actualFile.close();
-                eLog() << "MvdZip: Could not initialize zlib for compression";
-                delete h;
-                return MvdZip::ZlibError;
-            }
-
-            qint64 compressed;
-
-            int flush = Z_NO_FLUSH;
-
-            do {
-                read = actualFile.read(buffer1, MVD_ZIP_READ_BUFFER);
-                totRead += read;
-
-                if (read == 0)
-                    break;
-                if (read < 0) {
-                    actualFile.close();
-                    deflateEnd(&zstr);
-                    eLog() << QString("MvdZip: Error while reading %1").arg(file.absoluteFilePath());
-                    delete h;
-                    return MvdZip::ReadError;
-                }
-
-                crc = crc32(crc, uBuffer, read);
-
-                zstr.next_in = (Bytef *)buffer1;
-                zstr.avail_in = (uInt)read;
-
-                // Tell zlib if this is the last chunk we want to encode
-                // by setting the flush parameter to Z_FINISH
-                flush = (totRead == toRead) ? Z_FINISH : Z_NO_FLUSH;
-
-                // Run deflate() on input until output buffer not full
-                // finish compression if all of source has been read in
-                do {
-                    zstr.next_out = (Bytef *)buffer2;
-                    zstr.avail_out = MVD_ZIP_READ_BUFFER;
-
-                    zret = deflate(&zstr, flush);
-                    // State not clobbered
-                    Q_ASSERT(zret != Z_STREAM_ERROR);
-
-                    // Write compressed data to file and empty buffer
-                    compressed = MVD_ZIP_READ_BUFFER - zstr.avail_out;
-
-                    if (password != 0)
-                        encryptBytes(keys, buffer2, compressed);
-
-                    if (device->write(buffer2, compressed) != compressed) {
-                        deflateEnd(&zstr);
-                        actualFile.close();
-                        eLog() << QString("MvdZip: Error while writing %1").arg(file.absoluteFilePath());
-                        delete h;
-                        return MvdZip::WriteError;
-                    }
-
-                    written += compressed;
-
-                } while (zstr.avail_out == 0);
+    return MvdZip::NoError;
+}
 
-                // All input will be used
-                Q_ASSERT(zstr.avail_in == 0);
+//! \internal Appends a compressed block to the entry being written.
+MvdZip::ErrorCode MvdZip::Private::writeBlock(MvdZipEntry *h, quint32 *keys, Block *block)
+{
+    if (block->error != MvdZip::NoError)
+        return block->error;
 
-            } while (flush != Z_FINISH);
+    h->crc = crc32Combine(h->crc, block->crc, block->size);
 
-            // Stream will be complete
-            Q_ASSERT(zret == Z_STREAM_END);
+    const int compressed = block->data.size();
+    if (h->isEncrypted())
+        encryptBytes(keys, block->data.data(), compressed);
 
-            deflateEnd(&zstr);
+    if (device->write(block->data) != compressed)
+        return MvdZip::WriteError;
 
-        } // if (level != STORE)
+    h->szComp += compressed;
+    block->data.clear();
 
-        actualFile.close();
-    }
+    return MvdZip::NoError;
+}
 
-    // NoCompression end of entry offset
+/*!
+    \internal Updates the local header of a completely written entry and
+    stores the header for the central directory. The header is deleted in
+    case of error.
+*/
+MvdZip::ErrorCode MvdZip::Private::finishEntry(MvdZipEntry *h, const QString &name)
+{
+    // End of entry offset
     quint32 current = device->pos();
 
-    // Update crc and compressed size in local header
-    if (!device->seek(crcOffset)) {
+    // Update crc and sizes in local header
+    if (!device->seek(h->lhOffset + MVD_ZIP_LH_OFF_CRC)) {
         delete h;
         return MvdZip::SeekError;
     }
 
-    h->crc = dirOnly ? 0 : crc;
-    h->szComp += written;
-
     setULong(h->crc, buffer1, 0);
     setULong(h->szComp, buffer1, 4);
-    if (device->write(buffer1, 8) != 8) {
+    setULong(h->szUncomp, buffer1, 8);
+    if (device->write(buffer1, 12) != 12) {
         delete h;
         return MvdZip::WriteError;
     }
@@ -665,10 +1093,178 @@ MvdZip::ErrorCode MvdZip::Private::createEntry(const QFileInfo &file, const QStr
         }
     }
 
-    headers->insert(entryName, h);
+    headers->insert(name, h);
     return MvdZip::NoError;
 }
 
+//! \internal Adds a block to the queue, starting it if less than enough blocks are being compressed.
+void MvdZip::Private::appendBlock(Block *block)
+{
+    blocks.append(block);
+
+    if (queuedBlocks < pool.maxThreadCount() * MVD_ZIP_BLOCKS_PER_THREAD) {
+        pool.start(block);
+        ++queuedBlocks;
+    }
+}
+
+//! \internal Waits for the first block to be compressed, removes it from the queue and starts a new one.
+MvdZip::Private::Block *MvdZip::Private::takeBlock()
+{
+    Q_ASSERT(!blocks.isEmpty() && queuedBlocks > 0);
+
+    Block *block = blocks.takeFirst();
+    --queuedBlocks;
+    block->done.acquire();
+
+    if (queuedBlocks < blocks.size())
+        pool.start(blocks.at(queuedBlocks++));
+
+    return block;
+}
+
+//! \internal Deletes the queued blocks, waiting for the running ones.
+void MvdZip::Private::discardBlocks()
+{
+    pool.waitForDone();
+    qDeleteAll(blocks);
+    blocks.clear();
+    queuedBlocks = 0;
+}
+
+//! \internal Starts a new entry and returns the device used to write its data.
+QIODevice *MvdZip::Private::openStream(const QString &name, MvdZip::CompressionLevel level)
+{
+    Q_ASSERT(stream == 0);
+
+    switch (level) {
+        case MvdZip::AutoCpuCompression:
+            level = MvdZip::Deflate5Compression;
+            break;
+
+        case MvdZip::AutoMimeCompression:
+        case MvdZip::AutoFullCompression:
+            level = detectCompressionByMime(QFileInfo(name).completeSuffix().toLower());
+            break;
+
+        default:
+            ;
+    }
+
+    streamHeader = createHeader(QDateTime::currentDateTime(), level, !password.isEmpty());
+
+    MvdZip::ErrorCode ec = writeLocalHeader(streamHeader, name, streamKeys);
+    if (ec != MvdZip::NoError) {
+        eLog() << QString("MvdZip: Unable to create entry %1").arg(name);
+        delete streamHeader;
+        streamHeader = 0;
+        return 0;
+    }
+
+    streamName = name;
+    streamLevel = level;
+    streamBuffer.clear();
+    streamDictionary = 0;
+    streamError = MvdZip::NoError;
+
+    stream = new EntryDevice(this);
+    stream->open(QIODevice::WriteOnly);
+    return stream;
+}
+
+/*!
+    \internal Buffers data written to the open entry. Full blocks are
+    compressed in parallel and written to the archive as soon as they are
+    ready; the call only blocks if too many blocks are pending.
+*/
+qint64 MvdZip::Private::writeStream(const char *data, qint64 len)
+{
+    if (streamError != MvdZip::NoError)
+        return -1;
+
+    streamBuffer.append(data, (int)len);
+    streamHeader->szUncomp += len;
+
+    while (streamBuffer.size() - streamDictionary >= MVD_ZIP_BLOCK_SIZE)
+        queueStreamBlock(false);
+
+    while (streamError == MvdZip::NoError && !blocks.isEmpty()
+        && (blocks.first()->isDone() || blocks.size() > queuedBlocks)) {
+        Block *block = takeBlock();
+        streamError = writeBlock(streamHeader, streamKeys, block);
+        delete block;
+    }
+
+    return streamError == MvdZip::NoError ? len : -1;
+}
+
+//! \internal Queues the next block of the open entry.
+void MvdZip::Private::queueStreamBlock(bool last)
+{
+    const int size = last ? streamBuffer.size() - streamDictionary : MVD_ZIP_BLOCK_SIZE;
+
+    appendBlock(new Block(streamBuffer.left(streamDictionary + size), streamDictionary,
+        streamLevel, Z_DEFAULT_STRATEGY, last));
+
+    if (last) {
+        streamBuffer.clear();
+        streamDictionary = 0;
+        return;
+    }
+
+    // Keep the tail of the block as dictionary for the next one
+    const int dictionary = streamLevel == MvdZip::NoCompression ? 0 : MVD_ZIP_DICT_SIZE;
+    streamBuffer.remove(0, streamDictionary + size - dictionary);
+    streamDictionary = dictionary;
+}
+
+//! \internal Writes the remaining data of the open entry and completes the entry.
+MvdZip::ErrorCode MvdZip::Private::closeStream()
+{
+    if (stream == 0)
+        return MvdZip::NoError;
+
+    if (streamError == MvdZip::NoError) {
+        queueStreamBlock(true);
+
+        while (streamError == MvdZip::NoError && !blocks.isEmpty()) {
+            Block *block = takeBlock();
+            streamError = writeBlock(streamHeader, streamKeys, block);
+            delete block;
+        }
+    }
+
+    MvdZip::ErrorCode ec = streamError;
+    if (ec == MvdZip::NoError)
+        ec = finishEntry(streamHeader, streamName);
+    else {
+        discardBlocks();
+        delete streamHeader;
+    }
+
+    if (ec != MvdZip::NoError)
+        eLog() << QString("MvdZip: Error while writing %1").arg(streamName);
+
+    streamHeader = 0;
+    streamBuffer.clear();
+
+    stream->close();
+    delete stream;
+    stream = 0;
+
+    return ec;
+}
+
+//! \internal Emits the current progress if a callback has been registered.
+void MvdZip::Private::emitProgress()
+{
+    if (progressCallbackObject && totalProgress != 0) {
+        int progress = (currentProgress * 100) / totalProgress;
+        QMetaObject::invokeMethod(progressCallbackObject, qPrintable(progressCallbackSlot),
+            Qt::DirectConnection, Q_ARG(int, progress));
+    }
+}
+
 //! \internal
 int MvdZip::Private::decryptByte(quint32 key2) const
 {
@@ -768,9 +1364,17 @@ MvdZip::ErrorCode MvdZip::Private::closeArchive()
     if (device == 0)
         return MvdZip::NoError;
 
+    MVD_TRACE_SPAN(span, "MvdZip::closeArchive", "zip");
+
     if (headers == 0)
         return MvdZip::NoError;
 
+    if (stream != 0) {
+        MvdZip::ErrorCode ec = closeStream();
+        if (ec != MvdZip::NoError)
+            return ec;
+    }
+
     const MvdZipEntry *h;
 
     unsigned int sz;
@@ -997,6 +1601,22 @@ void MvdZip::setPassword(const QString &pwd)
     d->password = pwd;
 }
 
+/*!
+    Sets a slot to be called to show the current compression progress.
+    The slot is expected to take a single int parameter for the
+    current progress value (expressed as percent of the data being added
+    by the current addDirectory() call). The slot is called in the thread
+    calling addDirectory().
+*/
+void MvdZip::setProgressHandler(QObject *obj, const char *member)
+{
+    if (!obj || !member)
+        return;
+
+    d->progressCallbackSlot = QString::fromAscii(member);
+    d->progressCallbackObject = d->progressCallbackSlot.isEmpty() ? 0 : obj;
+}
+
 //! Convenience method, clears the current password.
 void MvdZip::clearPassword()
 {
@@ -1050,6 +1670,53 @@ MvdZip::ErrorCode MvdZip::createArchive(QIODevice *device)
     return d->createArchive(device);
 }
 
+/*!
+    Opens an existing archive to add new entries to it. Any open archive
+    will be closed.
+
+    The new entries and a new central directory are written after the end
+    of the archive, so no existing data is overwritten and the archive can
+    still be read while the new entries are being added. Truncate the file
+    to its previous size if the new entries cannot be written completely.
+    The space used by the previous central directory is not reclaimed.
+
+    Archives containing entries that cannot be read by MvdUnZip are not
+    opened, as those entries would be lost.
+*/
+MvdZip::ErrorCode MvdZip::appendArchive(const QString &filename)
+{
+    MvdUnZip uz;
+    if (uz.openArchive(filename) != MvdUnZip::NoError) {
+        eLog() << QString("MvdZip: Unable to read archive: %1").arg(filename);
+        return MvdZip::FileOpenError;
+    }
+
+    QString comment;
+    QMap<QString, MvdZipEntry *> *headers = uz.takeCentralDirectory(&comment);
+    if (!headers) {
+        eLog() << QString("MvdZip: Archive contains unsupported entries: %1").arg(filename);
+        return MvdZip::FileOpenError;
+    }
+
+    QFile *file = new QFile(filename);
+    if (!file->open(QIODevice::ReadWrite) || !file->seek(file->size())) {
+        delete file;
+        qDeleteAll(*headers);
+        delete headers;
+        return MvdZip::FileOpenError;
+    }
+
+    return d->appendArchive(file, headers, comment);
+}
+
+/*!
+    Returns true if the archive contains an entry named \p name.
+*/
+bool MvdZip::contains(const QString &name) const
+{
+    return d->headers != 0 && d->headers->contains(name);
+}
+
 /*!
     Returns the current archive comment.
 */
@@ -1126,93 +1793,155 @@ MvdZip::ErrorCode MvdZip::addDirectoryContents(const QString &path,
     The \p root parameter is ignored with the MvdZip::IgnorePathsOption parameter and used as
     path prefix (a trailing / is always added as directory separator!) otherwise
     (even with MvdZip::AbsolutePathsOption set!).
+
+    The files are compressed in parallel and the progress handler is called
+    after each compressed block (see setProgressHandler()).
 */
 MvdZip::ErrorCode MvdZip::addDirectory(const QString &path, const QString &root,
     CompressionOptions options, CompressionLevel level)
 {
-    // eLog() << QString("addDir(path=%1, root=%2)").arg(path, root);
-
     // Bad boy didn't call createArchive() yet :)
     if (d->device == 0)
         return MvdZip::NoOpenArchiveError;
 
-    QDir dir(path);
-    if (!dir.exists())
-        return MvdZip::FileNotFoundError;
+    ErrorCode ec = d->closeStream();
+    if (ec != MvdZip::NoError)
+        return ec;
+
+    QList<Private::Entry> entries;
+    ec = d->collectEntries(path, root, options, level, &entries);
+    if (ec == MvdZip::NoError)
+        ec = d->writeEntries(entries);
+
+    return ec;
+}
+
+/*!
+    Adds a list of files to the archive, using \p root as path prefix (a
+    trailing / is always added as directory separator). The files are
+    compressed in parallel, like with addDirectory().
+*/
+MvdZip::ErrorCode MvdZip::addFiles(const QStringList &files, const QString &root,
+    CompressionLevel level)
+{
+    if (d->device == 0)
+        return MvdZip::NoOpenArchiveError;
+
+    ErrorCode ec = d->closeStream();
+    if (ec != MvdZip::NoError)
+        return ec;
 
-    // ActualRoot is the path to be written in the zip records
-    // Remove any trailing separator
     QString actualRoot = root.trimmed();
+    while (actualRoot.endsWith("/") || actualRoot.endsWith("\\"))
+        actualRoot.truncate(actualRoot.length() - 1);
+    if (!actualRoot.isEmpty())
+        actualRoot.append("/");
 
-    // Preserve Unix root
-    if (actualRoot != "/") {
-        while (actualRoot.endsWith("/") || actualRoot.endsWith("\\"))
-            actualRoot.truncate(actualRoot.length() - 1);
+    QList<Private::Entry> entries;
+    for (int i = 0; i < files.size(); ++i) {
+        QFileInfo info(files.at(i));
+        if (!info.isFile()) {
+            eLog() << QString("MvdZip: File not found: %1").arg(files.at(i));
+            return MvdZip::FileNotFoundError;
+        }
+
+        entries.append(d->createEntry(info, actualRoot, level));
     }
 
-    // QDir::cleanPath() fixes some issues with QDir::dirName()
-    QFileInfo current(QDir::cleanPath(path));
+    return d->writeEntries(entries);
+}
 
-    if (!actualRoot.isEmpty() && actualRoot != "/")
-        actualRoot.append("/");
+/*!
+    Copies an entry from another archive without decompressing it. The
+    compressed data, the CRC and the modification time are copied as they
+    are. The entry is stored as \p name or with its original name if \p
+    name is empty.
+
+    Encrypted entries cannot be copied and no entry can be copied if a
+    password has been set, as the data would need to be decrypted and
+    encrypted again; ReadError is returned in this case, like when the entry
+    cannot be read.
+*/
+MvdZip::ErrorCode MvdZip::copyEntry(MvdUnZip *archive, const QString &entry, const QString &name)
+{
+    Q_ASSERT(archive);
 
-    /* This part is quite confusing and needs some test or check*/
-    /* An attempt to compress the / root directory evtl. using a root prefix should be a good test */
-    if (options.testFlag(AbsolutePathsOption) && !options.testFlag(IgnorePathsOption)) {
-        QString absolutePath = d->extractRoot(path, options);
+    if (d->device == 0)
+        return MvdZip::NoOpenArchiveError;
 
-        // addDir("/home/blue/.movida", "myroot") -> absolutePath = "/home/"
-        if (!absolutePath.isEmpty() && absolutePath != "/")
-            absolutePath.append("/");
+    ErrorCode ec = d->closeStream();
+    if (ec != MvdZip::NoError)
+        return ec;
 
-        // addDir("/home/blue/.movida", "myroot") -> actualRoot = "myroot/home/"
-        if (absolutePath.startsWith("/"))
-            actualRoot.append(absolutePath.right(absolutePath.length() - 1));
-        else
-            actualRoot.append(absolutePath);
+    MvdUnZip::ZipEntry info;
+    MvdUnZip::ErrorCode uec;
+    QByteArray data = archive->readRawFile(entry, &info, &uec);
+    if (uec != MvdUnZip::NoError) {
+        eLog() << QString("MvdZip: Unable to read %1 (%2)").arg(entry).arg(archive->formatError(uec));
+        return MvdZip::ReadError;
     }
 
-    if (!(options.testFlag(IgnorePathsOption) || options.testFlag(IgnoreRootOption))) {
-        actualRoot.append(QDir(current.absoluteFilePath()).dirName())
-            .append("/");
+    if (info.encrypted || info.compression == MvdUnZip::UnknownCompression || !d->password.isEmpty()) {
+        eLog() << QString("MvdZip: %1 cannot be copied without decompressing it").arg(entry);
+        return MvdZip::ReadError;
     }
 
-    // actualRoot now contains the path of the file relative to the zip archive
-    // with a trailing /
+    const QString entryName = name.isEmpty() ? entry : name;
 
-    QFileInfoList list = dir.entryInfoList(
-        QDir::Files |
-        QDir::Dirs |
-        QDir::NoDotAndDotDot |
-        QDir::NoSymLinks);
+    MvdZipEntry *h = d->createHeader(info.lastModified,
+        info.compression == MvdUnZip::Deflated ? Deflate9Compression : NoCompression, false);
+    h->szUncomp = info.uncompressedSize;
 
-    ErrorCode ec = MvdZip::NoError;
-    bool filesAdded = false;
+    quint32 keys[3] = { 0, 0, 0 };
+    ec = d->writeLocalHeader(h, entryName, keys);
+    if (ec == MvdZip::NoError && d->device->write(data) != data.size())
+        ec = MvdZip::WriteError;
 
-    CompressionOptions recursionOptions;
-    if (options.testFlag(IgnorePathsOption))
-        recursionOptions |= IgnorePathsOption;
-    else recursionOptions |= RelativePathsOption;
+    if (ec != MvdZip::NoError) {
+        delete h;
+        return ec;
+    }
 
-    for (int i = 0; i < list.size() && ec == MvdZip::NoError; ++i) {
-        QFileInfo info = list.at(i);
+    h->crc = info.crc32;
+    h->szComp += data.size();
 
-        if (info.isDir()) {
-            // Recursion :)
-            ec = addDirectory(info.absoluteFilePath(), actualRoot, recursionOptions, level);
-        } else {
-            ec = d->createEntry(info, actualRoot, level);
-            filesAdded = true;
-        }
+    return d->finishEntry(h, entryName);
+}
+
+/*!
+    Adds a new entry named \p name (the path as it should be written in the
+    archive) and returns a write-only device for its data, or 0 if the entry
+    could not be created. This allows to create entries without writing
+    them to a temporary file first. The data is compressed as it is written,
+    in the same way as addDirectory() does.
+
+    The entry is completed by closeEntry(), which is also called when a new
+    entry is added or the archive is closed. The device is owned by MvdZip
+    and is deleted when the entry is closed.
+*/
+QIODevice *MvdZip::openEntry(const QString &name, CompressionLevel level)
+{
+    if (d->device == 0) {
+        eLog() << "MvdZip: No archive has been created yet.";
+        return 0;
     }
 
+    if (d->closeStream() != MvdZip::NoError)
+        return 0;
 
-    // We need an explicit record for this dir
-    // Non-empty directories don't need it because they have a path component in the filename
-    if (!filesAdded && !options.testFlag(IgnorePathsOption))
-        ec = d->createEntry(current, actualRoot, level);
+    return d->openStream(name, level);
+}
 
-    return ec;
+/*!
+    Completes the entry created with openEntry() and deletes its device.
+    Does nothing if there is no open entry.
+*/
+MvdZip::ErrorCode MvdZip::closeEntry()
+{
+    if (d->device == 0)
+        return MvdZip::NoOpenArchiveError;
+
+    return d->closeStream();
 }
 
 /*!
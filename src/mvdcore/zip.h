@@ -29,9 +29,11 @@
 #include <zlib/zlib.h>
 
 class MvdLogger;
+class MvdUnZip;
 
 class QIODevice;
 class QFile;
+class QObject;
 class QDir;
 class QStringList;
 class QString;
@@ -80,6 +82,9 @@ public:
 
     ErrorCode createArchive(const QString &file, bool overwrite = true);
     ErrorCode createArchive(QIODevice *device);
+    ErrorCode appendArchive(const QString &file);
+
+    bool contains(const QString &name) const;
 
     QString archiveComment() const;
     void setArchiveComment(const QString &comment);
@@ -88,6 +93,8 @@ public:
     void clearPassword();
     QString password() const;
 
+    void setProgressHandler(QObject *obj, const char *member);
+
     MvdZip::ErrorCode addDirectoryContents(const QString &path,
     CompressionLevel level = AutoFullCompression);
     MvdZip::ErrorCode addDirectoryContents(const QString &path, const QString &root,
@@ -100,6 +107,14 @@ public:
     MvdZip::ErrorCode addDirectory(const QString &path, const QString &root,
     CompressionOptions options = RelativePathsOption, CompressionLevel level = AutoFullCompression);
 
+    MvdZip::ErrorCode addFiles(const QStringList &files, const QString &root,
+    CompressionLevel level = AutoFullCompression);
+    MvdZip::ErrorCode copyEntry(MvdUnZip *archive, const QString &entry,
+    const QString &name = QString());
+
+    QIODevice *openEntry(const QString &name, CompressionLevel level = AutoFullCompression);
+    MvdZip::ErrorCode closeEntry();
+
     MvdZip::ErrorCode closeArchive();
 
     QString formatError(ErrorCode c) const;
@@ -21,6 +21,8 @@
 #include "browserview.h"
 #include "ui_browserview.h"
 
+#include "pageaccessmanager.h"
+
 #include "mvdcore/core.h"
 #include "mvdcore/movie.h"
 #include "mvdcore/moviecollection.h"
@@ -124,7 +126,11 @@ void MvdBrowserView::Private::contextMenuActionTriggered(const QWebHitTestResult
             MvdMovie movie = !collection.isNull() ? collection->movie(currentMovie) : MvdMovie();
             QString title = movie.validTitle();
 
-            QString sourceFile = hit.imageUrl().toLocalFile();
+            // Images in cached pages are local files served through the cache URL scheme
+            QUrl sourceUrl = hit.imageUrl();
+            if (sourceUrl.scheme() == MvdTemplateCache::scheme())
+                sourceUrl.setScheme(QLatin1String("file"));
+            QString sourceFile = sourceUrl.toLocalFile();
             QString lastDir = Movida::settings().value("movida/browserview/saveposterdialog").toString();
             if (!title.isEmpty()) {
                 if (!lastDir.isEmpty() && !lastDir.endsWith("\\") && !lastDir.endsWith("/"))
@@ -184,6 +190,7 @@ MvdBrowserView::MvdBrowserView(QWidget *parent) :
     ws->setAttribute(QWebSettings::DeveloperExtrasEnabled, false);
 
     d->ui.webView->page()->setLinkDelegationPolicy(QWebPage::DelegateAllLinks);
+    d->ui.webView->page()->setNetworkAccessManager(new MvdPageAccessManager(this));
 
     d->ui.webView->installEventFilter(this);
 
@@ -203,8 +210,10 @@ void MvdBrowserView::setMovieCollection(MvdMovieCollection *c)
     d->collection = QPointer<MvdMovieCollection>(c);
     d->currentMovie = MvdNull;
 
-    if (!d->collection.isNull())
+    if (!d->collection.isNull()) {
         QObject::connect(d->collection.data(), SIGNAL(movieChanged(mvdid)), this, SLOT(movieChanged(mvdid)));
+        QObject::connect(d->collection.data(), SIGNAL(moviesChanged(QList<mvdid>)), this, SLOT(moviesChanged(QList<mvdid>)));
+    }
 }
 
 void MvdBrowserView::clear()
@@ -215,11 +224,11 @@ void MvdBrowserView::clear()
 
 void MvdBrowserView::blank()
 {
-    QString path = Movida::tcache().blank(d->collection.data());
+    QUrl url = Movida::tcache().blank(d->collection.data());
 
-    if (path.isEmpty())
+    if (url.isEmpty())
         clear();
-    else d->ui.webView->setUrl(QUrl::fromLocalFile(path));
+    else d->ui.webView->setUrl(url);
 
     d->currentMovie = MvdNull;
 }
@@ -350,11 +359,11 @@ void MvdBrowserView::showMovie(mvdid id)
     if (d->currentMovie == id)
         return;
 
-    QString path = Movida::tcache().movie(d->collection.data(), id);
-    if (path.isEmpty()) {
+    QUrl url = Movida::tcache().movie(d->collection.data(), id);
+    if (url.isEmpty()) {
         blank();
     } else {
-        d->ui.webView->setUrl(QUrl::fromLocalFile(path));
+        d->ui.webView->setUrl(url);
         d->currentMovie = id;
     }
 }
@@ -391,12 +400,12 @@ void MvdBrowserView::showCachedMovie(int id)
     if (d->currentMovie == id)
         return;
 
-    QString path = Movida::tcache().movieData(id);
+    QUrl url = Movida::tcache().movieData(id);
 
-    if (path.isEmpty())
+    if (url.isEmpty())
         blank();
     else
-        d->ui.webView->setUrl(QUrl::fromLocalFile(path));
+        d->ui.webView->setUrl(url);
 }
 
 void MvdBrowserView::clearCachedMovieData(int id)
@@ -501,3 +510,9 @@ void MvdBrowserView::movieChanged(mvdid id)
         showMovie(id);
     }
 }
+
+void MvdBrowserView::moviesChanged(const QList<mvdid> &ids)
+{
+    if (d->currentMovie != MvdNull && ids.contains(d->currentMovie))
+        movieChanged(d->currentMovie);
+}
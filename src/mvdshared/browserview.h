@@ -77,6 +77,7 @@ protected:
 
 protected slots:
     void movieChanged(mvdid id);
+    void moviesChanged(const QList<mvdid> &ids);
 
 private:
     class Private;
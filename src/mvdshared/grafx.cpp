@@ -21,6 +21,9 @@
 #include "grafx.h"
 
 #include "mvdcore/core.h"
+#include "mvdcore/thumbnailcache.h"
+
+#include <QtCore/QFileInfo>
 
 #include <QtGui/QFont>
 #include <QtGui/QImage>
@@ -69,19 +72,17 @@ QPixmap MvdGrafx::moviesDragPixmap(const QStringList &imagePaths, QString messag
 
     foreach(QString s, imagePaths)
     {
-        QString key = QString("%1x%2/").arg(cachedSize.width()).arg(cachedSize.height()).append(s);
+        // Collection images are named after their content hash
+        QString image = QFileInfo(s).fileName();
+        QString key = QString("drag/%1x%2/").arg(cachedSize.width()).arg(cachedSize.height()).append(image);
         QPixmap *p = new QPixmap;
 
         QPixmapCache::find(key, *p);
         if (p->isNull()) {
-            p->load(s);
-            if (!p->isNull()) {
-                // Resize and cache poster pixmap
-                QPixmap *sp = new QPixmap(p->scaled(cachedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation));
-                delete p;
-                p = sp;
+            // Resize and cache poster pixmap
+            *p = QPixmap::fromImage(MvdThumbnailCache::createThumbnail(image, s, cachedSize));
+            if (!p->isNull())
                 QPixmapCache::insert(key, *p);
-            }
         }
 
         if (p->isNull()) {
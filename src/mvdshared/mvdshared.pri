@@ -27,6 +27,7 @@ HEADERS += \
     importsummarypage.h \
     lineedit.h \
     messagebox.h \
+    pageaccessmanager.h \
     queryvalidator.h \
     richtexteditor.h \
     richtexteditor_p.h \
@@ -55,6 +56,7 @@ SOURCES += \
     importsummarypage.cpp \
     lineedit.cpp \
     messagebox.cpp \
+    pageaccessmanager.cpp \
     richtexteditor.cpp
 
 RESOURCES += \
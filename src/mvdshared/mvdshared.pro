@@ -9,7 +9,8 @@ win32:LIBS += -llibxml2 \
 else:LIBS += -lxml2 \
     -lxslt
 TEMPLATE = lib
-QT += webkit
+QT += network \
+    webkit
 CONFIG += dll
 DEFINES += MVD_BUILD_SHARED_DLL
 QMAKE_TARGET_DESCRIPTION = "Utility library for Movida, the free movie collection manager."
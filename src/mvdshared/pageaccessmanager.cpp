@@ -0,0 +1,124 @@
+/**************************************************************************
+** Filename: pageaccessmanager.cpp
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#include "pageaccessmanager.h"
+
+#include "mvdcore/templatecache.h"
+
+#include <QtCore/QMetaObject>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QNetworkRequest>
+
+/*!
+    \class MvdPageAccessManager pageaccessmanager.h
+    \ingroup MovidaShared
+
+    \brief Network access manager serving template pages from memory.
+
+    Requests for URLs with the MvdTemplateCache::scheme() scheme are
+    answered with the pages and resources held by the template cache, so
+    that showing a page does not involve any file system access.
+    Any other request is handled by QNetworkAccessManager.
+*/
+
+
+namespace {
+//! \internal Reply with contents available as soon as it is created.
+class MvdPageReply : public QNetworkReply
+{
+public:
+    MvdPageReply(const QNetworkRequest &request, const QByteArray &data, QObject *parent) :
+        QNetworkReply(parent),
+        mData(data),
+        mOffset(0)
+    {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(QNetworkAccessManager::GetOperation);
+        open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+        if (data.isNull()) {
+            setError(QNetworkReply::ContentNotFoundError,
+                QString("%1 not found").arg(request.url().toString()));
+        } else {
+            if (MvdTemplateCache::isPageUrl(request.url()))
+                setHeader(QNetworkRequest::ContentTypeHeader, QLatin1String("text/html; charset=UTF-8"));
+            setHeader(QNetworkRequest::ContentLengthHeader, data.size());
+        }
+
+        // Signals must not be emitted before the caller has a chance to connect
+        QMetaObject::invokeMethod(this, "metaDataChanged", Qt::QueuedConnection);
+        if (!data.isEmpty())
+            QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
+        QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection);
+    }
+
+    void abort()
+    { }
+
+    bool isSequential() const
+    {
+        return true;
+    }
+
+    qint64 bytesAvailable() const
+    {
+        return mData.size() - mOffset + QNetworkReply::bytesAvailable();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize)
+    {
+        if (mOffset >= mData.size())
+            return -1;
+
+        qint64 count = qMin(maxSize, (qint64)(mData.size() - mOffset));
+        memcpy(data, mData.constData() + mOffset, count);
+        mOffset += count;
+        return count;
+    }
+
+private:
+    QByteArray mData;
+    int mOffset;
+};
+}
+
+
+/************************************************************************
+    MvdPageAccessManager
+ *************************************************************************/
+
+MvdPageAccessManager::MvdPageAccessManager(QObject *parent) :
+    QNetworkAccessManager(parent)
+{ }
+
+MvdPageAccessManager::~MvdPageAccessManager()
+{ }
+
+//! \internal
+QNetworkReply *MvdPageAccessManager::createRequest(Operation op, const QNetworkRequest &request,
+    QIODevice *outgoingData)
+{
+    if (op != GetOperation || request.url().scheme() != MvdTemplateCache::scheme())
+        return QNetworkAccessManager::createRequest(op, request, outgoingData);
+
+    return new MvdPageReply(request, Movida::tcache().data(request.url()), this);
+}
@@ -0,0 +1,39 @@
+/**************************************************************************
+** Filename: pageaccessmanager.h
+**
+** Copyright (C) 2007-2009 Angius Fabrizio. All rights reserved.
+**
+** This file is part of the Movida project (http://movida.42cows.org/).
+**
+** This file may be distributed and/or modified under the terms of the
+** GNU General Public License version 2 as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** See the file LICENSE.GPL that came with this software distribution or
+** visit http://www.gnu.org/copyleft/gpl.html for GPL licensing information.
+**
+**************************************************************************/
+
+#ifndef MVD_PAGEACCESSMANAGER_H
+#define MVD_PAGEACCESSMANAGER_H
+
+#include <QtNetwork/QNetworkAccessManager>
+
+class MvdPageAccessManager : public QNetworkAccessManager
+{
+    Q_OBJECT
+
+public:
+    MvdPageAccessManager(QObject *parent = 0);
+    virtual ~MvdPageAccessManager();
+
+protected:
+    virtual QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
+        QIODevice *outgoingData = 0);
+};
+
+#endif // MVD_PAGEACCESSMANAGER_H